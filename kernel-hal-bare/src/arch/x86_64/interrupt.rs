@@ -65,6 +65,11 @@ fn ioapic_controller(i: &acpi::interrupt::IoApic) -> IoApic {
 
 #[no_mangle]
 pub extern "C" fn trap_handler(tf: &mut TrapFrame) {
+    // an NMI may arrive with any lock held, even the one of the logger
+    if tf.trap_num as u8 == NonMaskableInterrupt {
+        super::tlb::handle_shootdown();
+        return;
+    }
     trace!("Interrupt: {:#x} @ CPU{}", tf.trap_num, 0); // TODO 0 should replace in multi-core case
     match tf.trap_num as u8 {
         Breakpoint => breakpoint(),
@@ -308,6 +313,15 @@ fn double_fault(tf: &TrapFrame) {
 }
 
 fn page_fault(tf: &mut TrapFrame) {
+    // a fault in copying user memory is resolved by the VMAR and the copy is
+    // restarted, or it fails the copy instead
+    if let Some(fixup) = super::copy_user_fixup(tf.rip) {
+        let write = tf.error_code & 0x2 != 0;
+        if !super::handle_user_fault(super::fetch_fault_vaddr(), write) {
+            tf.rip = fixup;
+        }
+        return;
+    }
     panic!("\nEXCEPTION: Page Fault\n{:#x?}", tf);
 }
 
@@ -7,6 +7,7 @@ use {
     core::convert::TryFrom,
     core::fmt::{Arguments, Write},
     core::ptr::NonNull,
+    core::sync::atomic::{AtomicBool, Ordering},
     core::time::Duration,
     git_version::git_version,
     kernel_hal::{Result, HalError, PageTableTrait},
@@ -16,6 +17,7 @@ use {
     x86_64::{
         instructions::port::Port,
         registers::control::{Cr2, Cr3, Cr3Flags, Cr4, Cr4Flags},
+        registers::model_specific::Msr,
         structures::paging::{PageTableFlags as PTF, *},
     },
 };
@@ -23,6 +25,9 @@ use {
 mod acpi_table;
 mod interrupt;
 mod keyboard;
+mod tlb;
+
+use tlb::TlbBatch;
 
 /// Page Table
 #[repr(C)]
@@ -90,46 +95,13 @@ impl PageTableTrait for PageTableImpl {
     /// Unmap the page of `vaddr`.
     #[export_name = "hal_pt_unmap"]
     fn unmap(&mut self, vaddr: VirtAddr) -> Result<()> {
-        let mut pt = self.get();
-        let page =
-            Page::<Size4KiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64)).unwrap();
-        // This is a workaround to an issue in the x86-64 crate
-        // A page without PRESENT bit is not unmappable AND mapable
-        // So we add PRESENT bit here
-        unsafe {
-            pt.update_flags(page, PTF::PRESENT | PTF::NO_EXECUTE).ok();
-        }
-        match pt.unmap(page) {
-            Ok((_, flush)) => {
-                flush.flush();
-                trace!("unmap: {:x?} in {:#x?}", vaddr, self.root_paddr);
-            }
-            Err(mapper::UnmapError::PageNotMapped) => {
-                trace!("unmap not mapped, skip: {:x?} in {:#x?}", vaddr, self.root_paddr);
-                return Ok(())
-            }
-            Err(err) => {
-                debug!(
-                    "unmap failed: {:x?} err={:x?} in {:#x?}",
-                    vaddr, err, self.root_paddr
-                );
-                return Err(HalError);
-            }
-        }
-        Ok(())
+        self.unmap_cont(vaddr, 1)
     }
 
     /// Change the `flags` of the page of `vaddr`.
     #[export_name = "hal_pt_protect"]
     fn protect(&mut self, vaddr: VirtAddr, flags: MMUFlags) -> Result<()> {
-        let mut pt = self.get();
-        let page =
-            Page::<Size4KiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64)).unwrap();
-        if let Ok(flush) = unsafe { pt.update_flags(page, flags.to_ptf()) } {
-            flush.flush();
-        }
-        trace!("protect: {:x?}, flags={:?}", vaddr, flags);
-        Ok(())
+        self.protect_cont(vaddr, 1, flags)
     }
 
     /// Query the physical address which the page of `vaddr` maps to.
@@ -148,6 +120,203 @@ impl PageTableTrait for PageTableImpl {
     fn table_phys(&self) -> PhysAddr {
         self.root_paddr
     }
+
+    /// Map the huge page of `vaddr` to the contiguous frames from `paddr` with `flags`.
+    #[export_name = "hal_pt_map_huge"]
+    fn map_huge(&mut self, vaddr: VirtAddr, paddr: PhysAddr, flags: MMUFlags) -> Result<()> {
+        let mut pt = self.get();
+        let page = Page::<Size2MiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64))
+            .map_err(|_| HalError)?;
+        let frame = PhysFrame::<Size2MiB>::from_start_address(x86_64::PhysAddr::new(paddr as u64))
+            .map_err(|_| HalError)?;
+        let result = unsafe {
+            pt.map_to_with_table_flags(
+                page,
+                frame,
+                flags.to_ptf(),
+                PTF::PRESENT | PTF::WRITABLE | PTF::USER_ACCESSIBLE,
+                &mut FrameAllocatorImpl,
+            )
+        };
+        match result {
+            Ok(flush) => flush.flush(),
+            Err(err) => {
+                // e.g. some base pages of the range are still mapped
+                debug!("map huge failed: {:x?} err={:x?}", vaddr, err);
+                return Err(HalError);
+            }
+        }
+        trace!(
+            "map huge: {:x?} -> {:x?}, flags={:?} in {:#x?}",
+            vaddr,
+            paddr,
+            flags,
+            self.root_paddr
+        );
+        Ok(())
+    }
+
+    /// Unmap the huge page of `vaddr`.
+    #[export_name = "hal_pt_unmap_huge"]
+    fn unmap_huge(&mut self, vaddr: VirtAddr) -> Result<()> {
+        let mut pt = self.get();
+        let page = Page::<Size2MiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64))
+            .map_err(|_| HalError)?;
+        // the same workaround as `unmap`
+        unsafe {
+            pt.update_flags(page, PTF::PRESENT | PTF::NO_EXECUTE).ok();
+        }
+        match pt.unmap(page) {
+            Ok((_, flush)) => flush.ignore(),
+            Err(err) => {
+                debug!("unmap huge failed: {:x?} err={:x?}", vaddr, err);
+                return Err(HalError);
+            }
+        }
+        let mut batch = TlbBatch::new(self.root_paddr);
+        batch.add(vaddr, HUGE_PAGE_SIZE);
+        batch.flush();
+        trace!("unmap huge: {:x?} in {:#x?}", vaddr, self.root_paddr);
+        Ok(())
+    }
+
+    /// Change the `flags` of the huge page of `vaddr`.
+    #[export_name = "hal_pt_protect_huge"]
+    fn protect_huge(&mut self, vaddr: VirtAddr, flags: MMUFlags) -> Result<()> {
+        let mut pt = self.get();
+        let page = Page::<Size2MiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64))
+            .map_err(|_| HalError)?;
+        match unsafe { pt.update_flags(page, flags.to_ptf()) } {
+            Ok(flush) => flush.ignore(),
+            Err(_) => return Err(HalError),
+        }
+        let mut batch = TlbBatch::new(self.root_paddr);
+        batch.add(vaddr, HUGE_PAGE_SIZE);
+        batch.flush();
+        trace!("protect huge: {:x?}, flags={:?}", vaddr, flags);
+        Ok(())
+    }
+
+    /// Map `pages` pages from `vaddr` to the contiguous frames from `paddr`.
+    #[export_name = "hal_pt_map_cont"]
+    fn map_cont(
+        &mut self,
+        vaddr: VirtAddr,
+        paddr: PhysAddr,
+        pages: usize,
+        flags: MMUFlags,
+    ) -> Result<()> {
+        let mut pt = self.get();
+        let mut failed = None;
+        for i in 0..pages {
+            let (vaddr, paddr) = (vaddr + i * PAGE_SIZE, paddr + i * PAGE_SIZE);
+            let page =
+                Page::<Size4KiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64)).unwrap();
+            let frame = PhysFrame::from_start_address(x86_64::PhysAddr::new(paddr as u64)).unwrap();
+            let result = unsafe {
+                pt.map_to_with_table_flags(
+                    page,
+                    frame,
+                    flags.to_ptf(),
+                    PTF::PRESENT | PTF::WRITABLE | PTF::USER_ACCESSIBLE,
+                    &mut FrameAllocatorImpl,
+                )
+            };
+            match result {
+                // no TLB caches a page which was not present, so nothing to flush
+                Ok(flush) => flush.ignore(),
+                Err(_) => {
+                    failed = Some(i);
+                    break;
+                }
+            }
+        }
+        if let Some(mapped) = failed {
+            // leave nothing of the range mapped on failure
+            self.unmap_cont(vaddr, mapped)?;
+            return Err(HalError);
+        }
+        trace!(
+            "map cont: {:x?} -> {:x?}, pages={}, flags={:?} in {:#x?}",
+            vaddr,
+            paddr,
+            pages,
+            flags,
+            self.root_paddr
+        );
+        Ok(())
+    }
+
+    /// Unmap `pages` pages from `vaddr`, with one TLB flush for all of them.
+    #[export_name = "hal_pt_unmap_cont"]
+    fn unmap_cont(&mut self, vaddr: VirtAddr, pages: usize) -> Result<()> {
+        let root_paddr = self.root_paddr;
+        let mut batch = TlbBatch::new(root_paddr);
+        let mut pt = self.get();
+        let mut result = Ok(());
+        for i in 0..pages {
+            let vaddr = vaddr + i * PAGE_SIZE;
+            let page =
+                Page::<Size4KiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64)).unwrap();
+            // This is a workaround to an issue in the x86-64 crate
+            // A page without PRESENT bit is not unmappable AND mapable
+            // So we add PRESENT bit here
+            unsafe {
+                pt.update_flags(page, PTF::PRESENT | PTF::NO_EXECUTE).ok();
+            }
+            match pt.unmap(page) {
+                Ok((_, flush)) => {
+                    flush.ignore();
+                    batch.add(vaddr, PAGE_SIZE);
+                }
+                Err(mapper::UnmapError::PageNotMapped) => {
+                    trace!("unmap not mapped, skip: {:x?} in {:#x?}", vaddr, root_paddr);
+                }
+                Err(err) => {
+                    debug!(
+                        "unmap failed: {:x?} err={:x?} in {:#x?}",
+                        vaddr, err, root_paddr
+                    );
+                    result = Err(HalError);
+                    break;
+                }
+            }
+        }
+        // flush what has been unmapped even on failure
+        batch.flush();
+        trace!(
+            "unmap cont: {:x?}, pages={} in {:#x?}",
+            vaddr,
+            pages,
+            root_paddr
+        );
+        result
+    }
+
+    /// Change the `flags` of `pages` pages from `vaddr`, with one TLB flush for all of them.
+    #[export_name = "hal_pt_protect_cont"]
+    fn protect_cont(&mut self, vaddr: VirtAddr, pages: usize, flags: MMUFlags) -> Result<()> {
+        let root_paddr = self.root_paddr;
+        let mut batch = TlbBatch::new(root_paddr);
+        let mut pt = self.get();
+        for i in 0..pages {
+            let vaddr = vaddr + i * PAGE_SIZE;
+            let page =
+                Page::<Size4KiB>::from_start_address(x86_64::VirtAddr::new(vaddr as u64)).unwrap();
+            if let Ok(flush) = unsafe { pt.update_flags(page, flags.to_ptf()) } {
+                flush.ignore();
+                batch.add(vaddr, PAGE_SIZE);
+            }
+        }
+        batch.flush();
+        trace!(
+            "protect cont: {:x?}, pages={}, flags={:?}",
+            vaddr,
+            pages,
+            flags
+        );
+        Ok(())
+    }
 }
 
 /// Set page table.
@@ -156,6 +325,7 @@ impl PageTableTrait for PageTableImpl {
 /// This function will set CR3 to `vmtoken`.
 pub unsafe fn set_page_table(vmtoken: usize) {
     let frame = PhysFrame::containing_address(x86_64::PhysAddr::new(vmtoken as _));
+    tlb::set_active(vmtoken);
     if Cr3::read().0 == frame {
         return;
     }
@@ -336,6 +506,40 @@ pub fn apic_local_id() -> u8 {
     lapic.id() as u8
 }
 
+/// Whether `IA32_TSC_AUX` of the running CPUs holds their index, see `cpu_id`.
+static CPU_ID_READY: AtomicBool = AtomicBool::new(false);
+
+const IA32_TSC_AUX: u32 = 0xc000_0103;
+
+/// Store the index of current CPU in its `IA32_TSC_AUX`, which `cpu_id` reads.
+fn cpu_id_init() {
+    let id = apic_local_id() as usize % MAX_CPU_NUM;
+    unsafe { Msr::new(IA32_TSC_AUX).write(id as u64) };
+}
+
+/// Get the index of current CPU, which is less than `MAX_CPU_NUM`.
+///
+/// It is read from `IA32_TSC_AUX` by `rdtscp`, as the local APIC ID is an
+/// uncached MMIO read, which is too slow for the per-CPU caches of the
+/// allocators and the counters. Before `init`, only the bootstrap CPU runs.
+#[export_name = "hal_cpu_id"]
+pub fn cpu_id() -> usize {
+    if !CPU_ID_READY.load(Ordering::Relaxed) {
+        return 0;
+    }
+    let id: u32;
+    unsafe {
+        asm!(
+            "rdtscp",
+            out("eax") _,
+            out("edx") _,
+            out("ecx") id,
+            options(nomem, nostack, preserves_flags),
+        );
+    }
+    id as usize
+}
+
 const LAPIC_ADDR: usize = 0xfee0_0000;
 const IOAPIC_ADDR: usize = 0xfec0_0000;
 
@@ -367,6 +571,8 @@ fn vdso_constants() -> VdsoConstants {
 
 /// Initialize the HAL.
 pub fn init(config: Config) {
+    cpu_id_init();
+    CPU_ID_READY.store(true, Ordering::Relaxed);
     timer_init();
     interrupt::init();
     COM1.lock().init();
@@ -377,9 +583,12 @@ pub fn init(config: Config) {
         CONFIG = config;
         // get tsc frequency
         TSC_FREQUENCY = tsc_frequency();
+        // clock monotonic is `timer_now`, in units of TSC ticks
+        VDSO_TIME.set_ticks_to_mono(1000, TSC_FREQUENCY as u32, 0);
 
         // start multi-processors
         fn ap_main() {
+            cpu_id_init();
             info!("processor {} started", apic_local_id());
             unsafe {
                 trapframe::init();
@@ -413,6 +622,63 @@ pub fn fetch_fault_vaddr() -> VirtAddr {
     Cr2::read().as_u64() as _
 }
 
+/// Copy `len` bytes from `src` to `dst`, either of which may be user memory.
+///
+/// A page fault at `rep movsb` resumes after it, see `copy_user_fixup`, so the
+/// number of bytes not copied is left in `rcx`.
+#[inline(never)]
+#[export_name = "hal_copy_user"]
+pub unsafe fn copy_user(dst: *mut u8, src: *const u8, len: usize) -> usize {
+    let remain: usize;
+    asm!(
+        ".global __copy_user_fault",
+        "__copy_user_fault:",
+        "rep movsb",
+        ".global __copy_user_fixup",
+        "__copy_user_fixup:",
+        inout("rcx") len => remain,
+        inout("rdi") dst => _,
+        inout("rsi") src => _,
+        options(nostack),
+    );
+    remain
+}
+
+static USER_FAULT_HANDLER: spin::Once<kernel_hal::UserFaultHandler> = spin::Once::new();
+
+#[export_name = "hal_user_fault_set_handler"]
+pub fn user_fault_set_handler(handler: kernel_hal::UserFaultHandler) {
+    USER_FAULT_HANDLER.call_once(|| handler);
+}
+
+/// Resolve a page fault of `copy_user` at `vaddr`, e.g. of a lazily mapped or
+/// copy-on-write page, by the handler of the current page table.
+pub fn handle_user_fault(vaddr: VirtAddr, write: bool) -> bool {
+    let flags = if write {
+        MMUFlags::WRITE
+    } else {
+        MMUFlags::READ
+    };
+    let table = Cr3::read().0.start_address().as_u64() as PhysAddr;
+    match USER_FAULT_HANDLER.get() {
+        Some(handler) => handler(table, vaddr, flags),
+        None => false,
+    }
+}
+
+/// Get where to resume from a page fault of the kernel at `rip`, if it is expected.
+pub fn copy_user_fixup(rip: usize) -> Option<usize> {
+    extern "C" {
+        fn __copy_user_fault();
+        fn __copy_user_fixup();
+    }
+    if rip == __copy_user_fault as usize {
+        Some(__copy_user_fixup as usize)
+    } else {
+        None
+    }
+}
+
 /// Get physical address of `acpi_rsdp` and `smbios` on x86_64.
 #[export_name = "hal_pc_firmware_tables"]
 pub fn pc_firmware_tables() -> (u64, u64) {
@@ -0,0 +1,183 @@
+//! TLB invalidation batched per page table operation, and shootdown to other CPUs.
+//!
+//! Shootdowns are sent as NMIs. The kernel runs with interrupts disabled, and
+//! the initiator usually holds page table locks, so a CPU spinning on one of
+//! them could never take a maskable interrupt and acknowledge the request.
+
+use super::{apic_local_id, phys_to_virt, LAPIC_ADDR};
+use crate::MAX_CPU_NUM;
+use core::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use spin::Mutex;
+use x86_64::{
+    instructions::tlb,
+    registers::control::{Cr4, Cr4Flags},
+};
+
+/// Flush the whole TLB instead of each page when more pages are changed.
+const FULL_FLUSH_PAGES: usize = 32;
+
+#[allow(clippy::declare_interior_mutable_const)]
+const NO_TABLE: AtomicUsize = AtomicUsize::new(0);
+
+/// Root page table active on each CPU by local APIC ID, 0 if unknown.
+static ACTIVE_TABLE: [AtomicUsize; MAX_CPU_NUM] = [NO_TABLE; MAX_CPU_NUM];
+
+/// Serializes shootdowns, so that only one request is pending at a time.
+static SHOOTDOWN_LOCK: Mutex<()> = Mutex::new(());
+/// Range of the pending shootdown, `count == 0` for a full flush.
+static SHOOTDOWN_VADDR: AtomicUsize = AtomicUsize::new(0);
+static SHOOTDOWN_COUNT: AtomicUsize = AtomicUsize::new(0);
+static SHOOTDOWN_STEP: AtomicUsize = AtomicUsize::new(0);
+/// CPUs which have not finished the pending shootdown, a bit per local APIC ID.
+static SHOOTDOWN_PENDING: AtomicU64 = AtomicU64::new(0);
+
+/// `SHOOTDOWN_PENDING` has a bit for each CPU.
+const _: usize = 64 - MAX_CPU_NUM;
+
+/// Record that the page table of `root_paddr` is active on this CPU.
+pub fn set_active(root_paddr: usize) {
+    if let Some(active) = ACTIVE_TABLE.get(apic_local_id() as usize) {
+        active.store(root_paddr, Ordering::Release);
+    }
+}
+
+/// The pages changed by a page table operation, which are flushed at once
+/// when it is done.
+pub struct TlbBatch {
+    root_paddr: usize,
+    begin: usize,
+    end: usize,
+    /// Size of the smallest page changed.
+    step: usize,
+}
+
+impl TlbBatch {
+    /// Begin a batch for the page table at `root_paddr`.
+    pub fn new(root_paddr: usize) -> Self {
+        TlbBatch {
+            root_paddr,
+            begin: usize::MAX,
+            end: 0,
+            step: usize::MAX,
+        }
+    }
+
+    /// Add a changed page at `vaddr` of `size` bytes.
+    pub fn add(&mut self, vaddr: usize, size: usize) {
+        self.begin = self.begin.min(vaddr);
+        self.end = self.end.max(vaddr + size);
+        self.step = self.step.min(size);
+    }
+
+    /// Flush the changed range on all CPUs using the page table.
+    pub fn flush(self) {
+        if self.begin >= self.end {
+            return;
+        }
+        let count = (self.end - self.begin + self.step - 1) / self.step;
+        let count = if count > FULL_FLUSH_PAGES { 0 } else { count };
+        flush_local(self.begin, count, self.step);
+        shootdown(self.root_paddr, self.begin, count, self.step);
+    }
+}
+
+/// Whether `vaddr` is a kernel address, whose mappings are global.
+fn is_kernel(vaddr: usize) -> bool {
+    vaddr >= phys_to_virt(0)
+}
+
+/// Flush `count` pages of `step` bytes from `vaddr`, or all if `count == 0`.
+///
+/// Reloading CR3 keeps the global entries, so a full flush of a kernel range
+/// toggles CR4.PGE instead.
+fn flush_local(vaddr: usize, count: usize, step: usize) {
+    if count == 0 {
+        let cr4 = Cr4::read();
+        if is_kernel(vaddr) && cr4.contains(Cr4Flags::PAGE_GLOBAL) {
+            unsafe {
+                Cr4::write(cr4 - Cr4Flags::PAGE_GLOBAL);
+                Cr4::write(cr4);
+            }
+        } else {
+            tlb::flush_all();
+        }
+        return;
+    }
+    for i in 0..count {
+        tlb::flush(x86_64::VirtAddr::new((vaddr + i * step) as u64));
+    }
+}
+
+/// Ask the other CPUs using the page table at `root_paddr` to flush the range,
+/// and wait for them.
+///
+/// Kernel mappings are shared by all page tables, so they go to every CPU.
+fn shootdown(root_paddr: usize, vaddr: usize, count: usize, step: usize) {
+    let this = apic_local_id() as usize;
+    let kernel = is_kernel(vaddr);
+    let targets = ACTIVE_TABLE
+        .iter()
+        .enumerate()
+        .filter(|&(cpu, active)| {
+            let active = active.load(Ordering::Acquire);
+            cpu != this && active != 0 && (kernel || active == root_paddr)
+        })
+        .fold(0u64, |mask, (cpu, _)| mask | 1 << cpu);
+    if targets == 0 {
+        return;
+    }
+    // keep serving requests from others, which may run with interrupts disabled
+    let _guard = loop {
+        if let Some(guard) = SHOOTDOWN_LOCK.try_lock() {
+            break guard;
+        }
+        handle_shootdown();
+        core::hint::spin_loop();
+    };
+    SHOOTDOWN_VADDR.store(vaddr, Ordering::Relaxed);
+    SHOOTDOWN_COUNT.store(count, Ordering::Relaxed);
+    SHOOTDOWN_STEP.store(step, Ordering::Relaxed);
+    SHOOTDOWN_PENDING.store(targets, Ordering::Release);
+    for cpu in 0..MAX_CPU_NUM {
+        if targets & 1 << cpu != 0 {
+            send_nmi(cpu as u8);
+        }
+    }
+    while SHOOTDOWN_PENDING.load(Ordering::Acquire) != 0 {
+        core::hint::spin_loop();
+    }
+}
+
+/// Send an NMI to the CPU of local APIC ID `apic_id`.
+fn send_nmi(apic_id: u8) {
+    const ICR_LOW: usize = 0x300;
+    const ICR_HIGH: usize = 0x310;
+    const DELIVERY_NMI: u32 = 0b100 << 8;
+    const LEVEL_ASSERT: u32 = 1 << 14;
+    const SEND_PENDING: u32 = 1 << 12;
+    let base = phys_to_virt(LAPIC_ADDR);
+    let icr_low = (base + ICR_LOW) as *mut u32;
+    let icr_high = (base + ICR_HIGH) as *mut u32;
+    unsafe {
+        icr_high.write_volatile((apic_id as u32) << 24);
+        icr_low.write_volatile(DELIVERY_NMI | LEVEL_ASSERT);
+        while icr_low.read_volatile() & SEND_PENDING != 0 {
+            core::hint::spin_loop();
+        }
+    }
+}
+
+/// Handle a shootdown request from another CPU, on an NMI.
+///
+/// Only atomics are used, so that it is safe wherever the NMI arrives.
+pub fn handle_shootdown() {
+    let this = 1u64.checked_shl(apic_local_id() as u32).unwrap_or(0);
+    if SHOOTDOWN_PENDING.load(Ordering::Acquire) & this == 0 {
+        return;
+    }
+    let vaddr = SHOOTDOWN_VADDR.load(Ordering::Relaxed);
+    let count = SHOOTDOWN_COUNT.load(Ordering::Relaxed);
+    let step = SHOOTDOWN_STEP.load(Ordering::Relaxed);
+    flush_local(vaddr, count, step);
+    SHOOTDOWN_PENDING.fetch_and(!this, Ordering::Release);
+}
@@ -0,0 +1,198 @@
+//! An executor with per-CPU run queues and work stealing.
+//!
+//! Each CPU picks the task with the smallest virtual runtime from its own run
+//! queue, and steals from the others when it is empty. A task accumulates
+//! virtual runtime inversely proportional to the weight of its priority, so
+//! CPU time is shared in proportion to the weights, like Linux's CFS.
+//!
+//! A task is always woken up to the run queue of the CPU which last ran it.
+
+use super::{cpu_id, timer_now, MAX_CPU_NUM};
+use alloc::{boxed::Box, collections::BTreeMap, sync::Arc, task::Wake, vec::Vec};
+use core::future::Future;
+use core::pin::Pin;
+use core::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use core::task::{Context, Waker};
+use spin::Mutex;
+
+/// Number of priority levels, from lowest 0 to highest 31.
+pub const PRIORITY_LEVELS: usize = 32;
+
+/// Time a task can run before it should yield to others, in nanoseconds.
+const TIME_SLICE: u64 = 4_000_000;
+
+/// Virtual runtime a woken task may be ahead of the others, in nanoseconds.
+const WAKEUP_CREDIT: u64 = TIME_SLICE;
+
+/// Weight of each priority, the same ratio between adjacent levels as Linux
+/// nice values. The default priority 16 has weight 1024.
+const PRIORITY_WEIGHT: [u64; PRIORITY_LEVELS] = [
+    29, 36, 45, 56, 70, 87, 110, 137, 172, 215, 272, 335, 423, 526, 655, 820, 1024, 1277, 1586,
+    1991, 2501, 3121, 3906, 4904, 6100, 7620, 9548, 11916, 14949, 18705, 23254, 29154,
+];
+
+type BoxFuture = Pin<Box<dyn Future<Output = ()> + Send + 'static>>;
+
+struct Task {
+    /// The future, which is `None` after it is completed.
+    future: Mutex<Option<BoxFuture>>,
+    priority: AtomicUsize,
+    /// Virtual runtime, relative to the run queue of `cpu`.
+    vruntime: AtomicU64,
+    /// The CPU which last ran this task.
+    cpu: AtomicUsize,
+    /// Whether the task is in a run queue or being polled.
+    queued: AtomicBool,
+    /// Whether the task has been woken up since its last poll.
+    notified: AtomicBool,
+}
+
+impl Task {
+    fn schedule(self: Arc<Self>) {
+        self.notified.store(true, Ordering::Release);
+        if self.queued.swap(true, Ordering::AcqRel) {
+            return;
+        }
+        let cpu = self.cpu.load(Ordering::Relaxed);
+        CPUS[cpu].queue.lock().push(self);
+    }
+
+    /// Charge runtime `delta` in nanoseconds.
+    fn charge(&self, delta: u64) {
+        let weight = PRIORITY_WEIGHT[self.priority.load(Ordering::Relaxed)];
+        let delta = delta * PRIORITY_WEIGHT[16] / weight;
+        self.vruntime.fetch_add(delta, Ordering::Relaxed);
+    }
+}
+
+impl Wake for Task {
+    fn wake(self: Arc<Self>) {
+        self.schedule();
+    }
+}
+
+/// Run queue of a CPU.
+#[derive(Default)]
+struct RunQueue {
+    /// Tasks ordered by (vruntime, sequence number).
+    tasks: BTreeMap<(u64, u64), Arc<Task>>,
+    /// Monotonic lower bound of vruntime of the tasks in this queue.
+    min_vruntime: u64,
+    seq: u64,
+}
+
+impl RunQueue {
+    fn push(&mut self, task: Arc<Task>) {
+        // don't let a task which has slept for long monopolize the CPU
+        let floor = self.min_vruntime.saturating_sub(WAKEUP_CREDIT);
+        let vruntime = task.vruntime.load(Ordering::Relaxed).max(floor);
+        task.vruntime.store(vruntime, Ordering::Relaxed);
+        self.seq += 1;
+        self.tasks.insert((vruntime, self.seq), task);
+    }
+
+    fn pop(&mut self) -> Option<Arc<Task>> {
+        let key = *self.tasks.keys().next()?;
+        self.min_vruntime = self.min_vruntime.max(key.0);
+        self.tasks.remove(&key)
+    }
+}
+
+#[derive(Default)]
+struct Cpu {
+    queue: Mutex<RunQueue>,
+    /// The task being polled, and when it started.
+    current: Mutex<Option<(Arc<Task>, u64)>>,
+}
+
+lazy_static! {
+    static ref CPUS: Vec<Cpu> = (0..MAX_CPU_NUM).map(|_| Cpu::default()).collect();
+}
+
+/// Spawn a task on the current CPU.
+pub fn spawn(future: impl Future<Output = ()> + Send + 'static, priority: usize) {
+    let cpu = cpu_id();
+    let task = Arc::new(Task {
+        future: Mutex::new(Some(Box::pin(future))),
+        priority: AtomicUsize::new(priority.min(PRIORITY_LEVELS - 1)),
+        vruntime: AtomicU64::new(CPUS[cpu].queue.lock().min_vruntime),
+        cpu: AtomicUsize::new(cpu),
+        queued: AtomicBool::new(false),
+        notified: AtomicBool::new(false),
+    });
+    task.schedule();
+}
+
+/// Run tasks on the current CPU until no CPU has a runnable task.
+pub fn run_until_idle() {
+    let cpu = cpu_id();
+    loop {
+        let task = CPUS[cpu].queue.lock().pop();
+        match task.or_else(|| steal(cpu)) {
+            Some(task) => run_task(task, cpu),
+            None => return,
+        }
+    }
+}
+
+/// Take a task from the run queue of another CPU.
+fn steal(cpu: usize) -> Option<Arc<Task>> {
+    (1..MAX_CPU_NUM)
+        .map(|i| (cpu + i) % MAX_CPU_NUM)
+        .find_map(|victim| {
+            let task = CPUS[victim].queue.lock().pop()?;
+            // it has the smallest vruntime on the victim, so rebase it to
+            // the smallest on the local queue
+            let local_min = CPUS[cpu].queue.lock().min_vruntime;
+            task.vruntime.store(local_min, Ordering::Relaxed);
+            Some(task)
+        })
+}
+
+fn run_task(task: Arc<Task>, cpu: usize) {
+    task.cpu.store(cpu, Ordering::Relaxed);
+    // `queued` stays set while polling, so that wake-ups only set `notified`
+    // and the task is queued again after its vruntime is charged
+    task.notified.store(false, Ordering::Release);
+    let start = now();
+    *CPUS[cpu].current.lock() = Some((task.clone(), start));
+    {
+        let mut future = task.future.lock();
+        if let Some(inner) = future.as_mut() {
+            let waker = Waker::from(task.clone());
+            let mut cx = Context::from_waker(&waker);
+            if inner.as_mut().poll(&mut cx).is_ready() {
+                *future = None;
+            }
+        }
+    }
+    *CPUS[cpu].current.lock() = None;
+    task.charge(now().saturating_sub(start));
+    task.queued.store(false, Ordering::Release);
+    if task.notified.load(Ordering::Acquire) {
+        task.schedule();
+    }
+}
+
+fn now() -> u64 {
+    timer_now().as_nanos() as u64
+}
+
+/// Whether the current task has used up its time slice while others are
+/// waiting on this CPU.
+pub fn need_resched() -> bool {
+    let cpu = &CPUS[cpu_id()];
+    let start = match &*cpu.current.lock() {
+        Some((_, start)) => *start,
+        None => return false,
+    };
+    now().saturating_sub(start) >= TIME_SLICE && !cpu.queue.lock().tasks.is_empty()
+}
+
+/// Change the priority of the current task.
+pub fn set_priority(priority: usize) {
+    if let Some((task, _)) = &*CPUS[cpu_id()].current.lock() {
+        let priority = priority.min(PRIORITY_LEVELS - 1);
+        task.priority.store(priority, Ordering::Relaxed);
+    }
+}
@@ -6,6 +6,12 @@
 //! - `hal_pt_unmap`
 //! - `hal_pt_protect`
 //! - `hal_pt_query`
+//! - `hal_pt_map_huge`
+//! - `hal_pt_unmap_huge`
+//! - `hal_pt_protect_huge`
+//! - `hal_pt_map_cont`
+//! - `hal_pt_unmap_cont`
+//! - `hal_pt_protect_cont`
 //! - `hal_pmem_read`
 //! - `hal_pmem_write`
 //!
@@ -27,6 +33,7 @@ extern crate alloc;
 extern crate lazy_static;
 
 use alloc::boxed::Box;
+use alloc::vec::Vec;
 use core::time::Duration;
 use core::{
     future::Future,
@@ -34,15 +41,19 @@ use core::{
     task::{Context, Poll},
 };
 use kernel_hal::defs::*;
+use kernel_hal::timer::{TimerCallback, TimerId, TimerWheel};
 use kernel_hal::vdso::*;
 use kernel_hal::UserContext;
-use naive_timer::Timer;
 use spin::Mutex;
 
 pub mod arch;
+pub mod executor;
 
 pub use self::arch::*;
 
+/// Maximum number of CPUs supported.
+pub const MAX_CPU_NUM: usize = 64;
+
 #[allow(improper_ctypes)]
 extern "C" {
     fn hal_pt_map_kernel(pt: *mut u8, current: *const u8);
@@ -62,6 +73,7 @@ impl Thread {
     pub fn spawn(
         future: Pin<Box<dyn Future<Output = ()> + Send + 'static>>,
         vmtoken: usize,
+        priority: u8,
     ) -> Self {
         struct PageTableSwitchWrapper {
             inner: Mutex<Pin<Box<dyn Future<Output = ()> + Send>>>,
@@ -77,10 +89,13 @@ impl Thread {
             }
         }
 
-        executor::spawn(PageTableSwitchWrapper {
-            inner: Mutex::new(future),
-            vmtoken,
-        });
+        executor::spawn(
+            PageTableSwitchWrapper {
+                inner: Mutex::new(future),
+                vmtoken,
+            },
+            priority as usize,
+        );
         Thread { thread: 0 }
     }
 
@@ -91,6 +106,16 @@ impl Thread {
     pub fn get_tid() -> (u64, u64) {
         (0, 0)
     }
+
+    #[export_name = "hal_thread_set_priority"]
+    pub fn set_priority(priority: u8) {
+        executor::set_priority(priority as usize);
+    }
+
+    #[export_name = "hal_thread_need_resched"]
+    pub fn need_resched() -> bool {
+        executor::need_resched()
+    }
 }
 
 #[export_name = "hal_context_run"]
@@ -176,18 +201,29 @@ pub fn frame_copy(src: PhysAddr, target: PhysAddr) {
 }
 
 lazy_static! {
-    pub static ref NAIVE_TIMER: Mutex<Timer> = Mutex::new(Timer::default());
+    /// Timer wheels of each CPU, which only expire on their own timer interrupts.
+    static ref TIMERS: Vec<Mutex<TimerWheel>> =
+        (0..MAX_CPU_NUM).map(|cpu| Mutex::new(TimerWheel::new(cpu))).collect();
 }
 
 #[export_name = "hal_timer_set"]
-pub fn timer_set(deadline: Duration, callback: Box<dyn FnOnce(Duration) + Send + Sync>) {
-    NAIVE_TIMER.lock().add(deadline, callback);
+pub fn timer_set(deadline: Duration, callback: TimerCallback) -> TimerId {
+    TIMERS[cpu_id()].lock().add(deadline, callback)
+}
+
+#[export_name = "hal_timer_cancel"]
+pub fn timer_cancel(id: TimerId) {
+    TIMERS[id.wheel()].lock().cancel(id);
 }
 
 #[export_name = "hal_timer_tick"]
 pub fn timer_tick() {
     let now = arch::timer_now();
-    NAIVE_TIMER.lock().expire(now);
+    // call them with the wheel unlocked, they may set new timers
+    let callbacks = TIMERS[cpu_id()].lock().expire(now);
+    for callback in callbacks {
+        callback(now);
+    }
 }
 
 /// Initialize the HAL.
@@ -8,9 +8,14 @@ extern crate log;
 extern crate alloc;
 
 use {
-    alloc::collections::VecDeque,
+    alloc::collections::{BTreeSet, VecDeque},
     async_std::task_local,
-    core::{cell::Cell, future::Future, pin::Pin},
+    core::{
+        cell::{Cell, RefCell},
+        future::Future,
+        pin::Pin,
+        sync::atomic::{AtomicUsize, Ordering},
+    },
     git_version::git_version,
     kernel_hal::PageTableTrait,
     lazy_static::lazy_static,
@@ -18,12 +23,13 @@ use {
     std::fs::{File, OpenOptions},
     std::io::Error,
     std::os::unix::io::AsRawFd,
-    std::sync::Mutex,
+    std::sync::{Condvar, Mutex},
     std::time::{Duration, SystemTime},
     tempfile::tempdir,
 };
 
 pub use kernel_hal::defs::*;
+use kernel_hal::timer::{TimerCallback, TimerId, TimerWheel};
 use kernel_hal::vdso::*;
 pub use kernel_hal::*;
 use std::io::Read;
@@ -42,6 +48,7 @@ impl Thread {
     pub fn spawn(
         future: Pin<Box<dyn Future<Output = ()> + Send + 'static>>,
         _vmtoken: usize,
+        _priority: u8,
     ) -> Self {
         async_std::task::spawn(future);
         Thread { thread: 0 }
@@ -57,6 +64,14 @@ impl Thread {
     pub fn get_tid() -> (u64, u64) {
         (TID.with(|x| x.get()), PID.with(|x| x.get()))
     }
+
+    #[export_name = "hal_thread_set_priority"]
+    pub fn set_priority(_priority: u8) {}
+
+    #[export_name = "hal_thread_need_resched"]
+    pub fn need_resched() -> bool {
+        true
+    }
 }
 
 task_local! {
@@ -124,6 +139,66 @@ impl PageTableTrait for PageTable {
         self.table_phys
     }
 
+    /// Map the huge page of `vaddr` to the contiguous frames from `paddr` with `flags`.
+    #[export_name = "hal_pt_map_huge"]
+    fn map_huge(&mut self, vaddr: VirtAddr, paddr: PhysAddr, flags: MMUFlags) -> Result<()> {
+        debug_assert!(vaddr % HUGE_PAGE_SIZE == 0 && paddr % HUGE_PAGE_SIZE == 0);
+        let prot = flags.to_mmap_prot();
+        mmap(FRAME_FILE.as_raw_fd(), paddr, HUGE_PAGE_SIZE, vaddr, prot);
+        Ok(())
+    }
+
+    /// Unmap the huge page of `vaddr`.
+    #[export_name = "hal_pt_unmap_huge"]
+    fn unmap_huge(&mut self, vaddr: VirtAddr) -> Result<()> {
+        self.unmap_cont(vaddr, HUGE_PAGE_SIZE / PAGE_SIZE)
+    }
+
+    /// Change the `flags` of the huge page of `vaddr`.
+    #[export_name = "hal_pt_protect_huge"]
+    fn protect_huge(&mut self, vaddr: VirtAddr, flags: MMUFlags) -> Result<()> {
+        let prot = flags.to_mmap_prot();
+        let ret = unsafe { libc::mprotect(vaddr as _, HUGE_PAGE_SIZE, prot) };
+        assert_eq!(ret, 0, "failed to mprotect: {:?}", Error::last_os_error());
+        Ok(())
+    }
+
+    #[export_name = "hal_pt_map_cont"]
+    fn map_cont(
+        &mut self,
+        vaddr: VirtAddr,
+        paddr: PhysAddr,
+        pages: usize,
+        flags: MMUFlags,
+    ) -> Result<()> {
+        if pages == 0 {
+            return Ok(());
+        }
+        debug_assert!(page_aligned(vaddr));
+        debug_assert!(page_aligned(paddr));
+        let prot = flags.to_mmap_prot();
+        mmap(
+            FRAME_FILE.as_raw_fd(),
+            paddr,
+            PAGE_SIZE * pages,
+            vaddr,
+            prot,
+        );
+        Ok(())
+    }
+
+    #[export_name = "hal_pt_protect_cont"]
+    fn protect_cont(&mut self, vaddr: VirtAddr, pages: usize, flags: MMUFlags) -> Result<()> {
+        if pages == 0 {
+            return Ok(());
+        }
+        debug_assert!(page_aligned(vaddr));
+        let prot = flags.to_mmap_prot();
+        let ret = unsafe { libc::mprotect(vaddr as _, PAGE_SIZE * pages, prot) };
+        assert_eq!(ret, 0, "failed to mprotect: {:?}", Error::last_os_error());
+        Ok(())
+    }
+
     #[export_name = "hal_pt_unmap_cont"]
     fn unmap_cont(&mut self, vaddr: VirtAddr, pages: usize) -> Result<()> {
         if pages == 0 {
@@ -148,21 +223,118 @@ impl Debug for PhysFrame {
 }
 
 lazy_static! {
-    static ref AVAILABLE_FRAMES: Mutex<VecDeque<usize>> =
+    /// Free frames in address order, so that contiguous ones are adjacent.
+    static ref AVAILABLE_FRAMES: Mutex<BTreeSet<usize>> =
         Mutex::new((PAGE_SIZE..PMEM_SIZE).step_by(PAGE_SIZE).collect());
 }
 
+/// Take at most `n` frames with the lowest addresses from `frames`.
+fn take_frames(frames: &mut BTreeSet<usize>, n: usize) -> Vec<usize> {
+    let taken: Vec<usize> = frames.iter().take(n).copied().collect();
+    for paddr in taken.iter() {
+        frames.remove(paddr);
+    }
+    taken
+}
+
+/// Capacity of the frame cache of each thread.
+const FRAME_CACHE_SIZE: usize = 64;
+/// Number of frames moved between a thread cache and `AVAILABLE_FRAMES` at once.
+const FRAME_CACHE_BATCH: usize = FRAME_CACHE_SIZE / 2;
+
+/// Free frames cached by each thread in front of `AVAILABLE_FRAMES`.
+struct FrameCache(Vec<usize>);
+
+impl FrameCache {
+    fn alloc(&mut self) -> Option<usize> {
+        if self.0.is_empty() {
+            let batch = take_frames(&mut AVAILABLE_FRAMES.lock().unwrap(), FRAME_CACHE_BATCH);
+            self.0.extend(batch.into_iter().rev());
+        }
+        self.0.pop()
+    }
+
+    fn dealloc(&mut self, paddr: usize) {
+        if self.0.len() == FRAME_CACHE_SIZE {
+            let mut frames = AVAILABLE_FRAMES.lock().unwrap();
+            frames.extend(self.0.drain(FRAME_CACHE_SIZE - FRAME_CACHE_BATCH..));
+        }
+        self.0.push(paddr);
+    }
+
+    /// Return all cached frames to `AVAILABLE_FRAMES`.
+    fn flush(&mut self) {
+        AVAILABLE_FRAMES.lock().unwrap().extend(self.0.drain(..));
+    }
+}
+
+impl Drop for FrameCache {
+    fn drop(&mut self) {
+        if let Ok(mut frames) = AVAILABLE_FRAMES.lock() {
+            frames.extend(self.0.drain(..));
+        }
+    }
+}
+
+thread_local! {
+    static FRAME_CACHE: RefCell<FrameCache> = RefCell::new(FrameCache(Vec::new()));
+    static CPU_ID: usize = {
+        static NEXT_CPU_ID: AtomicUsize = AtomicUsize::new(0);
+        NEXT_CPU_ID.fetch_add(1, Ordering::Relaxed)
+    };
+}
+
+/// Get the index of the current CPU.
+///
+/// Each thread stands for a CPU here, which gets an index when it first asks.
+#[export_name = "hal_cpu_id"]
+pub fn cpu_id() -> usize {
+    CPU_ID.try_with(|&id| id).unwrap_or(0)
+}
+
 impl PhysFrame {
     #[export_name = "hal_frame_alloc"]
     pub fn alloc() -> Option<Self> {
-        let ret = AVAILABLE_FRAMES
-            .lock()
-            .unwrap()
-            .pop_front()
+        let ret = FRAME_CACHE
+            .try_with(|cache| cache.borrow_mut().alloc())
+            .unwrap_or_else(|_| take_frames(&mut AVAILABLE_FRAMES.lock().unwrap(), 1).pop())
             .map(|paddr| PhysFrame { paddr });
         trace!("frame alloc: {:?}", ret);
         ret
     }
+
+    #[export_name = "hal_frame_alloc_many"]
+    pub fn alloc_many(paddrs: &mut [PhysAddr]) -> bool {
+        let mut frames = AVAILABLE_FRAMES.lock().unwrap();
+        if frames.len() < paddrs.len() {
+            return false;
+        }
+        let taken = take_frames(&mut frames, paddrs.len());
+        for (paddr, frame) in paddrs.iter_mut().zip(taken) {
+            *paddr = frame;
+        }
+        trace!("frame alloc many: {:#x?}", paddrs);
+        true
+    }
+
+    /// Allocate `size` contiguous frames aligned to `1 << align_log2` frames.
+    ///
+    /// It looks for a run of consecutive frames in the free list, after
+    /// returning the frames cached by this thread to it if none is found.
+    #[export_name = "hal_frame_alloc_contiguous"]
+    pub fn alloc_contiguous_base(size: usize, align_log2: usize) -> Option<PhysAddr> {
+        let align = PAGE_SIZE << align_log2;
+        let mut base = alloc_contiguous(&mut AVAILABLE_FRAMES.lock().unwrap(), size, align);
+        if base.is_none() {
+            let flushed = FRAME_CACHE.try_with(|cache| cache.borrow_mut().flush());
+            if flushed.is_ok() {
+                base = alloc_contiguous(&mut AVAILABLE_FRAMES.lock().unwrap(), size, align);
+            }
+        }
+        trace!("frame alloc contiguous: {:#x?}, {} frames", base, size);
+        base
+    }
+
     #[export_name = "hal_zero_frame_paddr"]
     pub fn zero_frame_addr() -> PhysAddr {
         0
@@ -173,10 +345,41 @@ impl Drop for PhysFrame {
     #[export_name = "hal_frame_dealloc"]
     fn drop(&mut self) {
         trace!("frame dealloc: {:?}", self);
-        AVAILABLE_FRAMES.lock().unwrap().push_back(self.paddr);
+        let paddr = self.paddr;
+        if FRAME_CACHE
+            .try_with(|cache| cache.borrow_mut().dealloc(paddr))
+            .is_err()
+        {
+            AVAILABLE_FRAMES.lock().unwrap().insert(paddr);
+        }
     }
 }
 
+/// Take `size` consecutive frames from `frames`, the first aligned to `align` bytes.
+fn alloc_contiguous(frames: &mut BTreeSet<usize>, size: usize, align: usize) -> Option<usize> {
+    let (mut base, mut run) = (0, 0);
+    for &paddr in frames.iter() {
+        if run != 0 && paddr == base + run * PAGE_SIZE {
+            run += 1;
+        } else if paddr % align == 0 {
+            base = paddr;
+            run = 1;
+        } else {
+            run = 0;
+        }
+        if run >= size {
+            break;
+        }
+    }
+    if run == 0 || run < size {
+        return None;
+    }
+    for i in 0..size {
+        frames.remove(&(base + i * PAGE_SIZE));
+    }
+    Some(base)
+}
+
 fn phys_to_virt(paddr: PhysAddr) -> VirtAddr {
     /// Map physical memory from here.
     const PMEM_BASE: VirtAddr = 0x8_0000_0000;
@@ -362,18 +565,69 @@ pub fn timer_now() -> Duration {
         .unwrap()
 }
 
+struct Timers {
+    wheel: Mutex<TimerWheel>,
+    /// Notified when the earliest deadline changes.
+    changed: Condvar,
+}
+
+lazy_static! {
+    static ref TIMERS: Timers = {
+        std::thread::spawn(timer_thread);
+        Timers {
+            wheel: Mutex::new(TimerWheel::new(0)),
+            changed: Condvar::new(),
+        }
+    };
+}
+
+/// Call the callbacks of expired timers, and sleep until the next deadline.
+fn timer_thread() {
+    let mut wheel = TIMERS.wheel.lock().unwrap();
+    loop {
+        let now = timer_now();
+        let callbacks = wheel.expire(now);
+        if !callbacks.is_empty() {
+            drop(wheel);
+            for callback in callbacks {
+                callback(now);
+            }
+            wheel = TIMERS.wheel.lock().unwrap();
+            continue;
+        }
+        wheel = match wheel.next_deadline() {
+            Some(deadline) if deadline > now => {
+                let timeout = deadline - now;
+                TIMERS.changed.wait_timeout(wheel, timeout).unwrap().0
+            }
+            Some(_) => wheel,
+            None => TIMERS.changed.wait(wheel).unwrap(),
+        };
+    }
+}
+
 /// Set a new timer.
 ///
-/// After `deadline`, the `callback` will be called.
+/// After `deadline`, the `callback` will be called on the timer thread.
 #[export_name = "hal_timer_set"]
-pub fn timer_set(deadline: Duration, callback: Box<dyn FnOnce(Duration) + Send + Sync>) {
-    std::thread::spawn(move || {
-        let now = timer_now();
-        if deadline > now {
-            std::thread::sleep(deadline - now);
-        }
-        callback(timer_now());
-    });
+pub fn timer_set(deadline: Duration, callback: TimerCallback) -> TimerId {
+    let mut wheel = TIMERS.wheel.lock().unwrap();
+    if wheel.is_empty() {
+        // catch up after being idle
+        wheel.expire(timer_now());
+    }
+    let next = wheel.next_deadline();
+    let id = wheel.add(deadline, callback);
+    if next.map_or(true, |next| deadline < next) {
+        TIMERS.changed.notify_one();
+    }
+    id
+}
+
+/// Cancel a timer set by `timer_set`.
+#[export_name = "hal_timer_cancel"]
+pub fn timer_cancel(id: TimerId) {
+    TIMERS.wheel.lock().unwrap().cancel(id);
 }
 
 #[export_name = "hal_vdso_constants"]
@@ -442,4 +696,150 @@ mod tests {
 
         pt.unmap(VBASE + 0x1000).unwrap();
     }
+
+    #[test]
+    fn map_protect_cont() {
+        let mut pt = PageTable::new();
+        let vbase = VBASE + 0x10_0000;
+        pt.map_cont(vbase, 0x2000, 4, MMUFlags::READ | MMUFlags::WRITE)
+            .unwrap();
+        pt.protect_cont(vbase, 2, MMUFlags::READ).unwrap();
+        unsafe {
+            const MAGIC: usize = 0xdead_beaf;
+            ((vbase + 0x3000) as *mut usize).write(MAGIC);
+            assert_eq!(((vbase + 0x3000) as *const usize).read(), MAGIC);
+            (vbase as *const usize).read();
+        }
+        pt.unmap_cont(vbase, 4).unwrap();
+    }
+
+    #[test]
+    fn timer() {
+        use std::sync::atomic::{AtomicUsize, Ordering};
+        use std::sync::Arc;
+
+        let fired = Arc::new(AtomicUsize::new(0));
+        let now = timer_now();
+        let ids: Vec<_> = (0..3)
+            .map(|i| {
+                let fired = fired.clone();
+                let deadline = now + Duration::from_millis(10 * (i + 1) as u64);
+                timer_set(
+                    deadline,
+                    Box::new(move |_| {
+                        fired.fetch_or(1 << i, Ordering::SeqCst);
+                    }),
+                )
+            })
+            .collect();
+        timer_cancel(ids[1]);
+        std::thread::sleep(Duration::from_millis(100));
+        assert_eq!(fired.load(Ordering::SeqCst), 0b101);
+    }
+
+    #[test]
+    fn user_cstring() {
+        use kernel_hal::user::{Error, UserInPtr};
+        // longer than the chunk copied at a time
+        let long = "x".repeat(300) + "\0";
+        let short = "arg\0";
+        let argv = [long.as_ptr() as usize, short.as_ptr() as usize, 0];
+
+        let ptr = UserInPtr::<u8>::from(long.as_ptr() as usize);
+        assert_eq!(ptr.read_cstring().unwrap().len(), 300);
+        let mut buf = [0u8; 16];
+        assert_eq!(ptr.read_cstring_into(&mut buf), Err(Error::BufferTooSmall));
+        let ptr = UserInPtr::<u8>::from(short.as_ptr() as usize);
+        assert_eq!(ptr.read_cstring_into(&mut buf), Ok(3));
+
+        let ptr = UserInPtr::<UserInPtr<u8>>::from(argv.as_ptr() as usize);
+        let args = ptr.read_cstring_array().unwrap();
+        assert_eq!(args.len(), 2);
+        assert_eq!(args[1], "arg");
+    }
+
+    #[test]
+    fn user_iovecs() {
+        use kernel_hal::user::{IoVecIn, IoVecOut, UserInPtr};
+        let (a, b) = (*b"hello", *b" world");
+        let iov = [a.as_ptr() as usize, a.len(), b.as_ptr() as usize, b.len()];
+        let iovs = UserInPtr::<IoVecIn>::from(iov.as_ptr() as usize)
+            .read_iovecs(2)
+            .unwrap();
+        let mut buf = [0u8; 4];
+        // a chunk across both buffers
+        assert_eq!(iovs.read_to_buf(3, &mut buf), Ok(4));
+        assert_eq!(&buf, b"lo w");
+        assert_eq!(iovs.read_to_buf(9, &mut buf), Ok(2));
+        assert_eq!(&buf[..2], b"ld");
+
+        let (mut c, mut d) = ([0u8; 3], [0u8; 3]);
+        let iov = [c.as_mut_ptr() as usize, 3, d.as_mut_ptr() as usize, 3];
+        let mut iovs = UserInPtr::<IoVecOut>::from(iov.as_ptr() as usize)
+            .read_iovecs(2)
+            .unwrap();
+        assert_eq!(iovs.write_from_buf_at(2, b"abcdef"), Ok(4));
+        assert_eq!((c, d), ([0, 0, b'a'], *b"bcd"));
+    }
+
+    #[test]
+    fn vdso_time() {
+        use std::sync::atomic::{AtomicBool, Ordering};
+
+        static DONE: AtomicBool = AtomicBool::new(false);
+        // each update keeps `mono_offset == N == D`, readers must never see a mix
+        let writers: Vec<_> = (0..2u32)
+            .map(|w| {
+                std::thread::spawn(move || {
+                    for i in 0..10_000u32 {
+                        let n = i * 2 + w + 1;
+                        VDSO_TIME.set_ticks_to_mono(n, n, n as i64);
+                    }
+                })
+            })
+            .collect();
+        let readers: Vec<_> = (0..2)
+            .map(|_| {
+                std::thread::spawn(|| {
+                    while !DONE.load(Ordering::Acquire) {
+                        let params = VDSO_TIME.read();
+                        let n = params.ticks_to_mono_numerator;
+                        if n != 0 {
+                            assert_eq!(params.ticks_to_mono_denominator, n);
+                            assert_eq!(params.mono_offset, n as i64);
+                        }
+                    }
+                })
+            })
+            .collect();
+        for writer in writers {
+            writer.join().unwrap();
+        }
+        DONE.store(true, Ordering::Release);
+        for reader in readers {
+            reader.join().unwrap();
+        }
+
+        VDSO_TIME.set_utc_offset(-5);
+        assert_eq!(VDSO_TIME.utc_offset(), -5);
+        let params = VDSO_TIME.read();
+        assert_eq!(params.mono_offset, params.ticks_to_mono_numerator as i64);
+    }
+
+    #[test]
+    fn contiguous_frames() {
+        let mut frames: BTreeSet<usize> = [1, 2, 4, 5, 6, 7, 9]
+            .iter()
+            .map(|i| i * PAGE_SIZE)
+            .collect();
+        // the first run is too short
+        assert_eq!(
+            alloc_contiguous(&mut frames, 3, PAGE_SIZE),
+            Some(4 * PAGE_SIZE)
+        );
+        // frames 1, 2, 7 and 9 are left, no two of them from an even frame
+        assert_eq!(alloc_contiguous(&mut frames, 2, 2 * PAGE_SIZE), None);
+        assert_eq!(alloc_contiguous(&mut frames, 2, PAGE_SIZE), Some(PAGE_SIZE));
+        assert_eq!(frames.len(), 2);
+    }
 }
@@ -1,10 +1,10 @@
 use super::*;
+use crate::timer::{TimerCallback, TimerId};
 use crate::vdso::VdsoConstants;
 use acpi::Acpi;
 use alloc::boxed::Box;
 use alloc::vec::Vec;
 use core::future::Future;
-use core::ops::FnOnce;
 use core::pin::Pin;
 use core::time::Duration;
 
@@ -24,11 +24,14 @@ pub struct Thread {
 
 impl Thread {
     /// Spawn a new thread.
+    ///
+    /// Threads with higher `priority` are scheduled first.
     #[linkage = "weak"]
     #[export_name = "hal_thread_spawn"]
     pub fn spawn(
         _future: Pin<Box<dyn Future<Output = ()> + Send + 'static>>,
         _vmtoken: usize,
+        _priority: u8,
     ) -> Self {
         unimplemented!()
     }
@@ -46,6 +49,20 @@ impl Thread {
     pub fn get_tid() -> (u64, u64) {
         unimplemented!()
     }
+
+    /// Set the scheduling priority of current task.
+    #[linkage = "weak"]
+    #[export_name = "hal_thread_set_priority"]
+    pub fn set_priority(_priority: u8) {
+        unimplemented!()
+    }
+
+    /// Whether current task has used up its time slice and should yield.
+    #[linkage = "weak"]
+    #[export_name = "hal_thread_need_resched"]
+    pub fn need_resched() -> bool {
+        unimplemented!()
+    }
 }
 
 #[linkage = "weak"]
@@ -70,6 +87,24 @@ pub trait PageTableTrait: Sync + Send {
     /// Get the physical address of root page table.
     fn table_phys(&self) -> PhysAddr;
 
+    /// Map the huge page of `vaddr` to the contiguous frames from `paddr` with `flags`.
+    ///
+    /// Both addresses are aligned to `HUGE_PAGE_SIZE`. Returns an error if huge
+    /// pages are not supported, then the caller should map base pages instead.
+    fn map_huge(&mut self, _vaddr: VirtAddr, _paddr: PhysAddr, _flags: MMUFlags) -> Result<()> {
+        Err(HalError)
+    }
+
+    /// Unmap the huge page of `vaddr`.
+    fn unmap_huge(&mut self, _vaddr: VirtAddr) -> Result<()> {
+        Err(HalError)
+    }
+
+    /// Change the `flags` of the huge page of `vaddr`.
+    fn protect_huge(&mut self, _vaddr: VirtAddr, _flags: MMUFlags) -> Result<()> {
+        Err(HalError)
+    }
+
     fn map_many(
         &mut self,
         mut vaddr: VirtAddr,
@@ -104,6 +139,16 @@ pub trait PageTableTrait: Sync + Send {
         }
         Ok(())
     }
+
+    /// Change the `flags` of `pages` pages from `vaddr`.
+    ///
+    /// Implementations should flush the TLB once for the whole range.
+    fn protect_cont(&mut self, vaddr: VirtAddr, pages: usize, flags: MMUFlags) -> Result<()> {
+        for i in 0..pages {
+            self.protect(vaddr + i * PAGE_SIZE, flags)?;
+        }
+        Ok(())
+    }
 }
 
 /// Page Table
@@ -160,6 +205,38 @@ impl PageTableTrait for PageTable {
     fn table_phys(&self) -> PhysAddr {
         self.table_phys
     }
+    /// Map the huge page of `vaddr` to the contiguous frames from `paddr` with `flags`.
+    #[linkage = "weak"]
+    #[export_name = "hal_pt_map_huge"]
+    fn map_huge(&mut self, _vaddr: VirtAddr, _paddr: PhysAddr, _flags: MMUFlags) -> Result<()> {
+        Err(HalError)
+    }
+    /// Unmap the huge page of `vaddr`.
+    #[linkage = "weak"]
+    #[export_name = "hal_pt_unmap_huge"]
+    fn unmap_huge(&mut self, _vaddr: VirtAddr) -> Result<()> {
+        Err(HalError)
+    }
+    /// Change the `flags` of the huge page of `vaddr`.
+    #[linkage = "weak"]
+    #[export_name = "hal_pt_protect_huge"]
+    fn protect_huge(&mut self, _vaddr: VirtAddr, _flags: MMUFlags) -> Result<()> {
+        Err(HalError)
+    }
+    #[linkage = "weak"]
+    #[export_name = "hal_pt_map_cont"]
+    fn map_cont(
+        &mut self,
+        vaddr: VirtAddr,
+        paddr: PhysAddr,
+        pages: usize,
+        flags: MMUFlags,
+    ) -> Result<()> {
+        for i in 0..pages {
+            self.map(vaddr + i * PAGE_SIZE, paddr + i * PAGE_SIZE, flags)?;
+        }
+        Ok(())
+    }
     #[linkage = "weak"]
     #[export_name = "hal_pt_unmap_cont"]
     fn unmap_cont(&mut self, vaddr: VirtAddr, pages: usize) -> Result<()> {
@@ -168,6 +245,14 @@ impl PageTableTrait for PageTable {
         }
         Ok(())
     }
+    #[linkage = "weak"]
+    #[export_name = "hal_pt_protect_cont"]
+    fn protect_cont(&mut self, vaddr: VirtAddr, pages: usize, flags: MMUFlags) -> Result<()> {
+        for i in 0..pages {
+            self.protect(vaddr + i * PAGE_SIZE, flags)?;
+        }
+        Ok(())
+    }
 }
 
 #[repr(C)]
@@ -188,6 +273,26 @@ impl PhysFrame {
         unimplemented!()
     }
 
+    #[linkage = "weak"]
+    #[export_name = "hal_frame_alloc_many"]
+    pub fn alloc_many_base(_paddrs: &mut [PhysAddr]) -> bool {
+        unimplemented!()
+    }
+
+    /// Allocate `n` frames at once, which are not necessarily contiguous.
+    ///
+    /// Return an empty vector if there are not enough free frames.
+    pub fn alloc_many(n: usize) -> Vec<Self> {
+        let mut paddrs = alloc::vec![0; n];
+        if !PhysFrame::alloc_many_base(&mut paddrs) {
+            return Vec::new();
+        }
+        paddrs
+            .into_iter()
+            .map(|paddr| PhysFrame { paddr })
+            .collect()
+    }
+
     pub fn alloc_contiguous(size: usize, align_log2: usize) -> Vec<Self> {
         PhysFrame::alloc_contiguous_base(size, align_log2).map_or(Vec::new(), |base| {
             (0..size)
@@ -281,9 +386,18 @@ pub fn timer_now() -> Duration {
 }
 
 /// Set a new timer. After `deadline`, the `callback` will be called.
+///
+/// Returns an ID to cancel it.
 #[linkage = "weak"]
 #[export_name = "hal_timer_set"]
-pub fn timer_set(_deadline: Duration, _callback: Box<dyn FnOnce(Duration) + Send + Sync>) {
+pub fn timer_set(_deadline: Duration, _callback: TimerCallback) -> TimerId {
+    unimplemented!()
+}
+
+/// Cancel a timer set by `timer_set`, which does nothing if it has fired.
+#[linkage = "weak"]
+#[export_name = "hal_timer_cancel"]
+pub fn timer_cancel(_id: TimerId) {
     unimplemented!()
 }
 
@@ -387,6 +501,34 @@ pub fn vdso_constants() -> VdsoConstants {
     unimplemented!()
 }
 
+/// Copy `len` bytes from `src` to `dst`, either of which may be user memory.
+///
+/// Returns the number of bytes not copied because of a page fault, 0 on success.
+/// This default can't recover from faults, HALs which can should override it.
+///
+/// # Safety
+///
+/// The kernel side must be valid for `len` bytes.
+#[linkage = "weak"]
+#[export_name = "hal_copy_user"]
+pub unsafe fn copy_user(dst: *mut u8, src: *const u8, len: usize) -> usize {
+    core::ptr::copy_nonoverlapping(src, dst, len);
+    0
+}
+
+/// Handler of page faults in `copy_user`.
+///
+/// It gets the root of the current page table, the fault address and the
+/// access, and returns whether the fault is resolved so the copy can go on.
+pub type UserFaultHandler = Box<dyn Fn(PhysAddr, VirtAddr, MMUFlags) -> bool + Send + Sync>;
+
+/// Set the handler of page faults in `copy_user`, see `UserFaultHandler`.
+///
+/// HALs whose `copy_user` can't fault ignore it.
+#[linkage = "weak"]
+#[export_name = "hal_user_fault_set_handler"]
+pub fn user_fault_set_handler(_handler: UserFaultHandler) {}
+
 /// Get fault address of the last page fault.
 #[linkage = "weak"]
 #[export_name = "fetch_fault_vaddr"]
@@ -428,6 +570,13 @@ pub fn apic_local_id() -> u8 {
     unimplemented!()
 }
 
+/// Get the index of the current CPU, which is small and stable while it runs.
+#[linkage = "weak"]
+#[export_name = "hal_cpu_id"]
+pub fn cpu_id() -> usize {
+    0
+}
+
 /// Fill random bytes to the buffer
 #[cfg(target_arch = "x86_64")]
 pub fn fill_random(buf: &mut [u8]) {
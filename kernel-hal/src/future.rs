@@ -1,4 +1,4 @@
-use crate::timer_now;
+use crate::{timer_now, TimerId};
 use alloc::boxed::Box;
 use core::future::Future;
 use core::pin::Pin;
@@ -32,29 +32,45 @@ impl Future for YieldFuture {
 
 /// Sleeps until the specified of time.
 pub fn sleep_until(deadline: Duration) -> impl Future {
-    SleepFuture { deadline }
+    SleepFuture {
+        deadline,
+        timer: None,
+    }
 }
 
 #[must_use = "sleep does nothing unless polled/`await`-ed"]
 pub struct SleepFuture {
     deadline: Duration,
+    /// The timer to wake up, which is set on the first pending poll.
+    timer: Option<TimerId>,
 }
 
 impl Future for SleepFuture {
     type Output = ();
 
-    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
         if timer_now() >= self.deadline {
             return Poll::Ready(());
         }
-        if self.deadline.as_nanos() < i64::max_value() as u128 {
+        if self.timer.is_none() && self.deadline.as_nanos() < i64::max_value() as u128 {
             let waker = cx.waker().clone();
-            crate::timer_set(self.deadline, Box::new(move |_| waker.wake()));
+            self.timer = Some(crate::timer_set(
+                self.deadline,
+                Box::new(move |_| waker.wake()),
+            ));
         }
         Poll::Pending
     }
 }
 
+impl Drop for SleepFuture {
+    fn drop(&mut self) {
+        if let Some(timer) = self.timer.take() {
+            crate::timer_cancel(timer);
+        }
+    }
+}
+
 /// Get a char from serial.
 pub fn serial_getchar() -> impl Future<Output = u8> {
     SerialFuture
@@ -38,11 +38,14 @@ pub mod defs {
     pub type VirtAddr = usize;
     pub type DevVAddr = usize;
     pub const PAGE_SIZE: usize = 0x1000;
+    /// Size of a huge page, which is mapped by a single entry of the level 2 page table.
+    pub const HUGE_PAGE_SIZE: usize = 0x20_0000;
 }
 
 mod context;
 mod dummy;
 mod future;
+pub mod timer;
 pub mod user;
 pub mod vdso;
 
@@ -50,4 +53,5 @@ pub use self::context::*;
 pub use self::defs::*;
 pub use self::dummy::*;
 pub use self::future::*;
+pub use self::timer::TimerId;
 pub use trapframe::{GeneralRegs, UserContext};
@@ -0,0 +1,303 @@
+//! A hierarchical timer wheel.
+//!
+//! Timers are hashed by their deadline tick into `LEVELS` levels of `SLOTS`
+//! slots, each level `SLOTS` times coarser than the one below. A slot of an
+//! upper level is cascaded into the lower levels when the wheel reaches it,
+//! so adding and cancelling a timer are O(1), and each tick only looks at
+//! one slot. Timers in the same tick fire together.
+
+use alloc::{boxed::Box, vec::Vec};
+use core::time::Duration;
+
+/// Callback of a timer, called with the current time.
+pub type TimerCallback = Box<dyn FnOnce(Duration) + Send + Sync>;
+
+/// Length of a tick of the timer wheel, in nanoseconds.
+pub const TICK_NS: u64 = 1_000_000;
+
+const SLOT_BITS: u32 = 6;
+const SLOTS: usize = 1 << SLOT_BITS;
+const LEVELS: usize = 4;
+
+/// Identity of a timer, which is used to cancel it.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct TimerId {
+    wheel: u32,
+    index: u32,
+    gen: u32,
+}
+
+impl TimerId {
+    /// Get the ID of the wheel which the timer was added to.
+    pub fn wheel(&self) -> usize {
+        self.wheel as usize
+    }
+}
+
+struct Entry {
+    deadline: Duration,
+    /// Incremented each time the entry is freed, to detect stale references.
+    gen: u32,
+    /// Whether it is in level 0.
+    level0: bool,
+    callback: Option<TimerCallback>,
+}
+
+/// A reference to an entry in a slot, which is stale if `gen` differs.
+#[derive(Clone, Copy)]
+struct SlotRef {
+    index: u32,
+    gen: u32,
+}
+
+/// A hierarchical timer wheel.
+pub struct TimerWheel {
+    id: u32,
+    /// The next tick to process.
+    tick: u64,
+    /// Storage of timers, the slots only hold references into it.
+    entries: Vec<Entry>,
+    free: Vec<u32>,
+    /// `LEVELS * SLOTS` slots.
+    slots: Vec<Vec<SlotRef>>,
+    /// Number of live timers in level 0.
+    level0_len: usize,
+    /// Timers beyond the range of the top level.
+    overflow: Vec<SlotRef>,
+    len: usize,
+}
+
+fn tick_of(time: Duration) -> u64 {
+    (time.as_nanos() / TICK_NS as u128) as u64
+}
+
+impl TimerWheel {
+    /// Create an empty timer wheel with `id`, which is returned by `TimerId::wheel`.
+    pub fn new(id: usize) -> Self {
+        TimerWheel {
+            id: id as u32,
+            tick: 0,
+            entries: Vec::new(),
+            free: Vec::new(),
+            slots: (0..LEVELS * SLOTS).map(|_| Vec::new()).collect(),
+            level0_len: 0,
+            overflow: Vec::new(),
+            len: 0,
+        }
+    }
+
+    /// Get the number of pending timers.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Whether there is no pending timer.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Add a timer, `callback` will be called by `expire` after `deadline`.
+    pub fn add(&mut self, deadline: Duration, callback: TimerCallback) -> TimerId {
+        let index = match self.free.pop() {
+            Some(index) => {
+                let entry = &mut self.entries[index as usize];
+                entry.deadline = deadline;
+                entry.callback = Some(callback);
+                index
+            }
+            None => {
+                self.entries.push(Entry {
+                    deadline,
+                    gen: 0,
+                    level0: false,
+                    callback: Some(callback),
+                });
+                self.entries.len() as u32 - 1
+            }
+        };
+        let gen = self.entries[index as usize].gen;
+        self.insert(SlotRef { index, gen });
+        self.len += 1;
+        TimerId {
+            wheel: self.id,
+            index,
+            gen,
+        }
+    }
+
+    /// Cancel a pending timer.
+    ///
+    /// Returns `false` if it has fired or been cancelled.
+    pub fn cancel(&mut self, id: TimerId) -> bool {
+        debug_assert_eq!(id.wheel, self.id);
+        let entry = match self.entries.get(id.index as usize) {
+            Some(entry) if entry.gen == id.gen && entry.callback.is_some() => entry,
+            _ => return false,
+        };
+        // the reference in its slot is skipped later
+        if entry.level0 {
+            self.level0_len -= 1;
+        }
+        self.release(id.index);
+        true
+    }
+
+    /// Get the earliest time at which `expire` may have work to do,
+    /// or `None` if the wheel is empty.
+    ///
+    /// It is no later than the earliest deadline.
+    pub fn next_deadline(&self) -> Option<Duration> {
+        if self.len == 0 {
+            return None;
+        }
+        // timers in the upper levels fire no earlier than the next cascade
+        let cascade = (self.tick | (SLOTS as u64 - 1)) + 1;
+        let cascade = Duration::from_nanos(cascade * TICK_NS);
+        if self.level0_len == 0 {
+            return Some(cascade);
+        }
+        let earliest = (0..SLOTS as u64).find_map(|i| {
+            self.slots[((self.tick + i) % SLOTS as u64) as usize]
+                .iter()
+                .filter_map(|r| self.get(*r))
+                .map(|entry| entry.deadline)
+                .min()
+        });
+        Some(earliest.map_or(cascade, |deadline| deadline.min(cascade)))
+    }
+
+    /// Take the callbacks of timers whose deadlines are no later than `now`.
+    ///
+    /// They should be called after unlocking the wheel, because a callback may
+    /// add another timer.
+    ///
+    /// The wheel only advances here, so call it before adding to a wheel which
+    /// has been idle for long, or it takes a while to catch up.
+    pub fn expire(&mut self, now: Duration) -> Vec<TimerCallback> {
+        let mut callbacks = Vec::new();
+        let target = tick_of(now);
+        if self.len == 0 {
+            self.tick = self.tick.max(target);
+            return callbacks;
+        }
+        while self.tick <= target {
+            if self.tick % SLOTS as u64 == 0 {
+                self.cascade();
+            }
+            if self.level0_len == 0 && self.tick < target {
+                // skip to the next cascade
+                let next = (self.tick | (SLOTS as u64 - 1)) + 1;
+                self.tick = next.min(target);
+                continue;
+            }
+            let slot = (self.tick % SLOTS as u64) as usize;
+            let refs = core::mem::take(&mut self.slots[slot]);
+            for r in refs {
+                let deadline = match self.get(r) {
+                    Some(entry) => entry.deadline,
+                    None => continue,
+                };
+                if deadline > now {
+                    // in the current tick, but not yet
+                    self.slots[slot].push(r);
+                    continue;
+                }
+                let callback = self.entries[r.index as usize].callback.take().unwrap();
+                self.release(r.index);
+                self.level0_len -= 1;
+                callbacks.push(callback);
+            }
+            if self.tick == target {
+                break;
+            }
+            self.tick += 1;
+        }
+        callbacks
+    }
+
+    fn get(&self, r: SlotRef) -> Option<&Entry> {
+        let entry = &self.entries[r.index as usize];
+        if entry.gen == r.gen && entry.callback.is_some() {
+            Some(entry)
+        } else {
+            None
+        }
+    }
+
+    fn release(&mut self, index: u32) {
+        let entry = &mut self.entries[index as usize];
+        entry.callback = None;
+        entry.gen = entry.gen.wrapping_add(1);
+        self.free.push(index);
+        self.len -= 1;
+    }
+
+    /// Put a timer into the slot of its deadline.
+    fn insert(&mut self, r: SlotRef) {
+        let tick = tick_of(self.entries[r.index as usize].deadline).max(self.tick);
+        let delta = tick - self.tick;
+        for level in 0..LEVELS {
+            if delta < 1 << (SLOT_BITS * (level as u32 + 1)) {
+                let slot = (tick >> (SLOT_BITS * level as u32)) as usize % SLOTS;
+                self.slots[level * SLOTS + slot].push(r);
+                self.entries[r.index as usize].level0 = level == 0;
+                if level == 0 {
+                    self.level0_len += 1;
+                }
+                return;
+            }
+        }
+        self.entries[r.index as usize].level0 = false;
+        self.overflow.push(r);
+    }
+
+    /// Move timers of the upper levels down when the lower level wraps around.
+    fn cascade(&mut self) {
+        for level in 1..LEVELS {
+            let slot = (self.tick >> (SLOT_BITS * level as u32)) as usize % SLOTS;
+            let refs = core::mem::take(&mut self.slots[level * SLOTS + slot]);
+            for r in refs {
+                if self.get(r).is_some() {
+                    self.insert(r);
+                }
+            }
+            if slot != 0 {
+                return;
+            }
+        }
+        for r in core::mem::take(&mut self.overflow) {
+            if self.get(r).is_some() {
+                self.insert(r);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn timer_wheel() {
+        let mut wheel = TimerWheel::new(0);
+        let ms = Duration::from_millis;
+        // in level 0, 1, 2 and 3
+        for &t in [5, 100, 5_000, 1_000_000].iter() {
+            wheel.add(ms(t), Box::new(|_| {}));
+        }
+        let cancelled = wheel.add(ms(200), Box::new(|_| {}));
+        assert!(wheel.cancel(cancelled));
+        assert!(!wheel.cancel(cancelled));
+        assert_eq!(wheel.len(), 4);
+
+        assert_eq!(wheel.expire(ms(4)).len(), 0);
+        assert_eq!(wheel.expire(ms(5)).len(), 1);
+        assert!(wheel.next_deadline().unwrap() <= ms(100));
+        assert_eq!(wheel.expire(ms(99)).len(), 0);
+        assert_eq!(wheel.expire(ms(4_999)).len(), 1);
+        assert_eq!(wheel.expire(ms(5_000)).len(), 1);
+        assert_eq!(wheel.expire(ms(999_999)).len(), 0);
+        assert_eq!(wheel.expire(ms(2_000_000)).len(), 1);
+        assert!(wheel.is_empty());
+    }
+}
@@ -1,7 +1,10 @@
+use crate::{copy_user, PAGE_SIZE};
 use alloc::string::String;
 use alloc::vec::Vec;
+use core::convert::TryInto;
 use core::fmt::{Debug, Formatter};
 use core::marker::PhantomData;
+use core::mem::{size_of, ManuallyDrop, MaybeUninit};
 use core::ops::{Deref, DerefMut};
 
 #[repr(C)]
@@ -41,6 +44,43 @@ pub enum Error {
     InvalidVectorAddress,
 }
 
+/// Bytes of user memory copied at a time when looking for the end of a C string.
+const CSTRING_CHUNK: usize = 256;
+
+/// Number of pointers read at a time when looking for the end of an array.
+const CSTRING_ARRAY_BATCH: usize = 16;
+
+/// Copy `len` elements from `src` to `dst`, either of which may be user memory.
+///
+/// A page fault in user memory stops the copy with `InvalidPointer`.
+unsafe fn copy<T>(dst: *mut T, src: *const T, len: usize) -> Result<()> {
+    let size = len
+        .checked_mul(size_of::<T>())
+        .ok_or(Error::InvalidLength)?;
+    match copy_user(dst as *mut u8, src as *const u8, size) {
+        0 => Ok(()),
+        _ => Err(Error::InvalidPointer),
+    }
+}
+
+/// Find the first NUL in `bytes`, checking a word at a time.
+fn find_zero(bytes: &[u8]) -> Option<usize> {
+    const WORD: usize = size_of::<usize>();
+    const LO: usize = usize::MAX / 0xff;
+    const HI: usize = LO << 7;
+    let mut words = bytes.chunks_exact(WORD);
+    for (i, word) in (&mut words).enumerate() {
+        let x = usize::from_ne_bytes(word.try_into().unwrap());
+        // some byte is zero iff this is non-zero
+        if x.wrapping_sub(LO) & !x & HI != 0 {
+            return word.iter().position(|&b| b == 0).map(|j| i * WORD + j);
+        }
+    }
+    let rest = words.remainder();
+    let offset = bytes.len() - rest.len();
+    rest.iter().position(|&b| b == 0).map(|j| offset + j)
+}
+
 impl<T, P: Policy> Debug for UserPtr<T, P> {
     fn fmt(&self, f: &mut Formatter<'_>) -> core::fmt::Result {
         write!(f, "{:?}", self.ptr)
@@ -100,9 +140,12 @@ impl<T, P: Read> UserPtr<T, P> {
     }
 
     pub fn read(&self) -> Result<T> {
-        // TODO: check ptr and return err
         self.check()?;
-        Ok(unsafe { self.ptr.read() })
+        let mut value = MaybeUninit::<T>::uninit();
+        unsafe {
+            copy(value.as_mut_ptr(), self.ptr, 1)?;
+            Ok(value.assume_init())
+        }
     }
 
     pub fn read_if_not_null(&self) -> Result<Option<T>> {
@@ -120,50 +163,97 @@ impl<T, P: Read> UserPtr<T, P> {
         self.check()?;
         let mut ret = Vec::<T>::with_capacity(len);
         unsafe {
+            copy(ret.as_mut_ptr(), self.ptr, len)?;
             ret.set_len(len);
-            ret.as_mut_ptr().copy_from_nonoverlapping(self.ptr, len);
         }
         Ok(ret)
     }
+
+    /// Read `buf.len()` elements into `buf`, without allocating.
+    pub fn read_array_into(&self, buf: &mut [T]) -> Result<()>
+    where
+        T: Copy,
+    {
+        if buf.is_empty() {
+            return Ok(());
+        }
+        self.check()?;
+        unsafe { copy(buf.as_mut_ptr(), self.ptr, buf.len()) }
+    }
 }
 
 impl<P: Read> UserPtr<u8, P> {
     pub fn read_string(&self, len: usize) -> Result<String> {
         self.check()?;
-        let src = unsafe { core::slice::from_raw_parts(self.ptr, len) };
-        let s = core::str::from_utf8(src).map_err(|_| Error::InvalidUtf8)?;
-        Ok(String::from(s))
+        String::from_utf8(self.read_array(len)?).map_err(|_| Error::InvalidUtf8)
     }
 
     pub fn read_cstring(&self) -> Result<String> {
         self.check()?;
-        let len = unsafe { (0usize..).find(|&i| *self.ptr.add(i) == 0).unwrap() };
-        self.read_string(len)
+        let mut bytes = Vec::new();
+        let mut chunk = [0u8; CSTRING_CHUNK];
+        loop {
+            match self.add(bytes.len()).read_cstring_into(&mut chunk) {
+                Ok(len) => {
+                    bytes.extend_from_slice(&chunk[..len]);
+                    break;
+                }
+                Err(Error::BufferTooSmall) => bytes.extend_from_slice(&chunk),
+                Err(e) => return Err(e),
+            }
+        }
+        String::from_utf8(bytes).map_err(|_| Error::InvalidUtf8)
+    }
+
+    /// Copy a C string into `buf` without allocating, return its length
+    /// without the NUL.
+    ///
+    /// Returns `BufferTooSmall` if there is no NUL in `buf.len()` bytes.
+    pub fn read_cstring_into(&self, buf: &mut [u8]) -> Result<usize> {
+        self.check()?;
+        let mut len = 0;
+        while len < buf.len() {
+            // never read past the page of the NUL, the next one may be unmapped
+            let addr = self.ptr as usize + len;
+            let n = (buf.len() - len)
+                .min(CSTRING_CHUNK)
+                .min(PAGE_SIZE - addr % PAGE_SIZE);
+            unsafe { copy(buf[len..].as_mut_ptr(), addr as *const u8, n)? };
+            if let Some(i) = find_zero(&buf[len..len + n]) {
+                return Ok(len + i);
+            }
+            len += n;
+        }
+        Err(Error::BufferTooSmall)
     }
 }
 
 impl<P: Read> UserPtr<UserPtr<u8, P>, P> {
     pub fn read_cstring_array(&self) -> Result<Vec<String>> {
         self.check()?;
-        let len = unsafe {
-            (0usize..)
-                .find(|&i| self.ptr.add(i).read().is_null())
-                .unwrap()
-        };
-        self.read_array(len)?
-            .into_iter()
-            .map(|ptr| ptr.read_cstring())
-            .collect()
+        let mut strings = Vec::new();
+        let mut batch = [0usize; CSTRING_ARRAY_BATCH];
+        loop {
+            // pointers are read in batches that don't cross a page
+            let addr = self.ptr as usize + strings.len() * size_of::<usize>();
+            let n = CSTRING_ARRAY_BATCH.min((PAGE_SIZE - addr % PAGE_SIZE) / size_of::<usize>());
+            UserPtr::<usize, P>::from(addr).read_array_into(&mut batch[..n])?;
+            for &ptr in batch[..n].iter() {
+                if ptr == 0 {
+                    return Ok(strings);
+                }
+                strings.push(UserPtr::<u8, P>::from(ptr).read_cstring()?);
+            }
+        }
     }
 }
 
 impl<T, P: Write> UserPtr<T, P> {
     pub fn write(&mut self, value: T) -> Result<()> {
         self.check()?;
-        unsafe {
-            self.ptr.write(value);
-        }
-        Ok(())
+        // the value is moved to user memory
+        let value = ManuallyDrop::new(value);
+        unsafe { copy(self.ptr, &*value as *const T, 1) }
     }
 
     pub fn write_if_not_null(&mut self, value: T) -> Result<()> {
@@ -178,11 +268,7 @@ impl<T, P: Write> UserPtr<T, P> {
             return Ok(());
         }
         self.check()?;
-        unsafe {
-            self.ptr
-                .copy_from_nonoverlapping(values.as_ptr(), values.len());
-        }
-        Ok(())
+        unsafe { copy(self.ptr, values.as_ptr(), values.len()) }
     }
 }
 
@@ -190,10 +276,7 @@ impl<P: Write> UserPtr<u8, P> {
     pub fn write_cstring(&mut self, s: &str) -> Result<()> {
         let bytes = s.as_bytes();
         self.write_array(bytes)?;
-        unsafe {
-            self.ptr.add(bytes.len()).write(0);
-        }
-        Ok(())
+        self.add(bytes.len()).write(0)
     }
 }
 
@@ -242,23 +325,66 @@ impl<P: Policy> IoVecs<P> {
 
 impl<P: Read> IoVecs<P> {
     pub fn read_to_vec(&self) -> Result<Vec<u8>> {
-        let mut buf = Vec::new();
-        for vec in self.vec.iter() {
-            buf.extend(vec.ptr.read_array(vec.len)?);
+        let mut buf = Vec::with_capacity(self.total_len());
+        for vec in self.vec.iter().filter(|vec| vec.len != 0) {
+            vec.ptr.check()?;
+            unsafe {
+                copy(buf.as_mut_ptr().add(buf.len()), vec.ptr.as_ptr(), vec.len)?;
+                buf.set_len(buf.len() + vec.len);
+            }
         }
         Ok(buf)
     }
+
+    /// Read into `buf` from byte `offset` of all buffers without allocating,
+    /// return the number of bytes read.
+    pub fn read_to_buf(&self, mut offset: usize, buf: &mut [u8]) -> Result<usize> {
+        let mut len = 0;
+        for vec in self.vec.iter() {
+            if offset >= vec.len {
+                offset -= vec.len;
+                continue;
+            }
+            let copy_len = (vec.len - offset).min(buf.len() - len);
+            if copy_len == 0 {
+                break;
+            }
+            if vec.ptr.is_null() {
+                return Err(Error::InvalidVectorAddress);
+            }
+            vec.ptr
+                .add(offset)
+                .read_array_into(&mut buf[len..len + copy_len])?;
+            offset = 0;
+            len += copy_len;
+        }
+        Ok(len)
+    }
 }
 
 impl<P: Write> IoVecs<P> {
-    pub fn write_from_buf(&mut self, mut buf: &[u8]) -> Result<usize> {
+    pub fn write_from_buf(&mut self, buf: &[u8]) -> Result<usize> {
+        self.write_from_buf_at(0, buf)
+    }
+
+    /// Write `buf` from byte `offset` of all buffers, return the number of
+    /// bytes written.
+    pub fn write_from_buf_at(&mut self, mut offset: usize, mut buf: &[u8]) -> Result<usize> {
         let buf_len = buf.len();
         for vec in self.vec.iter_mut() {
-            let copy_len = vec.len.min(buf.len());
-            if copy_len == 0 {
+            if offset >= vec.len {
+                offset -= vec.len;
                 continue;
             }
-            vec.ptr.write_array(&buf[..copy_len])?;
+            let copy_len = (vec.len - offset).min(buf.len());
+            if copy_len == 0 {
+                break;
+            }
+            if vec.ptr.is_null() {
+                return Err(Error::InvalidVectorAddress);
+            }
+            vec.ptr.add(offset).write_array(&buf[..copy_len])?;
+            offset = 0;
             buf = &buf[copy_len..];
         }
         Ok(buf_len - buf.len())
@@ -284,6 +410,11 @@ impl<P: Policy> IoVec<P> {
         self.ptr.is_null()
     }
 
+    /// Starting address
+    pub fn addr(&self) -> usize {
+        self.ptr.as_ptr() as usize
+    }
+
     pub fn len(&self) -> usize {
         self.len
     }
@@ -295,22 +426,4 @@ impl<P: Policy> IoVec<P> {
     pub fn check(&self) -> Result<()> {
         self.ptr.check()
     }
-
-    pub fn as_slice(&self) -> Result<&[u8]> {
-        if self.ptr.is_null() {
-            return Err(Error::InvalidVectorAddress);
-        }
-        let slice = unsafe { core::slice::from_raw_parts(self.ptr.as_ptr(), self.len) };
-        Ok(slice)
-    }
-}
-
-impl<P: Write> IoVec<P> {
-    pub fn as_mut_slice(&mut self) -> Result<&mut [u8]> {
-        if self.ptr.is_null() {
-            return Err(Error::InvalidVectorAddress);
-        }
-        let slice = unsafe { core::slice::from_raw_parts_mut(self.ptr.as_ptr(), self.len) };
-        Ok(slice)
-    }
 }
@@ -1,4 +1,5 @@
 use core::fmt::{Debug, Error, Formatter};
+use core::sync::atomic::{fence, AtomicI64, AtomicU32, Ordering};
 
 /// This struct contains constants that are initialized by the kernel
 /// once at boot time.  From the vDSO code's perspective, they are
@@ -69,3 +70,119 @@ impl Debug for VersionString {
         Ok(())
     }
 }
+
+/// Clock parameters shared with user space through a read-only page, so that
+/// clocks can be read without entering the kernel.
+///
+/// A reader computes the clocks from the ticks counter (`zx_ticks_get`):
+///
+/// - ClockMono(ticks) = mono_offset + (ticks * N) / D
+/// - ClockUTC(ticks) = ClockMono(ticks) + utc_offset
+///
+/// The parameters are protected by a sequence lock: `seq` is odd while the
+/// kernel updates them, so a reader retries if `seq` is odd or changes during
+/// its reads. `N == 0` means the page is not set up, and the clocks must be
+/// read by syscalls.
+///
+/// The page is only published: the prebuilt vDSO images do not read it yet,
+/// so `zx_clock_get` still enters the kernel. Linux processes have no vDSO.
+#[repr(C, align(4096))]
+#[derive(Debug)]
+pub struct VdsoTime {
+    seq: AtomicU32,
+    /// Ratio which relates ticks to clock monotonic, N and D above.
+    ticks_to_mono_numerator: AtomicU32,
+    ticks_to_mono_denominator: AtomicU32,
+    _reserved: u32,
+    /// Nanoseconds added to the ticks scaled to clock monotonic.
+    mono_offset: AtomicI64,
+    /// Nanoseconds of clock UTC at clock monotonic 0.
+    utc_offset: AtomicI64,
+}
+
+/// A consistent copy of the parameters of `VdsoTime`.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct VdsoTimeParams {
+    pub ticks_to_mono_numerator: u32,
+    pub ticks_to_mono_denominator: u32,
+    pub mono_offset: i64,
+    pub utc_offset: i64,
+}
+
+/// The time page of the kernel.
+pub static VDSO_TIME: VdsoTime = VdsoTime {
+    seq: AtomicU32::new(0),
+    ticks_to_mono_numerator: AtomicU32::new(0),
+    ticks_to_mono_denominator: AtomicU32::new(1),
+    _reserved: 0,
+    mono_offset: AtomicI64::new(0),
+    utc_offset: AtomicI64::new(0),
+};
+
+impl VdsoTime {
+    /// Read the parameters, as user space does.
+    pub fn read(&self) -> VdsoTimeParams {
+        loop {
+            let seq = self.seq.load(Ordering::Acquire);
+            if seq & 1 != 0 {
+                core::hint::spin_loop();
+                continue;
+            }
+            let params = VdsoTimeParams {
+                ticks_to_mono_numerator: self.ticks_to_mono_numerator.load(Ordering::Relaxed),
+                ticks_to_mono_denominator: self.ticks_to_mono_denominator.load(Ordering::Relaxed),
+                mono_offset: self.mono_offset.load(Ordering::Relaxed),
+                utc_offset: self.utc_offset.load(Ordering::Relaxed),
+            };
+            fence(Ordering::Acquire);
+            if self.seq.load(Ordering::Relaxed) == seq {
+                return params;
+            }
+        }
+    }
+
+    /// Set how ticks are converted to clock monotonic.
+    pub fn set_ticks_to_mono(&self, numerator: u32, denominator: u32, mono_offset: i64) {
+        self.update(|time| {
+            time.ticks_to_mono_numerator
+                .store(numerator, Ordering::Relaxed);
+            time.ticks_to_mono_denominator
+                .store(denominator, Ordering::Relaxed);
+            time.mono_offset.store(mono_offset, Ordering::Relaxed);
+        });
+    }
+
+    /// Set the offset of clock UTC from clock monotonic in nanoseconds.
+    pub fn set_utc_offset(&self, utc_offset: i64) {
+        self.update(|time| time.utc_offset.store(utc_offset, Ordering::Relaxed));
+    }
+
+    /// Get the offset of clock UTC from clock monotonic in nanoseconds.
+    pub fn utc_offset(&self) -> i64 {
+        self.read().utc_offset
+    }
+
+    fn update(&self, f: impl FnOnce(&Self)) {
+        // an odd `seq` also excludes other writers
+        let mut seq = self.seq.load(Ordering::Relaxed);
+        loop {
+            if seq & 1 != 0 {
+                core::hint::spin_loop();
+                seq = self.seq.load(Ordering::Relaxed);
+                continue;
+            }
+            match self.seq.compare_exchange_weak(
+                seq,
+                seq.wrapping_add(1),
+                Ordering::Acquire,
+                Ordering::Relaxed,
+            ) {
+                Ok(_) => break,
+                Err(current) => seq = current,
+            }
+        }
+        fence(Ordering::Release);
+        f(self);
+        self.seq.store(seq.wrapping_add(2), Ordering::Release);
+    }
+}
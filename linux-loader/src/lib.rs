@@ -13,10 +13,7 @@ use {
     core::{future::Future, pin::Pin},
     kernel_hal::{GeneralRegs, MMUFlags},
     linux_object::{
-        fs::{vfs::FileSystem, INodeExt},
-        loader::LinuxElfLoader,
-        process::ProcessExt,
-        thread::ThreadExt,
+        fs::vfs::FileSystem, loader::LinuxElfLoader, process::ProcessExt, thread::ThreadExt,
     },
     linux_syscall::Syscall,
     zircon_object::task::*,
@@ -36,9 +33,8 @@ pub fn run(args: Vec<String>, envs: Vec<String>, rootfs: Arc<dyn FileSystem>) ->
         root_inode: rootfs.root_inode(),
     };
     let inode = rootfs.root_inode().lookup(&args[0]).unwrap();
-    let data = inode.read_as_vec().unwrap();
     let path = args[0].clone();
-    let (entry, sp) = loader.load(&proc.vmar(), &data, args, envs, path).unwrap();
+    let (entry, sp) = loader.load(&proc.vmar(), &inode, args, envs, path).unwrap();
 
     thread
         .start(entry, sp, 0, 0, thread_fn)
@@ -70,7 +66,7 @@ async fn new_thread(thread: CurrentThread) {
             0x100 => handle_syscall(&thread, &mut cx.general).await,
             0x20..=0x3f => {
                 kernel_hal::InterruptManager::handle(cx.trap_num as u8);
-                if cx.trap_num == 0x20 {
+                if cx.trap_num == 0x20 && kernel_hal::Thread::need_resched() {
                     kernel_hal::yield_now().await;
                 }
             }
@@ -187,6 +187,16 @@ mod tests {
         assert_eq!(test("/bin/testpipe1").await, 0);
     }
 
+    #[async_std::test]
+    async fn test_splice() {
+        assert_eq!(test("/bin/testsplice").await, 0);
+    }
+
+    #[async_std::test]
+    async fn test_epoll() {
+        assert_eq!(test("/bin/testepoll").await, 0);
+    }
+
     #[async_std::test]
     async fn test_time() {
         assert_eq!(test("/bin/testtime").await, 0);
@@ -216,4 +226,14 @@ mod tests {
     async fn test_poll() {
         assert_eq!(test("/bin/testpoll").await, 0);
     }
+
+    #[async_std::test]
+    async fn test_fd() {
+        assert_eq!(test("/bin/testfd").await, 0);
+    }
+
+    #[async_std::test]
+    async fn test_futex() {
+        assert_eq!(test("/bin/testfutex").await, 0);
+    }
 }
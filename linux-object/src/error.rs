@@ -113,6 +113,8 @@ pub enum LxError {
     ENOTCONN = 107,
     /// Connection refused
     ECONNREFUSED = 111,
+    /// Connection timed out
+    ETIMEDOUT = 110,
 }
 
 #[allow(non_snake_case)]
@@ -169,6 +171,7 @@ impl fmt::Display for LxError {
             EISCONN => "Transport endpoint is already connected",
             ENOTCONN => "Transport endpoint is not connected",
             ECONNREFUSED => "Connection refused",
+            ETIMEDOUT => "Connection timed out",
             _ => "Unknown error",
         };
         write!(f, "{}", explain)
@@ -0,0 +1,60 @@
+//! Cache of path lookups
+//!
+//! Each process caches the inodes it looked up by absolute path, so that
+//! resolving a path does not walk every directory on it again. Any change
+//! of the namespace invalidates the caches of all processes.
+
+use alloc::{collections::BTreeMap, string::String, sync::Arc};
+use core::sync::atomic::{AtomicUsize, Ordering};
+
+use rcore_fs::vfs::INode;
+
+/// A cache is cleared once it has this many entries.
+const MAX_DENTRIES: usize = 256;
+
+/// Incremented whenever a path may resolve to another inode.
+static GENERATION: AtomicUsize = AtomicUsize::new(0);
+
+/// Invalidate the cached lookups of all processes.
+///
+/// Called after unlinking, renaming or removing a directory entry.
+pub fn invalidate_dentries() {
+    GENERATION.fetch_add(1, Ordering::Release);
+}
+
+/// Inodes looked up by a process, indexed by whether symbolic links were
+/// followed and the absolute path.
+#[derive(Default)]
+pub struct DentryCache {
+    generation: usize,
+    entries: [BTreeMap<String, Arc<dyn INode>>; 2],
+}
+
+impl DentryCache {
+    /// Get the inode at `path` if it is cached.
+    pub fn get(&mut self, path: &str, follow: bool) -> Option<Arc<dyn INode>> {
+        self.check_generation();
+        self.entries[follow as usize].get(path).cloned()
+    }
+
+    /// Cache the inode at `path`, which was looked up after `get` missed.
+    pub fn insert(&mut self, path: String, follow: bool, inode: Arc<dyn INode>) {
+        // the namespace changed during the lookup
+        if GENERATION.load(Ordering::Acquire) != self.generation {
+            return;
+        }
+        let entries = &mut self.entries[follow as usize];
+        if entries.len() >= MAX_DENTRIES {
+            entries.clear();
+        }
+        entries.insert(path, inode);
+    }
+
+    fn check_generation(&mut self) {
+        let generation = GENERATION.load(Ordering::Acquire);
+        if generation != self.generation {
+            self.entries.iter_mut().for_each(BTreeMap::clear);
+            self.generation = generation;
+        }
+    }
+}
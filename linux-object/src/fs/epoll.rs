@@ -0,0 +1,361 @@
+//! Implement epoll, I/O event notification with a persistent interest list
+#![deny(missing_docs)]
+
+use super::{FileDesc, FileLike};
+use crate::error::{LxError, LxResult};
+use crate::sync::{wait_for_event, Event, EventBus, EventHandler};
+use alloc::{
+    boxed::Box,
+    collections::{BTreeMap, VecDeque},
+    sync::{Arc, Weak},
+    vec::Vec,
+};
+use async_trait::async_trait;
+use bitflags::bitflags;
+use core::sync::atomic::{AtomicBool, Ordering};
+use rcore_fs::vfs::PollStatus;
+use spin::Mutex;
+use zircon_object::object::*;
+
+bitflags! {
+    /// Events of epoll, `EPOLL*` in Linux.
+    #[derive(Default)]
+    pub struct EpollEvents: u32 {
+        /// The file is available for read.
+        const IN = 0x001;
+        /// There is an exceptional condition on the file.
+        const PRI = 0x002;
+        /// The file is available for write.
+        const OUT = 0x004;
+        /// Error condition (return only)
+        const ERR = 0x008;
+        /// Hang up (return only)
+        const HUP = 0x010;
+        /// Stream socket peer closed connection.
+        const RDHUP = 0x2000;
+        /// Wake up only one of the epoll instances watching the file, ignored.
+        const EXCLUSIVE = 1 << 28;
+        /// Prevent system suspend, ignored.
+        const WAKEUP = 1 << 29;
+        /// Disable the file after one event is reported.
+        const ONESHOT = 1 << 30;
+        /// Edge-triggered, report an event only when the readiness changes.
+        const ET = 1 << 31;
+    }
+}
+
+impl From<PollStatus> for EpollEvents {
+    fn from(status: PollStatus) -> Self {
+        let mut events = EpollEvents::empty();
+        if status.read {
+            events |= EpollEvents::IN;
+        }
+        if status.write {
+            events |= EpollEvents::OUT;
+        }
+        if status.error {
+            events |= EpollEvents::ERR;
+        }
+        events
+    }
+}
+
+/// `struct epoll_event` in Linux, which is packed on x86_64.
+#[repr(C)]
+#[cfg_attr(target_arch = "x86_64", repr(packed))]
+#[derive(Clone, Copy, Default)]
+pub struct EpollEvent {
+    /// Interested events, or the events which happened.
+    pub events: EpollEvents,
+    /// User data returned with the events.
+    pub data: u64,
+}
+
+/// A file in the interest list.
+struct Interest {
+    file: Weak<dyn FileLike>,
+    event: Mutex<EpollEvent>,
+    /// Whether it is in the ready list.
+    queued: AtomicBool,
+    /// Whether it has been removed from the interest list.
+    removed: AtomicBool,
+    /// ID of the callback on the event bus of the file.
+    subscription: Mutex<Option<usize>>,
+}
+
+impl Interest {
+    fn is_file(&self, file: &Arc<dyn FileLike>) -> bool {
+        Weak::as_ptr(&self.file) as *const () == Arc::as_ptr(file) as *const ()
+    }
+
+    /// Mark it removed from the interest list, and remove its callback.
+    fn remove(&self) {
+        self.removed.store(true, Ordering::Release);
+        let id = self.subscription.lock().take();
+        if let (Some(file), Some(id)) = (self.file.upgrade(), id) {
+            file.unsubscribe(id);
+        }
+    }
+}
+
+#[derive(Default)]
+struct EpollInner {
+    interests: BTreeMap<FileDesc, Arc<Interest>>,
+    /// Interests which may be ready, each at most once.
+    ready: VecDeque<Arc<Interest>>,
+}
+
+/// An epoll instance.
+///
+/// Each file in the interest list notifies the instance by a callback on its
+/// event bus, which pushes it to the ready list. So waiting only checks the
+/// files which may be ready, rather than all of them. Files without an event
+/// bus (e.g. regular files) are always ready.
+///
+/// Level-triggered files stay in the ready list while they are ready.
+/// Edge-triggered ones are queued again when more data arrives.
+/// Epoll instances can not be nested.
+pub struct EpollInstance {
+    base: KObjectBase,
+    /// Shared with the callbacks, which must not own the instance: dropping
+    /// it in a callback would unsubscribe with the event bus locked.
+    inner: Arc<Mutex<EpollInner>>,
+    /// READABLE if the ready list is not empty.
+    eventbus: Arc<Mutex<EventBus>>,
+    cloexec: bool,
+}
+
+impl_kobject!(EpollInstance);
+
+impl EpollInstance {
+    /// Create a new epoll instance.
+    pub fn new(cloexec: bool) -> Arc<Self> {
+        Arc::new(EpollInstance {
+            base: KObjectBase::new(),
+            inner: Arc::default(),
+            eventbus: EventBus::new(),
+            cloexec,
+        })
+    }
+
+    /// Whether the instance should be closed on exec.
+    pub fn cloexec(&self) -> bool {
+        self.cloexec
+    }
+
+    /// Add `file` of `fd` to the interest list.
+    pub fn add(
+        self: &Arc<Self>,
+        fd: FileDesc,
+        file: &Arc<dyn FileLike>,
+        event: EpollEvent,
+    ) -> LxResult {
+        // nesting is not supported, which also rules out loops
+        if file.clone().downcast_arc::<EpollInstance>().is_ok() {
+            return Err(LxError::EINVAL);
+        }
+        let interest = Arc::new(Interest {
+            file: Arc::downgrade(file),
+            event: Mutex::new(event),
+            queued: AtomicBool::new(false),
+            removed: AtomicBool::new(false),
+            subscription: Mutex::new(None),
+        });
+        let old = {
+            let mut inner = self.inner.lock();
+            if let Some(old) = inner.interests.get(&fd) {
+                if old.is_file(file) {
+                    return Err(LxError::EEXIST);
+                }
+            }
+            inner.interests.insert(fd, interest.clone())
+        };
+        // the old file is registered with a closed fd
+        if let Some(old) = old {
+            old.remove();
+        }
+        let inner = Arc::downgrade(&self.inner);
+        let eventbus = Arc::downgrade(&self.eventbus);
+        let callback = interest.clone();
+        let id = file.subscribe(Box::new(move |_| {
+            // removed, or the file is closed
+            if callback.removed.load(Ordering::Acquire) || callback.file.strong_count() == 0 {
+                return true;
+            }
+            match (inner.upgrade(), eventbus.upgrade()) {
+                (Some(inner), Some(eventbus)) => {
+                    enqueue(&inner, &eventbus, &callback);
+                    false
+                }
+                _ => true,
+            }
+        }));
+        *interest.subscription.lock() = id;
+        // deleted before its callback was registered
+        if interest.removed.load(Ordering::Acquire) {
+            interest.remove();
+        }
+        // check its current readiness
+        self.enqueue(&interest);
+        Ok(())
+    }
+
+    /// Change the interested events of `file` of `fd`.
+    pub fn modify(&self, fd: FileDesc, file: &Arc<dyn FileLike>, event: EpollEvent) -> LxResult {
+        let interest = self.get(fd, file)?;
+        *interest.event.lock() = event;
+        self.enqueue(&interest);
+        Ok(())
+    }
+
+    /// Remove `file` of `fd` from the interest list.
+    pub fn delete(&self, fd: FileDesc, file: &Arc<dyn FileLike>) -> LxResult {
+        // check and remove under one lock, the fd may be deleted or reused meanwhile
+        let interest = {
+            let mut inner = self.inner.lock();
+            match inner.interests.get(&fd) {
+                Some(interest) if interest.is_file(file) => {}
+                _ => return Err(LxError::ENOENT),
+            }
+            inner.interests.remove(&fd).unwrap()
+        };
+        interest.remove();
+        Ok(())
+    }
+
+    fn get(&self, fd: FileDesc, file: &Arc<dyn FileLike>) -> LxResult<Arc<Interest>> {
+        match self.inner.lock().interests.get(&fd) {
+            Some(interest) if interest.is_file(file) => Ok(interest.clone()),
+            _ => Err(LxError::ENOENT),
+        }
+    }
+
+    fn enqueue(&self, interest: &Arc<Interest>) {
+        enqueue(&self.inner, &self.eventbus, interest);
+    }
+
+    /// Take at most `max` events of ready files without blocking.
+    pub fn try_wait(&self, max: usize) -> Vec<EpollEvent> {
+        let ready = core::mem::take(&mut self.inner.lock().ready);
+        let mut events = Vec::new();
+        let mut requeue = Vec::new();
+        for interest in ready {
+            interest.queued.store(false, Ordering::Release);
+            if interest.removed.load(Ordering::Acquire) {
+                continue;
+            }
+            if events.len() >= max {
+                requeue.push(interest);
+                continue;
+            }
+            let file = match interest.file.upgrade() {
+                Some(file) => file,
+                None => continue,
+            };
+            let mut event = interest.event.lock();
+            if event.events.is_empty() {
+                // disabled by ONESHOT
+                continue;
+            }
+            let revents = match file.poll() {
+                Ok(status) => EpollEvents::from(status),
+                Err(_) => EpollEvents::ERR,
+            } & (event.events | EpollEvents::ERR | EpollEvents::HUP);
+            if revents.is_empty() {
+                // it will be queued again by its callback
+                continue;
+            }
+            events.push(EpollEvent {
+                events: revents,
+                data: event.data,
+            });
+            if event.events.contains(EpollEvents::ONESHOT) {
+                event.events = EpollEvents::empty();
+            } else if !event.events.contains(EpollEvents::ET) {
+                drop(event);
+                requeue.push(interest);
+            }
+        }
+        for interest in requeue.iter() {
+            self.enqueue(interest);
+        }
+        // `enqueue` sets READABLE after pushing, so check it with the event bus locked
+        let mut eventbus = self.eventbus.lock();
+        if self.inner.lock().ready.is_empty() {
+            eventbus.clear(Event::READABLE);
+        }
+        events
+    }
+
+    /// Get the event bus, which is READABLE when there may be ready files.
+    pub fn eventbus(&self) -> Arc<Mutex<EventBus>> {
+        self.eventbus.clone()
+    }
+}
+
+/// Push `interest` to the ready list in `inner`, and set READABLE on `eventbus`.
+fn enqueue(inner: &Mutex<EpollInner>, eventbus: &Mutex<EventBus>, interest: &Arc<Interest>) {
+    if interest.queued.swap(true, Ordering::AcqRel) {
+        return;
+    }
+    inner.lock().ready.push_back(interest.clone());
+    eventbus.lock().set(Event::READABLE);
+}
+
+impl Drop for EpollInstance {
+    fn drop(&mut self) {
+        // callbacks lock `inner` with the event bus of the file locked
+        let interests = core::mem::take(&mut self.inner.lock().interests);
+        for interest in interests.values() {
+            interest.remove();
+        }
+    }
+}
+
+#[async_trait]
+impl FileLike for EpollInstance {
+    async fn read(&self, _buf: &mut [u8]) -> LxResult<usize> {
+        Err(LxError::EINVAL)
+    }
+
+    async fn write(&self, _buf: &[u8]) -> LxResult<usize> {
+        Err(LxError::EINVAL)
+    }
+
+    async fn read_at(&self, _offset: u64, _buf: &mut [u8]) -> LxResult<usize> {
+        Err(LxError::ESPIPE)
+    }
+
+    async fn write_at(&self, _offset: u64, _buf: &[u8]) -> LxResult<usize> {
+        Err(LxError::ESPIPE)
+    }
+
+    fn poll(&self) -> LxResult<PollStatus> {
+        Ok(PollStatus {
+            read: !self.inner.lock().ready.is_empty(),
+            write: false,
+            error: false,
+        })
+    }
+
+    async fn async_poll(&self) -> LxResult<PollStatus> {
+        wait_for_event(self.eventbus.clone(), Event::READABLE).await;
+        self.poll()
+    }
+
+    fn ioctl(&self, _request: usize, _arg1: usize, _arg2: usize, _arg3: usize) -> LxResult<usize> {
+        Err(LxError::ENOTTY)
+    }
+
+    fn fcntl(&self, _cmd: usize, _arg: usize) -> LxResult<usize> {
+        Ok(0)
+    }
+
+    fn subscribe(&self, callback: EventHandler) -> Option<usize> {
+        Some(self.eventbus.lock().subscribe(callback))
+    }
+
+    fn unsubscribe(&self, id: usize) {
+        self.eventbus.lock().unsubscribe(id);
+    }
+}
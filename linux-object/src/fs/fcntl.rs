@@ -30,6 +30,10 @@ bitflags! {
         const FD_CLOEXEC = 1;
         /// like F_DUPFD, but additionally set the close-on-exec flag
         const F_DUPFD_CLOEXEC = F_LINUX_SPECIFIC_BASE + 6;
+        /// set the capacity of a pipe
+        const F_SETPIPE_SZ = F_LINUX_SPECIFIC_BASE + 7;
+        /// get the capacity of a pipe
+        const F_GETPIPE_SZ = F_LINUX_SPECIFIC_BASE + 8;
     }
 }
 
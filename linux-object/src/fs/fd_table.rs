@@ -0,0 +1,165 @@
+//! File descriptor table of a process
+#![deny(missing_docs)]
+
+use super::{EpollInstance, File, FileDesc, FileLike};
+use alloc::{sync::Arc, vec::Vec};
+
+/// A file descriptor table, `struct fdtable` in Linux.
+///
+/// Files are stored in a dense array indexed by fd, with a bitmap of open fds
+/// to find the lowest free fd, and a bitmap of fds to close on exec.
+///
+/// It is cheap to clone, processes share the table after fork until one
+/// of them changes it.
+#[derive(Clone, Default)]
+pub struct FdTable {
+    files: Vec<Option<Arc<dyn FileLike>>>,
+    /// Bitmap of open fds.
+    open: Vec<u64>,
+    /// Bitmap of fds to close on exec.
+    cloexec: Vec<u64>,
+    /// Number of open fds.
+    count: usize,
+}
+
+/// Whether the file should be closed on exec when it is opened.
+fn opened_with_cloexec(file: &Arc<dyn FileLike>) -> bool {
+    if let Ok(file) = file.clone().downcast_arc::<File>() {
+        file.options.fd_cloexec
+    } else if let Ok(epoll) = file.clone().downcast_arc::<EpollInstance>() {
+        epoll.cloexec()
+    } else {
+        false
+    }
+}
+
+fn index(fd: FileDesc) -> Option<usize> {
+    let fd = i32::from(fd);
+    if fd < 0 {
+        None
+    } else {
+        Some(fd as usize)
+    }
+}
+
+fn test_bit(bitmap: &[u64], i: usize) -> bool {
+    bitmap
+        .get(i / 64)
+        .map_or(false, |w| w & (1 << (i % 64)) != 0)
+}
+
+fn set_bit(bitmap: &mut [u64], i: usize, value: bool) {
+    if value {
+        bitmap[i / 64] |= 1 << (i % 64);
+    } else {
+        bitmap[i / 64] &= !(1 << (i % 64));
+    }
+}
+
+impl FdTable {
+    /// Get the number of open fds.
+    pub fn len(&self) -> usize {
+        self.count
+    }
+
+    /// Whether no fd is open.
+    pub fn is_empty(&self) -> bool {
+        self.count == 0
+    }
+
+    /// Get the file of `fd`.
+    pub fn get(&self, fd: FileDesc) -> Option<&Arc<dyn FileLike>> {
+        self.files.get(index(fd)?)?.as_ref()
+    }
+
+    /// Get the lowest fd which is not open.
+    pub fn lowest_free(&self) -> FileDesc {
+        let i = match self.open.iter().position(|&w| w != u64::MAX) {
+            Some(word) => word * 64 + self.open[word].trailing_ones() as usize,
+            None => self.open.len() * 64,
+        };
+        i.into()
+    }
+
+    /// Put `file` at `fd`, whose close-on-exec flag is taken from how the file
+    /// was opened.
+    ///
+    /// Returns the file previously at `fd`.
+    pub fn insert(&mut self, fd: FileDesc, file: Arc<dyn FileLike>) -> Option<Arc<dyn FileLike>> {
+        let cloexec = opened_with_cloexec(&file);
+        let i = index(fd).expect("negative fd");
+        if i >= self.files.len() {
+            self.files.resize(i + 1, None);
+            let words = (i + 64) / 64;
+            self.open.resize(words, 0);
+            self.cloexec.resize(words, 0);
+        }
+        set_bit(&mut self.open, i, true);
+        set_bit(&mut self.cloexec, i, cloexec);
+        let old = self.files[i].replace(file);
+        if old.is_none() {
+            self.count += 1;
+        }
+        old
+    }
+
+    /// Remove the file at `fd`.
+    pub fn remove(&mut self, fd: FileDesc) -> Option<Arc<dyn FileLike>> {
+        let i = index(fd)?;
+        let file = self.files.get_mut(i)?.take()?;
+        set_bit(&mut self.open, i, false);
+        set_bit(&mut self.cloexec, i, false);
+        self.count -= 1;
+        Some(file)
+    }
+
+    /// Get the close-on-exec flag of `fd`.
+    pub fn cloexec(&self, fd: FileDesc) -> Option<bool> {
+        let i = index(fd)?;
+        test_bit(&self.open, i).then(|| test_bit(&self.cloexec, i))
+    }
+
+    /// Set the close-on-exec flag of `fd`.
+    ///
+    /// Returns false if `fd` is not open.
+    pub fn set_cloexec(&mut self, fd: FileDesc, cloexec: bool) -> bool {
+        match index(fd) {
+            Some(i) if test_bit(&self.open, i) => {
+                set_bit(&mut self.cloexec, i, cloexec);
+                true
+            }
+            _ => false,
+        }
+    }
+
+    /// Whether any fd has the close-on-exec flag set.
+    pub fn has_cloexec(&self) -> bool {
+        self.cloexec.iter().any(|&w| w != 0)
+    }
+
+    /// Close all fds whose close-on-exec flag is set.
+    ///
+    /// Returns the removed files.
+    pub fn remove_cloexec(&mut self) -> Vec<Arc<dyn FileLike>> {
+        let mut removed = Vec::new();
+        for word in 0..self.cloexec.len() {
+            let mut bits = core::mem::take(&mut self.cloexec[word]);
+            self.open[word] &= !bits;
+            while bits != 0 {
+                let i = word * 64 + bits.trailing_zeros() as usize;
+                bits &= bits - 1;
+                removed.extend(self.files[i].take());
+                self.count -= 1;
+            }
+        }
+        removed
+    }
+
+    /// Iterate over open fds and their files in ascending order.
+    pub fn iter(&self) -> impl Iterator<Item = (FileDesc, &Arc<dyn FileLike>)> {
+        self.files
+            .iter()
+            .enumerate()
+            .filter_map(|(i, file)| Some((i.into(), file.as_ref()?)))
+    }
+}
@@ -4,8 +4,9 @@
 
 use alloc::{boxed::Box, string::String, sync::Arc};
 
-use super::FileLike;
+use super::{FcntlFlags, FileLike, PageCache, Pipe, Stdin};
 use crate::error::{LxError, LxResult};
+use crate::sync::EventHandler;
 use async_trait::async_trait;
 use rcore_fs::vfs::{FsError, INode, Metadata, PollStatus};
 use spin::Mutex;
@@ -17,6 +18,8 @@ pub struct File {
     base: KObjectBase,
     /// file INode
     inode: Arc<dyn INode>,
+    /// page cache of a regular file
+    page_cache: Option<Arc<PageCache>>,
     /// file open options
     pub options: OpenOptions,
     /// file path
@@ -64,6 +67,7 @@ impl File {
     pub fn new(inode: Arc<dyn INode>, options: OpenOptions, path: String) -> Arc<Self> {
         Arc::new(File {
             base: KObjectBase::new(),
+            page_cache: PageCache::of(&inode).ok(),
             inode,
             options,
             path,
@@ -73,6 +77,10 @@ impl File {
 
     /// read from file
     pub async fn read(&self, buf: &mut [u8]) -> LxResult<usize> {
+        if self.as_pipe().is_some() {
+            // no offset, and don't hold the lock while blocking
+            return self.read_at(0, buf).await;
+        }
         let mut inner = self.inner.lock();
         let len = self.read_at(inner.offset, buf).await?;
         inner.offset += len as u64;
@@ -84,6 +92,9 @@ impl File {
         if !self.options.read {
             return Err(LxError::EBADF);
         }
+        if let Some(cache) = &self.page_cache {
+            return cache.read(offset as usize, buf);
+        }
         if !self.options.nonblock {
             // block
             loop {
@@ -101,24 +112,59 @@ impl File {
     }
 
     /// write to file
-    pub fn write(&self, buf: &[u8]) -> LxResult<usize> {
+    pub async fn write(&self, buf: &[u8]) -> LxResult<usize> {
+        if self.as_pipe().is_some() {
+            // no offset, and don't hold the lock while blocking
+            return self.write_at(0, buf).await;
+        }
         let mut inner = self.inner.lock();
         let offset = if self.options.append {
             self.inode.metadata()?.size as u64
         } else {
             inner.offset
         };
-        let len = self.write_at(offset, buf)?;
+        let len = self.write_at(offset, buf).await?;
         inner.offset = offset + len as u64;
         Ok(len)
     }
 
     /// write to file at given offset
-    pub fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize> {
+    pub async fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize> {
         if !self.options.write {
             return Err(LxError::EBADF);
         }
-        let len = self.inode.write_at(offset as usize, buf)?;
+        if let Some(cache) = &self.page_cache {
+            return cache.write(offset as usize, buf);
+        }
+        let pipe = self.as_pipe();
+        let is_pipe = pipe.is_some();
+        let mut len = 0;
+        loop {
+            match self.inode.write_at(offset as usize + len, &buf[len..]) {
+                Ok(0) if len < buf.len() && is_pipe => {
+                    // the read end is closed
+                    if len == 0 {
+                        return Err(LxError::EPIPE);
+                    }
+                    break;
+                }
+                Ok(written) => {
+                    len += written;
+                    // a blocking write to a pipe returns after all is written
+                    if len == buf.len() || !is_pipe || self.options.nonblock {
+                        break;
+                    }
+                }
+                Err(FsError::Again) if !self.options.nonblock => match pipe {
+                    // the pipe may be writable but without enough space
+                    Some(pipe) => pipe.wait_writable(buf.len() - len).await,
+                    None => {
+                        self.async_poll().await?;
+                    }
+                },
+                Err(err) => return Err(err.into()),
+            }
+        }
         Ok(len)
     }
 
@@ -138,18 +184,38 @@ impl File {
         if !self.options.write {
             return Err(LxError::EBADF);
         }
-        self.inode.resize(len as usize)?;
-        Ok(())
+        match &self.page_cache {
+            Some(cache) => cache.set_len(len as usize),
+            None => Ok(self.inode.resize(len as usize)?),
+        }
+    }
+
+    /// Get the page cache of this regular file, whose VMO is shared by all mappings.
+    pub fn page_cache(&self) -> LxResult<Arc<PageCache>> {
+        match &self.page_cache {
+            Some(cache) => Ok(cache.clone()),
+            None => PageCache::of(&self.inode),
+        }
+    }
+
+    /// Write back the dirty pages of this file
+    fn write_back(&self) -> LxResult {
+        match &self.page_cache {
+            Some(cache) => cache.write_back(),
+            None => Ok(()),
+        }
     }
 
     /// Sync all data and metadata
     pub fn sync_all(&self) -> LxResult {
+        self.write_back()?;
         self.inode.sync_all()?;
         Ok(())
     }
 
     /// Sync data (not include metadata)
     pub fn sync_data(&self) -> LxResult {
+        self.write_back()?;
         self.inode.sync_data()?;
         Ok(())
     }
@@ -199,9 +265,42 @@ impl File {
         self.inode.clone()
     }
 
+    /// Get the pipe if this file is one end of it.
+    pub fn as_pipe(&self) -> Option<&Pipe> {
+        self.inode.as_any_ref().downcast_ref::<Pipe>()
+    }
+
+    /// Register a callback on the event bus of the file, see `FileLike::subscribe`.
+    pub fn subscribe(&self, callback: EventHandler) -> Option<usize> {
+        if let Some(pipe) = self.as_pipe() {
+            Some(pipe.subscribe(callback))
+        } else if let Some(stdin) = self.inode.as_any_ref().downcast_ref::<Stdin>() {
+            Some(stdin.subscribe(callback))
+        } else {
+            None
+        }
+    }
+
+    /// Remove a callback registered by `subscribe`.
+    pub fn unsubscribe(&self, id: usize) {
+        if let Some(pipe) = self.as_pipe() {
+            pipe.unsubscribe(id);
+        } else if let Some(stdin) = self.inode.as_any_ref().downcast_ref::<Stdin>() {
+            stdin.unsubscribe(id);
+        }
+    }
+
     /// manipulate file descriptor
     /// unimplemented
     pub fn fcntl(&self, cmd: usize, arg: usize) -> LxResult<usize> {
+        if cmd == FcntlFlags::F_SETPIPE_SZ.bits() {
+            let pipe = self.as_pipe().ok_or(LxError::EBADF)?;
+            return pipe.set_capacity(arg);
+        }
+        if cmd == FcntlFlags::F_GETPIPE_SZ.bits() {
+            let pipe = self.as_pipe().ok_or(LxError::EBADF)?;
+            return Ok(pipe.capacity());
+        }
         if arg & 0x800 > 0 && cmd == 4 {
             unimplemented!()
             //            self.options.nonblock = true;
@@ -210,22 +309,33 @@ impl File {
     }
 }
 
+impl Drop for File {
+    fn drop(&mut self) {
+        if !self.options.write {
+            return;
+        }
+        if let Err(err) = self.write_back() {
+            warn!("failed to write back {:?} on close: {:?}", self.path, err);
+        }
+    }
+}
+
 #[async_trait]
 impl FileLike for File {
     async fn read(&self, buf: &mut [u8]) -> LxResult<usize> {
         self.read(buf).await
     }
 
-    fn write(&self, buf: &[u8]) -> LxResult<usize> {
-        self.write(buf)
+    async fn write(&self, buf: &[u8]) -> LxResult<usize> {
+        self.write(buf).await
     }
 
     async fn read_at(&self, offset: u64, buf: &mut [u8]) -> LxResult<usize> {
         self.read_at(offset, buf).await
     }
 
-    fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize> {
-        self.write_at(offset, buf)
+    async fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize> {
+        self.write_at(offset, buf).await
     }
 
     fn poll(&self) -> LxResult<PollStatus> {
@@ -243,4 +353,12 @@ impl FileLike for File {
     fn fcntl(&self, cmd: usize, arg: usize) -> LxResult<usize> {
         self.fcntl(cmd, arg)
     }
+
+    fn subscribe(&self, callback: EventHandler) -> Option<usize> {
+        self.subscribe(callback)
+    }
+
+    fn unsubscribe(&self, id: usize) {
+        self.unsubscribe(id)
+    }
 }
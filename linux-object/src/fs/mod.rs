@@ -1,15 +1,19 @@
 //! Linux file objects
 #![deny(missing_docs)]
-use alloc::{boxed::Box, sync::Arc, vec::Vec};
+use alloc::{boxed::Box, string::String, sync::Arc, vec::Vec};
 
 use rcore_fs::vfs::*;
 use rcore_fs_devfs::{special::*, DevFS};
 use rcore_fs_mountfs::MountFS;
 use rcore_fs_ramfs::RamFS;
 
+pub use self::dcache::*;
 pub use self::device::*;
+pub use self::epoll::*;
 pub use self::fcntl::*;
+pub use self::fd_table::*;
 pub use self::file::*;
+pub use self::page_cache::*;
 pub use self::pipe::*;
 pub use self::pseudo::*;
 pub use self::random::*;
@@ -18,15 +22,20 @@ pub use rcore_fs::vfs;
 
 use crate::error::*;
 use crate::process::LinuxProcess;
+use crate::sync::EventHandler;
 use async_trait::async_trait;
 use core::convert::TryFrom;
 use downcast_rs::impl_downcast;
 use zircon_object::object::*;
 
+mod dcache;
 mod device;
+mod epoll;
 mod fcntl;
+mod fd_table;
 mod file;
 mod ioctl;
+mod page_cache;
 mod pipe;
 mod pseudo;
 mod random;
@@ -42,11 +51,11 @@ pub trait FileLike: KernelObject {
     /// read to buffer
     async fn read(&self, buf: &mut [u8]) -> LxResult<usize>;
     /// write from buffer
-    fn write(&self, buf: &[u8]) -> LxResult<usize>;
+    async fn write(&self, buf: &[u8]) -> LxResult<usize>;
     /// read to buffer at given offset
     async fn read_at(&self, offset: u64, buf: &mut [u8]) -> LxResult<usize>;
     /// write from buffer at given offset
-    fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize>;
+    async fn write_at(&self, offset: u64, buf: &[u8]) -> LxResult<usize>;
     /// wait for some event on a file descriptor
     fn poll(&self) -> LxResult<PollStatus>;
     /// wait for some event on a file descriptor use async
@@ -55,6 +64,14 @@ pub trait FileLike: KernelObject {
     fn ioctl(&self, request: usize, arg1: usize, arg2: usize, arg3: usize) -> LxResult<usize>;
     /// manipulate file descriptor
     fn fcntl(&self, cmd: usize, arg: usize) -> LxResult<usize>;
+    /// Register `callback`, which is called with the new events whenever the
+    /// readiness of the file changes, or more data arrives, until it returns true.
+    ///
+    /// Returns the ID of the callback for `unsubscribe`, or `None` if the file
+    /// has no event source, which means it is always ready.
+    fn subscribe(&self, callback: EventHandler) -> Option<usize>;
+    /// Remove a callback registered by `subscribe`.
+    fn unsubscribe(&self, id: usize);
 }
 
 impl_downcast!(sync FileLike);
@@ -198,10 +215,23 @@ impl LinuxProcess {
 
         let follow_max_depth = if follow { FOLLOW_MAX_DEPTH } else { 0 };
         if dirfd == FileDesc::CWD {
-            Ok(self
+            let cwd = self.current_working_directory();
+            let abs_path = if path.starts_with('/') {
+                String::from(path)
+            } else {
+                cwd.clone() + "/" + path
+            };
+            if let Some(inode) = self.dentry_cache().lock().get(&abs_path, follow) {
+                return Ok(inode);
+            }
+            let inode = self
                 .root_inode()
-                .lookup(&self.current_working_directory())?
-                .lookup_follow(path, follow_max_depth)?)
+                .lookup(&cwd)?
+                .lookup_follow(path, follow_max_depth)?;
+            self.dentry_cache()
+                .lock()
+                .insert(abs_path, follow, inode.clone());
+            Ok(inode)
         } else {
             let file = self.get_file(dirfd)?;
             Ok(file.lookup_follow(path, follow_max_depth)?)
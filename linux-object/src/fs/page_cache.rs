@@ -0,0 +1,327 @@
+//! Page cache of regular files
+//!
+//! All reads and writes of a regular file through a `File` go to its page cache
+//! VMO, which is also mapped by `mmap` and the ELF loader. Writes only dirty the
+//! pages, which are written back to the inode in runs of contiguous pages once
+//! enough of them are dirty, on sync, on close and when the cache is evicted.
+//! Stores through a shared mapping are not tracked, so once the VMO has been
+//! mapped shared and writable, all of its committed pages are written back.
+//! Sequential reads fill a window of pages ahead, which grows as they go on.
+
+use alloc::{
+    collections::{BTreeMap, BTreeSet},
+    sync::Arc,
+    vec,
+    vec::Vec,
+};
+use core::ops::Range;
+
+use crate::error::{LxError, LxResult};
+use kernel_hal::{PhysAddr, PAGE_SIZE};
+use lazy_static::lazy_static;
+use rcore_fs::vfs::{FileType, INode};
+use rcore_fs_mountfs::MNode;
+use spin::Mutex;
+use zircon_object::{object::*, vm::*};
+
+/// Idle caches are evicted once there are this many caches.
+const MAX_CACHES: usize = 64;
+
+/// Dirty pages are written back once there are this many of them.
+const WRITEBACK_BATCH: usize = 32;
+
+/// Initial and maximum number of pages read ahead of a sequential read.
+const READAHEAD_MIN: usize = 4;
+const READAHEAD_MAX: usize = 32;
+
+lazy_static! {
+    /// Page caches of regular files, indexed by `page_cache_key`.
+    static ref PAGE_CACHES: Mutex<BTreeMap<usize, Arc<PageCache>>> = Mutex::new(BTreeMap::new());
+}
+
+/// Fill the pages of a page cache VMO from the inode.
+struct INodePager(Arc<dyn INode>);
+
+impl VmPager for INodePager {
+    fn read_page(&self, page_idx: usize, paddr: PhysAddr) -> ZxResult {
+        let mut buf = [0u8; PAGE_SIZE];
+        // the part beyond the end of file is left as zero
+        self.0
+            .read_at(page_idx * PAGE_SIZE, &mut buf)
+            .map_err(|_| ZxError::IO)?;
+        kernel_hal::pmem_write(paddr, &buf);
+        Ok(())
+    }
+}
+
+fn page_cache_key(inode: &Arc<dyn INode>) -> usize {
+    // a mount point wraps the inode in a new `MNode` for each lookup
+    match inode.as_any_ref().downcast_ref::<MNode>() {
+        Some(mnode) => Arc::as_ptr(&mnode.inode) as *const u8 as usize,
+        None => Arc::as_ptr(inode) as *const u8 as usize,
+    }
+}
+
+/// The cached pages of a regular file.
+pub struct PageCache {
+    inode: Arc<dyn INode>,
+    vmo: Arc<VmObject>,
+    inner: Mutex<PageCacheInner>,
+}
+
+struct PageCacheInner {
+    /// Size of the file, the VMO covers at least all of its pages.
+    size: usize,
+    /// Pages written since they were last written back.
+    dirty: BTreeSet<usize>,
+    /// Whether the VMO has been mapped shared and writable.
+    mapped_shared: bool,
+    /// The page after the last read, where a sequential read goes on.
+    next_read: usize,
+    /// Pages before this one have been read ahead.
+    ahead_end: usize,
+    /// Number of pages to read ahead of the next sequential read.
+    window: usize,
+}
+
+impl PageCacheInner {
+    /// Update the readahead state for a read of pages `first..end`,
+    /// and return the pages to read ahead.
+    fn readahead(&mut self, first: usize, end: usize) -> Option<Range<usize>> {
+        let sequential = first == self.next_read || first + 1 == self.next_read;
+        self.next_read = end;
+        if !sequential {
+            self.window = READAHEAD_MIN;
+            self.ahead_end = end;
+            return None;
+        }
+        let start = self.ahead_end.max(end);
+        let stop = (end + self.window).min(pages(self.size));
+        self.window = (self.window * 2).min(READAHEAD_MAX);
+        if start >= stop {
+            return None;
+        }
+        self.ahead_end = stop;
+        Some(start..stop)
+    }
+}
+
+impl PageCache {
+    /// Get the page cache of a regular file.
+    pub fn of(inode: &Arc<dyn INode>) -> LxResult<Arc<Self>> {
+        let metadata = inode.metadata()?;
+        if metadata.type_ != FileType::File {
+            return Err(LxError::ENODEV);
+        }
+        let key = page_cache_key(inode);
+        let mut caches = PAGE_CACHES.lock();
+        if let Some(cache) = caches.get(&key) {
+            return Ok(cache.clone());
+        }
+        if caches.len() >= MAX_CACHES {
+            evict_idle(&mut caches);
+        }
+        let pager = Arc::new(INodePager(inode.clone()));
+        let cache = Arc::new(PageCache {
+            inode: inode.clone(),
+            vmo: VmObject::new_paged_with_pager(pages(metadata.size), pager),
+            inner: Mutex::new(PageCacheInner {
+                size: metadata.size,
+                dirty: BTreeSet::new(),
+                mapped_shared: false,
+                next_read: 0,
+                ahead_end: 0,
+                window: READAHEAD_MIN,
+            }),
+        });
+        caches.insert(key, cache.clone());
+        Ok(cache)
+    }
+
+    /// Get the page cache of a file if it exists.
+    pub fn lookup(inode: &Arc<dyn INode>) -> Option<Arc<Self>> {
+        PAGE_CACHES.lock().get(&page_cache_key(inode)).cloned()
+    }
+
+    /// Get the page cache of which `vmo` is the VMO if it exists.
+    pub fn of_vmo(vmo: &Arc<VmObject>) -> Option<Arc<Self>> {
+        PAGE_CACHES
+            .lock()
+            .values()
+            .find(|cache| Arc::ptr_eq(&cache.vmo, vmo))
+            .cloned()
+    }
+
+    /// Get the VMO of the cached pages, which is shared by all mappings.
+    pub fn vmo(&self) -> Arc<VmObject> {
+        self.vmo.clone()
+    }
+
+    /// Get the VMO of the cached pages to map it shared and writable.
+    ///
+    /// From now on all committed pages are written back.
+    pub fn vmo_for_shared_write(&self) -> Arc<VmObject> {
+        self.inner.lock().mapped_shared = true;
+        self.vmo.clone()
+    }
+
+    /// Get the size of the file.
+    pub fn size(&self) -> usize {
+        self.inner.lock().size
+    }
+
+    /// Read from the file at `offset`, and read ahead if it is sequential.
+    pub fn read(&self, offset: usize, buf: &mut [u8]) -> LxResult<usize> {
+        let (len, ahead) = {
+            let mut inner = self.inner.lock();
+            if offset >= inner.size {
+                return Ok(0);
+            }
+            let len = buf.len().min(inner.size - offset);
+            (
+                len,
+                inner.readahead(offset / PAGE_SIZE, pages(offset + len)),
+            )
+        };
+        self.vmo.read(offset, &mut buf[..len])?;
+        if let Some(ahead) = ahead {
+            // only a hint, the pages are read again on demand if it fails
+            let _ = self
+                .vmo
+                .commit(ahead.start * PAGE_SIZE, ahead.len() * PAGE_SIZE);
+        }
+        Ok(len)
+    }
+
+    /// Write to the file at `offset`.
+    ///
+    /// The file is extended at once, but the data is written back later.
+    pub fn write(&self, offset: usize, buf: &[u8]) -> LxResult<usize> {
+        let end = offset + buf.len();
+        let full = {
+            let mut inner = self.inner.lock();
+            if end > inner.size {
+                if end > self.vmo.len() {
+                    self.vmo.set_len(roundup_pages(end))?;
+                }
+                self.inode.resize(end)?;
+                inner.size = end;
+            }
+            self.vmo.write(offset, buf)?;
+            inner.dirty.extend(offset / PAGE_SIZE..pages(end));
+            inner.dirty.len() >= WRITEBACK_BATCH
+        };
+        if full {
+            self.write_back()?;
+        }
+        Ok(buf.len())
+    }
+
+    /// Resize the file to `len` bytes, discarding the pages beyond it.
+    pub fn set_len(&self, len: usize) -> LxResult {
+        let mut inner = self.inner.lock();
+        let _ = inner.dirty.split_off(&pages(len));
+        self.inode.resize(len)?;
+        if len < self.vmo.len() {
+            self.vmo.set_len(roundup_pages(len))?;
+            self.vmo.zero(len, self.vmo.len() - len)?;
+        } else if roundup_pages(len) > self.vmo.len() {
+            self.vmo.set_len(roundup_pages(len))?;
+        }
+        inner.size = len;
+        inner.ahead_end = inner.ahead_end.min(pages(len));
+        Ok(())
+    }
+
+    /// Write all dirty pages back to the inode.
+    ///
+    /// Each run of contiguous dirty pages is written at once.
+    pub fn write_back(&self) -> LxResult {
+        let (mut dirty, size, mapped_shared) = {
+            let mut inner = self.inner.lock();
+            let dirty = core::mem::take(&mut inner.dirty);
+            (dirty, inner.size, inner.mapped_shared)
+        };
+        if mapped_shared {
+            // any committed page may have been written through a mapping
+            let end = pages(size).min(self.vmo.len() / PAGE_SIZE);
+            for idx in 0..end {
+                if self.vmo.committed_pages_in_range(idx, idx + 1) != 0 {
+                    dirty.insert(idx);
+                }
+            }
+        }
+        let mut runs: Vec<Range<usize>> = Vec::new();
+        for idx in dirty {
+            match runs.last_mut() {
+                Some(run) if run.end == idx => run.end += 1,
+                _ => runs.push(idx..idx + 1),
+            }
+        }
+        for (i, run) in runs.iter().enumerate() {
+            let start = run.start * PAGE_SIZE;
+            let end = (run.end * PAGE_SIZE).min(size);
+            if start >= end {
+                continue;
+            }
+            let mut buf = vec![0u8; end - start];
+            let result = self
+                .vmo
+                .read(start, &mut buf)
+                .map_err(LxError::from)
+                .and_then(|_| Ok(self.inode.write_at(start, &buf)?));
+            if let Err(err) = result {
+                // keep the pages not written back dirty
+                let mut inner = self.inner.lock();
+                for run in runs[i..].iter() {
+                    inner.dirty.extend(run.clone());
+                }
+                return Err(err);
+            }
+        }
+        Ok(())
+    }
+
+    /// Whether the cache is only referenced by the cache table,
+    /// and its VMO is not mapped anywhere.
+    fn is_idle(self: &Arc<Self>) -> bool {
+        Arc::strong_count(self) == 1
+            && Arc::strong_count(&self.vmo) == 1
+            && self.vmo.share_count() == 0
+    }
+}
+
+/// Write back and drop the caches which are neither opened nor mapped.
+///
+/// The pages stored through a shared mapping are written back as well, see
+/// `PageCache::write_back`. A cache which fails to be written back is kept.
+fn evict_idle(caches: &mut BTreeMap<usize, Arc<PageCache>>) {
+    let idle: Vec<usize> = caches
+        .iter()
+        .filter(|(_, cache)| cache.is_idle())
+        .map(|(&key, _)| key)
+        .collect();
+    for key in idle {
+        if let Err(err) = caches[&key].write_back() {
+            warn!("failed to write back page cache: {:?}", err);
+            continue;
+        }
+        caches.remove(&key);
+    }
+}
+
+/// Write back the dirty pages of all files.
+pub fn sync_page_caches() -> LxResult {
+    let caches: Vec<Arc<PageCache>> = PAGE_CACHES.lock().values().cloned().collect();
+    for cache in caches {
+        cache.write_back()?;
+    }
+    Ok(())
+}
+
+/// Get the page cache VMO of a regular file, which is shared by all mappings.
+///
+/// The VMO is filled from the inode on demand.
+pub fn page_cache_of(inode: &Arc<dyn INode>) -> LxResult<Arc<VmObject>> {
+    Ok(PageCache::of(inode)?.vmo())
+}
@@ -1,16 +1,26 @@
 //! Implement INode for Pipe
 #![deny(missing_docs)]
 
-use crate::{sync::Event, sync::EventBus};
-use alloc::{boxed::Box, collections::vec_deque::VecDeque, sync::Arc};
-use core::{any::Any, cmp::min};
+use crate::error::{LxError, LxResult};
+use crate::sync::{Event, EventBus, EventHandler};
+use alloc::{boxed::Box, sync::Arc};
+use core::any::Any;
 use core::{
     future::Future,
     pin::Pin,
     task::{Context, Poll},
 };
+use kernel_hal::PAGE_SIZE;
 use rcore_fs::vfs::*;
 use spin::Mutex;
+use zircon_object::util::ring::RingBuffer;
+
+/// Default capacity of a pipe.
+pub const PIPE_DEFAULT_SIZE: usize = 16 * PAGE_SIZE;
+/// Maximum capacity of a pipe, which is `/proc/sys/fs/pipe-max-size` in Linux.
+pub const PIPE_MAX_SIZE: usize = 1024 * 1024;
+/// Writes of at most this size are atomic.
+pub const PIPE_BUF: usize = PAGE_SIZE;
 
 #[derive(Clone, PartialEq)]
 #[allow(dead_code)]
@@ -25,15 +35,48 @@ pub enum PipeEnd {
 /// Pipe inner data
 pub struct PipeData {
     /// pipe buffer
-    buf: VecDeque<u8>,
+    buf: RingBuffer,
     /// event bus for pipe
     eventbus: EventBus,
     /// number of pipe ends
     end_cnt: i32,
 }
 
+impl PipeData {
+    /// Update READABLE and WRITABLE, which only wakes up waiters when they change.
+    fn update_events(&mut self) {
+        let mut set = Event::empty();
+        if !self.buf.is_empty() {
+            set |= Event::READABLE;
+        }
+        if self.buf.free() != 0 {
+            set |= Event::WRITABLE;
+        }
+        let reset = (Event::READABLE | Event::WRITABLE) - set;
+        self.eventbus.change(reset, set);
+    }
+
+    /// Update the events after data is written, and notify the callbacks even
+    /// if the pipe was readable already, for edge-triggered epoll.
+    fn update_events_written(&mut self) {
+        self.update_events();
+        self.eventbus.notify(Event::NEW_DATA);
+    }
+
+    /// Update the events after data is consumed, and wake up the writers
+    /// waiting for more space even if the pipe was writable already.
+    fn update_events_consumed(&mut self) {
+        self.update_events();
+        self.eventbus.notify(Event::SPACE_FREED);
+    }
+
+    /// Whether a blocking write of `len` bytes can go on, see `Pipe::can_write_len`.
+    fn write_ready(&self, len: usize) -> bool {
+        self.end_cnt < 2 || self.buf.free() >= len.min(PIPE_BUF).max(1)
+    }
+}
+
 /// pipe struct
-#[derive(Clone)]
 pub struct Pipe {
     data: Arc<Mutex<PipeData>>,
     direction: PipeEnd,
@@ -52,11 +95,12 @@ impl Drop for Pipe {
 impl Pipe {
     /// Create a pair of INode: (read, write)
     pub fn create_pair() -> (Pipe, Pipe) {
-        let inner = PipeData {
-            buf: VecDeque::new(),
+        let mut inner = PipeData {
+            buf: RingBuffer::new(PIPE_DEFAULT_SIZE),
             eventbus: EventBus::default(),
             end_cnt: 2, // one read, one write
         };
+        inner.update_events();
         let data = Arc::new(Mutex::new(inner));
         (
             Pipe {
@@ -83,11 +127,150 @@ impl Pipe {
     /// whether the pipe struct is writeable
     fn can_write(&self) -> bool {
         if let PipeEnd::Write = self.direction {
-            self.data.lock().end_cnt == 2
+            let data = self.data.lock();
+            data.buf.free() != 0 || data.end_cnt < 2 // other end closed
         } else {
             false
         }
     }
+
+    /// Whether a write of `len` bytes to this write end can go on without blocking,
+    /// or the read end is closed.
+    ///
+    /// A write no larger than `PIPE_BUF` needs space for all of it, since it is
+    /// never split, and a larger one needs space for `PIPE_BUF` bytes.
+    pub fn can_write_len(&self, len: usize) -> bool {
+        self.direction == PipeEnd::Write && self.data.lock().write_ready(len)
+    }
+
+    /// Wait until a write of `len` bytes can go on, see [`can_write_len`].
+    ///
+    /// Unlike `async_poll`, it is woken up whenever the reader consumes data.
+    ///
+    /// [`can_write_len`]: Pipe::can_write_len
+    pub fn wait_writable(&self, len: usize) -> impl Future<Output = ()> + '_ {
+        #[must_use = "future does nothing unless polled/`await`-ed"]
+        struct PipeWriteFuture<'a> {
+            pipe: &'a Pipe,
+            len: usize,
+        }
+
+        impl Future for PipeWriteFuture<'_> {
+            type Output = ();
+
+            fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+                let mut data = self.pipe.data.lock();
+                if self.pipe.direction != PipeEnd::Write || data.write_ready(self.len) {
+                    return Poll::Ready(());
+                }
+                let waker = cx.waker().clone();
+                data.eventbus.subscribe(Box::new(move |_| {
+                    waker.wake_by_ref();
+                    true
+                }));
+                Poll::Pending
+            }
+        }
+
+        PipeWriteFuture { pipe: self, len }
+    }
+
+    /// Register a callback on the event bus shared by both ends, and return its ID.
+    pub fn subscribe(&self, callback: EventHandler) -> usize {
+        self.data.lock().eventbus.subscribe(callback)
+    }
+
+    /// Remove a callback registered by `subscribe`.
+    pub fn unsubscribe(&self, id: usize) {
+        self.data.lock().eventbus.unsubscribe(id);
+    }
+
+    /// Get the capacity of the pipe.
+    pub fn capacity(&self) -> usize {
+        self.data.lock().buf.capacity()
+    }
+
+    /// Set the capacity of the pipe, which is rounded up to pages.
+    ///
+    /// Returns the actual capacity.
+    pub fn set_capacity(&self, size: usize) -> LxResult<usize> {
+        if size > PIPE_MAX_SIZE {
+            return Err(LxError::EPERM);
+        }
+        let size = ((size.max(1) + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+        let mut data = self.data.lock();
+        if data.buf.len() > size {
+            return Err(LxError::EBUSY);
+        }
+        data.buf.resize(size);
+        data.update_events_consumed();
+        Ok(size)
+    }
+
+    /// Copy data from this read end to `buf` without consuming it.
+    ///
+    /// Returns `EAGAIN` if it is empty and the write end is still open.
+    pub fn peek(&self, buf: &mut [u8]) -> LxResult<usize> {
+        if self.direction != PipeEnd::Read {
+            return Err(LxError::EBADF);
+        }
+        let data = self.data.lock();
+        if data.buf.is_empty() && data.end_cnt == 2 {
+            return Err(LxError::EAGAIN);
+        }
+        Ok(data.buf.peek(buf))
+    }
+
+    /// Consume `len` bytes of this read end, which are copied by `peek` before.
+    ///
+    /// If another reader consumed some of them meanwhile, only the rest is consumed.
+    pub fn consume(&self, len: usize) {
+        let mut data = self.data.lock();
+        let len = len.min(data.buf.len());
+        data.buf.consume(len);
+        data.update_events_consumed();
+    }
+
+    /// Move (or copy if `keep` is true) at most `len` bytes from this read end
+    /// to the write end `other`, without going through an intermediate buffer.
+    ///
+    /// Returns `EAGAIN` if nothing can be moved now.
+    pub fn transfer_to(&self, other: &Pipe, len: usize, keep: bool) -> LxResult<usize> {
+        if self.direction != PipeEnd::Read || other.direction != PipeEnd::Write {
+            return Err(LxError::EBADF);
+        }
+        if Arc::ptr_eq(&self.data, &other.data) {
+            return Err(LxError::EINVAL);
+        }
+        // lock in address order to avoid deadlock with a transfer in reverse
+        let (mut src, mut dst) = if Arc::as_ptr(&self.data) < Arc::as_ptr(&other.data) {
+            let src = self.data.lock();
+            (src, other.data.lock())
+        } else {
+            let dst = other.data.lock();
+            (self.data.lock(), dst)
+        };
+        if dst.end_cnt < 2 {
+            return Err(LxError::EPIPE);
+        }
+        if src.buf.is_empty() {
+            return if src.end_cnt < 2 {
+                Ok(0)
+            } else {
+                Err(LxError::EAGAIN)
+            };
+        }
+        if dst.buf.free() == 0 {
+            return Err(LxError::EAGAIN);
+        }
+        let len = src.buf.copy_to(&mut dst.buf, len);
+        if !keep {
+            src.buf.consume(len);
+            src.update_events_consumed();
+        }
+        dst.update_events_written();
+        Ok(len)
+    }
 }
 
 impl INode for Pipe {
@@ -101,13 +284,8 @@ impl INode for Pipe {
             if data.buf.is_empty() && data.end_cnt == 2 {
                 Err(FsError::Again)
             } else {
-                let len = min(buf.len(), data.buf.len());
-                for item in buf.iter_mut().take(len) {
-                    *item = data.buf.pop_front().unwrap();
-                }
-                if data.buf.is_empty() {
-                    data.eventbus.clear(Event::READABLE);
-                }
+                let len = data.buf.pop(buf);
+                data.update_events_consumed();
                 Ok(len)
             }
         } else {
@@ -116,14 +294,25 @@ impl INode for Pipe {
     }
 
     /// write to pipe
+    ///
+    /// Returns 0 if the read end is closed. Writes no larger than `PIPE_BUF`
+    /// are never split.
     fn write_at(&self, _offset: usize, buf: &[u8]) -> Result<usize> {
+        if buf.is_empty() {
+            return Ok(0);
+        }
         if let PipeEnd::Write = self.direction {
             let mut data = self.data.lock();
-            for c in buf {
-                data.buf.push_back(*c);
+            if data.end_cnt < 2 {
+                return Ok(0);
+            }
+            let free = data.buf.free();
+            if free == 0 || (buf.len() <= PIPE_BUF && free < buf.len()) {
+                return Err(FsError::Again);
             }
-            data.eventbus.set(Event::READABLE);
-            Ok(buf.len())
+            let len = data.buf.push(buf);
+            data.update_events_written();
+            Ok(len)
         } else {
             Ok(0)
         }
@@ -2,7 +2,7 @@
 #![allow(unsafe_code)]
 
 use super::ioctl::*;
-use crate::{sync::Event, sync::EventBus};
+use crate::sync::{Event, EventBus, EventHandler};
 use alloc::boxed::Box;
 use alloc::collections::VecDeque;
 use alloc::sync::Arc;
@@ -32,7 +32,9 @@ impl Stdin {
     /// push a char in Stdin buffer
     pub fn push(&self, c: char) {
         self.buf.lock().push_back(c);
-        self.eventbus.lock().set(Event::READABLE);
+        let mut eventbus = self.eventbus.lock();
+        eventbus.set(Event::READABLE);
+        eventbus.notify(Event::NEW_DATA);
     }
     /// pop a char in Stdin buffer
     pub fn pop(&self) -> char {
@@ -43,6 +45,14 @@ impl Stdin {
         }
         c
     }
+    /// Register a callback on the event bus of Stdin, and return its ID.
+    pub fn subscribe(&self, callback: EventHandler) -> usize {
+        self.eventbus.lock().subscribe(callback)
+    }
+    /// Remove a callback registered by `subscribe`.
+    pub fn unsubscribe(&self, id: usize) {
+        self.eventbus.lock().unsubscribe(id);
+    }
     /// specify whether the Stdin buffer is readable
     pub fn can_read(&self) -> bool {
         self.buf.lock().len() > 0
@@ -5,9 +5,11 @@ mod shared_mem;
 
 pub use self::semary::*;
 pub use self::shared_mem::*;
+use crate::error::{LxError, LxResult};
 use alloc::collections::BTreeMap;
-use alloc::sync::Arc;
+use alloc::sync::{Arc, Weak};
 use bitflags::*;
+use spin::RwLock;
 
 /// Semaphore table in a process
 #[derive(Default)]
@@ -60,6 +62,97 @@ pub struct IpcPerm {
     pub __pad2: usize,
 }
 
+impl IpcPerm {
+    /// The permissions of a new object with `key`, created by semget(2) or shmget(2)
+    fn new(key: u32, flags: usize) -> Self {
+        IpcPerm {
+            key,
+            uid: 0,
+            gid: 0,
+            cuid: 0,
+            cgid: 0,
+            // least significant 9 bits
+            mode: (flags as u32) & 0x1ff,
+            __seq: 0,
+            __pad1: 0,
+            __pad2: 0,
+        }
+    }
+}
+
+/// The key passed to semget(2) or shmget(2) to always create a new object
+const IPC_PRIVATE: u32 = 0;
+
+/// Number of shards of an `IpcRegistry`
+const REGISTRY_SHARDS: usize = 16;
+
+/// System-wide IPC objects of a kind, indexed by key.
+///
+/// The keys are spread over shards with a lock each, so that lookups of existing
+/// objects only take a read lock and lookups of different keys rarely contend.
+/// Objects created with `IPC_PRIVATE` are not registered.
+struct IpcRegistry<T> {
+    shards: [RwLock<BTreeMap<u32, Weak<T>>>; REGISTRY_SHARDS],
+}
+
+impl<T> IpcRegistry<T> {
+    fn new() -> Self {
+        IpcRegistry {
+            shards: Default::default(),
+        }
+    }
+
+    fn shard(&self, key: u32) -> &RwLock<BTreeMap<u32, Weak<T>>> {
+        &self.shards[key as usize % REGISTRY_SHARDS]
+    }
+
+    /// Get the object with `key`, or create one with `create` if IPC_CREAT is in `flags`.
+    fn get_or_create(
+        &self,
+        key: u32,
+        flags: usize,
+        create: impl FnOnce() -> LxResult<Arc<T>>,
+    ) -> LxResult<Arc<T>> {
+        let flag = IpcGetFlag::from_bits_truncate(flags);
+        if key == IPC_PRIVATE {
+            return create();
+        }
+        let found = |object: Arc<T>| {
+            if flag.contains(IpcGetFlag::CREAT | IpcGetFlag::EXCLUSIVE) {
+                return Err(LxError::EEXIST);
+            }
+            Ok(object)
+        };
+        let shard = self.shard(key);
+        if let Some(object) = shard.read().get(&key).and_then(Weak::upgrade) {
+            return found(object);
+        }
+        let mut shard = shard.write();
+        // it may have been created after the read lock was released
+        if let Some(object) = shard.get(&key).and_then(Weak::upgrade) {
+            return found(object);
+        }
+        if !flag.contains(IpcGetFlag::CREAT) {
+            return Err(LxError::ENOENT);
+        }
+        let object = create()?;
+        shard.insert(key, Arc::downgrade(&object));
+        Ok(object)
+    }
+
+    /// Remove `object` with `key`, later lookups of `key` create a new object.
+    fn remove(&self, key: u32, object: *const T) {
+        if key == IPC_PRIVATE {
+            return;
+        }
+        let mut shard = self.shard(key).write();
+        // the key may belong to a newer object already
+        if shard.get(&key).map(Weak::as_ptr) == Some(object) {
+            shard.remove(&key);
+        }
+    }
+}
+
 /// Semaphore set identifier (in a process)
 type SemId = usize;
 /// Shared_memory identifier (in a process)
@@ -117,12 +210,8 @@ impl Drop for SemProc {
     fn drop(&mut self) {
         for (&(id, num), &op) in self.undos.iter() {
             debug!("semundo: id: {}, num: {}, op: {}", id, num, op);
-            let sem_array = self.arrays[&id].clone();
-            let sem = &sem_array[num as usize];
-            match op {
-                1 => sem.release(),
-                0 => {}
-                _ => unimplemented!("Semaphore: semundo.(Not 1)"),
+            if let Some(sem_array) = self.arrays.get(&id) {
+                sem_array.adjust(num as usize, op as isize);
             }
         }
     }
@@ -1,13 +1,20 @@
 //! Linux semaphore ipc
+//!
+//! Each semaphore keeps the queue of `semop`s blocked on it. A change of a
+//! semaphore only wakes the waiters whose operation is possible now, instead
+//! of all waiters of the set.
 use super::*;
-use crate::error::LxError;
-use crate::sync::Semaphore;
+use crate::error::{LxError, LxResult};
 use crate::time::*;
-use alloc::{collections::BTreeMap, sync::Arc, sync::Weak, vec::Vec};
-use core::ops::Index;
+use alloc::{collections::VecDeque, sync::Arc, vec::Vec};
+use core::future::Future;
+use core::pin::Pin;
+use core::task::{Context, Poll, Waker};
 use lazy_static::*;
 use spin::Mutex;
-use spin::RwLock;
+
+/// Maximum value of a semaphore
+const SEMVMX: isize = 32767;
 
 /// semid data structure
 ///
@@ -27,33 +34,287 @@ pub struct SemidDs {
     pub nsems: usize,
 }
 
+/// An operation to be performed on a single semaphore
+///
+/// Ref: [http://man7.org/linux/man-pages/man2/semop.2.html]
+#[repr(C)]
+#[derive(Clone, Copy, Debug)]
+pub struct SemBuf {
+    /// Semaphore number
+    pub num: u16,
+    /// Semaphore operation
+    pub op: i16,
+    /// Operation flags
+    pub flags: i16,
+}
+
+bitflags! {
+    /// flags of a semaphore operation
+    pub struct SemFlags: i16 {
+        /// For SemOP
+        const IPC_NOWAIT = 0x800;
+        /// it will be automatically undone when the process terminates.
+        const SEM_UNDO = 0x1000;
+    }
+}
+
 /// A System V semaphore set
 pub struct SemArray {
     /// semid data structure
     pub semid_ds: Mutex<SemidDs>,
-    sems: Vec<Semaphore>,
+    inner: Mutex<SemArrayInner>,
 }
 
-impl Index<usize> for SemArray {
-    type Output = Semaphore;
-    fn index(&self, idx: usize) -> &Semaphore {
-        &self.sems[idx]
-    }
+struct SemArrayInner {
+    sems: Vec<Sem>,
+    /// Set by IPC_RMID, all operations fail with EIDRM then.
+    removed: bool,
+    /// ID of the next waiter
+    next_waiter: u64,
+}
+
+/// A semaphore of a set
+#[derive(Default)]
+struct Sem {
+    /// semval
+    value: isize,
+    /// sempid, the process of the last operation
+    pid: usize,
+    /// Operations blocked on this semaphore, in arrival order
+    waiters: VecDeque<SemWaiter>,
+}
+
+/// A `semop` blocked on an operation of a semaphore
+struct SemWaiter {
+    id: u64,
+    op: SemOp,
+    waker: Waker,
 }
 
 lazy_static! {
-    static ref KEY2SEM: RwLock<BTreeMap<u32, Weak<SemArray>>> = RwLock::new(BTreeMap::new());
+    static ref KEY2SEM: IpcRegistry<SemArray> = IpcRegistry::new();
+}
+
+impl SemArrayInner {
+    /// Perform all `ops` at once if none of them blocks.
+    ///
+    /// Returns the index of the first operation which blocks, nothing is changed then.
+    fn try_ops(&mut self, ops: &[SemBuf], pid: usize) -> LxResult<Option<usize>> {
+        if ops.iter().any(|op| op.num as usize >= self.sems.len()) {
+            return Err(LxError::EFBIG);
+        }
+        for (i, op) in ops.iter().enumerate() {
+            let value = self.sems[op.num as usize].value;
+            let new_value = value + op.op as isize;
+            let blocked = match op.op {
+                0 => value != 0,
+                _ => new_value < 0,
+            };
+            if blocked || new_value > SEMVMX {
+                for op in ops[..i].iter() {
+                    self.sems[op.num as usize].value -= op.op as isize;
+                }
+                if blocked {
+                    return Ok(Some(i));
+                }
+                return Err(LxError::ERANGE);
+            }
+            self.sems[op.num as usize].value = new_value;
+        }
+        for op in ops.iter() {
+            self.sems[op.num as usize].pid = pid;
+        }
+        for op in ops.iter().filter(|op| op.op != 0) {
+            self.wake(op.num as usize);
+        }
+        Ok(None)
+    }
+
+    /// Wake the waiters of semaphore `num` whose operation is possible now.
+    ///
+    /// Decrements are granted in arrival order as far as the value allows, so
+    /// that a release wakes as many waiters as it can satisfy and no more.
+    fn wake(&mut self, num: usize) {
+        let sem = &mut self.sems[num];
+        let mut value = sem.value;
+        sem.waiters.retain(|waiter| {
+            let possible = match waiter.op {
+                0 => value == 0,
+                op => value + op as isize >= 0,
+            };
+            if possible {
+                value += waiter.op as isize;
+                waiter.waker.wake_by_ref();
+            }
+            !possible
+        });
+    }
+
+    /// Remove the waiter `id` from semaphore `num`.
+    ///
+    /// Returns false if it has been woken.
+    fn unregister(&mut self, num: usize, id: u64) -> bool {
+        let waiters = &mut self.sems[num].waiters;
+        match waiters.iter().position(|waiter| waiter.id == id) {
+            Some(pos) => {
+                waiters.remove(pos);
+                true
+            }
+            None => false,
+        }
+    }
+
+    fn sem(&self, num: usize) -> LxResult<&Sem> {
+        self.sems.get(num).ok_or(LxError::EINVAL)
+    }
+}
+
+/// A `semop` waiting until all its operations can be performed at once.
+struct SemopFuture {
+    array: Arc<SemArray>,
+    ops: Vec<SemBuf>,
+    pid: usize,
+    /// The semaphore and the ID of the waiter registered by the last poll
+    waiting: Option<(usize, u64)>,
+}
+
+impl Future for SemopFuture {
+    type Output = LxResult;
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        let this = &mut *self;
+        let mut inner = this.array.inner.lock();
+        if inner.removed {
+            this.waiting = None;
+            return Poll::Ready(Err(LxError::EIDRM));
+        }
+        let woken = match this.waiting.take() {
+            Some((num, id)) if !inner.unregister(num, id) => Some(num),
+            _ => None,
+        };
+        let result = inner.try_ops(&this.ops, this.pid);
+        // pass on the wakeup we could not use
+        if let Some(num) = woken.filter(|_| !matches!(result, Ok(None))) {
+            inner.wake(num);
+        }
+        let i = match result {
+            Ok(None) => return Poll::Ready(Ok(())),
+            Ok(Some(i)) => i,
+            Err(err) => return Poll::Ready(Err(err)),
+        };
+        let op = this.ops[i];
+        if SemFlags::from_bits_truncate(op.flags).contains(SemFlags::IPC_NOWAIT) {
+            return Poll::Ready(Err(LxError::EAGAIN));
+        }
+        let id = inner.next_waiter;
+        inner.next_waiter += 1;
+        inner.sems[op.num as usize].waiters.push_back(SemWaiter {
+            id,
+            op: op.op,
+            waker: cx.waker().clone(),
+        });
+        this.waiting = Some((op.num as usize, id));
+        Poll::Pending
+    }
+}
+
+impl Drop for SemopFuture {
+    fn drop(&mut self) {
+        if let Some((num, id)) = self.waiting.take() {
+            let mut inner = self.array.inner.lock();
+            if !inner.removed && !inner.unregister(num, id) {
+                inner.wake(num);
+            }
+        }
+    }
 }
 
 impl SemArray {
     /// remove semaphores
+    ///
+    /// All blocked operations fail with EIDRM.
     pub fn remove(&self) {
-        let mut key2sem = KEY2SEM.write();
         let key = self.semid_ds.lock().perm.key;
-        key2sem.remove(&key);
-        for sem in self.sems.iter() {
-            sem.remove();
+        KEY2SEM.remove(key, self);
+        let mut inner = self.inner.lock();
+        inner.removed = true;
+        for sem in inner.sems.iter_mut() {
+            for waiter in sem.waiters.drain(..) {
+                waiter.waker.wake();
+            }
+        }
+    }
+
+    /// Perform `ops` atomically as process `pid`, waiting until all of them are possible.
+    ///
+    /// Fails with EAGAIN if an operation with IPC_NOWAIT would block.
+    pub fn semop(
+        self: &Arc<Self>,
+        ops: Vec<SemBuf>,
+        pid: usize,
+    ) -> impl Future<Output = LxResult> + Unpin {
+        SemopFuture {
+            array: self.clone(),
+            ops,
+            pid,
+            waiting: None,
+        }
+    }
+
+    /// Add `delta` to semaphore `num`, clamping the result into the valid range.
+    ///
+    /// Used to undo the operations of a process on exit.
+    pub fn adjust(&self, num: usize, delta: isize) {
+        let mut inner = self.inner.lock();
+        if inner.removed || num >= inner.sems.len() {
+            return;
+        }
+        let sem = &mut inner.sems[num];
+        sem.value = (sem.value + delta).max(0).min(SEMVMX);
+        inner.wake(num);
+    }
+
+    /// Number of semaphores in the set
+    pub fn nsems(&self) -> usize {
+        self.inner.lock().sems.len()
+    }
+
+    /// semval of semaphore `num`
+    pub fn get_val(&self, num: usize) -> LxResult<isize> {
+        Ok(self.inner.lock().sem(num)?.value)
+    }
+
+    /// sempid of semaphore `num`
+    pub fn get_pid(&self, num: usize) -> LxResult<usize> {
+        Ok(self.inner.lock().sem(num)?.pid)
+    }
+
+    /// Number of operations waiting for semaphore `num` to increase
+    pub fn get_ncnt(&self, num: usize) -> LxResult<usize> {
+        let inner = self.inner.lock();
+        let waiters = &inner.sem(num)?.waiters;
+        Ok(waiters.iter().filter(|waiter| waiter.op < 0).count())
+    }
+
+    /// Number of operations waiting for semaphore `num` to become zero
+    pub fn get_zcnt(&self, num: usize) -> LxResult<usize> {
+        let inner = self.inner.lock();
+        let waiters = &inner.sem(num)?.waiters;
+        Ok(waiters.iter().filter(|waiter| waiter.op == 0).count())
+    }
+
+    /// Set semval of semaphore `num` for SETVAL
+    pub fn set_val(&self, num: usize, value: isize, pid: usize) -> LxResult {
+        if !(0..=SEMVMX).contains(&value) {
+            return Err(LxError::ERANGE);
         }
+        let mut inner = self.inner.lock();
+        inner.sem(num)?;
+        let sem = &mut inner.sems[num];
+        sem.value = value;
+        sem.pid = pid;
+        inner.wake(num);
+        Ok(())
     }
 
     /// set last semop time
@@ -77,57 +338,29 @@ impl SemArray {
 
     /// Get the semaphore array with `key`.
     /// If not exist, create a new one with `nsems` elements.
-    pub fn get_or_create(mut key: u32, nsems: usize, flags: usize) -> Result<Arc<Self>, LxError> {
-        let mut key2sem = KEY2SEM.write();
-        let flag = IpcGetFlag::from_bits_truncate(flags);
-
-        if key == 0 {
-            // IPC_PRIVATE
-            // find an empty key slot
-            key = (1u32..).find(|i| key2sem.get(i).is_none()).unwrap();
-        } else {
-            // check existence
-            if let Some(weak_array) = key2sem.get(&key) {
-                if let Some(array) = weak_array.upgrade() {
-                    if flag.contains(IpcGetFlag::CREAT) && flag.contains(IpcGetFlag::EXCLUSIVE) {
-                        // exclusive
-                        return Err(LxError::EEXIST);
-                    }
-                    return Ok(array);
-                }
-            }
-        }
-
-        // not found, create one
-        let mut semaphores = Vec::new();
-        for _ in 0..nsems {
-            semaphores.push(Semaphore::new(0));
-        }
-
-        // insert to global map
-        let array = Arc::new(SemArray {
-            semid_ds: Mutex::new(SemidDs {
-                perm: IpcPerm {
-                    key,
-                    uid: 0,
-                    gid: 0,
-                    cuid: 0,
-                    cgid: 0,
-                    // least significant 9 bits
-                    mode: (flags as u32) & 0x1ff,
-                    __seq: 0,
+    pub fn get_or_create(key: u32, nsems: usize, flags: usize) -> LxResult<Arc<Self>> {
+        let array = KEY2SEM.get_or_create(key, flags, || {
+            let mut sems = Vec::new();
+            sems.resize_with(nsems, Sem::default);
+            Ok(Arc::new(SemArray {
+                semid_ds: Mutex::new(SemidDs {
+                    perm: IpcPerm::new(key, flags),
+                    otime: 0,
+                    ctime: TimeSpec::now().sec,
+                    nsems,
                     __pad1: 0,
                     __pad2: 0,
-                },
-                otime: 0,
-                ctime: TimeSpec::now().sec,
-                nsems,
-                __pad1: 0,
-                __pad2: 0,
-            }),
-            sems: semaphores,
-        });
-        key2sem.insert(key, Arc::downgrade(&array));
+                }),
+                inner: Mutex::new(SemArrayInner {
+                    sems,
+                    removed: false,
+                    next_waiter: 0,
+                }),
+            }))
+        })?;
+        if nsems > array.nsems() {
+            return Err(LxError::EINVAL);
+        }
         Ok(array)
     }
 }
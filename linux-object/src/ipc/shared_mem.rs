@@ -1,16 +1,14 @@
 //! Linux Shared memory ipc
 use super::*;
-use crate::error::LxError;
+use crate::error::LxResult;
 use crate::time::TimeSpec;
-use alloc::{collections::BTreeMap, sync::Arc, sync::Weak};
+use alloc::sync::Arc;
 use lazy_static::lazy_static;
 use spin::Mutex;
-use spin::RwLock;
 use zircon_object::vm::*;
 
 lazy_static! {
-    static ref KEY2SHM: RwLock<BTreeMap<u32, Weak<spin::Mutex<ShmGuard>>>> =
-        RwLock::new(BTreeMap::new());
+    static ref KEY2SHM: IpcRegistry<Mutex<ShmGuard>> = IpcRegistry::new();
 }
 
 /// shmid data structure
@@ -66,47 +64,30 @@ impl ShmIdentifier {
         memsize: usize,
         flags: usize,
         cpid: u32,
-    ) -> Result<Arc<spin::Mutex<ShmGuard>>, LxError> {
-        let mut key2shm = KEY2SHM.write();
-        let flag = IpcGetFlag::from_bits_truncate(flags);
+    ) -> LxResult<Arc<spin::Mutex<ShmGuard>>> {
+        KEY2SHM.get_or_create(key, flags, || {
+            Ok(Arc::new(spin::Mutex::new(ShmGuard {
+                shared_guard: VmObject::new_paged(pages(memsize)),
+                shmid_ds: Mutex::new(ShmidDs {
+                    perm: IpcPerm::new(key, flags),
+                    segsz: memsize,
+                    atime: 0,
+                    dtime: 0,
+                    ctime: TimeSpec::now().sec,
+                    cpid,
+                    lpid: 0,
+                    nattch: 0,
+                }),
+            })))
+        })
+    }
 
-        // found in the map
-        if let Some(weak_guard) = key2shm.get(&key) {
-            if let Some(guard) = weak_guard.upgrade() {
-                if flag.contains(IpcGetFlag::CREAT) && flag.contains(IpcGetFlag::EXCLUSIVE) {
-                    // exclusive
-                    return Err(LxError::EEXIST);
-                }
-                return Ok(guard);
-            }
-        }
-        let shared_guard = Arc::new(spin::Mutex::new(ShmGuard {
-            shared_guard: VmObject::new_paged(pages(memsize)),
-            shmid_ds: Mutex::new(ShmidDs {
-                perm: IpcPerm {
-                    key,
-                    uid: 0,
-                    gid: 0,
-                    cuid: 0,
-                    cgid: 0,
-                    // least significant 9 bits
-                    mode: (flags as u32) & 0x1ff,
-                    __seq: 0,
-                    __pad1: 0,
-                    __pad2: 0,
-                },
-                segsz: memsize,
-                atime: 0,
-                dtime: 0,
-                ctime: TimeSpec::now().sec,
-                cpid,
-                lpid: 0,
-                nattch: 0,
-            }),
-        }));
-        // insert to global map
-        key2shm.insert(key, Arc::downgrade(&shared_guard));
-        Ok(shared_guard)
+    /// remove Shared memory, `guard` is the locked `self.guard`
+    ///
+    /// It is destroyed after the last process detaches it.
+    pub fn remove(&self, guard: &ShmGuard) {
+        let key = guard.shmid_ds.lock().perm.key;
+        KEY2SHM.remove(key, Arc::as_ptr(&self.guard));
     }
 }
 
@@ -140,11 +121,4 @@ impl ShmGuard {
         lock.perm.gid = new.perm.gid;
         lock.perm.mode = new.perm.mode & 0x1ff;
     }
-
-    /// remove Shared memory
-    pub fn remove(&self) {
-        let mut key2shm = KEY2SHM.write();
-        let key = self.shmid_ds.lock().perm.key;
-        key2shm.remove(&key);
-    }
 }
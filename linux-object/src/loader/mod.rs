@@ -2,11 +2,12 @@
 #![deny(missing_docs)]
 
 use {
-    crate::error::LxResult,
-    crate::fs::INodeExt,
-    alloc::{collections::BTreeMap, string::String, sync::Arc, vec::Vec},
+    crate::error::{LxError, LxResult},
+    crate::fs::PageCache,
+    alloc::{collections::BTreeMap, string::String, sync::Arc, vec, vec::Vec},
+    core::convert::TryInto,
     rcore_fs::vfs::INode,
-    xmas_elf::ElfFile,
+    xmas_elf::{program::Type, ElfFile},
     zircon_object::{util::elf_loader::*, vm::*, ZxError},
 };
 
@@ -23,39 +24,44 @@ pub struct LinuxElfLoader {
 }
 
 impl LinuxElfLoader {
-    /// load a Linux ElfFile and return a tuple of (entry,sp)
+    /// load a Linux ElfFile from `inode` and return a tuple of (entry,sp)
+    ///
+    /// Segments are mapped from the page cache of the file, so that
+    /// processes running the same program share the frames until written.
+    /// Only the headers and the interpreter path are read from it here.
     pub fn load(
         &self,
         vmar: &Arc<VmAddressRegion>,
-        data: &[u8],
+        inode: &Arc<dyn INode>,
         mut args: Vec<String>,
         envs: Vec<String>,
         path: String,
     ) -> LxResult<(VirtAddr, VirtAddr)> {
         info!("load: vmar: {:?} args: {:?}, envs: {:?}", vmar, args, envs);
-        let elf = ElfFile::new(data).map_err(|_| ZxError::INVALID_ARGS)?;
-        if let Ok(interp) = elf.get_interpreter() {
+        let file = PageCache::of(inode)?;
+        let headers = read_headers(&file)?;
+        let elf = ElfFile::new(&headers).map_err(|_| ZxError::INVALID_ARGS)?;
+        if let Some(interp) = read_interpreter(&file, &elf)? {
             info!("interp: {:?}", interp);
-            let inode = self.root_inode.lookup(interp)?;
-            let data = inode.read_as_vec()?;
+            let inode = self.root_inode.lookup(&interp)?;
             args[0] = path.clone();
-            args.insert(0, interp.into());
-            return self.load(vmar, &data, args, envs, path);
+            args.insert(0, interp);
+            return self.load(vmar, &inode, args, envs, path);
         }
 
         let size = elf.load_segment_size();
         let image_vmar = vmar.allocate(None, size, VmarFlags::CAN_MAP_RXW, PAGE_SIZE)?;
         let base = image_vmar.addr();
-        let vmo = image_vmar.load_from_elf(&elf)?;
+        let vmo = image_vmar.load_from_elf_vmo(&elf, &file.vmo())?;
         let entry = base + elf.header.pt2.entry_point() as usize;
 
-        // fill syscall entry
-        if let Some(offset) = elf.get_symbol_address("rcore_syscall_entry") {
-            vmo.write(offset as usize, &self.syscall_entry.to_ne_bytes())?;
+        // fill syscall entry, only the LibOS patches it into the libc
+        if self.syscall_entry != 0 {
+            if let Some(offset) = find_symbol(&file, &elf, "rcore_syscall_entry")? {
+                vmo.write(offset as usize, &self.syscall_entry.to_ne_bytes())?;
+            }
         }
 
-        elf.relocate(base).map_err(|_| ZxError::INVALID_ARGS)?;
-
         let stack_vmo = VmObject::new_paged(self.stack_pages);
         let flags = MMUFlags::READ | MMUFlags::WRITE | MMUFlags::USER;
         let stack_bottom = vmar.map(None, stack_vmo.clone(), 0, stack_vmo.len(), flags)?;
@@ -82,3 +88,99 @@ impl LinuxElfLoader {
         Ok((entry, sp))
     }
 }
+
+/// Maximum length of the interpreter path.
+const MAX_INTERP_LEN: usize = PAGE_SIZE;
+
+/// Read `len` bytes at `offset` of the ELF file.
+fn read_exact(file: &PageCache, offset: usize, len: usize) -> LxResult<Vec<u8>> {
+    match offset.checked_add(len) {
+        Some(end) if end <= file.size() => {}
+        _ => return Err(LxError::ENOEXEC),
+    }
+    let mut buf = vec![0; len];
+    file.read(offset, &mut buf)?;
+    Ok(buf)
+}
+
+/// Read the ELF header and the program headers.
+///
+/// They are in the first page of almost all files, which is read at once.
+fn read_headers(file: &PageCache) -> LxResult<Vec<u8>> {
+    let buf = read_exact(file, 0, file.size().min(PAGE_SIZE))?;
+    let ph_end = {
+        let elf = ElfFile::new(&buf).map_err(|_| ZxError::INVALID_ARGS)?;
+        let header = &elf.header.pt2;
+        let ph_size = header.ph_count() as usize * header.ph_entry_size() as usize;
+        (header.ph_offset() as usize).saturating_add(ph_size)
+    };
+    if ph_end <= buf.len() {
+        return Ok(buf);
+    }
+    read_exact(file, 0, ph_end)
+}
+
+/// Read the path of the program interpreter in the INTERP segment.
+fn read_interpreter(file: &PageCache, elf: &ElfFile) -> LxResult<Option<String>> {
+    let ph = match elf
+        .program_iter()
+        .find(|ph| ph.get_type() == Ok(Type::Interp))
+    {
+        Some(ph) => ph,
+        None => return Ok(None),
+    };
+    if ph.file_size() as usize > MAX_INTERP_LEN {
+        return Err(LxError::ENOEXEC);
+    }
+    let mut path = read_exact(file, ph.offset() as usize, ph.file_size() as usize)?;
+    let len = path.iter().position(|&c| c == 0).unwrap_or(path.len());
+    path.truncate(len);
+    let path = String::from_utf8(path).map_err(|_| LxError::ENOEXEC)?;
+    Ok(Some(path))
+}
+
+/// Find the value of `symbol` in the symbol table.
+///
+/// Only the section headers, the symbol table and its string table are read.
+fn find_symbol(file: &PageCache, elf: &ElfFile, symbol: &str) -> LxResult<Option<u64>> {
+    const SHT_SYMTAB: u32 = 2;
+    const SHDR_SIZE: usize = 64;
+    const SYM_SIZE: usize = 24;
+    let header = &elf.header.pt2;
+    let count = header.sh_count() as usize;
+    if count == 0 || header.sh_entry_size() as usize != SHDR_SIZE {
+        return Ok(None);
+    }
+    let shdrs = read_exact(file, header.sh_offset() as usize, count * SHDR_SIZE)?;
+    // sh_type: u32 at 4, sh_offset: u64 at 24, sh_size: u64 at 32, sh_link: u32 at 40
+    let read_section =
+        |shdr: &[u8]| read_exact(file, u64_at(shdr, 24) as usize, u64_at(shdr, 32) as usize);
+    for shdr in shdrs.chunks_exact(SHDR_SIZE) {
+        if u32_at(shdr, 4) != SHT_SYMTAB {
+            continue;
+        }
+        let link = u32_at(shdr, 40) as usize;
+        let strtab_shdr = shdrs
+            .get(link * SHDR_SIZE..(link + 1) * SHDR_SIZE)
+            .ok_or(LxError::ENOEXEC)?;
+        let symtab = read_section(shdr)?;
+        let strtab = read_section(strtab_shdr)?;
+        // st_name: u32 at 0, st_value: u64 at 8
+        for sym in symtab.chunks_exact(SYM_SIZE) {
+            let name = strtab.get(u32_at(sym, 0) as usize..).unwrap_or(&[]);
+            let len = name.iter().position(|&c| c == 0).unwrap_or(name.len());
+            if &name[..len] == symbol.as_bytes() {
+                return Ok(Some(u64_at(sym, 8)));
+            }
+        }
+    }
+    Ok(None)
+}
+
+fn u32_at(buf: &[u8], offset: usize) -> u32 {
+    u32::from_ne_bytes(buf[offset..offset + 4].try_into().unwrap())
+}
+
+fn u64_at(buf: &[u8], offset: usize) -> u64 {
+    u64::from_ne_bytes(buf[offset..offset + 8].try_into().unwrap())
+}
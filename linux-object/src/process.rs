@@ -12,12 +12,12 @@ use alloc::{
 };
 use core::sync::atomic::AtomicI32;
 use hashbrown::HashMap;
-use kernel_hal::VirtAddr;
+use kernel_hal::{MMUFlags, VirtAddr};
 use rcore_fs::vfs::{FileSystem, INode};
-use spin::*;
+use spin::{Mutex, RwLock};
 use zircon_object::{
     object::{KernelObject, KoID, Signal},
-    signal::Futex,
+    signal::{Futex, FutexKey},
     task::{Job, Process, Status},
     ZxResult,
 };
@@ -30,6 +30,8 @@ pub trait ProcessExt {
     fn linux(&self) -> &LinuxProcess;
     /// fork from current linux process
     fn fork_from(parent: &Arc<Self>, vfork: bool) -> ZxResult<Arc<Self>>;
+    /// get the futex at `uaddr`
+    fn get_futex_at(&self, uaddr: VirtAddr) -> LxResult<Arc<Futex>>;
 }
 
 impl ProcessExt for Process {
@@ -51,10 +53,11 @@ impl ProcessExt for Process {
         let new_linux_proc = LinuxProcess {
             root_inode: linux_parent.root_inode.clone(),
             parent: Arc::downgrade(parent),
+            files: RwLock::new(linux_parent.files.read().clone()),
+            dentries: Mutex::new(DentryCache::default()),
             inner: Mutex::new(LinuxProcessInner {
                 execute_path: linux_parent_inner.execute_path.clone(),
                 current_working_directory: linux_parent_inner.current_working_directory.clone(),
-                files: linux_parent_inner.files.clone(),
                 signal_actions: linux_parent_inner.signal_actions.clone(),
                 ..Default::default()
             }),
@@ -77,6 +80,30 @@ impl ProcessExt for Process {
         }));
         Ok(new_proc)
     }
+
+    /// Get the futex at `uaddr` from the global futex table.
+    ///
+    /// Like Linux, futexes are keyed by the VMO and the offset, so processes
+    /// sharing memory share futexes, even with different addresses. A private
+    /// mapping has its own VMO, so `FUTEX_PRIVATE_FLAG` makes no difference.
+    ///
+    /// Returns `EINVAL` if `uaddr` is not 4-byte aligned, or `EFAULT` if it is
+    /// not in a readable mapping of this process.
+    #[allow(unsafe_code)]
+    fn get_futex_at(&self, uaddr: VirtAddr) -> LxResult<Arc<Futex>> {
+        if uaddr % core::mem::align_of::<AtomicI32>() != 0 {
+            return Err(LxError::EINVAL);
+        }
+        let mapping = self.vmar().find_mapping(uaddr).ok_or(LxError::EFAULT)?;
+        let flags = mapping.get_flags(uaddr).map_err(|_| LxError::EFAULT)?;
+        if !flags.contains(MMUFlags::READ) {
+            return Err(LxError::EFAULT);
+        }
+        let (vmo, offset) = mapping.vmo_offset(uaddr).map_err(|_| LxError::EFAULT)?;
+        // the word is in a user mapping of this process, and faults on it are handled
+        let value = unsafe { &*(uaddr as *const AtomicI32) };
+        Ok(Futex::get(FutexKey::Shared(vmo.id(), offset), value))
+    }
 }
 
 /// Wait for state changes in a child of the calling process, and obtain information about
@@ -133,6 +160,10 @@ pub struct LinuxProcess {
     root_inode: Arc<dyn INode>,
     /// Parent process
     parent: Weak<Process>,
+    /// Opened files, which are shared with the parent after fork until changed
+    files: RwLock<Arc<FdTable>>,
+    /// Cached path lookups
+    dentries: Mutex<DentryCache>,
     /// Inner
     inner: Mutex<LinuxProcessInner>,
 }
@@ -148,14 +179,10 @@ struct LinuxProcessInner {
     current_working_directory: String,
     /// file open number limit
     file_limit: RLimit,
-    /// Opened files
-    files: HashMap<FileDesc, Arc<dyn FileLike>>,
     /// Semaphore
     semaphores: SemProc,
     /// Share Memory
     shm_identifiers: ShmProc,
-    /// Futexes
-    futexes: HashMap<VirtAddr, Arc<Futex>>,
     /// Child processes
     children: HashMap<KoID, Arc<Process>>,
     /// Signal actions
@@ -222,7 +249,7 @@ impl LinuxProcess {
             },
             String::from("/dev/stdout"),
         ) as Arc<dyn FileLike>;
-        let mut files = HashMap::new();
+        let mut files = FdTable::default();
         files.insert(0.into(), stdin);
         files.insert(1.into(), stdout.clone());
         files.insert(2.into(), stdout);
@@ -230,54 +257,52 @@ impl LinuxProcess {
         LinuxProcess {
             root_inode: create_root_fs(rootfs),
             parent: Weak::default(),
-            inner: Mutex::new(LinuxProcessInner {
-                files,
-                ..Default::default()
-            }),
+            files: RwLock::new(Arc::new(files)),
+            dentries: Mutex::new(DentryCache::default()),
+            inner: Mutex::new(LinuxProcessInner::default()),
         }
     }
 
-    /// Get futex object.
-    #[allow(unsafe_code)]
-    pub fn get_futex(&self, uaddr: VirtAddr) -> Arc<Futex> {
-        let mut inner = self.inner.lock();
-        inner
-            .futexes
-            .entry(uaddr)
-            .or_insert_with(|| {
-                // FIXME: check address
-                let value = unsafe { &*(uaddr as *const AtomicI32) };
-                Futex::new(value)
-            })
-            .clone()
-    }
-
     /// Add a file to the file descriptor table.
     pub fn add_file(&self, file: Arc<dyn FileLike>) -> LxResult<FileDesc> {
-        let inner = self.inner.lock();
-        let fd = inner.get_free_fd();
-        self.insert_file(inner, fd, file)
+        let limit = self.inner.lock().file_limit.cur as usize;
+        let mut files = self.files.write();
+        let fd = files.lowest_free();
+        // all descriptors below the limit are in use
+        if usize::from(fd) >= limit {
+            return Err(LxError::EMFILE);
+        }
+        Self::insert_file(&mut files, limit, fd, file)?;
+        Ok(fd)
     }
 
     /// Add a file to the file descriptor table at given `fd`.
     pub fn add_file_at(&self, fd: FileDesc, file: Arc<dyn FileLike>) -> LxResult<FileDesc> {
-        let inner = self.inner.lock();
-        self.insert_file(inner, fd, file)
+        let limit = self.inner.lock().file_limit.cur as usize;
+        let old = Self::insert_file(&mut self.files.write(), limit, fd, file)?;
+        // the replaced file is closed after the table is unlocked
+        drop(old);
+        Ok(fd)
     }
 
     /// insert a file and fd into the file descriptor table
+    ///
+    /// Returns the file replaced at `fd`, which the caller should drop after
+    /// releasing the lock of `files`.
     fn insert_file(
-        &self,
-        mut inner: MutexGuard<LinuxProcessInner>,
+        files: &mut Arc<FdTable>,
+        limit: usize,
         fd: FileDesc,
         file: Arc<dyn FileLike>,
-    ) -> LxResult<FileDesc> {
-        if inner.files.len() < inner.file_limit.cur as usize {
-            inner.files.insert(fd, file);
-            Ok(fd)
-        } else {
-            Err(LxError::EMFILE)
+    ) -> LxResult<Option<Arc<dyn FileLike>>> {
+        if !(0..limit as i32).contains(&i32::from(fd)) {
+            return Err(LxError::EBADF);
         }
+        if files.get(fd).is_none() && files.len() >= limit {
+            return Err(LxError::EMFILE);
+        }
+        // copy the table if it is shared with another process
+        Ok(Arc::make_mut(files).insert(fd, file))
     }
 
     /// get and set file limit number
@@ -301,20 +326,41 @@ impl LinuxProcess {
 
     /// Get the `FileLike` with given `fd`.
     pub fn get_file_like(&self, fd: FileDesc) -> LxResult<Arc<dyn FileLike>> {
-        let inner = self.inner.lock();
-        inner.files.get(&fd).cloned().ok_or(LxError::EBADF)
+        self.files.read().get(fd).cloned().ok_or(LxError::EBADF)
     }
 
-    /// get all files
-    pub fn get_files(&self) -> LxResult<HashMap<FileDesc, Arc<dyn FileLike>>> {
-        let inner = self.inner.lock();
-        Ok(inner.files.clone())
+    /// Get a snapshot of the file descriptor table.
+    pub fn get_files(&self) -> Arc<FdTable> {
+        self.files.read().clone()
     }
 
     /// Close file descriptor `fd`.
     pub fn close_file(&self, fd: FileDesc) -> LxResult {
-        let mut inner = self.inner.lock();
-        inner.files.remove(&fd).map(|_| ()).ok_or(LxError::EBADF)
+        let mut files = self.files.write();
+        files.get(fd).ok_or(LxError::EBADF)?;
+        let file = Arc::make_mut(&mut *files).remove(fd);
+        drop(files);
+        // closing the last reference may flush or wake others, out of the lock
+        drop(file);
+        Ok(())
+    }
+
+    /// Get the close-on-exec flag of `fd`.
+    pub fn fd_cloexec(&self, fd: FileDesc) -> LxResult<bool> {
+        self.files.read().cloexec(fd).ok_or(LxError::EBADF)
+    }
+
+    /// Set the close-on-exec flag of `fd`.
+    pub fn set_fd_cloexec(&self, fd: FileDesc, cloexec: bool) -> LxResult {
+        let mut files = self.files.write();
+        if files.cloexec(fd) == Some(cloexec) {
+            return Ok(());
+        }
+        if Arc::make_mut(&mut *files).set_cloexec(fd, cloexec) {
+            Ok(())
+        } else {
+            Err(LxError::EBADF)
+        }
     }
 
     /// Get root INode of the process.
@@ -322,6 +368,11 @@ impl LinuxProcess {
         &self.root_inode
     }
 
+    /// Get the cache of path lookups, see `lookup_inode_at`.
+    pub fn dentry_cache(&self) -> &Mutex<DentryCache> {
+        &self.dentries
+    }
+
     /// Get parent process.
     pub fn parent(&self) -> Option<Arc<Process>> {
         self.parent.upgrade()
@@ -377,24 +428,12 @@ impl LinuxProcess {
 
     /// Close file that FD_CLOEXEC is set
     pub fn remove_cloexec_files(&self) {
-        let mut inner = self.inner.lock();
-        let close_fds = inner
-            .files
-            .iter()
-            .filter_map(|(fd, file_like)| {
-                if let Ok(file) = file_like.clone().downcast_arc::<File>() {
-                    if file.options.fd_cloexec {
-                        Some(*fd)
-                    } else {
-                        None
-                    }
-                } else {
-                    None
-                }
-            })
-            .collect::<Vec<_>>();
-        for fd in close_fds {
-            inner.files.remove(&fd).map(|_| ()).unwrap();
+        let mut files = self.files.write();
+        if files.has_cloexec() {
+            let removed = Arc::make_mut(&mut *files).remove_cloexec();
+            drop(files);
+            // the files are closed after the table is unlocked
+            drop(removed);
         }
     }
 
@@ -443,12 +482,3 @@ impl LinuxProcess {
         self.inner.lock().shm_identifiers.set(id, shm_id)
     }
 }
-
-impl LinuxProcessInner {
-    fn get_free_fd(&self) -> FileDesc {
-        (0usize..)
-            .map(|i| i.into())
-            .find(|fd| !self.files.contains_key(fd))
-            .unwrap()
-    }
-}
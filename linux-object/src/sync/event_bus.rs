@@ -23,6 +23,10 @@ bitflags! {
         const ERROR                         = 1 << 2;
         /// File: is closed
         const CLOSED                        = 1 << 3;
+        /// File: some data was consumed, only passed to `notify`
+        const SPACE_FREED                   = 1 << 4;
+        /// File: more data arrived, only passed to `notify`
+        const NEW_DATA                      = 1 << 5;
 
         /// Process: is Quit
         const PROCESS_QUIT                  = 1 << 10;
@@ -46,8 +50,10 @@ pub type EventHandler = Box<dyn Fn(Event) -> bool + Send>;
 pub struct EventBus {
     /// event type
     event: Event,
-    /// EventBus callback
-    callbacks: Vec<EventHandler>,
+    /// EventBus callbacks with their IDs
+    callbacks: Vec<(usize, EventHandler)>,
+    /// ID of the next callback
+    next_id: usize,
 }
 
 impl EventBus {
@@ -76,13 +82,32 @@ impl EventBus {
         new.insert(set);
         self.event = new;
         if new != orig {
-            self.callbacks.retain(|f| !f(new));
+            self.callbacks.retain(|(_, f)| !f(new));
         }
     }
 
+    /// Call the callbacks with the current events and `event`, which is not kept.
+    ///
+    /// Used for events which do not change the state, such as more data consumed
+    /// from a buffer which is still not empty.
+    pub fn notify(&mut self, event: Event) {
+        let current = self.event | event;
+        self.callbacks.retain(|(_, f)| !f(current));
+    }
+
     /// push a EventHandler into the callback vector
-    pub fn subscribe(&mut self, callback: EventHandler) {
-        self.callbacks.push(callback);
+    ///
+    /// Returns the ID of the callback for `unsubscribe`.
+    pub fn subscribe(&mut self, callback: EventHandler) -> usize {
+        let id = self.next_id;
+        self.next_id += 1;
+        self.callbacks.push((id, callback));
+        id
+    }
+
+    /// Remove the callback of `id`, if it has not returned true yet.
+    pub fn unsubscribe(&mut self, id: usize) {
+        self.callbacks.retain(|&(i, _)| i != id);
     }
 
     /// get the callback vector length
@@ -59,8 +59,9 @@ impl CurrentThreadExt for CurrentThread {
             info!("exit: do futex {:?} wake 1", clear_child_tid);
             clear_child_tid.write(0).unwrap();
             let uaddr = clear_child_tid.as_ptr() as VirtAddr;
-            let futex = self.proc().linux().get_futex(uaddr);
-            futex.wake(1);
+            if let Ok(futex) = self.proc().get_futex_at(uaddr) {
+                futex.wake(1);
+            }
         }
         self.exit();
     }
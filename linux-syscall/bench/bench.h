@@ -0,0 +1,58 @@
+/*
+ * Helpers shared by the benchmarks.
+ *
+ * Each result is printed as one JSON object per line, for scripts/bench.py:
+ *   {"bench": "pipe_latency", "value": 12.345, "unit": "ns", "iters": 10000}
+ * The first argument of a benchmark scales its number of iterations.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK(f)                 \
+    do                           \
+    {                            \
+        if ((long)(f) == -1)     \
+        {                        \
+            perror(#f);          \
+            exit(1);             \
+        }                        \
+    } while (0)
+
+static inline long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static inline long iterations(int argc, char *argv[], long base)
+{
+    long scale = argc > 1 ? atol(argv[1]) : 1;
+    return base * (scale > 0 ? scale : 1);
+}
+
+static inline void report(const char *bench, double value, const char *unit, long iters)
+{
+    printf("{\"bench\": \"%s\", \"value\": %.3f, \"unit\": \"%s\", \"iters\": %ld}\n",
+           bench, value, unit, iters);
+    fflush(stdout);
+}
+
+/* Report the average time of an operation since `start` in nanoseconds. */
+static inline void report_ns(const char *bench, long long start, long iters)
+{
+    report(bench, (double)(now_ns() - start) / iters, "ns", iters);
+}
+
+/* Report the bandwidth of copying `bytes` since `start` in MB/s. */
+static inline void report_mbps(const char *bench, long long start, long long bytes, long iters)
+{
+    double seconds = (double)(now_ns() - start) / 1e9;
+    report(bench, bytes / seconds / 1e6, "MB/s", iters);
+}
+
+#endif
@@ -0,0 +1,9 @@
+#!/bin/sh
+# Run all benchmarks, used as the init program when benchmarking in QEMU.
+for bench in /bin/bench*; do
+    case "$bench" in
+    *.sh) ;;
+    *) "$bench" "$@" ;;
+    esac
+done
+echo "bench finished!"
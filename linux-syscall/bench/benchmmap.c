@@ -0,0 +1,53 @@
+/*
+ * Cost per page of mapping, faulting in and unmapping anonymous and shared
+ * file mappings. The three steps are timed together, as a lazy mmap moves
+ * work from mmap to the faults and unmapping frees the touched pages.
+ */
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define MAPPING (16 * 1024 * 1024)
+#define PAGE 4096
+
+static const char path[] = "/tmp/benchmmap";
+
+/* Map `fd` or anonymous memory, touch every page, unmap, and return the time. */
+static long long map_and_touch(int fd)
+{
+    int flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED;
+    long long start = now_ns();
+    char *addr = mmap(NULL, MAPPING, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (addr == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    for (size_t off = 0; off < MAPPING; off += PAGE)
+        addr[off] = 1;
+    CHECK(munmap(addr, MAPPING));
+    return now_ns() - start;
+}
+
+int main(int argc, char *argv[])
+{
+    long rounds = iterations(argc, argv, 4);
+    long pages = rounds * (MAPPING / PAGE);
+
+    long long time = 0;
+    for (long i = 0; i < rounds; i++)
+        time += map_and_touch(-1);
+    report("mmap_anon_page", (double)time / pages, "ns", pages);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0600);
+    CHECK(fd);
+    CHECK(ftruncate(fd, MAPPING));
+    time = 0;
+    for (long i = 0; i < rounds; i++)
+        time += map_and_touch(fd);
+    report("mmap_file_page", (double)time / pages, "ns", pages);
+    close(fd);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,75 @@
+/* Pipe throughput and ping-pong latency between two processes. */
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define CHUNK (64 * 1024)
+
+static char buf[CHUNK];
+
+static void throughput(long iters)
+{
+    int fds[2];
+    CHECK(pipe(fds));
+    pid_t pid = fork();
+    CHECK(pid);
+    if (pid == 0)
+    {
+        close(fds[1]);
+        while (read(fds[0], buf, CHUNK) > 0)
+            ;
+        exit(0);
+    }
+    close(fds[0]);
+    memset(buf, 'x', CHUNK);
+    long long start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        for (size_t done = 0; done < CHUNK;)
+        {
+            ssize_t len = write(fds[1], buf + done, CHUNK - done);
+            CHECK(len);
+            done += len;
+        }
+    }
+    close(fds[1]);
+    CHECK(waitpid(pid, NULL, 0));
+    report_mbps("pipe_throughput", start, (long long)iters * CHUNK, iters);
+}
+
+static void latency(long iters)
+{
+    int ping[2], pong[2];
+    char c = 0;
+    CHECK(pipe(ping));
+    CHECK(pipe(pong));
+    pid_t pid = fork();
+    CHECK(pid);
+    if (pid == 0)
+    {
+        close(ping[1]);
+        close(pong[0]);
+        while (read(ping[0], &c, 1) == 1)
+            CHECK(write(pong[1], &c, 1));
+        exit(0);
+    }
+    close(ping[0]);
+    close(pong[1]);
+    long long start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        CHECK(write(ping[1], &c, 1));
+        CHECK(read(pong[0], &c, 1));
+    }
+    report_ns("pipe_latency", start, iters);
+    close(ping[1]);
+    CHECK(waitpid(pid, NULL, 0));
+}
+
+int main(int argc, char *argv[])
+{
+    throughput(iterations(argc, argv, 256));
+    latency(iterations(argc, argv, 10000));
+    return 0;
+}
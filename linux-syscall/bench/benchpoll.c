@@ -0,0 +1,60 @@
+/* Cost of poll and select on pipes as the number of fds grows. */
+#include <poll.h>
+#include <stdio.h>
+#include <sys/select.h>
+#include <unistd.h>
+#include "bench.h"
+
+#define MAX_FDS 256
+
+static const int fd_counts[] = {1, 16, 64, 256};
+
+static int fds[MAX_FDS];
+
+int main(int argc, char *argv[])
+{
+    long iters = iterations(argc, argv, 10000);
+    int maxfd = 0;
+    for (int i = 0; i < MAX_FDS; i++)
+    {
+        int p[2];
+        CHECK(pipe(p));
+        fds[i] = p[0];
+        maxfd = p[0] > maxfd ? p[0] : maxfd;
+        /* only the last pipe is readable */
+        if (i == MAX_FDS - 1)
+            CHECK(write(p[1], "x", 1));
+    }
+    for (size_t n = 0; n < sizeof(fd_counts) / sizeof(fd_counts[0]); n++)
+    {
+        int count = fd_counts[n];
+        int *first = fds + MAX_FDS - count;
+        char name[32];
+
+        struct pollfd pfds[MAX_FDS];
+        for (int i = 0; i < count; i++)
+        {
+            pfds[i].fd = first[i];
+            pfds[i].events = POLLIN;
+        }
+        long long start = now_ns();
+        for (long i = 0; i < iters; i++)
+            CHECK(poll(pfds, count, 0));
+        snprintf(name, sizeof(name), "poll_%dfds", count);
+        report_ns(name, start, iters);
+
+        start = now_ns();
+        for (long i = 0; i < iters; i++)
+        {
+            fd_set set;
+            struct timeval timeout = {0, 0};
+            FD_ZERO(&set);
+            for (int j = 0; j < count; j++)
+                FD_SET(first[j], &set);
+            CHECK(select(maxfd + 1, &set, NULL, NULL, &timeout));
+        }
+        snprintf(name, sizeof(name), "select_%dfds", count);
+        report_ns(name, start, iters);
+    }
+    return 0;
+}
@@ -0,0 +1,38 @@
+/* Latency of creating, executing and waiting for processes. */
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+int main(int argc, char *argv[])
+{
+    if (argc > 1 && strcmp(argv[1], "child") == 0)
+        return 0;
+    long iters = iterations(argc, argv, 100);
+
+    long long start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        pid_t pid = fork();
+        CHECK(pid);
+        if (pid == 0)
+            exit(0);
+        CHECK(waitpid(pid, NULL, 0));
+    }
+    report_ns("fork_wait", start, iters);
+
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        pid_t pid = vfork();
+        CHECK(pid);
+        if (pid == 0)
+        {
+            execl(argv[0], argv[0], "child", NULL);
+            _exit(1);
+        }
+        CHECK(waitpid(pid, NULL, 0));
+    }
+    report_ns("vfork_exec_wait", start, iters);
+    return 0;
+}
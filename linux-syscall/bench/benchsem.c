@@ -0,0 +1,41 @@
+/* Handoff latency of SysV semaphores between two processes. */
+#include <sys/ipc.h>
+#include <sys/sem.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "bench.h"
+
+static void sem_change(int id, unsigned short num, short op)
+{
+    struct sembuf sop = {num, op, 0};
+    CHECK(semop(id, &sop, 1));
+}
+
+int main(int argc, char *argv[])
+{
+    long iters = iterations(argc, argv, 10000);
+    /* semaphore 0 wakes the child, semaphore 1 wakes the parent */
+    int id = semget(IPC_PRIVATE, 2, IPC_CREAT | 0600);
+    CHECK(id);
+    pid_t pid = fork();
+    CHECK(pid);
+    if (pid == 0)
+    {
+        for (long i = 0; i < iters; i++)
+        {
+            sem_change(id, 0, -1);
+            sem_change(id, 1, 1);
+        }
+        exit(0);
+    }
+    long long start = now_ns();
+    for (long i = 0; i < iters; i++)
+    {
+        sem_change(id, 0, 1);
+        sem_change(id, 1, -1);
+    }
+    report_ns("sem_handoff", start, iters);
+    CHECK(waitpid(pid, NULL, 0));
+    CHECK(semctl(id, 0, IPC_RMID));
+    return 0;
+}
@@ -0,0 +1,37 @@
+/* Bandwidth of a SysV shared memory segment, attach with first touch, and copies. */
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include "bench.h"
+
+#define SEGMENT (4 * 1024 * 1024)
+
+static char src[SEGMENT];
+
+int main(int argc, char *argv[])
+{
+    long iters = iterations(argc, argv, 64);
+    int id = shmget(IPC_PRIVATE, SEGMENT, IPC_CREAT | 0600);
+    CHECK(id);
+
+    /* attach, fault in every page and detach, timed together */
+    long long start = now_ns();
+    char *shm = shmat(id, NULL, 0);
+    CHECK(shm);
+    memset(shm, 1, SEGMENT);
+    CHECK(shmdt(shm));
+    report_mbps("shm_attach_touch", start, SEGMENT, 1);
+
+    shm = shmat(id, NULL, 0);
+    CHECK(shm);
+
+    memset(src, 2, SEGMENT);
+    start = now_ns();
+    for (long i = 0; i < iters; i++)
+        memcpy(shm, src, SEGMENT);
+    report_mbps("shm_copy", start, (long long)iters * SEGMENT, iters);
+
+    CHECK(shmdt(shm));
+    CHECK(shmctl(id, IPC_RMID, NULL));
+    return 0;
+}
@@ -12,6 +12,7 @@ fn main() {
     writeln!(fout, "#[allow(non_camel_case_types)]").unwrap();
     writeln!(fout, "pub enum SyscallType {{").unwrap();
 
+    let mut num = 0;
     let data = std::fs::read_to_string("src/syscall.h.in").unwrap();
     for line in data.lines() {
         if !line.starts_with("#define") {
@@ -24,7 +25,10 @@ fn main() {
 
         let name = &name[5..].to_uppercase();
         writeln!(fout, "    {} = {},", name, id).unwrap();
+        num = num.max(id.parse::<usize>().unwrap() + 1);
     }
     writeln!(fout, "}}").unwrap();
     writeln!(fout, "}}").unwrap();
+    writeln!(fout, "\n/// Number of syscalls, which is the maximum number plus one.").unwrap();
+    writeln!(fout, "pub const SYSCALL_NUM: usize = {};", num).unwrap();
 }
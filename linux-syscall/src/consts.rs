@@ -355,3 +355,6 @@ pub enum SyscallType {
     CLONE3 = 435,
 }
 }
+
+/// Number of syscalls, which is the maximum number plus one.
+pub const SYSCALL_NUM: usize = 436;
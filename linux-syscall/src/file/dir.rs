@@ -86,6 +86,7 @@ impl Syscall<'_> {
             return Err(LxError::ENOTDIR);
         }
         dir_inode.unlink(file_name)?;
+        invalidate_dentries();
         Ok(0)
     }
 
@@ -183,6 +184,7 @@ impl Syscall<'_> {
             return Err(LxError::EISDIR);
         }
         dir_inode.unlink(file_name)?;
+        invalidate_dentries();
         Ok(0)
     }
 
@@ -212,6 +214,7 @@ impl Syscall<'_> {
         let old_dir_inode = proc.lookup_inode_at(olddirfd, old_dir_path, false)?;
         let new_dir_inode = proc.lookup_inode_at(newdirfd, new_dir_path, false)?;
         old_dir_inode.move_(old_file_name, &new_dir_inode, new_file_name)?;
+        invalidate_dentries();
         Ok(0)
     }
 
@@ -230,14 +233,15 @@ impl Syscall<'_> {
         mut base: UserOutPtr<u8>,
         len: usize,
     ) -> SysResult {
-        let path = path.read_cstring()?;
+        let mut path_buf = [0u8; PATH_MAX];
+        let path = read_path(&path, &mut path_buf)?;
         info!(
             "readlinkat: dirfd={:?}, path={:?}, base={:?}, len={}",
             dirfd, path, base, len
         );
 
         let proc = self.linux_process();
-        let inode = proc.lookup_inode_at(dirfd, &path, false)?;
+        let inode = proc.lookup_inode_at(dirfd, path, false)?;
         if inode.metadata()?.type_ != FileType::SymLink {
             return Err(LxError::EINVAL);
         }
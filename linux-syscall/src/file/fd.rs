@@ -71,6 +71,8 @@ impl Syscall<'_> {
         let _ = proc.close_file(fd2);
         let file_like = proc.get_file_like(fd1)?;
         let fd2 = proc.add_file_at(fd2, file_like)?;
+        // the new fd does not inherit the close-on-exec flag
+        proc.set_fd_cloexec(fd2, false)?;
         Ok(fd2.into())
     }
 
@@ -81,6 +83,7 @@ impl Syscall<'_> {
 
         let file_like = proc.get_file_like(fd1)?;
         let fd2 = proc.add_file(file_like)?;
+        proc.set_fd_cloexec(fd2, false)?;
         Ok(fd2.into())
     }
 
@@ -114,7 +117,7 @@ impl Syscall<'_> {
                 read: false,
                 write: true,
                 append: false,
-                nonblock: false,
+                nonblock: (flags & O_NONBLOCK) != 0,
                 fd_cloexec: (flags & O_CLOEXEC) != 0,
             },
             String::from("pipe_w:[]"),
@@ -5,12 +5,17 @@
 //! - lseek
 //! - truncate, ftruncate
 //! - sendfile, copy_file_range
+//! - splice, tee, vmsplice
 //! - sync, fsync, fdatasync
 //! - ioctl, fcntl
 //! - access, faccessat
 
 use super::*;
+use alloc::{boxed::Box, vec::Vec};
+use core::ops::{Deref, DerefMut};
+use lazy_static::lazy_static;
 use linux_object::time::TimeSpec;
+use spin::Mutex;
 
 impl Syscall<'_> {
     /// Reads from a specified file using a file descriptor. Before using this call,
@@ -20,12 +25,13 @@ impl Syscall<'_> {
     /// - len – number of bytes to read
     pub async fn sys_read(&self, fd: FileDesc, mut base: UserOutPtr<u8>, len: usize) -> SysResult {
         info!("read: fd={:?}, base={:?}, len={:#x}", fd, base, len);
+        self.check_user_range(base.as_ptr() as usize, len)?;
         let proc = self.linux_process();
         let file_like = proc.get_file_like(fd)?;
-        let mut buf = vec![0u8; len];
-        let len = file_like.read(&mut buf).await?;
-        base.write_array(&buf[..len])?;
-        Ok(len)
+        read_chunks(&file_like, None, len, |pos, data| {
+            Ok(base.add(pos).write_array(data)?)
+        })
+        .await
     }
 
     /// Writes to a specified file using a file descriptor. Before using this call,
@@ -33,13 +39,15 @@ impl Syscall<'_> {
     /// - fd – file descriptor
     /// - base – pointer to the buffer write
     /// - len – number of bytes to write
-    pub fn sys_write(&self, fd: FileDesc, base: UserInPtr<u8>, len: usize) -> SysResult {
+    pub async fn sys_write(&self, fd: FileDesc, base: UserInPtr<u8>, len: usize) -> SysResult {
         info!("write: fd={:?}, base={:?}, len={:#x}", fd, base, len);
+        self.check_user_range(base.as_ptr() as usize, len)?;
         let proc = self.linux_process();
-        let buf = base.read_array(len)?;
         let file_like = proc.get_file_like(fd)?;
-        let len = file_like.write(&buf)?;
-        Ok(len)
+        write_chunks(&file_like, None, len, |pos, buf| {
+            Ok(base.add(pos).read_array_into(buf)?)
+        })
+        .await
     }
 
     /// read from or write to a file descriptor at a given offset
@@ -56,17 +64,18 @@ impl Syscall<'_> {
             "pread: fd={:?}, base={:?}, len={}, offset={}",
             fd, base, len, offset
         );
+        self.check_user_range(base.as_ptr() as usize, len)?;
         let proc = self.linux_process();
         let file_like = proc.get_file_like(fd)?;
-        let mut buf = vec![0u8; len];
-        let len = file_like.read_at(offset, &mut buf).await?;
-        base.write_array(&buf[..len])?;
-        Ok(len)
+        read_chunks(&file_like, Some(offset), len, |pos, data| {
+            Ok(base.add(pos).write_array(data)?)
+        })
+        .await
     }
 
     /// writes up to count bytes from the buffer
     /// starting at buf to the file descriptor fd at offset offset. The file offset is not changed.
-    pub fn sys_pwrite(
+    pub async fn sys_pwrite(
         &self,
         fd: FileDesc,
         base: UserInPtr<u8>,
@@ -77,11 +86,13 @@ impl Syscall<'_> {
             "pwrite: fd={:?}, base={:?}, len={}, offset={}",
             fd, base, len, offset
         );
+        self.check_user_range(base.as_ptr() as usize, len)?;
         let proc = self.linux_process();
-        let buf = base.read_array(len)?;
         let file_like = proc.get_file_like(fd)?;
-        let len = file_like.write_at(offset, &buf)?;
-        Ok(len)
+        write_chunks(&file_like, Some(offset), len, |pos, buf| {
+            Ok(base.add(pos).read_array_into(buf)?)
+        })
+        .await
     }
 
     /// works just like read except that multiple buffers are filled.
@@ -95,18 +106,23 @@ impl Syscall<'_> {
     ) -> SysResult {
         info!("readv: fd={:?}, iov={:?}, count={}", fd, iov_ptr, iov_count);
         let mut iovs = iov_ptr.read_iovecs(iov_count)?;
+        for iov in iovs.iter() {
+            self.check_user_range(iov.addr(), iov.len())?;
+        }
         let proc = self.linux_process();
         let file_like = proc.get_file_like(fd)?;
-        let mut buf = vec![0u8; iovs.total_len()];
-        let len = file_like.read(&mut buf).await?;
-        iovs.write_from_buf(&buf)?;
-        Ok(len)
+        let len = iovs.total_len();
+        read_chunks(&file_like, None, len, |pos, data| {
+            iovs.write_from_buf_at(pos, data)?;
+            Ok(())
+        })
+        .await
     }
 
     /// works just like write except that multiple buffers are written out.
     /// writes iov_count buffers of data described
     /// by iov to the file associated with the file descriptor fd ("gather output").
-    pub fn sys_writev(
+    pub async fn sys_writev(
         &self,
         fd: FileDesc,
         iov_ptr: UserInPtr<IoVecIn>,
@@ -117,11 +133,17 @@ impl Syscall<'_> {
             fd, iov_ptr, iov_count
         );
         let iovs = iov_ptr.read_iovecs(iov_count)?;
-        let buf = iovs.read_to_vec()?;
+        for iov in iovs.iter() {
+            self.check_user_range(iov.addr(), iov.len())?;
+        }
         let proc = self.linux_process();
         let file_like = proc.get_file_like(fd)?;
-        let len = file_like.write(&buf)?;
-        Ok(len)
+        let len = iovs.total_len();
+        write_chunks(&file_like, None, len, |pos, buf| {
+            iovs.read_to_buf(pos, buf)?;
+            Ok(())
+        })
+        .await
     }
 
     /// repositions the offset of the open file associated with the file descriptor fd
@@ -150,7 +172,11 @@ impl Syscall<'_> {
         let path = path.read_cstring()?;
         info!("truncate: path={:?}, len={}", path, len);
         let proc = self.linux_process();
-        proc.lookup_inode(&path)?.resize(len)?;
+        let inode = proc.lookup_inode(&path)?;
+        match PageCache::lookup(&inode) {
+            Some(cache) => cache.set_len(len)?,
+            None => inode.resize(len)?,
+        }
         Ok(0)
     }
 
@@ -226,7 +252,9 @@ impl Syscall<'_> {
             let mut bytes_written = 0;
             let mut rlen = read_len;
             while bytes_written < read_len {
-                let write_len = out_file.write(&buffer[bytes_written..(bytes_written + rlen)])?;
+                let write_len = out_file
+                    .write(&buffer[bytes_written..(bytes_written + rlen)])
+                    .await?;
                 if write_len == 0 {
                     info!(
                         "copy_file_range:END_ERR in={:?}, out={:?}, in_offset={:?}, out_offset={:?}, count={} = bytes_read {}, bytes_written {}, write_len {}",
@@ -252,10 +280,176 @@ impl Syscall<'_> {
         Ok(total_written)
     }
 
+    /// Move data between a pipe and another file descriptor,
+    /// without copying through user memory.
+    pub async fn sys_splice(
+        &self,
+        fd_in: FileDesc,
+        mut off_in: UserInOutPtr<u64>,
+        fd_out: FileDesc,
+        mut off_out: UserInOutPtr<u64>,
+        len: usize,
+        flags: usize,
+    ) -> SysResult {
+        info!(
+            "splice: in={:?}, off_in={:?}, out={:?}, off_out={:?}, len={}, flags={:#x}",
+            fd_in, off_in, fd_out, off_out, len, flags
+        );
+        let proc = self.linux_process();
+        let in_file = proc.get_file(fd_in)?;
+        let out_file = proc.get_file(fd_out)?;
+        let nonblock = flags & SPLICE_F_NONBLOCK != 0;
+        if (in_file.as_pipe().is_some() && !off_in.is_null())
+            || (out_file.as_pipe().is_some() && !off_out.is_null())
+        {
+            return Err(LxError::ESPIPE);
+        }
+        match (in_file.as_pipe(), out_file.as_pipe()) {
+            (Some(_), Some(_)) => pipe_transfer(&in_file, &out_file, len, false, nonblock).await,
+            (Some(in_pipe), None) => {
+                let offset = if off_out.is_null() {
+                    None
+                } else {
+                    Some(off_out.read()?)
+                };
+                let mut buf = [0u8; PIPE_BUF];
+                let mut total = 0;
+                while total < len {
+                    // only wait for the first chunk
+                    if (total != 0 || nonblock) && !in_file.poll()?.read {
+                        if total == 0 {
+                            return Err(LxError::EAGAIN);
+                        }
+                        break;
+                    }
+                    let chunk = buf.len().min(len - total);
+                    // the data is only consumed once it is written
+                    let read_len = loop {
+                        match in_pipe.peek(&mut buf[..chunk]) {
+                            Err(LxError::EAGAIN) => in_file.async_poll().await?,
+                            result => break result?,
+                        };
+                    };
+                    if read_len == 0 {
+                        break;
+                    }
+                    let result = match offset {
+                        Some(offset) => {
+                            out_file
+                                .write_at(offset + total as u64, &buf[..read_len])
+                                .await
+                        }
+                        None => out_file.write(&buf[..read_len]).await,
+                    };
+                    let write_len = match result {
+                        Ok(write_len) => write_len,
+                        Err(_) if total != 0 => break,
+                        Err(err) => return Err(err),
+                    };
+                    in_pipe.consume(write_len);
+                    total += write_len;
+                    if write_len < read_len {
+                        break;
+                    }
+                }
+                if let Some(offset) = offset {
+                    off_out.write(offset + total as u64)?;
+                }
+                Ok(total)
+            }
+            (None, Some(out_pipe)) => {
+                let offset = if off_in.is_null() {
+                    None
+                } else {
+                    Some(off_in.read()?)
+                };
+                let mut buf = [0u8; PIPE_BUF];
+                let mut total = 0;
+                while total < len {
+                    let chunk = buf.len().min(len - total);
+                    // only wait for the first chunk, which must fit at once
+                    if (total != 0 || nonblock) && !out_pipe.can_write_len(chunk) {
+                        if total == 0 {
+                            return Err(LxError::EAGAIN);
+                        }
+                        break;
+                    }
+                    let read_len = match offset {
+                        Some(offset) => {
+                            in_file
+                                .read_at(offset + total as u64, &mut buf[..chunk])
+                                .await?
+                        }
+                        None => in_file.read(&mut buf[..chunk]).await?,
+                    };
+                    if read_len == 0 {
+                        break;
+                    }
+                    // no larger than PIPE_BUF, so it is written at once
+                    total += out_file.write(&buf[..read_len]).await?;
+                }
+                if let Some(offset) = offset {
+                    off_in.write(offset + total as u64)?;
+                }
+                Ok(total)
+            }
+            (None, None) => Err(LxError::EINVAL),
+        }
+    }
+
+    /// Duplicate data from one pipe to another, without consuming it.
+    pub async fn sys_tee(
+        &self,
+        fd_in: FileDesc,
+        fd_out: FileDesc,
+        len: usize,
+        flags: usize,
+    ) -> SysResult {
+        info!(
+            "tee: in={:?}, out={:?}, len={}, flags={:#x}",
+            fd_in, fd_out, len, flags
+        );
+        let proc = self.linux_process();
+        let in_file = proc.get_file(fd_in)?;
+        let out_file = proc.get_file(fd_out)?;
+        if in_file.as_pipe().is_none() || out_file.as_pipe().is_none() {
+            return Err(LxError::EINVAL);
+        }
+        let nonblock = flags & SPLICE_F_NONBLOCK != 0;
+        pipe_transfer(&in_file, &out_file, len, true, nonblock).await
+    }
+
+    /// Move user memory into a pipe, or out of it if `fd` is the read end.
+    ///
+    /// The data is copied through a kernel buffer, just like `writev` and `readv`.
+    pub async fn sys_vmsplice(
+        &self,
+        fd: FileDesc,
+        iov_ptr: usize,
+        iov_count: usize,
+        flags: usize,
+    ) -> SysResult {
+        info!(
+            "vmsplice: fd={:?}, iov={:#x}, count={}, flags={:#x}",
+            fd, iov_ptr, iov_count, flags
+        );
+        let proc = self.linux_process();
+        let file = proc.get_file(fd)?;
+        if file.as_pipe().is_none() {
+            return Err(LxError::EBADF);
+        }
+        if file.options.write {
+            self.sys_writev(fd, iov_ptr.into(), iov_count).await
+        } else {
+            self.sys_readv(fd, iov_ptr.into(), iov_count).await
+        }
+    }
+
     /// causes all buffered modifications to file metadata and data to be written to the underlying file systems.
     pub fn sys_sync(&self) -> SysResult {
         info!("sync:");
         let proc = self.linux_process();
+        sync_page_caches()?;
         proc.root_inode().fs().sync()?;
         Ok(0)
     }
@@ -301,6 +495,15 @@ impl Syscall<'_> {
     pub fn sys_fcntl(&self, fd: FileDesc, cmd: usize, arg: usize) -> SysResult {
         info!("fcntl: fd={:?}, cmd={:x}, arg={}", fd, cmd, arg);
         let proc = self.linux_process();
+        // the close-on-exec flag belongs to the fd rather than the file
+        if cmd == FcntlFlags::F_GETFD.bits() {
+            // FD_CLOEXEC is 1
+            return Ok(proc.fd_cloexec(fd)? as usize);
+        }
+        if cmd == FcntlFlags::F_SETFD.bits() {
+            proc.set_fd_cloexec(fd, arg & FcntlFlags::FD_CLOEXEC.bits() != 0)?;
+            return Ok(0);
+        }
         let file_like = proc.get_file_like(fd)?;
         file_like.fcntl(cmd, arg)
     }
@@ -320,7 +523,8 @@ impl Syscall<'_> {
         flags: usize,
     ) -> SysResult {
         // TODO: check permissions based on uid/gid
-        let path = path.read_cstring()?;
+        let mut buf = [0u8; PATH_MAX];
+        let path = read_path(&path, &mut buf)?;
         let flags = AtFlags::from_bits_truncate(flags);
         info!(
             "faccessat: dirfd={:?}, path={:?}, mode={:#o}, flags={:?}",
@@ -328,7 +532,7 @@ impl Syscall<'_> {
         );
         let proc = self.linux_process();
         let follow = !flags.contains(AtFlags::SYMLINK_NOFOLLOW);
-        let _inode = proc.lookup_inode_at(dirfd, &path, follow)?;
+        let _inode = proc.lookup_inode_at(dirfd, path, follow)?;
         Ok(0)
     }
 
@@ -396,3 +600,152 @@ impl Syscall<'_> {
         Ok(0)
     }
 }
+
+const SPLICE_F_NONBLOCK: usize = 2;
+
+/// Size of the kernel buffer which data is copied through between user
+/// memory and a file.
+///
+/// It is larger than PIPE_BUF, so a pipe write of at most PIPE_BUF bytes is
+/// a single write, and stays atomic.
+const RW_BUF_SIZE: usize = 0x10000;
+
+/// Number of idle buffers kept in `RW_BUFS`.
+const RW_BUF_POOL_SIZE: usize = 8;
+
+lazy_static! {
+    /// Idle buffers of `RW_BUF_SIZE` bytes, reused by file I/O.
+    static ref RW_BUFS: Mutex<Vec<Box<[u8]>>> = Mutex::new(Vec::new());
+}
+
+/// A kernel buffer of `RW_BUF_SIZE` bytes, taken from `RW_BUFS` and put back
+/// on drop, so that a read or write does not allocate once the pool is filled.
+struct RwBuf(Option<Box<[u8]>>);
+
+impl RwBuf {
+    fn get() -> Self {
+        let buf = RW_BUFS.lock().pop();
+        RwBuf(Some(
+            buf.unwrap_or_else(|| vec![0u8; RW_BUF_SIZE].into_boxed_slice()),
+        ))
+    }
+}
+
+impl Deref for RwBuf {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        self.0.as_ref().unwrap()
+    }
+}
+
+impl DerefMut for RwBuf {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        self.0.as_mut().unwrap()
+    }
+}
+
+impl Drop for RwBuf {
+    fn drop(&mut self) {
+        let mut bufs = RW_BUFS.lock();
+        if bufs.len() < RW_BUF_POOL_SIZE {
+            bufs.push(self.0.take().unwrap());
+        }
+    }
+}
+
+/// Read at most `len` bytes from `file`, at `offset` if given, through a
+/// bounded kernel buffer.
+///
+/// `copy_out` copies each chunk to user memory at its position in the whole
+/// read. Once some data is read, it stops instead of blocking for more.
+///
+/// The data is copied twice, as the file is read without holding user memory,
+/// which may fault while the file or its page cache is locked.
+async fn read_chunks(
+    file: &Arc<dyn FileLike>,
+    offset: Option<u64>,
+    len: usize,
+    mut copy_out: impl FnMut(usize, &[u8]) -> LxResult,
+) -> SysResult {
+    let mut buf = RwBuf::get();
+    let mut total = 0;
+    while total < len {
+        if total != 0 && !matches!(file.poll(), Ok(status) if status.read) {
+            break;
+        }
+        let chunk = &mut buf[..(len - total).min(RW_BUF_SIZE)];
+        let result = match offset {
+            Some(offset) => file.read_at(offset + total as u64, chunk).await,
+            None => file.read(chunk).await,
+        };
+        let n = match result {
+            Ok(n) => n,
+            Err(_) if total != 0 => break,
+            Err(err) => return Err(err),
+        };
+        copy_out(total, &chunk[..n])?;
+        total += n;
+        if n < chunk.len() {
+            break;
+        }
+    }
+    Ok(total)
+}
+
+/// Write `len` bytes to `file`, at `offset` if given, through a bounded
+/// kernel buffer.
+///
+/// `copy_in` fills each chunk from user memory at its position in the whole
+/// write. Once some data is written, an error ends the write early.
+async fn write_chunks(
+    file: &Arc<dyn FileLike>,
+    offset: Option<u64>,
+    len: usize,
+    mut copy_in: impl FnMut(usize, &mut [u8]) -> LxResult,
+) -> SysResult {
+    let mut buf = RwBuf::get();
+    let mut total = 0;
+    while total < len {
+        let chunk = &mut buf[..(len - total).min(RW_BUF_SIZE)];
+        match copy_in(total, chunk) {
+            Ok(()) => {}
+            Err(_) if total != 0 => break,
+            Err(err) => return Err(err),
+        }
+        let result = match offset {
+            Some(offset) => file.write_at(offset + total as u64, chunk).await,
+            None => file.write(chunk).await,
+        };
+        match result {
+            Ok(0) => break,
+            Ok(n) => total += n,
+            Err(_) if total != 0 => break,
+            Err(err) => return Err(err),
+        }
+    }
+    Ok(total)
+}
+
+/// Move or copy data between the ring buffers of two pipes directly.
+async fn pipe_transfer(
+    in_file: &File,
+    out_file: &File,
+    len: usize,
+    keep: bool,
+    nonblock: bool,
+) -> SysResult {
+    let (src, dst) = (in_file.as_pipe().unwrap(), out_file.as_pipe().unwrap());
+    loop {
+        match src.transfer_to(dst, len, keep) {
+            Err(LxError::EAGAIN) if !nonblock => {
+                if in_file.poll()?.read {
+                    out_file.async_poll().await?;
+                } else {
+                    in_file.async_poll().await?;
+                }
+            }
+            ret => return ret,
+        }
+    }
+}
@@ -13,3 +13,15 @@ mod poll;
 mod stat;
 
 use self::dir::AtFlags;
+
+/// Maximum length of a path, including the NUL.
+const PATH_MAX: usize = 4096;
+
+/// Copy the path at `path` into `buf`, without allocating.
+fn read_path<'a>(path: &UserInPtr<u8>, buf: &'a mut [u8; PATH_MAX]) -> LxResult<&'a str> {
+    let len = match path.read_cstring_into(buf) {
+        Err(kernel_hal::user::Error::BufferTooSmall) => return Err(LxError::ENAMETOOLONG),
+        result => result?,
+    };
+    core::str::from_utf8(&buf[..len]).map_err(|_| LxError::EINVAL)
+}
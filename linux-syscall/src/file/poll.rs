@@ -2,6 +2,7 @@
 //!
 //! - select, pselect
 //! - poll, ppoll
+//! - epoll_create, epoll_create1, epoll_ctl, epoll_wait, epoll_pwait
 
 use super::*;
 use alloc::boxed::Box;
@@ -12,8 +13,9 @@ use core::mem::size_of;
 use core::pin::Pin;
 use core::task::{Context, Poll};
 use core::time::Duration;
-use kernel_hal::timer_set;
+use kernel_hal::{timer_cancel, timer_now, timer_set, TimerId};
 use linux_object::fs::FileDesc;
+use linux_object::sync::{wait_for_event, Event};
 use linux_object::time::*;
 
 impl Syscall<'_> {
@@ -34,6 +36,8 @@ impl Syscall<'_> {
             polls: &'a mut Vec<PollFd>,
             timeout_msecs: usize,
             begin_time_ms: usize,
+            /// The timer to wake up on timeout, which is set on the first pending poll.
+            timer: Option<TimerId>,
             syscall: &'a Syscall<'a>,
         }
 
@@ -82,12 +86,13 @@ impl Syscall<'_> {
                 if self.timeout_msecs == 0 {
                     // no timeout, return now;
                     return Poll::Ready(Ok(0));
-                } else {
+                } else if self.timer.is_none() && self.timeout_msecs < (1 << 31) {
                     let waker = cx.waker().clone();
-                    timer_set(
-                        Duration::from_millis(self.timeout_msecs as u64),
+                    let deadline = (self.begin_time_ms + self.timeout_msecs) as u64;
+                    self.timer = Some(timer_set(
+                        Duration::from_millis(deadline),
                         Box::new(move |_| waker.wake()),
-                    );
+                    ));
                 }
 
                 let current_time_ms = TimeVal::now().to_msec();
@@ -101,10 +106,20 @@ impl Syscall<'_> {
                 Poll::Pending
             }
         }
+
+        impl<'a> Drop for PollFuture<'a> {
+            fn drop(&mut self) {
+                if let Some(timer) = self.timer.take() {
+                    timer_cancel(timer);
+                }
+            }
+        }
+
         let future = PollFuture {
             polls: &mut polls,
             timeout_msecs,
             begin_time_ms,
+            timer: None,
             syscall: self,
         };
         let result = future.await;
@@ -183,6 +198,8 @@ impl Syscall<'_> {
             err_fds: &'a mut FdSet,
             timeout_msecs: usize,
             begin_time_ms: usize,
+            /// The timer to wake up on timeout, which is set on the first pending poll.
+            timer: Option<TimerId>,
             syscall: &'a Syscall<'a>,
         }
 
@@ -190,10 +207,10 @@ impl Syscall<'_> {
             type Output = SysResult;
 
             fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
-                let files = self.syscall.linux_process().get_files()?;
+                let files = self.syscall.linux_process().get_files();
 
                 let mut events = 0;
-                for (&fd, file_like) in files.iter() {
+                for (fd, file_like) in files.iter() {
                     if !self.err_fds.contains(fd)
                         && !self.read_fds.contains(fd)
                         && !self.write_fds.contains(fd)
@@ -228,12 +245,13 @@ impl Syscall<'_> {
                 if self.timeout_msecs == 0 {
                     // no timeout, return now;
                     return Poll::Ready(Ok(0));
-                } else {
+                } else if self.timer.is_none() && self.timeout_msecs < (1 << 31) {
                     let waker = cx.waker().clone();
-                    timer_set(
-                        Duration::from_millis(self.timeout_msecs as u64),
+                    let deadline = (self.begin_time_ms + self.timeout_msecs) as u64;
+                    self.timer = Some(timer_set(
+                        Duration::from_millis(deadline),
                         Box::new(move |_| waker.wake()),
-                    );
+                    ));
                 }
 
                 let current_time_ms = TimeVal::now().to_msec();
@@ -247,18 +265,143 @@ impl Syscall<'_> {
                 Poll::Pending
             }
         }
+
+        impl<'a> Drop for SelectFuture<'a> {
+            fn drop(&mut self) {
+                if let Some(timer) = self.timer.take() {
+                    timer_cancel(timer);
+                }
+            }
+        }
+
         let future = SelectFuture {
             read_fds: &mut read_fds,
             write_fds: &mut write_fds,
             err_fds: &mut err_fds,
             timeout_msecs,
             begin_time_ms,
+            timer: None,
             syscall: self,
         };
         future.await
     }
+
+    /// Open an epoll file descriptor. `size` is ignored, but must be positive.
+    pub fn sys_epoll_create(&self, size: i32) -> SysResult {
+        info!("epoll_create: size={}", size);
+        if size <= 0 {
+            return Err(LxError::EINVAL);
+        }
+        self.sys_epoll_create1(0)
+    }
+
+    /// Open an epoll file descriptor.
+    pub fn sys_epoll_create1(&self, flags: usize) -> SysResult {
+        info!("epoll_create1: flags={:#x}", flags);
+        if flags & !EPOLL_CLOEXEC != 0 {
+            return Err(LxError::EINVAL);
+        }
+        let epoll = EpollInstance::new(flags & EPOLL_CLOEXEC != 0);
+        let fd = self.linux_process().add_file(epoll)?;
+        Ok(fd.into())
+    }
+
+    /// Add, modify, or remove entries in the interest list of an epoll instance.
+    pub fn sys_epoll_ctl(
+        &self,
+        epfd: FileDesc,
+        op: usize,
+        fd: FileDesc,
+        event: UserInPtr<EpollEvent>,
+    ) -> SysResult {
+        info!("epoll_ctl: epfd={:?}, op={}, fd={:?}", epfd, op, fd);
+        let proc = self.linux_process();
+        let epoll = proc
+            .get_file_like(epfd)?
+            .downcast_arc::<EpollInstance>()
+            .map_err(|_| LxError::EINVAL)?;
+        let file = proc.get_file_like(fd)?;
+        match op {
+            EPOLL_CTL_ADD => epoll.add(fd, &file, event.read()?)?,
+            EPOLL_CTL_DEL => epoll.delete(fd, &file)?,
+            EPOLL_CTL_MOD => epoll.modify(fd, &file, event.read()?)?,
+            _ => return Err(LxError::EINVAL),
+        }
+        Ok(0)
+    }
+
+    /// Wait for events on an epoll instance.
+    ///
+    /// Only the files which may be ready are checked. `timeout_msecs` of -1
+    /// means infinity.
+    pub async fn sys_epoll_wait(
+        &self,
+        epfd: FileDesc,
+        mut events: UserOutPtr<EpollEvent>,
+        maxevents: i32,
+        timeout_msecs: i32,
+    ) -> SysResult {
+        info!(
+            "epoll_wait: epfd={:?}, maxevents={}, timeout_msecs={}",
+            epfd, maxevents, timeout_msecs
+        );
+        if maxevents <= 0 {
+            return Err(LxError::EINVAL);
+        }
+        events.check()?;
+        let epoll = self
+            .linux_process()
+            .get_file_like(epfd)?
+            .downcast_arc::<EpollInstance>()
+            .map_err(|_| LxError::EINVAL)?;
+        let deadline = if timeout_msecs < 0 {
+            Duration::from_nanos(u64::max_value())
+        } else {
+            timer_now() + Duration::from_millis(timeout_msecs as u64)
+        };
+        loop {
+            let ready = epoll.try_wait(maxevents as usize);
+            if !ready.is_empty() || timeout_msecs == 0 {
+                events.write_array(&ready)?;
+                return Ok(ready.len());
+            }
+            let future = wait_for_event(epoll.eventbus(), Event::READABLE);
+            let res = self
+                .thread
+                .blocking_run(
+                    Box::pin(future),
+                    ThreadState::BlockedWaitMany,
+                    deadline,
+                    None,
+                )
+                .await;
+            match res {
+                Ok(_) => {}
+                Err(ZxError::TIMED_OUT) => return Ok(0),
+                Err(_) => return Err(LxError::EINTR),
+            }
+        }
+    }
+
+    /// Wait for events on an epoll instance, the signal mask is ignored.
+    pub async fn sys_epoll_pwait(
+        &self,
+        epfd: FileDesc,
+        events: UserOutPtr<EpollEvent>,
+        maxevents: i32,
+        timeout_msecs: i32,
+        _sigmask: usize,
+    ) -> SysResult {
+        self.sys_epoll_wait(epfd, events, maxevents, timeout_msecs)
+            .await
+    }
 }
 
+const EPOLL_CLOEXEC: usize = 0o2000000;
+const EPOLL_CTL_ADD: usize = 1;
+const EPOLL_CTL_DEL: usize = 2;
+const EPOLL_CTL_MOD: usize = 3;
+
 #[repr(C)]
 #[derive(Debug)]
 pub struct PollFd {
@@ -1,9 +1,10 @@
 //! Syscalls of Inter-Process Communication
 #![allow(dead_code)]
 
-use bitflags::*;
-use kernel_hal::user::*;
+use core::time::Duration;
+use kernel_hal::{timer_now, user::*};
 pub use linux_object::ipc::*;
+use linux_object::time::TimeSpec;
 use numeric_enum_macro::numeric_enum;
 use zircon_object::vm::*;
 
@@ -31,26 +32,64 @@ impl Syscall<'_> {
     /// performs operations on selected semaphores in the set indicated by semid
     pub async fn sys_semop(&self, id: usize, ops: UserInPtr<SemBuf>, num_ops: usize) -> SysResult {
         info!("semop: id: {}", id);
-        let ops = ops.read_array(num_ops)?;
+        self.semtimedop(id, ops, num_ops, None).await
+    }
 
+    /// semaphore operations with a timeout
+    ///
+    /// like semop, but fails with EAGAIN if the operations can not be performed
+    /// within the relative `timeout`
+    pub async fn sys_semtimedop(
+        &self,
+        id: usize,
+        ops: UserInPtr<SemBuf>,
+        num_ops: usize,
+        timeout: UserInPtr<TimeSpec>,
+    ) -> SysResult {
+        info!("semtimedop: id: {}, timeout: {:?}", id, timeout);
+        let timeout = timeout.read_if_not_null()?;
+        self.semtimedop(id, ops, num_ops, timeout).await
+    }
+
+    async fn semtimedop(
+        &self,
+        id: usize,
+        ops: UserInPtr<SemBuf>,
+        num_ops: usize,
+        timeout: Option<TimeSpec>,
+    ) -> SysResult {
+        /// The maximum operations per semop call
+        const SEMOPM: usize = 500;
+
+        if num_ops == 0 {
+            return Err(LxError::EINVAL);
+        }
+        if num_ops > SEMOPM {
+            return Err(LxError::E2BIG);
+        }
+        let ops = ops.read_array(num_ops)?;
         let sem_array = self
             .linux_process()
             .semaphores_get(id)
             .ok_or(LxError::EINVAL)?;
+        let deadline = match timeout {
+            Some(t) => timer_now() + Duration::from(t),
+            None => Duration::from_nanos(u64::max_value()),
+        };
+        let pid = self.zircon_process().id() as usize;
+        let future = sem_array.semop(ops.clone(), pid);
+        let res: ZxResult<LxResult> = self
+            .thread
+            .blocking_run(future, ThreadState::Blocked, deadline, None)
+            .await;
+        match res {
+            Ok(res) => res?,
+            Err(ZxError::TIMED_OUT) => return Err(LxError::EAGAIN),
+            Err(_) => return Err(LxError::EINTR),
+        }
         sem_array.otime();
         for &SemBuf { num, op, flags } in ops.iter() {
             let flags = SemFlags::from_bits_truncate(flags);
-            if flags.contains(SemFlags::IPC_NOWAIT) {
-                unimplemented!("Semaphore: semop.IPC_NOWAIT");
-            }
-            let sem = &sem_array[num as usize];
-
-            let _result = match op {
-                1 => sem.release(),
-                -1 => sem.acquire().await?,
-                _ => unimplemented!("Semaphore: semop.(Not 1/-1)"),
-            };
-            sem.set_pid(self.zircon_process().id() as usize);
             if flags.contains(SemFlags::SEM_UNDO) {
                 self.linux_process().semaphores_add_undo(id, num, op);
             }
@@ -100,22 +139,17 @@ impl Syscall<'_> {
                 ptr.write(*sem_array.semid_ds.lock())?;
                 Ok(0)
             }
-            _ => {
-                let sem = &sem_array[num as usize];
-                match cmd {
-                    SemctlCmds::GETPID => Ok(sem.get_pid()),
-                    SemctlCmds::GETVAL => Ok(sem.get() as usize),
-                    SemctlCmds::GETNCNT => Ok(sem.get_ncnt()),
-                    SemctlCmds::GETZCNT => Ok(0),
-                    SemctlCmds::SETVAL => {
-                        sem.set(arg as isize);
-                        sem.set_pid(self.zircon_process().id() as usize);
-                        sem_array.ctime();
-                        Ok(0)
-                    }
-                    _ => unimplemented!("Semaphore Semctl cmd: {:?}", cmd),
-                }
+            SemctlCmds::GETPID => sem_array.get_pid(num),
+            SemctlCmds::GETVAL => Ok(sem_array.get_val(num)? as usize),
+            SemctlCmds::GETNCNT => sem_array.get_ncnt(num),
+            SemctlCmds::GETZCNT => sem_array.get_zcnt(num),
+            SemctlCmds::SETVAL => {
+                let pid = self.zircon_process().id() as usize;
+                sem_array.set_val(num, arg as i32 as isize, pid)?;
+                sem_array.ctime();
+                Ok(0)
             }
+            _ => unimplemented!("Semaphore Semctl cmd: {:?}", cmd),
         }
     }
 
@@ -159,13 +193,14 @@ impl Syscall<'_> {
             vmo.len(),
             shmflg
         );
-        let addr = vmar.map(
-            None,
-            vmo.clone(),
-            0,
-            vmo.len(),
-            MMUFlags::READ | MMUFlags::WRITE | MMUFlags::EXECUTE,
-        )?;
+        let flags = MMUFlags::READ | MMUFlags::WRITE | MMUFlags::EXECUTE;
+        // a large segment is mapped at a huge page boundary,
+        // so that it can be backed by huge pages
+        let addr = if vmo.len() >= HUGE_PAGE_SIZE {
+            vmar.map_aligned(vmo.clone(), vmo.len(), flags, HUGE_PAGE_SIZE)?
+        } else {
+            vmar.map(None, vmo.clone(), 0, vmo.len(), flags)?
+        };
         shm_identifier.addr = addr;
         self.linux_process().shm_set(id, shm_identifier.clone());
 
@@ -209,7 +244,7 @@ impl Syscall<'_> {
         };
         match cmd {
             ShmctlCmds::IPC_RMID => {
-                shm_guard.remove();
+                shm_identifier.remove(&shm_guard);
                 self.linux_process().shm_pop(id);
                 Ok(0)
             }
@@ -291,16 +326,6 @@ numeric_enum! {
     }
 }
 
-/// An operation to be performed on a single semaphore
-///
-/// Ref: [http://man7.org/linux/man-pages/man2/semop.2.html]
-#[repr(C)]
-pub struct SemBuf {
-    num: u16,
-    op: i16,
-    flags: i16,
-}
-
 /// shm_info structure for shmctl
 #[repr(C)]
 #[derive(Default)]
@@ -326,12 +351,3 @@ pub union SemctlUnion {
     /// Array for GETALL, SETALL
     array: usize,
 }
-
-bitflags! {
-    pub struct SemFlags: i16 {
-        /// For SemOP
-        const IPC_NOWAIT = 0x800;
-        /// it will be automatically undone when the process terminates.
-        const SEM_UNDO = 0x1000;
-    }
-}
@@ -35,6 +35,8 @@ use {
     core::convert::TryFrom,
     kernel_hal::{user::*, GeneralRegs},
     linux_object::{error::*, fs::FileDesc, process::*},
+    zircon_object::util::ktrace::{ktrace, TraceEvent},
+    zircon_object::util::syscall_stats::SyscallStats,
     zircon_object::{object::*, task::*, vm::VirtAddr},
 };
 
@@ -47,6 +49,11 @@ mod task;
 mod time;
 mod vm;
 
+/// Call counts and latencies of syscalls, indexed by syscall number.
+///
+/// They are only recorded while the `SYSCALL` group of ktrace is enabled.
+pub static SYSCALL_STATS: SyscallStats<{ consts::SYSCALL_NUM }> = SyscallStats::new();
+
 /// The struct of Syscall which stores the information about making a syscall
 pub struct Syscall<'a> {
     /// the thread making a syscall
@@ -70,10 +77,12 @@ impl Syscall<'_> {
                 return LxError::EINVAL as _;
             }
         };
+        ktrace(TraceEvent::SyscallEnter, self.thread.id(), num as u64);
+        let begin = SYSCALL_STATS.begin();
         let [a0, a1, a2, a3, a4, a5] = args;
         let ret = match sys_type {
             Sys::READ => self.sys_read(a0.into(), a1.into(), a2).await,
-            Sys::WRITE => self.sys_write(a0.into(), a1.into(), a2),
+            Sys::WRITE => self.sys_write(a0.into(), a1.into(), a2).await,
             Sys::OPENAT => self.sys_openat(a0.into(), a1.into(), a2, a3),
             Sys::CLOSE => self.sys_close(a0.into()),
             Sys::FSTAT => self.sys_fstat(a0.into(), a1.into()),
@@ -81,9 +90,9 @@ impl Syscall<'_> {
             Sys::LSEEK => self.sys_lseek(a0.into(), a1 as i64, a2 as u8),
             Sys::IOCTL => self.sys_ioctl(a0.into(), a1, a2, a3, a4),
             Sys::PREAD64 => self.sys_pread(a0.into(), a1.into(), a2, a3 as _).await,
-            Sys::PWRITE64 => self.sys_pwrite(a0.into(), a1.into(), a2, a3 as _),
+            Sys::PWRITE64 => self.sys_pwrite(a0.into(), a1.into(), a2, a3 as _).await,
             Sys::READV => self.sys_readv(a0.into(), a1.into(), a2).await,
-            Sys::WRITEV => self.sys_writev(a0.into(), a1.into(), a2),
+            Sys::WRITEV => self.sys_writev(a0.into(), a1.into(), a2).await,
             Sys::SENDFILE => self.sys_sendfile(a0.into(), a1.into(), a2.into(), a3).await,
             Sys::FCNTL => self.sys_fcntl(a0.into(), a1, a2),
             Sys::FLOCK => self.sys_flock(a0.into(), a1),
@@ -113,6 +122,12 @@ impl Syscall<'_> {
                 self.sys_copy_file_range(a0.into(), a1.into(), a2.into(), a3.into(), a4, a5)
                     .await
             }
+            Sys::SPLICE => {
+                self.sys_splice(a0.into(), a1.into(), a2.into(), a3.into(), a4, a5)
+                    .await
+            }
+            Sys::TEE => self.sys_tee(a0.into(), a1.into(), a2, a3).await,
+            Sys::VMSPLICE => self.sys_vmsplice(a0.into(), a1, a2, a3).await,
 
             // io multiplexing
             Sys::PSELECT6 => {
@@ -120,9 +135,12 @@ impl Syscall<'_> {
                     .await
             }
             Sys::PPOLL => self.sys_ppoll(a0.into(), a1, a2.into()).await, // ignore sigmask
-            //            Sys::EPOLL_CREATE1 => self.sys_epoll_create1(a0),
-            //            Sys::EPOLL_CTL => self.sys_epoll_ctl(a0, a1, a2, a3.into()),
-            //            Sys::EPOLL_PWAIT => self.sys_epoll_pwait(a0, a1.into(), a2, a3, a4),
+            Sys::EPOLL_CREATE1 => self.sys_epoll_create1(a0),
+            Sys::EPOLL_CTL => self.sys_epoll_ctl(a0.into(), a1, a2.into(), a3.into()),
+            Sys::EPOLL_PWAIT => {
+                self.sys_epoll_pwait(a0.into(), a1.into(), a2 as _, a3 as _, a4)
+                    .await
+            }
             //            Sys::EVENTFD2 => self.unimplemented("eventfd2", Err(LxError::EACCES)),
 
             //            Sys::SOCKETPAIR => self.unimplemented("socketpair", Err(LxError::EACCES)),
@@ -138,7 +156,8 @@ impl Syscall<'_> {
             Sys::MMAP => self.sys_mmap(a0, a1, a2, a3, a4.into(), a5 as _).await,
             Sys::MPROTECT => self.sys_mprotect(a0, a1, a2),
             Sys::MUNMAP => self.sys_munmap(a0, a1),
-            Sys::MADVISE => self.unimplemented("madvise", Ok(0)),
+            Sys::MSYNC => self.sys_msync(a0, a1, a2),
+            Sys::MADVISE => self.sys_madvise(a0, a1, a2),
 
             // signal
             Sys::RT_SIGACTION => self.sys_rt_sigaction(a0, a1.into(), a2.into(), a3),
@@ -169,13 +188,13 @@ impl Syscall<'_> {
             //            Sys::GETSOCKOPT => self.sys_getsockopt(a0, a1, a2, a3.into(), a4.into()),
 
             // process
-            Sys::CLONE => self.sys_clone(a0, a1, a2.into(), a3.into(), a4),
+            Sys::CLONE => self.sys_clone(a0, a1, a2.into(), a3.into(), a4).await,
             Sys::EXECVE => self.sys_execve(a0.into(), a1.into(), a2.into()),
             Sys::EXIT => self.sys_exit(a0 as _),
             Sys::EXIT_GROUP => self.sys_exit_group(a0 as _),
             Sys::WAIT4 => self.sys_wait4(a0 as _, a1.into(), a2 as _).await,
             Sys::SET_TID_ADDRESS => self.sys_set_tid_address(a0.into()),
-            Sys::FUTEX => self.sys_futex(a0, a1 as _, a2 as _, a3.into()).await,
+            Sys::FUTEX => self.sys_futex(a0, a1 as _, a2 as _, a3, a4, a5 as _).await,
             Sys::TKILL => self.unimplemented("tkill", Ok(0)),
 
             // time
@@ -190,6 +209,8 @@ impl Syscall<'_> {
             #[cfg(not(target_arch = "mips"))]
             Sys::SEMOP => self.sys_semop(a0, a1.into(), a2).await,
             #[cfg(not(target_arch = "mips"))]
+            Sys::SEMTIMEDOP => self.sys_semtimedop(a0, a1.into(), a2, a3.into()).await,
+            #[cfg(not(target_arch = "mips"))]
             Sys::SEMCTL => self.sys_semctl(a0, a1, a2, a3),
 
             // shm
@@ -239,10 +260,13 @@ impl Syscall<'_> {
             _ => self.x86_64_syscall(sys_type, args).await,
         };
         info!("<= {:x?}", ret);
-        match ret {
+        let ret = match ret {
             Ok(value) => value as isize,
             Err(err) => -(err as isize),
-        }
+        };
+        SYSCALL_STATS.end(num as usize, begin);
+        ktrace(TraceEvent::SyscallExit, self.thread.id(), ret as u64);
+        ret
     }
 
     #[cfg(target_arch = "x86_64")]
@@ -274,8 +298,11 @@ impl Syscall<'_> {
             Sys::CHOWN => self.unimplemented("chown", Ok(0)),
             Sys::ARCH_PRCTL => self.sys_arch_prctl(a0 as _, a1),
             Sys::TIME => self.sys_time(a0.into()),
-            //            Sys::EPOLL_CREATE => self.sys_epoll_create(a0),
-            //            Sys::EPOLL_WAIT => self.sys_epoll_wait(a0, a1.into(), a2, a3),
+            Sys::EPOLL_CREATE => self.sys_epoll_create(a0 as _),
+            Sys::EPOLL_WAIT => {
+                self.sys_epoll_wait(a0.into(), a1.into(), a2 as _, a3 as _)
+                    .await
+            }
             _ => self.unknown_syscall(sys_type),
         }
     }
@@ -303,4 +330,13 @@ impl Syscall<'_> {
     fn linux_process(&self) -> &LinuxProcess {
         self.zircon_process().linux()
     }
+
+    /// Check that the user buffer of `len` bytes at `addr` is inside the
+    /// address space of the process.
+    fn check_user_range(&self, addr: usize, len: usize) -> LxResult {
+        if len != 0 && !self.zircon_process().vmar().contains_range(addr, len) {
+            return Err(LxError::EFAULT);
+        }
+        Ok(())
+    }
 }
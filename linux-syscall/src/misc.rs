@@ -1,5 +1,8 @@
 use super::*;
 use bitflags::bitflags;
+use core::sync::atomic::{AtomicI32, Ordering};
+use core::time::Duration;
+use kernel_hal::timer_now;
 use linux_object::time::*;
 
 impl Syscall<'_> {
@@ -41,40 +44,88 @@ impl Syscall<'_> {
     /// - `uaddr` - points to the futex word.
     /// - `op` -  the operation to perform on the futex
     /// - `val` -  a value whose meaning and purpose depends on op
-    /// - `timeout` - not support now
-    /// TODO: support timeout
+    /// - `timeout` - the timeout of wait operations, or `val2` of the others
+    /// - `uaddr2` - points to the second futex word of requeue and wake-op
+    /// - `val3` - the bitset of bitset operations, or the operation of wake-op
     pub async fn sys_futex(
         &self,
         uaddr: usize,
         op: u32,
         val: i32,
-        timeout: UserInPtr<TimeSpec>,
+        timeout: usize,
+        uaddr2: usize,
+        val3: u32,
     ) -> SysResult {
-        let op = FutexFlags::from_bits_truncate(op);
         info!(
-            "futex: uaddr: {:#x}, op: {:?}, val: {}, timeout_ptr: {:?}",
-            uaddr, op, val, timeout
+            "futex: uaddr: {:#x}, op: {:#x}, val: {}, timeout: {:#x}, uaddr2: {:#x}, val3: {:#x}",
+            uaddr, op, val, timeout, uaddr2, val3
         );
-        if op.contains(FutexFlags::PRIVATE) {
-            warn!("process-shared futex is unimplemented");
-        }
-        let futex = self.linux_process().get_futex(uaddr);
-        match op.bits & 0xf {
-            0 => {
-                // FIXME: support timeout
-                let _timeout = timeout.read_if_not_null()?;
-                match futex.wait(val).await {
+        let cmd = op & !(FutexFlags::PRIVATE | FutexFlags::CLOCK_REALTIME).bits();
+        let value = futex_word(uaddr)?;
+        let proc = self.thread.proc();
+        let futex = proc.get_futex_at(uaddr)?;
+        match cmd {
+            FUTEX_WAIT | FUTEX_WAIT_BITSET => {
+                let bitset = if cmd == FUTEX_WAIT {
+                    u32::MAX
+                } else if val3 == 0 {
+                    return Err(LxError::EINVAL);
+                } else {
+                    val3
+                };
+                let timeout = UserInPtr::<TimeSpec>::from(timeout).read_if_not_null()?;
+                let deadline = match timeout {
+                    // FUTEX_WAIT_BITSET takes an absolute timeout
+                    Some(t) if cmd == FUTEX_WAIT_BITSET => Duration::from(t),
+                    Some(t) => timer_now() + Duration::from(t),
+                    None => Duration::from_nanos(u64::max_value()),
+                };
+                let future = futex.wait_bitset(value, val, bitset, Some((*self.thread).clone()));
+                let res = self
+                    .thread
+                    .blocking_run(future, ThreadState::BlockedFutex, deadline, None)
+                    .await;
+                match res {
                     Ok(_) => Ok(0),
                     Err(ZxError::BAD_STATE) => Err(LxError::EAGAIN),
-                    Err(e) => Err(e.into()),
+                    Err(ZxError::TIMED_OUT) => Err(LxError::ETIMEDOUT),
+                    Err(_) => Err(LxError::EINTR),
+                }
+            }
+            FUTEX_WAKE => Ok(futex.wake(val as usize)),
+            FUTEX_WAKE_BITSET => {
+                if val3 == 0 {
+                    return Err(LxError::EINVAL);
+                }
+                Ok(futex.wake_bitset(val as usize, val3))
+            }
+            FUTEX_REQUEUE | FUTEX_CMP_REQUEUE => {
+                let check = if cmd == FUTEX_CMP_REQUEUE {
+                    Some((value, val3 as i32))
+                } else {
+                    None
+                };
+                futex_word(uaddr2)?;
+                let requeue_futex = proc.get_futex_at(uaddr2)?;
+                // `timeout` is the max number of waiters to requeue
+                match futex.requeue_checked(check, val as usize, timeout, &requeue_futex, None) {
+                    Ok(count) => Ok(count),
+                    Err(_) => Err(LxError::EAGAIN),
                 }
             }
-            1 => {
-                let woken_up_count = futex.wake(val as usize);
-                Ok(woken_up_count)
+            FUTEX_WAKE_OP => {
+                let value2 = futex_word(uaddr2)?;
+                let futex2 = proc.get_futex_at(uaddr2)?;
+                let old = futex_wake_op(value2, val3)?;
+                let mut count = futex.wake(val as usize);
+                if futex_wake_op_cmp(old, val3)? {
+                    // `timeout` is the max number of waiters to wake on `uaddr2`
+                    count += futex2.wake(timeout);
+                }
+                Ok(count)
             }
             _ => {
-                warn!("unsupported futex operation: {:?}", op);
+                warn!("unsupported futex operation: {:#x}", op);
                 Err(LxError::ENOSYS)
             }
         }
@@ -134,6 +185,59 @@ impl Syscall<'_> {
     }
 }
 
+const FUTEX_WAIT: u32 = 0;
+const FUTEX_WAKE: u32 = 1;
+const FUTEX_REQUEUE: u32 = 3;
+const FUTEX_CMP_REQUEUE: u32 = 4;
+const FUTEX_WAKE_OP: u32 = 5;
+const FUTEX_WAIT_BITSET: u32 = 9;
+const FUTEX_WAKE_BITSET: u32 = 10;
+
+/// Get the futex word at `uaddr`, which must be aligned.
+fn futex_word(uaddr: usize) -> LxResult<&'static AtomicI32> {
+    let ptr = UserInPtr::<AtomicI32>::from(uaddr);
+    ptr.check()?;
+    Ok(ptr.as_ref()?)
+}
+
+/// Apply the operation encoded in `val3` of FUTEX_WAKE_OP to `word`,
+/// return the old value.
+fn futex_wake_op(word: &AtomicI32, val3: u32) -> LxResult<i32> {
+    let op = (val3 >> 28) & 0x7;
+    // sign extend the 12-bit argument
+    let mut oparg = ((val3 << 8) as i32) >> 20;
+    if val3 & (8 << 28) != 0 {
+        if !(0..32).contains(&oparg) {
+            return Err(LxError::EINVAL);
+        }
+        oparg = 1 << oparg;
+    }
+    let f = |old: i32| match op {
+        0 => Some(oparg),
+        1 => Some(old.wrapping_add(oparg)),
+        2 => Some(old | oparg),
+        3 => Some(old & !oparg),
+        4 => Some(old ^ oparg),
+        _ => None,
+    };
+    word.fetch_update(Ordering::SeqCst, Ordering::SeqCst, f)
+        .map_err(|_| LxError::ENOSYS)
+}
+
+/// Compare the old value with the argument encoded in `val3` of FUTEX_WAKE_OP.
+fn futex_wake_op_cmp(old: i32, val3: u32) -> LxResult<bool> {
+    let cmparg = ((val3 << 20) as i32) >> 20;
+    Ok(match (val3 >> 24) & 0xf {
+        0 => old == cmparg,
+        1 => old != cmparg,
+        2 => old < cmparg,
+        3 => old <= cmparg,
+        4 => old > cmparg,
+        5 => old >= cmparg,
+        _ => return Err(LxError::ENOSYS),
+    })
+}
+
 bitflags! {
     /// for op argument in futex()
     struct FutexFlags: u32 {
@@ -145,6 +249,8 @@ bitflags! {
         const WAKE      = 1;
         /// can be employed with all futex operations, tells the kernel that the futex is process-private and not shared with another process
         const PRIVATE   = 0x80;
+        /// measure the timeout of FUTEX_WAIT_BITSET against CLOCK_REALTIME, ignored
+        const CLOCK_REALTIME = 0x100;
     }
 }
 
@@ -12,7 +12,6 @@
 use super::*;
 use bitflags::bitflags;
 use core::fmt::Debug;
-use linux_object::fs::INodeExt;
 use linux_object::loader::LinuxElfLoader;
 use linux_object::thread::{CurrentThreadExt, ThreadExt};
 use linux_object::time::*;
@@ -32,9 +31,15 @@ impl Syscall<'_> {
     /// creates a child process of the calling process, similar to fork but wait for execve
     pub async fn sys_vfork(&self) -> SysResult {
         info!("vfork:");
+        self.vfork(GeneralRegs::new_fork(self.regs)).await
+    }
+
+    /// Create a child process without copying the address space,
+    /// and wait for it to call execve.
+    async fn vfork(&self, regs: GeneralRegs) -> SysResult {
         let new_proc = Process::fork_from(self.zircon_process(), true)?;
         let new_thread = Thread::create_linux(&new_proc)?;
-        new_thread.start_with_regs(GeneralRegs::new_fork(self.regs), self.thread_fn)?;
+        new_thread.start_with_regs(regs, self.thread_fn)?;
 
         let new_proc: Arc<dyn KernelObject> = new_proc;
         info!("vfork: {} -> {}", self.zircon_process().id(), new_proc.id());
@@ -47,7 +52,7 @@ impl Syscall<'_> {
     /// and thread pointer will be set to `newtls`.
     /// The child tid will be stored at both `parent_tid` and `child_tid`.
     /// This is partially implemented for musl only.
-    pub fn sys_clone(
+    pub async fn sys_clone(
         &self,
         flags: usize,
         newsp: usize,
@@ -60,10 +65,17 @@ impl Syscall<'_> {
             "clone: flags={:#x}, newsp={:#x}, parent_tid={:?}, child_tid={:?}, newtls={:#x}",
             flags, newsp, parent_tid, child_tid, newtls
         );
-        if flags == 0x4111 || flags == 0x11 {
+        if flags == 0x4111 {
+            // CLONE_VM | CLONE_VFORK | SIGCHLD: posix_spawn of musl
+            let mut regs = GeneralRegs::new_fork(self.regs);
+            if newsp != 0 {
+                regs.rsp = newsp;
+            }
+            return self.vfork(regs).await;
+        }
+        if flags == 0x11 {
             warn!("sys_clone is calling sys_fork instead, ignoring other args");
-            unimplemented!()
-            //            return self.sys_fork();
+            return self.sys_fork();
         }
         if flags != 0x7d_0f00 && flags != 0x5d_0f00 {
             // 0x5d0f00: gcc of alpine linux
@@ -164,7 +176,6 @@ impl Syscall<'_> {
         // Read program file
         let proc = self.linux_process();
         let inode = proc.lookup_inode(&path)?;
-        let data = inode.read_as_vec()?;
 
         proc.remove_cloexec_files();
 
@@ -175,7 +186,7 @@ impl Syscall<'_> {
             stack_pages: 8,
             root_inode: proc.root_inode().clone(),
         };
-        let (entry, sp) = loader.load(&vmar, &data, args, envs, path.clone())?;
+        let (entry, sp) = loader.load(&vmar, &inode, args, envs, path.clone())?;
 
         // Modify exec path
         proc.set_execute_path(&path);
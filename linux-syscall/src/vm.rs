@@ -1,5 +1,7 @@
 use super::*;
+use alloc::vec::Vec;
 use bitflags::bitflags;
+use linux_object::fs::PageCache;
 use zircon_object::vm::*;
 
 impl Syscall<'_> {
@@ -35,20 +37,70 @@ impl Syscall<'_> {
             vmar.unmap(addr, len)?;
         }
         let vmar_offset = flags.contains(MmapFlags::FIXED).then(|| addr - vmar.addr());
+        // the pages are mapped on the first access where page faults are handled
+        let map = |vmo: Arc<VmObject>, vmo_offset, len, permissions, flags| {
+            vmar.map_ext_past_end(
+                vmar_offset,
+                vmo,
+                vmo_offset,
+                len,
+                permissions,
+                flags,
+                false,
+                !MAP_ON_DEMAND,
+            )
+        };
         if flags.contains(MmapFlags::ANONYMOUS) {
             if flags.contains(MmapFlags::SHARED) {
                 return Err(LxError::EINVAL);
             }
             let vmo = VmObject::new_paged(pages(len));
-            let addr = vmar.map(vmar_offset, vmo.clone(), 0, vmo.len(), prot.to_flags())?;
+            let len = vmo.len();
+            let addr = map(vmo, 0, len, MMUFlags::RXW, prot.to_flags())?;
             Ok(addr)
         } else {
             let file = self.linux_process().get_file(fd)?;
+            if let Ok(cache) = file.page_cache() {
+                if !file.options.read {
+                    return Err(LxError::EACCES);
+                }
+                if offset as usize % PAGE_SIZE != 0 {
+                    return Err(LxError::EINVAL);
+                }
+                let offset = offset as usize;
+                let len = pages(len) * PAGE_SIZE;
+                let addr = if flags.contains(MmapFlags::SHARED) {
+                    // a shared mapping must never write a file not opened for writing
+                    let mut permissions = MMUFlags::RXW;
+                    let mut mmu_flags = prot.to_flags();
+                    if !file.options.write {
+                        if prot.contains(MmapProt::WRITE) {
+                            return Err(LxError::EACCES);
+                        }
+                        permissions -= MMUFlags::WRITE;
+                        mmu_flags -= MMUFlags::WRITE;
+                    }
+                    // the pages beyond the end of file fault, like SIGBUS
+                    let vmo = if mmu_flags.contains(MMUFlags::WRITE) {
+                        cache.vmo_for_shared_write()
+                    } else {
+                        cache.vmo()
+                    };
+                    map(vmo, offset, len, permissions, mmu_flags)?
+                } else {
+                    let vmo = cache.vmo();
+                    let vmo = vmo.create_child(false, offset, len)?;
+                    map(vmo, 0, len, MMUFlags::RXW, prot.to_flags())?
+                };
+                return Ok(addr);
+            }
+            // not a regular file, make a private copy
             let mut buf = vec![0; len];
             let len = file.read_at(offset, &mut buf).await?;
             let vmo = VmObject::new_paged(pages(len));
             vmo.write(0, &buf[..len])?;
-            let addr = vmar.map(vmar_offset, vmo.clone(), 0, vmo.len(), prot.to_flags())?;
+            let len = vmo.len();
+            let addr = map(vmo, 0, len, MMUFlags::RXW, prot.to_flags())?;
             Ok(addr)
         }
     }
@@ -72,11 +124,84 @@ impl Syscall<'_> {
         info!("munmap: addr={:#x}, size={:#x}", addr, len);
         let proc = self.thread.proc();
         let vmar = proc.vmar();
+        let caches = mapped_page_caches(&vmar, addr, len)?;
         vmar.unmap(addr, len)?;
+        // the stores through the mappings are not written back otherwise
+        // if the file is already closed
+        for cache in caches {
+            if let Err(err) = cache.write_back() {
+                warn!("munmap: failed to write back page cache: {:?}", err);
+            }
+        }
+        Ok(0)
+    }
+
+    /// Flushes the changes made to the files mapped shared in the address range
+    /// `[addr, addr + len)` back to the file system.
+    ///
+    /// All of the dirty pages of each file are written back at once.
+    pub fn sys_msync(&self, addr: usize, len: usize, flags: usize) -> SysResult {
+        info!(
+            "msync: addr={:#x}, size={:#x}, flags={:#x}",
+            addr, len, flags
+        );
+        if !page_aligned(addr) {
+            return Err(LxError::EINVAL);
+        }
+        let proc = self.zircon_process();
+        let vmar = proc.vmar();
+        for cache in mapped_page_caches(&vmar, addr, roundup_pages(len))? {
+            cache.write_back()?;
+        }
+        Ok(0)
+    }
+
+    /// Gives advice about the use of memory in the address range `[addr, addr + len)`.
+    ///
+    /// Only the access pattern hints are honoured, by tuning fault-around of the mappings:
+    /// - `MADV_NORMAL` - map the resident neighbours of a faulting page
+    /// - `MADV_RANDOM` - only map the faulting page
+    /// - `MADV_SEQUENTIAL` - also commit the pages following a faulting page
+    /// - `MADV_WILLNEED` - map the range ahead of access
+    pub fn sys_madvise(&self, addr: usize, len: usize, advice: usize) -> SysResult {
+        info!(
+            "madvise: addr={:#x}, size={:#x}, advice={}",
+            addr, len, advice
+        );
+        if !page_aligned(addr) {
+            return Err(LxError::EINVAL);
+        }
+        let len = roundup_pages(len);
+        let proc = self.zircon_process();
+        let vmar = proc.vmar();
+        match advice {
+            MADV_NORMAL => vmar.set_fault_around(addr, len, DEFAULT_FAULT_AROUND_PAGES, false)?,
+            MADV_RANDOM => vmar.set_fault_around(addr, len, 1, false)?,
+            MADV_SEQUENTIAL => {
+                vmar.set_fault_around(addr, len, DEFAULT_FAULT_AROUND_PAGES, true)?
+            }
+            MADV_WILLNEED => vmar.populate(addr, len)?,
+            _ => warn!("madvise: unsupported advice {}", advice),
+        }
         Ok(0)
     }
 }
 
+/// Get the page caches of the files mapped within `[addr, addr + len)`.
+fn mapped_page_caches(
+    vmar: &Arc<VmAddressRegion>,
+    addr: usize,
+    len: usize,
+) -> LxResult<Vec<Arc<PageCache>>> {
+    let vmos = vmar.mapped_vmos(addr, len)?;
+    Ok(vmos.iter().filter_map(PageCache::of_vmo).collect())
+}
+
+const MADV_NORMAL: usize = 0;
+const MADV_RANDOM: usize = 1;
+const MADV_SEQUENTIAL: usize = 2;
+const MADV_WILLNEED: usize = 3;
+
 bitflags! {
     /// for the flag argument in mmap()
     pub struct MmapFlags: usize {
@@ -0,0 +1,70 @@
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <assert.h>
+
+int main()
+{
+    int p1[2], p2[2];
+    char buf[8];
+    struct epoll_event ev, events[4];
+
+    assert(pipe(p1) == 0);
+    assert(pipe(p2) == 0);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    assert(epfd >= 0);
+
+    // p1 is level-triggered, p2 is edge-triggered
+    ev.events = EPOLLIN;
+    ev.data.u64 = 1;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, p1[0], &ev) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, p1[0], &ev) == -1);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.u64 = 2;
+    assert(epoll_ctl(epfd, EPOLL_CTL_ADD, p2[0], &ev) == 0);
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    assert(write(p1[1], "a", 1) == 1);
+    assert(write(p2[1], "b", 1) == 1);
+    int n = epoll_wait(epfd, events, 4, 100);
+    assert(n == 2);
+    assert(events[0].data.u64 + events[1].data.u64 == 3);
+    assert(events[0].events == EPOLLIN && events[1].events == EPOLLIN);
+
+    // only the level-triggered one is reported again
+    n = epoll_wait(epfd, events, 4, 0);
+    assert(n == 1 && events[0].data.u64 == 1);
+    assert(read(p1[0], buf, sizeof(buf)) == 1);
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    // more data reports the edge-triggered one again
+    assert(write(p2[1], "c", 1) == 1);
+    n = epoll_wait(epfd, events, 4, 0);
+    assert(n == 1 && events[0].data.u64 == 2);
+    assert(read(p2[0], buf, 1) == 1);
+
+    // timeout
+    assert(epoll_wait(epfd, events, 4, 10) == 0);
+
+    // oneshot is disabled after one event until modified
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.u64 = 3;
+    assert(epoll_ctl(epfd, EPOLL_CTL_MOD, p2[0], &ev) == 0);
+    n = epoll_wait(epfd, events, 4, 0);
+    assert(n == 1 && events[0].data.u64 == 3);
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, p2[0], NULL) == 0);
+    assert(epoll_ctl(epfd, EPOLL_CTL_DEL, p2[0], NULL) == -1);
+    assert(write(p2[1], "d", 1) == 1);
+    assert(epoll_wait(epfd, events, 4, 0) == 0);
+
+    close(epfd);
+    close(p1[0]);
+    close(p1[1]);
+    close(p2[0]);
+    close(p2[1]);
+    printf("test epoll ok\n");
+    return 0;
+}
@@ -0,0 +1,74 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <assert.h>
+
+int main()
+{
+    int p[2];
+    assert(pipe2(p, O_CLOEXEC) == 0);
+    assert(p[0] == 3 && p[1] == 4);
+
+    // the close-on-exec flag belongs to the fd, dup does not copy it
+    assert(fcntl(p[0], F_GETFD) == FD_CLOEXEC);
+    int fd = dup(p[0]);
+    assert(fd == 5);
+    assert(fcntl(fd, F_GETFD) == 0);
+    assert(fcntl(fd, F_SETFD, FD_CLOEXEC) == 0);
+    assert(fcntl(fd, F_GETFD) == FD_CLOEXEC);
+    assert(fcntl(p[0], F_SETFD, 0) == 0);
+    assert(fcntl(p[0], F_GETFD) == 0);
+
+    // the lowest free fd is reused
+    assert(close(p[0]) == 0);
+    assert(dup(p[1]) == 3);
+    assert(dup2(p[1], 10) == 10);
+    assert(dup(p[1]) == 6);
+    assert(close(3) == 0 && close(6) == 0);
+
+    errno = 0;
+    assert(close(8) == -1 && errno == EBADF);
+    assert(fcntl(8, F_GETFD) == -1 && errno == EBADF);
+
+    // the child gets a copy of the table
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        assert(close(10) == 0);
+        assert(dup(p[1]) == 3);
+        _exit(0);
+    }
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(fcntl(10, F_GETFD) == 0);
+    assert(fcntl(3, F_GETFD) == -1);
+
+    close(10);
+    close(fd);
+
+    // a full table fails with EMFILE, a descriptor beyond the limit with EBADF
+    struct rlimit old, lim;
+    assert(getrlimit(RLIMIT_NOFILE, &old) == 0);
+    lim.rlim_cur = 5;
+    lim.rlim_max = old.rlim_max;
+    assert(setrlimit(RLIMIT_NOFILE, &lim) == 0);
+    assert(dup(p[1]) == 3);
+    errno = 0;
+    assert(dup(p[1]) == -1 && errno == EMFILE);
+    int q[2];
+    errno = 0;
+    assert(pipe(q) == -1 && errno == EMFILE);
+    errno = 0;
+    assert(dup2(p[1], 5) == -1 && errno == EBADF);
+    assert(dup2(p[1], 3) == 3);
+    assert(close(3) == 0);
+    assert(setrlimit(RLIMIT_NOFILE, &old) == 0);
+
+    close(p[1]);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <assert.h>
+
+static long futex(int *uaddr, int op, int val, void *timeout, int *uaddr2, int val3)
+{
+    return syscall(SYS_futex, uaddr, op, val, timeout, uaddr2, val3);
+}
+
+int main()
+{
+    int word = 0, word2 = 1;
+    struct timespec ts = {0, 10 * 1000 * 1000};
+
+    // mismatched value and timeout
+    assert(futex(&word, FUTEX_WAIT, 1, NULL, NULL, 0) == -1 && errno == EAGAIN);
+    assert(futex(&word, FUTEX_WAIT, 0, &ts, NULL, 0) == -1 && errno == ETIMEDOUT);
+    assert(futex(&word, FUTEX_WAIT_BITSET, 0, NULL, NULL, 0) == -1 && errno == EINVAL);
+    assert(futex(&word, FUTEX_WAKE, 1, NULL, NULL, 0) == 0);
+
+    // word2 += 2 if word2 == 1
+    int op = FUTEX_OP(FUTEX_OP_ADD, 2, FUTEX_OP_CMP_EQ, 1);
+    assert(futex(&word, FUTEX_WAKE_OP, 1, (void *)1, &word2, op) == 0);
+    assert(word2 == 3);
+
+    // a futex in shared memory is shared with another process
+    int shmid = shmget(IPC_PRIVATE, 4096, IPC_CREAT | 0600);
+    assert(shmid >= 0);
+    int *shared = (int *)shmat(shmid, NULL, 0);
+    assert(shared != (int *)-1);
+    *shared = 0;
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // attach it again, maybe at another address
+        int *child = (int *)shmat(shmid, NULL, 0);
+        if (child == (int *)-1)
+            _exit(1);
+        while (*child == 0)
+            futex(child, FUTEX_WAIT, 0, NULL, NULL, 0);
+        _exit(*child == 1 ? 0 : 1);
+    }
+    usleep(10 * 1000);
+    *shared = 1;
+    futex(shared, FUTEX_WAKE, 1, NULL, NULL, 0);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(shmdt(shared) == 0);
+    assert(shmctl(shmid, IPC_RMID, NULL) == 0);
+
+    printf("futex test passed\n");
+    return 0;
+}
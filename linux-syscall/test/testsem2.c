@@ -1,6 +1,7 @@
 #ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE 700
 #endif
+#define _GNU_SOURCE
 #include <errno.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +35,17 @@ static void dec()
 	T(semval = semctl(semid, 0, GETVAL));
 	assert(semval == 0);
 
+	/* test IPC_NOWAIT and semtimedop */
+	struct timespec timeout = {0, 10000000};
+	sops.sem_flg = IPC_NOWAIT;
+	errno = 0;
+	assert(semop(semid, &sops, 1) == -1 && errno == EAGAIN);
+	sops.sem_flg = 0;
+	errno = 0;
+	assert(semtimedop(semid, &sops, 1, &timeout) == -1 && errno == EAGAIN);
+	T(semval = semctl(semid, 0, GETVAL));
+	assert(semval == 0);
+
 	/* cleanup */
 	T(semctl(semid, 0, IPC_RMID));
 }
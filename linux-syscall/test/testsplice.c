@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+
+// a small write blocks until all of it fits into a nearly full pipe
+static void nearly_full()
+{
+    static char data[4096];
+    int p[2];
+
+    // it is not split
+    assert(pipe2(p, O_NONBLOCK) == 0);
+    assert(fcntl(p[1], F_SETPIPE_SZ, 4096) == 4096);
+    assert(write(p[1], data, 4000) == 4000);
+    errno = 0;
+    assert(write(p[1], data, 200) == -1 && errno == EAGAIN);
+    close(p[0]);
+    close(p[1]);
+
+    assert(pipe(p) == 0);
+    assert(fcntl(p[1], F_SETPIPE_SZ, 4096) == 4096);
+    assert(write(p[1], data, 4000) == 4000);
+
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) {
+        // not enough space yet, the writer keeps waiting
+        usleep(10000);
+        assert(read(p[0], data, 50) == 50);
+        usleep(10000);
+        assert(read(p[0], data, 3950) == 3950);
+        assert(read(p[0], data, 200) == 200);
+        _exit(0);
+    }
+    assert(write(p[1], data, 200) == 200);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    close(p[0]);
+    close(p[1]);
+}
+
+int main()
+{
+    int p1[2], p2[2];
+    char buf[32];
+    const char *msg = "hello splice";
+    int len = strlen(msg);
+
+    assert(pipe(p1) == 0);
+    assert(pipe(p2) == 0);
+
+    // the default capacity is 64 KiB, and can be changed
+    assert(fcntl(p1[0], F_GETPIPE_SZ) == 65536);
+    assert(fcntl(p1[1], F_SETPIPE_SZ, 4096 + 1) == 8192);
+    assert(fcntl(p1[0], F_GETPIPE_SZ) == 8192);
+
+    // vmsplice user memory into the pipe
+    struct iovec iov = {(void *)msg, len};
+    assert(vmsplice(p1[1], &iov, 1, 0) == len);
+
+    // tee keeps the data in p1
+    assert(tee(p1[0], p2[1], len, 0) == len);
+    memset(buf, 0, sizeof(buf));
+    assert(read(p2[0], buf, sizeof(buf)) == len);
+    assert(strcmp(buf, msg) == 0);
+
+    // splice from pipe to file, then from file back to pipe
+    int fd = open("testsplice.tmp", O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+    assert(splice(p1[0], NULL, fd, NULL, len, 0) == len);
+    loff_t off = 0;
+    assert(splice(fd, &off, p2[1], NULL, len, 0) == len);
+    assert(off == len);
+    memset(buf, 0, sizeof(buf));
+    assert(read(p2[0], buf, sizeof(buf)) == len);
+    assert(strcmp(buf, msg) == 0);
+    close(fd);
+    unlink("testsplice.tmp");
+
+    close(p1[0]);
+    close(p1[1]);
+    close(p2[0]);
+    close(p2[1]);
+
+    nearly_full();
+    return 0;
+}
@@ -0,0 +1,100 @@
+import datetime
+import glob
+import json
+import os
+import subprocess
+import sys
+
+# Run the benchmarks and append their results to RESULT_FILE, one JSON record per run.
+#
+# usage: python3 bench.py [libos|qemu|zircon] [scale]
+#
+# - libos: the Linux benchmarks in linux-syscall/bench, on linux-loader
+# - qemu: the same benchmarks on bare-metal zCore, needs `make image` first
+# - zircon: the round-trip benchmarks of zircon-object, on the host
+
+# ===============Must Config========================
+
+TIMEOUT = 600  # seconds
+ZCORE_PATH = '../zCore'
+BASE = 'bench/'
+OUTPUT_FILE = BASE + 'bench-output.txt'
+RESULT_FILE = BASE + 'bench-results.jsonl'
+
+# ==============================================
+
+mode = sys.argv[1] if len(sys.argv) > 1 else 'libos'
+scale = sys.argv[2] if len(sys.argv) > 2 else '1'
+
+
+def parse(output):
+    results = []
+    for line in output.splitlines():
+        line = line.strip()
+        if not line.startswith('{"bench"'):
+            continue
+        try:
+            results.append(json.loads(line))
+        except ValueError:
+            pass
+    return results
+
+
+def run_libos():
+    output = ''
+    for path in sorted(glob.glob('../rootfs/bin/bench*')):
+        path = path[len('../rootfs'):]
+        if path.endswith('.sh'):
+            continue
+        proc = subprocess.run('cd .. && cargo run --release -p linux-loader -- %s %s' % (path, scale),
+                              shell=True, timeout=TIMEOUT, stdout=subprocess.PIPE, universal_newlines=True)
+        output += proc.stdout
+    return output
+
+
+def run_qemu():
+    import pexpect
+    child = pexpect.spawn('make -C %s bench linux=1 mode=release bench_scale=%s' % (ZCORE_PATH, scale),
+                          timeout=TIMEOUT, encoding='utf-8')
+    index = child.expect(['bench finished!', 'panicked', pexpect.EOF, pexpect.TIMEOUT])
+    output = child.before
+    child.close(force=True)
+    if index != 0:
+        print(['FINISHED', 'PANICKED', 'EOF', 'TIMEOUT'][index])
+    return output
+
+
+def run_zircon():
+    proc = subprocess.run('cd .. && cargo test --release -p zircon-object -- --ignored --nocapture'
+                          ' --test-threads=1 bench_',
+                          shell=True, timeout=TIMEOUT, stdout=subprocess.PIPE, universal_newlines=True)
+    return proc.stdout
+
+
+runners = {'libos': run_libos, 'qemu': run_qemu, 'zircon': run_zircon}
+if mode not in runners:
+    print('unknown mode:', mode)
+    exit(1)
+
+os.makedirs(BASE, exist_ok=True)
+output = runners[mode]()
+with open(OUTPUT_FILE, 'w') as f:
+    f.write(output)
+
+results = parse(output)
+rev = subprocess.run('git rev-parse --short HEAD', shell=True,
+                     stdout=subprocess.PIPE, universal_newlines=True).stdout.strip()
+record = {
+    'time': datetime.datetime.now().isoformat(timespec='seconds'),
+    'rev': rev,
+    'mode': mode,
+    'results': results,
+}
+with open(RESULT_FILE, 'a') as f:
+    print(json.dumps(record), file=f)
+
+for result in results:
+    print('%-28s %14.3f %s' % (result['bench'], result['value'], result['unit']))
+if not results:
+    print('No benchmark results, see', OUTPUT_FILE)
+    exit(1)
@@ -0,0 +1,247 @@
+//! Kernel heap
+//!
+//! Small objects are served by per-CPU caches of size-class slabs, which are
+//! carved from frames. Larger ones go to a buddy heap, which starts with a
+//! static area for booting and grows from the frame allocator when it is full.
+
+use {
+    crate::memory::{
+        hal_frame_alloc, hal_frame_alloc_contiguous, PAGE_SIZE, PHYSICAL_MEMORY_OFFSET,
+    },
+    buddy_system_allocator::LockedHeap,
+    core::alloc::{GlobalAlloc, Layout},
+    core::ptr::{null_mut, NonNull},
+    kernel_hal_bare::{cpu_id, MAX_CPU_NUM},
+    spin::Mutex,
+    zircon_object::util::kcounter::KCounter,
+};
+
+/// Size of the static heap used before the frame allocator is ready.
+const BOOT_HEAP_SIZE: usize = 16 * 1024 * 1024; // 16 MB
+/// Minimum size added to the buddy heap each time it grows.
+const HEAP_GROW_SIZE: usize = 4 * 1024 * 1024; // 4 MB
+
+/// Capacity of the free list of each CPU in each slab cache.
+const CPU_CACHE_SIZE: usize = 64;
+/// Number of objects moved between a CPU free list and the shared one at once.
+const CPU_CACHE_BATCH: usize = CPU_CACHE_SIZE / 2;
+
+/// A slab cache of objects of `size` bytes, aligned to `size`.
+struct SizeClass {
+    size: usize,
+    /// Number of objects allocated.
+    live: &'static KCounter,
+    /// Number of pages carved into objects.
+    pages: &'static KCounter,
+}
+
+const CLASS_NUM: usize = 8;
+
+macro_rules! size_classes {
+    ($($size:literal => $live:ident, $pages:ident;)*) => {
+        $(
+            zircon_object::kcounter!($live, concat!("heap.slab", stringify!($size), ".live"));
+            zircon_object::kcounter!($pages, concat!("heap.slab", stringify!($size), ".pages"));
+        )*
+        static SIZE_CLASSES: [SizeClass; CLASS_NUM] = [$(SizeClass {
+            size: $size,
+            live: &$live,
+            pages: &$pages,
+        },)*];
+    };
+}
+
+size_classes! {
+    16 => SLAB16_LIVE, SLAB16_PAGES;
+    32 => SLAB32_LIVE, SLAB32_PAGES;
+    64 => SLAB64_LIVE, SLAB64_PAGES;
+    128 => SLAB128_LIVE, SLAB128_PAGES;
+    256 => SLAB256_LIVE, SLAB256_PAGES;
+    512 => SLAB512_LIVE, SLAB512_PAGES;
+    1024 => SLAB1024_LIVE, SLAB1024_PAGES;
+    2048 => SLAB2048_LIVE, SLAB2048_PAGES;
+}
+
+zircon_object::kcounter!(HEAP_GROW_BYTES, "heap.grow_bytes");
+
+/// Get the slab cache for `layout`, or `None` if it is too large.
+fn class_of(layout: &Layout) -> Option<usize> {
+    let size = layout.size().max(layout.align()).max(SIZE_CLASSES[0].size);
+    if size > SIZE_CLASSES[CLASS_NUM - 1].size {
+        return None;
+    }
+    let class = size.next_power_of_two().trailing_zeros() - SIZE_CLASSES[0].size.trailing_zeros();
+    Some(class as usize)
+}
+
+/// A free object, which links to the next one.
+struct FreeObject {
+    next: *mut FreeObject,
+}
+
+/// A singly linked list of free objects.
+struct FreeList {
+    head: *mut FreeObject,
+    len: usize,
+}
+
+// Objects in the list are only accessed with the list locked.
+unsafe impl Send for FreeList {}
+
+impl FreeList {
+    const EMPTY: Self = FreeList {
+        head: null_mut(),
+        len: 0,
+    };
+
+    unsafe fn push(&mut self, ptr: *mut u8) {
+        let obj = ptr as *mut FreeObject;
+        (*obj).next = self.head;
+        self.head = obj;
+        self.len += 1;
+    }
+
+    unsafe fn pop(&mut self) -> Option<*mut u8> {
+        if self.head.is_null() {
+            return None;
+        }
+        let obj = self.head;
+        self.head = (*obj).next;
+        self.len -= 1;
+        Some(obj as *mut u8)
+    }
+
+    /// Move at most `n` objects to `other`.
+    unsafe fn move_to(&mut self, other: &mut FreeList, n: usize) {
+        for _ in 0..n {
+            match self.pop() {
+                Some(ptr) => other.push(ptr),
+                None => break,
+            }
+        }
+    }
+}
+
+/// Free lists of slab caches cached by one CPU.
+struct CpuCache {
+    lists: [FreeList; CLASS_NUM],
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_CPU_CACHE: Mutex<CpuCache> = Mutex::new(CpuCache {
+    lists: [FreeList::EMPTY; CLASS_NUM],
+});
+/// The cache of each CPU, indexed by `cpu_id`, which is 0 before the HAL is
+/// initialized, when only the bootstrap CPU runs.
+static CPU_CACHES: [Mutex<CpuCache>; MAX_CPU_NUM] = [EMPTY_CPU_CACHE; MAX_CPU_NUM];
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_FREE_LIST: Mutex<FreeList> = Mutex::new(FreeList::EMPTY);
+/// Free objects shared by all CPUs, in front of new slabs.
+static SHARED_LISTS: [Mutex<FreeList>; CLASS_NUM] = [EMPTY_FREE_LIST; CLASS_NUM];
+
+/// The heap for objects larger than any slab cache.
+static BUDDY_HEAP: LockedHeap = LockedHeap::new();
+
+/// Global heap allocator
+///
+/// Available after `heap::init()`.
+#[global_allocator]
+static HEAP_ALLOCATOR: KernelHeap = KernelHeap;
+
+struct KernelHeap;
+
+unsafe impl GlobalAlloc for KernelHeap {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        match class_of(&layout) {
+            Some(class) => slab_alloc(class),
+            None => buddy_alloc(layout),
+        }
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        match class_of(&layout) {
+            Some(class) => slab_dealloc(class, ptr),
+            None => BUDDY_HEAP
+                .lock()
+                .dealloc(NonNull::new_unchecked(ptr), layout),
+        }
+    }
+}
+
+unsafe fn slab_alloc(class: usize) -> *mut u8 {
+    let mut cache = CPU_CACHES[cpu_id()].lock();
+    let list = &mut cache.lists[class];
+    if list.len == 0 {
+        SHARED_LISTS[class].lock().move_to(list, CPU_CACHE_BATCH);
+    }
+    if list.len == 0 {
+        new_slab(class, list);
+    }
+    match list.pop() {
+        Some(ptr) => {
+            SIZE_CLASSES[class].live.add(1);
+            ptr
+        }
+        None => null_mut(),
+    }
+}
+
+unsafe fn slab_dealloc(class: usize, ptr: *mut u8) {
+    let mut cache = CPU_CACHES[cpu_id()].lock();
+    let list = &mut cache.lists[class];
+    if list.len == CPU_CACHE_SIZE {
+        list.move_to(&mut SHARED_LISTS[class].lock(), CPU_CACHE_BATCH);
+    }
+    list.push(ptr);
+    SIZE_CLASSES[class].live.sub(1);
+}
+
+/// Carve a new page into objects of `class` and put them into `list`.
+///
+/// Pages are never returned, they are reused by the same cache.
+unsafe fn new_slab(class: usize, list: &mut FreeList) {
+    let page = match hal_frame_alloc() {
+        Some(paddr) => paddr + PHYSICAL_MEMORY_OFFSET,
+        // the frame allocator is not ready during boot
+        None => buddy_alloc(Layout::from_size_align_unchecked(PAGE_SIZE, PAGE_SIZE)) as usize,
+    };
+    if page == 0 {
+        return;
+    }
+    let size = SIZE_CLASSES[class].size;
+    for offset in (0..PAGE_SIZE).step_by(size).rev() {
+        list.push((page + offset) as *mut u8);
+    }
+    SIZE_CLASSES[class].pages.add(1);
+}
+
+unsafe fn buddy_alloc(layout: Layout) -> *mut u8 {
+    let mut heap = BUDDY_HEAP.lock();
+    if let Ok(ptr) = heap.alloc(layout) {
+        return ptr.as_ptr();
+    }
+    // add at least the whole layout, whose alignment may not hold for the start
+    let size = (layout.size() + layout.align()).max(HEAP_GROW_SIZE);
+    let pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    let paddr = match hal_frame_alloc_contiguous(pages, 0) {
+        Some(paddr) => paddr,
+        None => return null_mut(),
+    };
+    let start = paddr + PHYSICAL_MEMORY_OFFSET;
+    heap.add_to_heap(start, start + pages * PAGE_SIZE);
+    HEAP_GROW_BYTES.add(pages * PAGE_SIZE);
+    heap.alloc(layout).map_or(null_mut(), |ptr| ptr.as_ptr())
+}
+
+pub fn init() {
+    const MACHINE_ALIGN: usize = core::mem::size_of::<usize>();
+    const HEAP_BLOCK: usize = BOOT_HEAP_SIZE / MACHINE_ALIGN;
+    static mut HEAP: [usize; HEAP_BLOCK] = [0; HEAP_BLOCK];
+    unsafe {
+        BUDDY_HEAP
+            .lock()
+            .init(HEAP.as_ptr() as usize, HEAP_BLOCK * MACHINE_ALIGN);
+    }
+    info!("heap init end");
+}
@@ -13,6 +13,7 @@ extern crate rlibc_opt;
 
 #[macro_use]
 mod logging;
+mod heap;
 mod lang;
 mod memory;
 
@@ -23,7 +24,7 @@ pub use memory::{hal_frame_alloc, hal_frame_dealloc, hal_pt_map_kernel};
 #[no_mangle]
 pub extern "C" fn _start(boot_info: &BootInfo) -> ! {
     logging::init(get_log_level(boot_info.cmdline));
-    memory::init_heap();
+    heap::init();
     memory::init_frame_allocator(boot_info);
     #[cfg(feature = "graphic")]
     init_framebuffer(boot_info);
@@ -57,7 +58,7 @@ fn main(ramfs_data: &[u8], cmdline: &str) {
 }
 
 #[cfg(feature = "linux")]
-fn main(ramfs_data: &'static mut [u8], _cmdline: &str) {
+fn main(ramfs_data: &'static mut [u8], cmdline: &str) {
     use alloc::boxed::Box;
     use alloc::sync::Arc;
     use alloc::vec;
@@ -76,7 +77,11 @@ fn main(ramfs_data: &'static mut [u8], _cmdline: &str) {
         }
     }));
 
-    let args = vec!["/bin/busybox".into(), "sh".into()];
+    let args = match get_cmdline_value(cmdline, "ROOTPROC") {
+        // the path and arguments of the first process, separated by '?'
+        Some(rootproc) => rootproc.split('?').map(Into::into).collect(),
+        None => vec!["/bin/busybox".into(), "sh".into()],
+    };
     let envs = vec!["PATH=/usr/sbin:/usr/bin:/sbin:/bin:/usr/x86_64-alpine-linux-musl/bin".into()];
 
     let device = Arc::new(MemBuf::new(ramfs_data));
@@ -87,23 +92,27 @@ fn main(ramfs_data: &'static mut [u8], _cmdline: &str) {
 
 fn run() -> ! {
     loop {
-        executor::run_until_idle();
+        kernel_hal_bare::executor::run_until_idle();
         x86_64::instructions::interrupts::enable_and_hlt();
         x86_64::instructions::interrupts::disable();
     }
 }
 
 fn get_log_level(cmdline: &str) -> &str {
+    get_cmdline_value(cmdline, "LOG").unwrap_or("")
+}
+
+fn get_cmdline_value<'a>(cmdline: &'a str, key: &str) -> Option<&'a str> {
     for opt in cmdline.split(':') {
         // parse 'key=value'
         let mut iter = opt.trim().splitn(2, '=');
-        let key = iter.next().expect("failed to parse key");
+        let k = iter.next().expect("failed to parse key");
         let value = iter.next().expect("failed to parse value");
-        if key == "LOG" {
-            return value;
+        if k == key {
+            return Some(value);
         }
     }
-    ""
+    None
 }
 
 #[cfg(feature = "graphic")]
@@ -3,7 +3,7 @@
 
 use {
     bitmap_allocator::BitAlloc,
-    buddy_system_allocator::LockedHeap,
+    kernel_hal_bare::MAX_CPU_NUM,
     rboot::{BootInfo, MemoryType},
     spin::Mutex,
     x86_64::structures::paging::page_table::{PageTable, PageTableFlags as EF},
@@ -14,15 +14,86 @@ type FrameAlloc = bitmap_allocator::BitAlloc16M;
 
 static FRAME_ALLOCATOR: Mutex<FrameAlloc> = Mutex::new(FrameAlloc::DEFAULT);
 
+/// Capacity of the frame cache of each CPU.
+const FRAME_CACHE_SIZE: usize = 64;
+/// Number of frames moved between a CPU cache and `FRAME_ALLOCATOR` at once.
+const FRAME_CACHE_BATCH: usize = FRAME_CACHE_SIZE / 2;
+
+/// Free frame numbers cached by one CPU in front of `FRAME_ALLOCATOR`,
+/// so that most allocations do not touch the global bitmap lock.
+struct FrameCache {
+    frames: [usize; FRAME_CACHE_SIZE],
+    len: usize,
+}
+
+impl FrameCache {
+    const EMPTY: Self = FrameCache {
+        frames: [0; FRAME_CACHE_SIZE],
+        len: 0,
+    };
+
+    fn alloc(&mut self) -> Option<usize> {
+        if self.len == 0 {
+            let mut global = FRAME_ALLOCATOR.lock();
+            while self.len < FRAME_CACHE_BATCH {
+                match global.alloc() {
+                    Some(id) => self.push(id),
+                    None => break,
+                }
+            }
+        }
+        if self.len == 0 {
+            return None;
+        }
+        self.len -= 1;
+        Some(self.frames[self.len])
+    }
+
+    fn dealloc(&mut self, id: usize) {
+        if self.len == FRAME_CACHE_SIZE {
+            let mut global = FRAME_ALLOCATOR.lock();
+            while self.len > FRAME_CACHE_SIZE - FRAME_CACHE_BATCH {
+                self.len -= 1;
+                global.dealloc(self.frames[self.len]);
+            }
+        }
+        self.push(id);
+    }
+
+    fn push(&mut self, id: usize) {
+        self.frames[self.len] = id;
+        self.len += 1;
+    }
+
+    /// Return all cached frames to `global`.
+    fn drain(&mut self, global: &mut FrameAlloc) {
+        for &id in self.frames[..self.len].iter() {
+            global.dealloc(id);
+        }
+        self.len = 0;
+    }
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_FRAME_CACHE: Mutex<FrameCache> = Mutex::new(FrameCache::EMPTY);
+static FRAME_CACHES: [Mutex<FrameCache>; MAX_CPU_NUM] = [EMPTY_FRAME_CACHE; MAX_CPU_NUM];
+
+/// Get the frame cache of current CPU.
+///
+/// `cpu_id` reads the index cached in `IA32_TSC_AUX`, not the local APIC,
+/// so it is cheap enough to call on every frame allocation and free.
+fn local_frame_cache() -> &'static Mutex<FrameCache> {
+    &FRAME_CACHES[kernel_hal_bare::cpu_id()]
+}
+
 const MEMORY_OFFSET: usize = 0;
 const KERNEL_OFFSET: usize = 0xffffff00_00000000;
-const PHYSICAL_MEMORY_OFFSET: usize = 0xffff8000_00000000;
-const KERNEL_HEAP_SIZE: usize = 16 * 1024 * 1024; // 16 MB
+pub const PHYSICAL_MEMORY_OFFSET: usize = 0xffff8000_00000000;
 
 const KERNEL_PM4: usize = (KERNEL_OFFSET >> 39) & 0o777;
 const PHYSICAL_MEMORY_PM4: usize = (PHYSICAL_MEMORY_OFFSET >> 39) & 0o777;
 
-const PAGE_SIZE: usize = 1 << 12;
+pub const PAGE_SIZE: usize = 1 << 12;
 
 #[used]
 #[export_name = "hal_pmem_base"]
@@ -40,23 +111,11 @@ pub fn init_frame_allocator(boot_info: &BootInfo) {
     info!("Frame allocator init end");
 }
 
-pub fn init_heap() {
-    const MACHINE_ALIGN: usize = core::mem::size_of::<usize>();
-    const HEAP_BLOCK: usize = KERNEL_HEAP_SIZE / MACHINE_ALIGN;
-    static mut HEAP: [usize; HEAP_BLOCK] = [0; HEAP_BLOCK];
-    unsafe {
-        HEAP_ALLOCATOR
-            .lock()
-            .init(HEAP.as_ptr() as usize, HEAP_BLOCK * MACHINE_ALIGN);
-    }
-    info!("heap init end");
-}
-
 #[no_mangle]
 #[allow(improper_ctypes_definitions)]
 pub extern "C" fn hal_frame_alloc() -> Option<usize> {
     // get the real address of the alloc frame
-    let ret = FRAME_ALLOCATOR
+    let ret = local_frame_cache()
         .lock()
         .alloc()
         .map(|id| id * PAGE_SIZE + MEMORY_OFFSET);
@@ -64,13 +123,53 @@ pub extern "C" fn hal_frame_alloc() -> Option<usize> {
     ret
 }
 
+#[no_mangle]
+#[allow(improper_ctypes_definitions)]
+pub extern "C" fn hal_frame_alloc_many(paddrs: &mut [usize]) -> bool {
+    let mut cache = local_frame_cache().lock();
+    let from_cache = cache.len.min(paddrs.len());
+    for paddr in paddrs[..from_cache].iter_mut() {
+        cache.len -= 1;
+        *paddr = cache.frames[cache.len] * PAGE_SIZE + MEMORY_OFFSET;
+    }
+    let mut global = FRAME_ALLOCATOR.lock();
+    let mut filled = from_cache;
+    while filled < paddrs.len() {
+        match global.alloc() {
+            Some(id) => {
+                paddrs[filled] = id * PAGE_SIZE + MEMORY_OFFSET;
+                filled += 1;
+            }
+            None => {
+                // roll back, so that the caller gets all frames or nothing
+                for paddr in paddrs[..filled].iter() {
+                    global.dealloc((paddr - MEMORY_OFFSET) / PAGE_SIZE);
+                }
+                return false;
+            }
+        }
+    }
+    trace!("Allocate {} frames", paddrs.len());
+    true
+}
+
 #[no_mangle]
 #[allow(improper_ctypes_definitions)]
 pub extern "C" fn hal_frame_alloc_contiguous(page_num: usize, align_log2: usize) -> Option<usize> {
-    let ret = FRAME_ALLOCATOR
+    let mut ret = FRAME_ALLOCATOR
         .lock()
-        .alloc_contiguous(page_num, align_log2)
-        .map(|id| id * PAGE_SIZE + MEMORY_OFFSET);
+        .alloc_contiguous(page_num, align_log2);
+    if ret.is_none() {
+        // cached frames may be what breaks up a contiguous range
+        for cache in FRAME_CACHES.iter() {
+            let mut cache = cache.lock();
+            cache.drain(&mut FRAME_ALLOCATOR.lock());
+        }
+        ret = FRAME_ALLOCATOR
+            .lock()
+            .alloc_contiguous(page_num, align_log2);
+    }
+    let ret = ret.map(|id| id * PAGE_SIZE + MEMORY_OFFSET);
     trace!(
         "Allocate contiguous frames: {:x?} ~ {:x?}",
         ret,
@@ -82,7 +181,7 @@ pub extern "C" fn hal_frame_alloc_contiguous(page_num: usize, align_log2: usize)
 #[no_mangle]
 pub extern "C" fn hal_frame_dealloc(target: &usize) {
     trace!("Deallocate frame: {:x}", *target);
-    FRAME_ALLOCATOR
+    local_frame_cache()
         .lock()
         .dealloc((*target - MEMORY_OFFSET) / PAGE_SIZE);
 }
@@ -126,9 +225,3 @@ mod rvm_extern_fn {
         vector == 36 // IRQ0 + COM1 in kernel-hal-bare/src/arch/x86_64/interrupt.rs
     }
 }
-
-/// Global heap allocator
-///
-/// Available after `memory::init_heap()`.
-#[global_allocator]
-static HEAP_ALLOCATOR: LockedHeap = LockedHeap::new();
@@ -11,38 +11,35 @@ pub fn create_kcounter_vmo() -> (Arc<VmObject>, Arc<VmObject>) {
     const HEADER_SIZE: usize = size_of::<KCounterVmoHeader>();
     const DESC_SIZE: usize = size_of::<KCounterDescItem>();
     let descriptors = KCounterDescriptorArray::get();
-    let counter_table_size = descriptors.0.len() * DESC_SIZE;
+    // a descriptor for each index of the arena, unused ones have empty names
+    let counter_table_size = KCOUNTER_MAX * DESC_SIZE;
     let counter_name_vmo = VmObject::new_paged(pages(counter_table_size + HEADER_SIZE));
     let header = KCounterVmoHeader {
         magic: KCOUNTER_MAGIC,
-        max_cpu: 1,
+        max_cpu: KCOUNTER_SHARDS as u64,
         counter_table_size,
     };
     let serde_header: [u8; HEADER_SIZE] = unsafe { core::mem::transmute(header) };
     counter_name_vmo.write(0, &serde_header).unwrap();
-    for (i, descriptor) in descriptors.0.iter().enumerate() {
+    for descriptor in descriptors.0.iter() {
         let serde_counter: [u8; DESC_SIZE] =
             unsafe { core::mem::transmute(KCounterDescItem::from(descriptor)) };
         counter_name_vmo
-            .write(HEADER_SIZE + i * DESC_SIZE, &serde_counter)
+            .write(
+                HEADER_SIZE + descriptor.counter.index() * DESC_SIZE,
+                &serde_counter,
+            )
             .unwrap();
     }
     counter_name_vmo.set_name("counters/desc");
 
     let kcounters_vmo = {
-        extern "C" {
-            fn kcounters_arena_start();
-            fn kcounters_arena_end();
-        }
         use kernel_hal::PageTableTrait;
+        let arena = KCounterArena::get() as *const KCounterArena as usize;
         let mut pgtable = kernel_hal::PageTable::current();
-        let paddr = pgtable.query(kcounters_arena_start as usize).unwrap();
-        assert_eq!(
-            kcounters_arena_start as usize / PAGE_SIZE,
-            kcounters_arena_end as usize / PAGE_SIZE,
-            "all kcounters must in the same page"
-        );
-        VmObject::new_physical(paddr, 1)
+        // the kernel is loaded to contiguous physical memory
+        let paddr = pgtable.query(arena).unwrap();
+        VmObject::new_physical(paddr, pages(size_of::<KCounterArena>()))
     };
     kcounters_vmo.set_name("counters/arena");
     (counter_name_vmo, kcounters_vmo)
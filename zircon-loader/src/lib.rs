@@ -69,15 +69,33 @@ pub fn run_userboot(images: &Images<impl AsRef<[u8]>>, cmdline: &str) -> Arc<Pro
         let vdso_vmo = VmObject::new_paged(images.vdso.as_ref().len() / PAGE_SIZE + 1);
         vdso_vmo.write(0, images.vdso.as_ref()).unwrap();
         let size = elf.load_segment_size();
+        // The time page follows the vDSO, like the vvar page of Linux.
+        // It can't be a part of `vdso_vmo`: that is a copy of the image, while
+        // the time page is the frame of the kernel's `VDSO_TIME`. Processes
+        // which map the vDSO from its VMO get the page by `map_vdso_time`.
         let vmar = vmar
             .allocate_at(
                 userboot_size,
-                size,
+                size + PAGE_SIZE,
                 VmarFlags::CAN_MAP_RXW | VmarFlags::SPECIFIC,
                 PAGE_SIZE,
             )
             .unwrap();
         vmar.map_from_elf(&elf, vdso_vmo.clone()).unwrap();
+        if let Some(time_vmo) = VDSO_TIME_VMO.as_ref() {
+            let flags = MMUFlags::READ | MMUFlags::USER;
+            vmar.map_ext(
+                Some(size),
+                time_vmo.clone(),
+                0,
+                PAGE_SIZE,
+                flags,
+                flags,
+                false,
+                true,
+            )
+            .unwrap();
+        }
         #[cfg(feature = "std")]
         {
             let offset = elf
@@ -187,6 +205,7 @@ async fn new_thread(thread: CurrentThread) {
         }
         trace!("go to user: {:#x?}", cx);
         debug!("switch to {}|{}", thread.proc().name(), thread.name());
+        kernel_hal::Thread::set_priority(thread.priority());
         let tmp_time = kernel_hal::timer_now().as_nanos();
 
         // * Attention
@@ -220,7 +239,9 @@ async fn new_thread(thread: CurrentThread) {
                 kernel_hal::InterruptManager::handle(trap_num as u8);
                 if trap_num == 0x20 {
                     EXCEPTIONS_TIMER.add(1);
-                    kernel_hal::yield_now().await;
+                    if kernel_hal::Thread::need_resched() {
+                        kernel_hal::yield_now().await;
+                    }
                 }
             }
             0xe => {
@@ -1,5 +1,6 @@
 use {
     crate::object::*,
+    crate::util::ktrace::{ktrace, TraceEvent},
     alloc::collections::VecDeque,
     alloc::sync::{Arc, Weak},
     alloc::vec::Vec,
@@ -85,6 +86,7 @@ impl Channel {
             if recv_queue.is_empty() {
                 self.base.signal_clear(Signal::READABLE);
             }
+            ktrace(TraceEvent::ChannelRead, self.id(), msg.data.len() as u64);
             return Ok(msg);
         }
         if self.peer_closed() {
@@ -102,6 +104,7 @@ impl Channel {
     /// Write a packet to the channel
     pub fn write(&self, msg: T) -> ZxResult {
         let peer = self.peer.upgrade().ok_or(ZxError::PEER_CLOSED)?;
+        ktrace(TraceEvent::ChannelWrite, self.id(), msg.data.len() as u64);
         // check first 4 bytes: whether it is a call reply?
         let txid = msg.get_txid();
         if txid != 0 {
@@ -176,6 +179,24 @@ pub struct MessagePacket {
 }
 
 impl MessagePacket {
+    /// Create a message, copying `data` into a buffer from the pool.
+    pub fn with_data(data: &[u8], handles: Vec<Handle>) -> Self {
+        let mut buf = alloc_buffer(data.len());
+        buf.extend_from_slice(data);
+        MessagePacket { data: buf, handles }
+    }
+
+    /// Create a message of `len` zero bytes in a buffer from the pool, to be
+    /// filled in place, e.g. from user memory.
+    pub fn with_len(len: usize) -> Self {
+        let mut buf = alloc_buffer(len);
+        buf.resize(len, 0);
+        MessagePacket {
+            data: buf,
+            handles: Vec::new(),
+        }
+    }
+
     /// Set txid (the first 4 bytes)
     pub fn set_txid(&mut self, txid: TxID) {
         if self.data.len() >= core::mem::size_of::<TxID>() {
@@ -193,6 +214,54 @@ impl MessagePacket {
     }
 }
 
+impl Drop for MessagePacket {
+    fn drop(&mut self) {
+        free_buffer(core::mem::take(&mut self.data));
+    }
+}
+
+/// Capacities of pooled message buffers.
+const BUFFER_CLASSES: [usize; 5] = [256, 1024, 4096, 16384, 65536];
+/// Maximum number of free buffers kept for each class.
+const BUFFER_POOL_DEPTH: [usize; 5] = [64, 64, 32, 8, 4];
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_POOL: Mutex<Vec<Vec<u8>>> = Mutex::new(Vec::new());
+/// Free message buffers of each class, so that they are not allocated from
+/// the heap on every write.
+static BUFFER_POOL: [Mutex<Vec<Vec<u8>>>; 5] = [EMPTY_POOL; 5];
+
+kcounter!(MSG_BUFFER_POOL_HIT, "channel.msg_buffer.pool_hit");
+kcounter!(MSG_BUFFER_POOL_MISS, "channel.msg_buffer.pool_miss");
+
+/// Get an empty buffer with capacity of at least `len` bytes.
+fn alloc_buffer(len: usize) -> Vec<u8> {
+    let class = match BUFFER_CLASSES.iter().position(|&size| size >= len) {
+        Some(class) => class,
+        None => return Vec::with_capacity(len),
+    };
+    if let Some(buf) = BUFFER_POOL[class].lock().pop() {
+        MSG_BUFFER_POOL_HIT.add(1);
+        return buf;
+    }
+    MSG_BUFFER_POOL_MISS.add(1);
+    Vec::with_capacity(BUFFER_CLASSES[class])
+}
+
+/// Return a buffer to the pool if it is of one of the classes.
+fn free_buffer(mut buf: Vec<u8>) {
+    if let Some(class) = BUFFER_CLASSES
+        .iter()
+        .position(|&size| size == buf.capacity())
+    {
+        let mut pool = BUFFER_POOL[class].lock();
+        if pool.len() < BUFFER_POOL_DEPTH[class] {
+            buf.clear();
+            pool.push(buf);
+        }
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -214,6 +283,27 @@ mod tests {
         assert_eq!(end0.related_koid(), 0);
     }
 
+    #[test]
+    fn buffer_pool() {
+        let msg = MessagePacket::with_data(b"hello", Vec::new());
+        assert_eq!(msg.data.as_slice(), b"hello");
+        assert_eq!(msg.data.capacity(), 256);
+        drop(msg);
+        // a recycled buffer is empty
+        let msg = MessagePacket::with_data(&[1; 200], Vec::new());
+        assert_eq!(msg.data.as_slice(), &[1; 200][..]);
+        assert_eq!(msg.data.capacity(), 256);
+
+        let mut msg = MessagePacket::with_len(300);
+        msg.data[299] = 1;
+        assert_eq!(msg.data.len(), 300);
+        assert_eq!(msg.data.capacity(), 1024);
+
+        let large = [0u8; 70000];
+        let msg = MessagePacket::with_data(&large, Vec::new());
+        assert_eq!(msg.data.len(), 70000);
+    }
+
     #[test]
     fn read_write() {
         let (channel0, channel1) = Channel::create();
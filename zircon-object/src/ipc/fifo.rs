@@ -1,6 +1,5 @@
 use {
-    crate::object::*,
-    alloc::collections::VecDeque,
+    crate::{object::*, util::ring::RingBuffer},
     alloc::sync::{Arc, Weak},
     spin::Mutex,
 };
@@ -20,7 +19,7 @@ pub struct Fifo {
     peer: Weak<Fifo>,
     elem_count: usize,
     elem_size: usize,
-    recv_queue: Mutex<VecDeque<u8>>,
+    recv_queue: Mutex<RingBuffer>,
 }
 
 impl_kobject!(Fifo
@@ -42,14 +41,14 @@ impl Fifo {
             peer: Weak::default(),
             elem_count,
             elem_size,
-            recv_queue: Mutex::new(VecDeque::with_capacity(elem_count * elem_size)),
+            recv_queue: Mutex::new(RingBuffer::new(elem_count * elem_size)),
         });
         let end1 = Arc::new(Fifo {
             base: KObjectBase::with_signal(Signal::WRITABLE),
             peer: Arc::downgrade(&end0),
             elem_count,
             elem_size,
-            recv_queue: Mutex::new(VecDeque::with_capacity(elem_count * elem_size)),
+            recv_queue: Mutex::new(RingBuffer::new(elem_count * elem_size)),
         });
         // no other reference of `end0`
         unsafe {
@@ -78,7 +77,7 @@ impl Fifo {
 
         let peer = self.peer.upgrade().ok_or(ZxError::PEER_CLOSED)?;
         let mut recv_queue = peer.recv_queue.lock();
-        let rest_capacity = self.capacity() - recv_queue.len();
+        let rest_capacity = recv_queue.free();
         if rest_capacity == 0 {
             return Err(ZxError::SHOULD_WAIT);
         }
@@ -86,7 +85,7 @@ impl Fifo {
             peer.base.signal_set(Signal::READABLE);
         }
         let write_len = count_size.min(rest_capacity);
-        recv_queue.extend(&data[..write_len]);
+        recv_queue.push(&data[..write_len]);
         if recv_queue.len() == self.capacity() {
             self.base.signal_clear(Signal::WRITABLE);
         }
@@ -121,15 +120,12 @@ impl Fifo {
             }
             return Err(ZxError::SHOULD_WAIT);
         }
-        let read_size = count_size.min(recv_queue.len());
         if recv_queue.len() == self.capacity() {
             if let Some(peer) = peer {
                 peer.base.signal_set(Signal::WRITABLE);
             }
         }
-        for (i, x) in recv_queue.drain(..read_size).enumerate() {
-            data[i] = x;
-        }
+        let read_size = recv_queue.pop(data);
         if recv_queue.is_empty() {
             self.base.signal_clear(Signal::READABLE);
         }
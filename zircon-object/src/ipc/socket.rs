@@ -1,5 +1,5 @@
 use {
-    crate::object::*,
+    crate::{object::*, util::ring::RingBuffer},
     alloc::collections::VecDeque,
     alloc::sync::{Arc, Weak},
     bitflags::bitflags,
@@ -19,9 +19,8 @@ pub struct Socket {
     inner: Mutex<SocketInner>,
 }
 
-#[derive(Default)]
 struct SocketInner {
-    data: VecDeque<u8>,
+    data: RingBuffer,
     datagram_len: VecDeque<usize>,
     read_threshold: usize,
     write_threshold: usize,
@@ -30,6 +29,18 @@ struct SocketInner {
 
 const SOCKET_SIZE: usize = 128 * 2048;
 
+impl SocketInner {
+    fn new() -> Self {
+        SocketInner {
+            data: RingBuffer::new(SOCKET_SIZE),
+            datagram_len: VecDeque::new(),
+            read_threshold: 0,
+            write_threshold: 0,
+            read_disabled: false,
+        }
+    }
+}
+
 impl_kobject!(Socket
     fn peer(&self) -> ZxResult<Arc<dyn KernelObject>> {
         let peer = self.peer.upgrade().ok_or(ZxError::PEER_CLOSED)?;
@@ -82,13 +93,13 @@ impl Socket {
             base: KObjectBase::with_signal(starting_signals),
             peer: Weak::default(),
             flags,
-            inner: Default::default(),
+            inner: Mutex::new(SocketInner::new()),
         });
         let end1 = Arc::new(Socket {
             base: KObjectBase::with_signal(starting_signals),
             peer: Arc::downgrade(&end0),
             flags,
-            inner: Default::default(),
+            inner: Mutex::new(SocketInner::new()),
         });
         // no other reference of `end0`
         unsafe {
@@ -142,7 +153,10 @@ impl Socket {
             if data.len() > SOCKET_SIZE {
                 return Err(ZxError::OUT_OF_RANGE);
             }
-            self.write_datagram(&data[..write_size])?
+            if data.len() > rest_size {
+                return Err(ZxError::SHOULD_WAIT);
+            }
+            self.write_datagram(data)?
         } else {
             self.write_stream(&data[..write_size])?
         };
@@ -165,16 +179,14 @@ impl Socket {
             return Err(ZxError::INVALID_ARGS);
         }
         let mut inner = self.inner.lock();
-        let actual_count = data.len();
-        inner.data.extend(data);
+        let actual_count = inner.data.push(data);
         inner.datagram_len.push_back(actual_count);
         Ok(actual_count)
     }
 
     fn write_stream(&self, data: &[u8]) -> ZxResult<usize> {
-        let actual_count = data.len();
         let mut inner = self.inner.lock();
-        inner.data.extend(data);
+        let actual_count = inner.data.push(data);
         Ok(actual_count)
     }
 
@@ -240,29 +252,20 @@ impl Socket {
             inner.datagram_len.pop_front().unwrap()
         };
         let read_size = data.len().min(datagram_len);
-        if peek {
-            for (i, x) in inner.data.iter().take(read_size).enumerate() {
-                data[i] = *x;
-            }
-        } else {
-            for (i, x) in inner.data.drain(..datagram_len).take(read_size).enumerate() {
-                data[i] = x;
-            }
-        };
+        inner.data.peek(&mut data[..read_size]);
+        if !peek {
+            // the rest of the datagram is discarded
+            inner.data.consume(datagram_len);
+        }
         Ok(read_size)
     }
 
     fn read_stream(&self, data: &mut [u8], peek: bool) -> ZxResult<usize> {
         let mut inner = self.inner.lock();
-        let read_size = data.len().min(inner.data.len());
-        if peek {
-            for (i, x) in inner.data.iter().take(read_size).enumerate() {
-                data[i] = *x;
-            }
+        let read_size = if peek {
+            inner.data.peek(data)
         } else {
-            for (i, x) in inner.data.drain(..read_size).enumerate() {
-                data[i] = x;
-            }
+            inner.data.pop(data)
         };
         Ok(read_size)
     }
@@ -543,6 +546,11 @@ mod tests {
         assert!(!end0.signal().contains(Signal::WRITABLE));
         end1.read(false, &mut [0; 1]).unwrap();
         assert!(end0.signal().contains(Signal::WRITABLE));
+
+        // datagrams are never short
+        assert_eq!(end0.write(&[0; SOCKET_SIZE - 1]).unwrap(), SOCKET_SIZE - 1);
+        assert_eq!(end0.write(&[0; 2]).unwrap_err(), ZxError::SHOULD_WAIT);
+        assert_eq!(end0.write(&[0; 1]).unwrap(), 1);
     }
 
     #[test]
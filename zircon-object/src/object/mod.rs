@@ -96,7 +96,7 @@
 
 use {
     crate::signal::*,
-    alloc::{boxed::Box, string::String, sync::Arc, vec::Vec},
+    alloc::{boxed::Box, collections::BTreeMap, string::String, sync::Arc, vec::Vec},
     core::{
         fmt::Debug,
         future::Future,
@@ -144,6 +144,15 @@ pub trait KernelObject: DowncastSync + Debug {
     /// It returns a bool indicating whether the handle process is over.
     /// If true, the function will never be called again.
     fn add_signal_callback(&self, callback: SignalHandler);
+    /// Add a one-shot `waiter` which is called once one of `signal` is asserted.
+    ///
+    /// If one of `signal` is already asserted, it is called immediately and
+    /// `None` is returned.
+    fn add_signal_waiter(&self, signal: Signal, waiter: SignalWaiter) -> Option<SignalWaiterId>;
+    /// Remove a waiter which has not been called.
+    ///
+    /// Returns whether it is removed.
+    fn remove_signal_waiter(&self, id: SignalWaiterId) -> bool;
     /// Attempt to find a child of the object with given KoID.
     ///
     /// If the object is a *Process*, the *Threads* it contains may be obtained.
@@ -178,6 +187,9 @@ impl_downcast!(sync KernelObject);
 pub struct KObjectBase {
     /// The object's KoID.
     pub id: KoID,
+    /// The signal status, which can be read without locking. It is only
+    /// changed with `inner` locked.
+    signal: AtomicU32,
     inner: Mutex<KObjectBaseInner>,
 }
 
@@ -185,14 +197,19 @@ pub struct KObjectBase {
 #[derive(Default)]
 struct KObjectBaseInner {
     name: String,
-    signal: Signal,
     signal_callbacks: Vec<SignalHandler>,
+    /// One-shot waiters grouped by the signal they wait for.
+    signal_waiters: BTreeMap<u32, BTreeMap<u64, SignalWaiter>>,
+    /// Union of the signals in `signal_waiters`.
+    waiter_mask: Signal,
+    next_waiter_id: u64,
 }
 
 impl Default for KObjectBase {
     fn default() -> Self {
         KObjectBase {
             id: Self::new_koid(),
+            signal: AtomicU32::new(0),
             inner: Default::default(),
         }
     }
@@ -218,9 +235,9 @@ impl KObjectBase {
     pub fn with(name: &str, signal: Signal) -> Self {
         KObjectBase {
             id: Self::new_koid(),
+            signal: AtomicU32::new(signal.bits()),
             inner: Mutex::new(KObjectBaseInner {
                 name: String::from(name),
-                signal,
                 ..Default::default()
             }),
         }
@@ -244,21 +261,36 @@ impl KObjectBase {
 
     /// Get the signal status.
     pub fn signal(&self) -> Signal {
-        self.inner.lock().signal
+        Signal::from_bits_truncate(self.signal.load(Ordering::Acquire))
     }
 
     /// Change signal status: first `clear` then `set` indicated bits.
     ///
-    /// All signal callbacks will be called.
+    /// All signal callbacks will be called, but only the waiters of the
+    /// asserted signals.
     pub fn signal_change(&self, clear: Signal, set: Signal) {
         let mut inner = self.inner.lock();
-        let old_signal = inner.signal;
-        inner.signal.remove(clear);
-        inner.signal.insert(set);
-        let new_signal = inner.signal;
+        let old_signal = self.signal();
+        let new_signal = (old_signal - clear) | set;
         if new_signal == old_signal {
             return;
         }
+        self.signal.store(new_signal.bits(), Ordering::Release);
+        let asserted = new_signal - old_signal;
+        if inner.waiter_mask.intersects(asserted) {
+            let keys: Vec<u32> = inner
+                .signal_waiters
+                .keys()
+                .filter(|&&key| asserted.bits() & key != 0)
+                .cloned()
+                .collect();
+            for key in keys {
+                for (_, waiter) in inner.signal_waiters.remove(&key).unwrap() {
+                    waiter(new_signal);
+                }
+            }
+            inner.update_waiter_mask();
+        }
         inner.signal_callbacks.retain(|f| !f(new_signal));
     }
 
@@ -282,10 +314,72 @@ impl KObjectBase {
         // Check the callback immediately, in case that a signal arrives just before the call of
         // `add_signal_callback` (since lock is acquired inside it) and the callback is not triggered
         // in time.
-        if !callback(inner.signal) {
+        if !callback(self.signal()) {
             inner.signal_callbacks.push(callback);
         }
     }
+
+    /// Add a one-shot `waiter` which is called once one of `signal` is asserted.
+    ///
+    /// If one of `signal` is already asserted, it is called immediately and
+    /// `None` is returned.
+    pub fn add_signal_waiter(
+        &self,
+        signal: Signal,
+        waiter: SignalWaiter,
+    ) -> Option<SignalWaiterId> {
+        let mut inner = self.inner.lock();
+        let current = self.signal();
+        if current.intersects(signal) {
+            drop(inner);
+            waiter(current);
+            return None;
+        }
+        inner.next_waiter_id += 1;
+        let id = inner.next_waiter_id;
+        inner
+            .signal_waiters
+            .entry(signal.bits())
+            .or_default()
+            .insert(id, waiter);
+        inner.waiter_mask |= signal;
+        Some(SignalWaiterId { signal, id })
+    }
+
+    /// Remove a waiter which has not been called.
+    ///
+    /// Returns whether it is removed.
+    pub fn remove_signal_waiter(&self, id: SignalWaiterId) -> bool {
+        let mut inner = self.inner.lock();
+        let waiters = match inner.signal_waiters.get_mut(&id.signal.bits()) {
+            Some(waiters) => waiters,
+            None => return false,
+        };
+        let removed = waiters.remove(&id.id).is_some();
+        if waiters.is_empty() {
+            inner.signal_waiters.remove(&id.signal.bits());
+            inner.update_waiter_mask();
+        }
+        removed
+    }
+}
+
+impl KObjectBaseInner {
+    fn update_waiter_mask(&mut self) {
+        self.waiter_mask = self
+            .signal_waiters
+            .keys()
+            .fold(Signal::empty(), |mask, &key| {
+                mask | Signal::from_bits_truncate(key)
+            });
+    }
+}
+
+/// Identifier of a waiter added by `add_signal_waiter`.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct SignalWaiterId {
+    signal: Signal,
+    id: u64,
 }
 
 impl dyn KernelObject {
@@ -295,7 +389,7 @@ impl dyn KernelObject {
         struct SignalFuture {
             object: Arc<dyn KernelObject>,
             signal: Signal,
-            first: bool,
+            waiter: Option<SignalWaiterId>,
         }
 
         impl Future for SignalFuture {
@@ -306,71 +400,43 @@ impl dyn KernelObject {
                 if !(current_signal & self.signal).is_empty() {
                     return Poll::Ready(current_signal);
                 }
-                if self.first {
-                    self.object.add_signal_callback(Box::new({
-                        let signal = self.signal;
-                        let waker = cx.waker().clone();
-                        move |s| {
-                            if (s & signal).is_empty() {
-                                return false;
-                            }
-                            waker.wake_by_ref();
-                            true
-                        }
-                    }));
-                    self.first = false;
+                // the previous waiter may have been called with an old waker
+                if let Some(id) = self.waiter.take() {
+                    self.object.remove_signal_waiter(id);
                 }
+                let waker = cx.waker().clone();
+                self.waiter = self
+                    .object
+                    .add_signal_waiter(self.signal, Box::new(move |_| waker.wake()));
                 Poll::Pending
             }
         }
 
+        impl Drop for SignalFuture {
+            fn drop(&mut self) {
+                if let Some(id) = self.waiter.take() {
+                    self.object.remove_signal_waiter(id);
+                }
+            }
+        }
+
         SignalFuture {
             object: self.clone(),
             signal,
-            first: true,
+            waiter: None,
         }
     }
 
     /// Once one of the `signal` asserted, push a packet with `key` into the `port`,
     ///
     /// It's used to implement `sys_object_wait_async`.
-    #[allow(unsafe_code)]
     pub fn send_signal_to_port_async(self: &Arc<Self>, signal: Signal, port: &Arc<Port>, key: u64) {
-        let current_signal = self.signal();
-        if !(current_signal & signal).is_empty() {
-            port.push(PortPacketRepr {
-                key,
-                status: ZxError::OK,
-                data: PayloadRepr::Signal(PacketSignal {
-                    trigger: signal,
-                    observed: current_signal,
-                    count: 1,
-                    timestamp: 0,
-                    _reserved1: 0,
-                }),
-            });
-            return;
-        }
-        self.add_signal_callback(Box::new({
-            let port = port.clone();
-            move |s| {
-                if (s & signal).is_empty() {
-                    return false;
-                }
-                port.push(PortPacketRepr {
-                    key,
-                    status: ZxError::OK,
-                    data: PayloadRepr::Signal(PacketSignal {
-                        trigger: signal,
-                        observed: s,
-                        count: 1,
-                        timestamp: 0,
-                        _reserved1: 0,
-                    }),
-                });
-                true
-            }
-        }));
+        let port = port.clone();
+        let source = self.id();
+        self.add_signal_waiter(
+            signal,
+            Box::new(move |s| port.push_signal(source, key, signal, s)),
+        );
     }
 }
 
@@ -381,7 +447,7 @@ pub fn wait_signal_many(
     #[must_use = "wait_signal_many does nothing unless polled/`await`-ed"]
     struct SignalManyFuture {
         targets: Vec<(Arc<dyn KernelObject>, Signal)>,
-        first: bool,
+        waiters: Vec<Option<SignalWaiterId>>,
     }
 
     impl SignalManyFuture {
@@ -391,6 +457,14 @@ pub fn wait_signal_many(
                 .zip(current_signals)
                 .any(|(&(_, desired), &current)| !(current & desired).is_empty())
         }
+
+        fn remove_waiters(&mut self) {
+            for ((object, _), waiter) in self.targets.iter().zip(self.waiters.drain(..)) {
+                if let Some(id) = waiter {
+                    object.remove_signal_waiter(id);
+                }
+            }
+        }
     }
 
     impl Future for SignalManyFuture {
@@ -402,29 +476,29 @@ pub fn wait_signal_many(
             if self.happened(&current_signals) {
                 return Poll::Ready(current_signals);
             }
-            if self.first {
-                for (object, signal) in self.targets.iter() {
-                    object.add_signal_callback(Box::new({
-                        let signal = *signal;
-                        let waker = cx.waker().clone();
-                        move |s| {
-                            if (s & signal).is_empty() {
-                                return false;
-                            }
-                            waker.wake_by_ref();
-                            true
-                        }
-                    }));
-                }
-                self.first = false;
-            }
+            self.remove_waiters();
+            let waiters: Vec<_> = self
+                .targets
+                .iter()
+                .map(|(object, signal)| {
+                    let waker = cx.waker().clone();
+                    object.add_signal_waiter(*signal, Box::new(move |_| waker.wake()))
+                })
+                .collect();
+            self.waiters = waiters;
             Poll::Pending
         }
     }
 
+    impl Drop for SignalManyFuture {
+        fn drop(&mut self) {
+            self.remove_waiters();
+        }
+    }
+
     SignalManyFuture {
         targets: Vec::from(targets),
-        first: true,
+        waiters: Vec::new(),
     }
 }
 
@@ -460,6 +534,16 @@ macro_rules! impl_kobject {
             fn add_signal_callback(&self, callback: SignalHandler) {
                 self.base.add_signal_callback(callback);
             }
+            fn add_signal_waiter(
+                &self,
+                signal: Signal,
+                waiter: SignalWaiter,
+            ) -> Option<SignalWaiterId> {
+                self.base.add_signal_waiter(signal, waiter)
+            }
+            fn remove_signal_waiter(&self, id: SignalWaiterId) -> bool {
+                self.base.remove_signal_waiter(id)
+            }
             $( $fn )*
         }
         impl core::fmt::Debug for $class {
@@ -504,6 +588,9 @@ pub type KoID = u64;
 /// The type of kernel object signal handler.
 pub type SignalHandler = Box<dyn Fn(Signal) -> bool + Send>;
 
+/// The type of one-shot signal waiter, which is called with the new signal.
+pub type SignalWaiter = Box<dyn FnOnce(Signal) + Send>;
+
 /// Empty kernel object. Just for test.
 pub struct DummyObject {
     base: KObjectBase,
@@ -590,6 +677,39 @@ mod tests {
         assert_eq!(signals, [Signal::READABLE, Signal::WRITABLE]);
     }
 
+    #[test]
+    fn signal_waiter() {
+        let object = DummyObject::new();
+        let count = Arc::new(AtomicUsize::new(0));
+        let waiter = || -> SignalWaiter {
+            let count = count.clone();
+            Box::new(move |_| {
+                count.fetch_add(1, Ordering::SeqCst);
+            })
+        };
+        let id = object
+            .add_signal_waiter(Signal::READABLE, waiter())
+            .unwrap();
+        object
+            .add_signal_waiter(Signal::WRITABLE, waiter())
+            .unwrap();
+
+        // irrelevant signals don't call waiters
+        object.signal_set(Signal::USER_SIGNAL_0);
+        assert_eq!(count.load(Ordering::SeqCst), 0);
+
+        assert!(object.remove_signal_waiter(id));
+        assert!(!object.remove_signal_waiter(id));
+        object.signal_set(Signal::READABLE | Signal::WRITABLE);
+        assert_eq!(count.load(Ordering::SeqCst), 1);
+
+        // called immediately if already asserted
+        assert!(object
+            .add_signal_waiter(Signal::READABLE, waiter())
+            .is_none());
+        assert_eq!(count.load(Ordering::SeqCst), 2);
+    }
+
     #[test]
     fn test_trait_with_dummy() {
         let dummy = DummyObject::new();
@@ -114,6 +114,9 @@ bitflags! {
         /// BASIC | WRITE | SIGNAL
         const DEFAULT_DEBUGLOG = Self::BASIC.bits | Self::WRITE.bits | Self::SIGNAL.bits;
 
+        /// BASIC | APPLY_PROFILE
+        const DEFAULT_PROFILE = Self::BASIC.bits | Self::APPLY_PROFILE.bits;
+
         /// TRANSFER | INSPECT
         const DEFAULT_SUSPEND_TOKEN = Self::TRANSFER.bits | Self::INSPECT.bits;
 
@@ -1,7 +1,8 @@
 use super::*;
 use crate::{object::*, task::Thread};
 use alloc::collections::VecDeque;
-use alloc::sync::Arc;
+use alloc::sync::{Arc, Weak};
+use alloc::vec::Vec;
 use core::future::Future;
 use core::pin::Pin;
 use core::sync::atomic::*;
@@ -16,9 +17,15 @@ use spin::Mutex;
 /// APIs such as `pthread_mutex_t` and `pthread_cond_t`.
 /// Futexes are designed to not enter the kernel or allocate kernel
 /// resources in the uncontested case.
+///
+/// Futexes of processes are looked up by [`Futex::get`] in a global hash
+/// table, which is only locked per bucket. A futex is created when it is
+/// first used and freed when no one waits on it and it has no owner.
 pub struct Futex {
     base: KObjectBase,
     value: &'static AtomicI32,
+    /// The key in the global table, or `None` if it is not in the table.
+    key: Option<FutexKey>,
     inner: Mutex<FutexInner>,
 }
 
@@ -29,8 +36,42 @@ struct FutexInner {
     waiter_queue: VecDeque<Arc<Waiter>>,
     /// NOTE: use `set_owner`
     owner: Option<Arc<Thread>>,
+    /// The futex itself if it is owned and in the global table, which only
+    /// holds it weakly, so the owner is not lost when the waiters are gone.
+    pinned: Option<Arc<Futex>>,
+}
+
+/// The identity of a futex in the global table.
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum FutexKey {
+    /// A futex private to a process, by the KoID of the process and the virtual address.
+    Private(KoID, usize),
+    /// A futex which may be shared by processes, by the KoID of the VMO and the offset in it.
+    Shared(KoID, usize),
 }
 
+impl FutexKey {
+    fn bucket(&self) -> &'static Mutex<Vec<(FutexKey, Weak<Futex>)>> {
+        let (koid, addr) = match *self {
+            FutexKey::Private(koid, addr) => (koid, addr as u64),
+            FutexKey::Shared(koid, offset) => (!koid, offset as u64),
+        };
+        // futex words are 4-byte aligned
+        let hash = (koid ^ (addr >> 2)).wrapping_mul(0x9e37_79b9_7f4a_7c15);
+        &FUTEX_TABLE[(hash >> 32) as usize % FUTEX_BUCKETS]
+    }
+}
+
+/// Number of buckets of the global futex table.
+const FUTEX_BUCKETS: usize = 256;
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_BUCKET: Mutex<Vec<(FutexKey, Weak<Futex>)>> = Mutex::new(Vec::new());
+
+/// The global futex table, each bucket is a short list of live futexes.
+static FUTEX_TABLE: [Mutex<Vec<(FutexKey, Weak<Futex>)>>; FUTEX_BUCKETS] =
+    [EMPTY_BUCKET; FUTEX_BUCKETS];
+
 impl Futex {
     /// Create a new Futex.
     ///
@@ -41,13 +82,40 @@ impl Futex {
     /// `*value`. It is up to userspace code to correctly atomically modify this
     /// value across threads in order to build mutexes and so on.
     pub fn new(value: &'static AtomicI32) -> Arc<Self> {
+        Self::new_with_key(value, None)
+    }
+
+    fn new_with_key(value: &'static AtomicI32, key: Option<FutexKey>) -> Arc<Self> {
         Arc::new(Futex {
             base: KObjectBase::default(),
             value,
+            key,
             inner: Mutex::new(FutexInner::default()),
         })
     }
 
+    /// Get the futex of `key` from the global table, create it if not exists.
+    ///
+    /// `value` is the futex word in the address space of the caller.
+    /// For a shared futex, it is only used by [`wait`] and [`requeue`], because
+    /// other processes may map it at different addresses.
+    ///
+    /// [`wait`]: Futex::wait
+    /// [`requeue`]: Futex::requeue
+    pub fn get(key: FutexKey, value: &'static AtomicI32) -> Arc<Self> {
+        let mut bucket = key.bucket().lock();
+        if let Some(futex) = bucket
+            .iter()
+            .filter(|(k, _)| *k == key)
+            .find_map(|(_, futex)| futex.upgrade())
+        {
+            return futex;
+        }
+        let futex = Self::new_with_key(value, Some(key));
+        bucket.push((key, Arc::downgrade(&futex)));
+        futex
+    }
+
     /// Wait on a futex.
     ///
     /// This atomically verifies that `value_ptr` still contains the value `current_value`
@@ -70,16 +138,55 @@ impl Futex {
     ///
     /// The owner of the futex is set to nothing, regardless of the wake count.
     pub fn wake(&self, wake_count: usize) -> usize {
+        self.wake_bitset(wake_count, u32::MAX)
+    }
+
+    // ------ Advanced APIs on Linux ------
+
+    /// Wait on a futex, the same as [`wait`] but only woken by [`wake_bitset`]
+    /// with any bit in common with `bitset`.
+    ///
+    /// `value` is the futex word in the address space of the caller, which may
+    /// differ from the one of the creator for a shared futex.
+    ///
+    /// [`wait`]: Futex::wait
+    /// [`wake_bitset`]: Futex::wake_bitset
+    pub fn wait_bitset(
+        self: &Arc<Self>,
+        value: &'static AtomicI32,
+        current_value: i32,
+        bitset: u32,
+        thread: Option<Arc<Thread>>,
+    ) -> impl Future<Output = ZxResult> {
+        self.wait_inner(value, current_value, bitset, thread, None)
+    }
+
+    /// Wake at most `wake_count` waiters with any bit in common with `bitset`.
+    ///
+    /// Return the number of waiters that were woken up.
+    pub fn wake_bitset(&self, wake_count: usize, bitset: u32) -> usize {
         let mut inner = self.inner.lock();
         inner.set_owner(None);
-        for i in 0..wake_count {
-            if let Some(waiter) = inner.waiter_queue.pop_front() {
-                waiter.wake();
-            } else {
-                return i;
+        let mut count = 0;
+        if bitset == u32::MAX {
+            while count < wake_count {
+                match inner.waiter_queue.pop_front() {
+                    Some(waiter) => waiter.wake(),
+                    None => break,
+                }
+                count += 1;
             }
+        } else {
+            inner.waiter_queue.retain(|waiter| {
+                if count == wake_count || waiter.bitset & bitset == 0 {
+                    return true;
+                }
+                waiter.wake();
+                count += 1;
+                false
+            });
         }
-        wake_count
+        count
     }
 
     // ------ Advanced APIs on Zircon ------
@@ -103,6 +210,9 @@ impl Futex {
     /// A successful call results in the owner of the futex being set to the
     /// thread referenced by the `new_owner`, or to nothing if it is `None`.
     ///
+    /// The owner inherits the highest priority of the waiters, until it is
+    /// no longer the owner.
+    ///
     /// # Errors
     ///
     /// - `INVALID_ARGS`: One of the following is true
@@ -117,10 +227,22 @@ impl Futex {
         current_value: i32,
         thread: Option<Arc<Thread>>,
         new_owner: Option<Arc<Thread>>,
+    ) -> impl Future<Output = ZxResult> {
+        self.wait_inner(self.value, current_value, u32::MAX, thread, new_owner)
+    }
+
+    fn wait_inner(
+        self: &Arc<Self>,
+        value: &'static AtomicI32,
+        current_value: i32,
+        bitset: u32,
+        thread: Option<Arc<Thread>>,
+        new_owner: Option<Arc<Thread>>,
     ) -> impl Future<Output = ZxResult> {
         #[must_use = "wait does nothing unless polled/`await`-ed"]
         struct FutexFuture {
             waiter: Arc<Waiter>,
+            value: &'static AtomicI32,
             current_value: i32,
             new_owner: Option<Arc<Thread>>,
         }
@@ -132,13 +254,15 @@ impl Futex {
                 // check wakeup
                 if inner.woken {
                     // set new owner on success
-                    inner.futex.inner.lock().set_owner(self.new_owner.clone());
+                    let mut futex = inner.futex.inner.lock();
+                    futex.set_owner(self.new_owner.clone());
+                    futex.pin(&inner.futex);
                     return Poll::Ready(Ok(()));
                 }
                 // first time?
                 if inner.waker.is_none() {
                     // check value
-                    let value = inner.futex.value.load(Ordering::SeqCst);
+                    let value = self.value.load(Ordering::SeqCst);
                     if value != self.current_value {
                         return Poll::Ready(Err(ZxError::BAD_STATE));
                     }
@@ -148,6 +272,7 @@ impl Futex {
                         return Poll::Ready(Err(ZxError::INVALID_ARGS));
                     }
                     futex.waiter_queue.push_back(self.waiter.clone());
+                    futex.update_owner_priority();
                     drop(futex);
                     inner.waker.replace(cx.waker().clone());
                 }
@@ -161,10 +286,13 @@ impl Futex {
                 let inner = self.waiter.inner.lock();
                 if !inner.woken {
                     let futex = inner.futex.clone();
-                    let queue = &mut futex.inner.lock().waiter_queue;
+                    let mut futex_inner = futex.inner.lock();
+                    let queue = &mut futex_inner.waiter_queue;
                     if let Some(pos) = queue.iter().position(|x| Arc::ptr_eq(&x, &self.waiter)) {
                         // Nobody cares about the order of queue, so just remove faster
                         queue.swap_remove_back(pos);
+                        // the owner no longer inherits the priority of this waiter
+                        futex_inner.update_owner_priority();
                     }
                 }
             }
@@ -172,12 +300,14 @@ impl Futex {
         FutexFuture {
             waiter: Arc::new(Waiter {
                 thread,
+                bitset,
                 inner: Mutex::new(WaiterInner {
                     waker: None,
                     woken: false,
                     futex: self.clone(),
                 }),
             }),
+            value,
             current_value,
             new_owner,
         }
@@ -193,13 +323,14 @@ impl Futex {
     ///
     /// If there is at least one thread to wake, the owner of the futex will be
     /// set to the thread which was woken. Otherwise, the futex will have no owner.
-    pub fn wake_single_owner(&self) {
+    pub fn wake_single_owner(self: &Arc<Self>) {
         let mut inner = self.inner.lock();
         let new_owner = inner.waiter_queue.pop_front().and_then(|waiter| {
             waiter.wake();
             waiter.thread.clone()
         });
         inner.set_owner(new_owner);
+        inner.pin(self);
     }
 
     /// Requeuing is a generalization of waking.
@@ -223,18 +354,49 @@ impl Futex {
         requeue_futex: &Arc<Futex>,
         new_requeue_owner: Option<Arc<Thread>>,
     ) -> ZxResult {
+        self.requeue_checked(
+            Some((self.value, current_value)),
+            wake_count,
+            requeue_count,
+            requeue_futex,
+            new_requeue_owner,
+        )
+        .map(|_| ())
+    }
+
+    /// The same as [`requeue`], but check the futex word `value` in the address
+    /// space of the caller if `check` is `Some((value, current_value))`.
+    ///
+    /// Return the number of waiters that were woken up or requeued.
+    ///
+    /// [`requeue`]: Futex::requeue
+    pub fn requeue_checked(
+        &self,
+        check: Option<(&'static AtomicI32, i32)>,
+        wake_count: usize,
+        requeue_count: usize,
+        requeue_futex: &Arc<Futex>,
+        new_requeue_owner: Option<Arc<Thread>>,
+    ) -> ZxResult<usize> {
         let mut inner = self.inner.lock();
         // check value
-        if self.value.load(Ordering::SeqCst) != current_value {
-            return Err(ZxError::BAD_STATE);
+        if let Some((value, current_value)) = check {
+            if value.load(Ordering::SeqCst) != current_value {
+                return Err(ZxError::BAD_STATE);
+            }
         }
         // wake
-        for _ in 0..wake_count {
-            if let Some(waiter) = inner.waiter_queue.pop_front() {
-                waiter.wake();
-            } else {
-                break;
+        let mut count = 0;
+        while count < wake_count {
+            match inner.waiter_queue.pop_front() {
+                Some(waiter) => waiter.wake(),
+                None => break,
             }
+            count += 1;
+        }
+        inner.set_owner(None);
+        if core::ptr::eq(self, &**requeue_futex) {
+            return Ok(count);
         }
         // requeue
         let mut new_inner = requeue_futex.inner.lock();
@@ -244,9 +406,23 @@ impl Futex {
             new_inner.waiter_queue.push_back(waiter);
         }
         // set owner
-        inner.set_owner(None);
         new_inner.set_owner(new_requeue_owner);
-        Ok(())
+        new_inner.pin(requeue_futex);
+        Ok(count + requeue_count)
+    }
+}
+
+impl Drop for Futex {
+    fn drop(&mut self) {
+        if let Some(owner) = self.inner.get_mut().owner.take() {
+            owner.inherit_priority(0);
+        }
+        if let Some(key) = self.key {
+            // remove dead futexes, including this one
+            key.bucket()
+                .lock()
+                .retain(|(_, futex)| futex.strong_count() != 0);
+        }
     }
 }
 
@@ -267,14 +443,44 @@ impl FutexInner {
     }
 
     fn set_owner(&mut self, owner: Option<Arc<Thread>>) {
-        // TODO: change the priority of owner thread
+        if let Some(old) = self.owner.take() {
+            old.inherit_priority(0);
+        }
         self.owner = owner;
+        if self.owner.is_none() {
+            // not the last reference, the caller holds the futex
+            self.pinned = None;
+        }
+        self.update_owner_priority();
+    }
+
+    /// Keep `futex` in the global table alive if it is owned, see `set_owner`.
+    fn pin(&mut self, futex: &Arc<Futex>) {
+        if self.owner.is_some() && futex.key.is_some() {
+            self.pinned = Some(futex.clone());
+        }
+    }
+
+    /// Let the owner inherit the highest priority of the waiters.
+    fn update_owner_priority(&self) {
+        if let Some(owner) = &self.owner {
+            let priority = self
+                .waiter_queue
+                .iter()
+                .filter_map(|waiter| waiter.thread.as_ref())
+                .map(|thread| thread.priority())
+                .max()
+                .unwrap_or(0);
+            owner.inherit_priority(priority);
+        }
     }
 }
 
 struct Waiter {
     /// The thread waiting on the futex.
     thread: Option<Arc<Thread>>,
+    /// Only woken by wakes with any bit in common.
+    bitset: u32,
     inner: Mutex<WaiterInner>,
 }
 
@@ -302,7 +508,7 @@ impl Waiter {
 #[cfg(test)]
 mod tests {
     use super::*;
-    use crate::task::{Job, Process};
+    use crate::task::{Job, Process, DEFAULT_PRIORITY};
     use core::time::Duration;
 
     #[async_std::test]
@@ -419,4 +625,80 @@ mod tests {
         assert!(Arc::ptr_eq(&futex.owner().unwrap(), &thread));
         assert_eq!(futex.wake(1), 0);
     }
+
+    #[test]
+    fn table() {
+        static VALUE: AtomicI32 = AtomicI32::new(0);
+        let key = FutexKey::Shared(1, 0x1000);
+        let futex = Futex::get(key, &VALUE);
+        assert!(Arc::ptr_eq(&futex, &Futex::get(key, &VALUE)));
+        assert!(!Arc::ptr_eq(
+            &futex,
+            &Futex::get(FutexKey::Private(1, 0x1000), &VALUE)
+        ));
+        let ptr = Arc::as_ptr(&futex);
+        drop(futex);
+        // the dead one is removed from the table
+        assert!(key
+            .bucket()
+            .lock()
+            .iter()
+            .all(|(k, futex)| *k != key || futex.as_ptr() != ptr));
+    }
+
+    #[async_std::test]
+    async fn bitset_and_priority() {
+        let root_job = Job::root();
+        let proc = Process::create(&root_job, "proc").expect("failed to create process");
+        let owner = Thread::create(&proc, "owner").expect("failed to create thread");
+        let waiter = Thread::create(&proc, "waiter").expect("failed to create thread");
+        waiter.set_priority(24);
+
+        static VALUE: AtomicI32 = AtomicI32::new(1);
+        let futex = proc.get_futex(&VALUE);
+        {
+            let futex = futex.clone();
+            async_std::task::spawn(async move {
+                futex
+                    .wait_bitset(&VALUE, 1, 0b10, Some(waiter))
+                    .await
+                    .unwrap();
+            });
+        }
+        async_std::task::sleep(Duration::from_millis(10)).await;
+        // the owner inherits the priority of the waiter
+        futex.inner.lock().set_owner(Some(owner.clone()));
+        assert_eq!(owner.priority(), 24);
+        assert_eq!(futex.wake_bitset(1, 0b01), 0);
+        // waking resets the owner
+        assert_eq!(owner.priority(), DEFAULT_PRIORITY);
+        assert_eq!(futex.wake_bitset(1, 0b11), 1);
+    }
+
+    #[async_std::test]
+    async fn priority_after_timeout() {
+        let root_job = Job::root();
+        let proc = Process::create(&root_job, "proc").expect("failed to create process");
+        let owner = Thread::create(&proc, "owner").expect("failed to create thread");
+        let waiter = Thread::create(&proc, "waiter").expect("failed to create thread");
+        waiter.set_priority(24);
+
+        static VALUE: AtomicI32 = AtomicI32::new(1);
+        let futex = proc.get_futex(&VALUE);
+        let task = {
+            let futex = futex.clone();
+            async_std::task::spawn(async move {
+                let wait = futex.wait_bitset(&VALUE, 1, u32::MAX, Some(waiter));
+                async_std::future::timeout(Duration::from_millis(50), wait).await
+            })
+        };
+        async_std::task::sleep(Duration::from_millis(10)).await;
+        futex.inner.lock().set_owner(Some(owner.clone()));
+        assert_eq!(owner.priority(), 24);
+
+        // the waiter gives up, and the owner stops inheriting its priority
+        assert!(task.await.is_err());
+        assert_eq!(owner.priority(), DEFAULT_PRIORITY);
+        assert_eq!(futex.wake(1), 0);
+    }
 }
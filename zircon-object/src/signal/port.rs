@@ -1,8 +1,8 @@
 pub use self::port_packet::*;
 use super::*;
 use crate::object::*;
-use alloc::collections::{BTreeSet, VecDeque};
-use alloc::sync::Arc;
+use alloc::collections::{BTreeMap, BTreeSet, VecDeque};
+use alloc::{sync::Arc, vec::Vec};
 use bitflags::bitflags;
 use spin::Mutex;
 
@@ -20,6 +20,10 @@ const MAX_ALLOCATED_PACKET_COUNT_PER_PORT: usize = MAX_ALLOCATED_PACKET_COUNT /
 /// events. These events include explicit queueing on the port,
 /// asynchronous waits on other handles bound to the port, and
 /// asynchronous message delivery from IPC transports.
+///
+/// Signal packets from the same object for the same key and trigger which are
+/// not yet taken out are coalesced into one, whose `count` is the number of
+/// notifications.
 pub struct Port {
     base: KObjectBase,
     options: PortOptions,
@@ -31,11 +35,20 @@ impl_kobject!(Port);
 #[derive(Default, Debug)]
 struct PortInner {
     queue: VecDeque<PortPacket>,
+    /// Sequence number of the front of `queue`.
+    head_seq: u64,
+    /// Sequence numbers of pending signal packets by (source, key, trigger).
+    signal_index: BTreeMap<SignalKey, u64>,
+    /// The index keys of pending signal packets by sequence number.
+    signal_keys: BTreeMap<u64, SignalKey>,
     interrupt_queue: VecDeque<PortInterruptPacket>,
     interrupt_grave: BTreeSet<u64>,
     interrupt_pid: u64,
 }
 
+/// The source object, key and trigger of a signal packet.
+type SignalKey = (KoID, u64, u32);
+
 #[derive(Debug)]
 struct PortInterruptPacket {
     timestamp: i64,
@@ -54,6 +67,52 @@ impl From<PortInterruptPacket> for PacketInterrupt {
     }
 }
 
+impl PortInner {
+    fn push(&mut self, packet: PortPacket) {
+        self.queue.push_back(packet);
+    }
+
+    /// Push a signal packet, or merge it into a pending one from the same
+    /// `source` with the same key and trigger.
+    fn push_signal(&mut self, source: KoID, key: u64, trigger: Signal, observed: Signal) {
+        let index_key = (source, key, trigger.bits());
+        if let Some(&seq) = self.signal_index.get(&index_key) {
+            let packet = &mut self.queue[(seq - self.head_seq) as usize];
+            let signal = packet.signal_mut().unwrap();
+            signal.observed = observed;
+            signal.count += 1;
+            return;
+        }
+        let seq = self.head_seq + self.queue.len() as u64;
+        self.signal_index.insert(index_key, seq);
+        self.signal_keys.insert(seq, index_key);
+        self.push(
+            PortPacketRepr {
+                key,
+                status: ZxError::OK,
+                data: PayloadRepr::Signal(PacketSignal {
+                    trigger,
+                    observed,
+                    count: 1,
+                    timestamp: 0,
+                    _reserved1: 0,
+                }),
+            }
+            .into(),
+        );
+    }
+
+    fn pop(&mut self) -> Option<PortPacket> {
+        let packet = self.queue.pop_front()?;
+        let seq = self.head_seq;
+        self.head_seq += 1;
+        if let Some(index_key) = self.signal_keys.remove(&seq) {
+            self.signal_index.remove(&index_key);
+        }
+        Some(packet)
+    }
+}
+
 impl Port {
     /// Create a new `Port`.
     pub fn new(options: u32) -> ZxResult<Arc<Self>> {
@@ -67,7 +126,16 @@ impl Port {
     /// Push a `packet` into the port.
     pub fn push(&self, packet: impl Into<PortPacket>) {
         let mut inner = self.inner.lock();
-        inner.queue.push_back(packet.into());
+        inner.push(packet.into());
+        drop(inner);
+        self.base.signal_set(Signal::READABLE);
+    }
+
+    /// Push a signal packet from object `source` into the port, which is
+    /// coalesced with a pending one from `source` of the same `key` and `trigger`.
+    pub(crate) fn push_signal(&self, source: KoID, key: u64, trigger: Signal, observed: Signal) {
+        let mut inner = self.inner.lock();
+        inner.push_signal(source, key, trigger, observed);
         drop(inner);
         self.base.signal_set(Signal::READABLE);
     }
@@ -109,36 +177,55 @@ impl Port {
     /// Asynchronous wait until at least one packet is available, then take out the earliest
     /// (in FIFO order) available packet.
     pub async fn wait(self: &Arc<Self>) -> PortPacket {
+        self.wait_many(1).await.pop().unwrap()
+    }
+
+    /// Asynchronous wait until at least one packet is available, then take out
+    /// at most `max` available packets.
+    ///
+    /// Interrupt packets come first, then the others in FIFO order.
+    pub async fn wait_many(self: &Arc<Self>, max: usize) -> Vec<PortPacket> {
+        assert!(max > 0);
         let object = self.clone() as Arc<dyn KernelObject>;
         loop {
             object.wait_signal(Signal::READABLE).await;
             let mut inner = self.inner.lock();
-            if self.can_bind_to_interrupt() {
-                while let Some(packet) = inner.interrupt_queue.pop_front() {
-                    let in_queue = inner.interrupt_grave.remove(&packet.pid);
-                    if inner.queue.is_empty() && inner.interrupt_queue.is_empty() {
-                        self.base.signal_clear(Signal::READABLE);
-                    }
-                    if !in_queue {
-                        continue;
-                    }
-                    return PortPacketRepr {
+            let mut packets = Vec::new();
+            while packets.len() < max {
+                match self.pop(&mut inner) {
+                    Some(packet) => packets.push(packet),
+                    None => break,
+                }
+            }
+            if inner.queue.is_empty()
+                && (inner.interrupt_queue.is_empty() || !self.can_bind_to_interrupt())
+            {
+                self.base.signal_clear(Signal::READABLE);
+            }
+            if !packets.is_empty() {
+                return packets;
+            }
+        }
+    }
+
+    /// Take out the earliest packet.
+    fn pop(&self, inner: &mut PortInner) -> Option<PortPacket> {
+        if self.can_bind_to_interrupt() {
+            while let Some(packet) = inner.interrupt_queue.pop_front() {
+                if !inner.interrupt_grave.remove(&packet.pid) {
+                    continue;
+                }
+                return Some(
+                    PortPacketRepr {
                         key: packet.key,
                         status: ZxError::OK,
                         data: PayloadRepr::Interrupt(packet.into()),
                     }
-                    .into();
-                }
-            }
-            if let Some(packet) = inner.queue.pop_front() {
-                if inner.queue.is_empty()
-                    && (inner.interrupt_queue.is_empty() || !self.can_bind_to_interrupt())
-                {
-                    self.base.signal_clear(Signal::READABLE);
-                }
-                return packet;
+                    .into(),
+                );
             }
         }
+        inner.pop()
     }
 
     /// Get the number of packets in queue.
@@ -231,4 +318,69 @@ mod tests {
         let packet = port.wait().await;
         assert_eq!(PortPacketRepr::from(&packet), packet_repr);
     }
+
+    #[async_std::test]
+    async fn wait_many() {
+        let port = Port::new(0).unwrap();
+        let object = DummyObject::new() as Arc<dyn KernelObject>;
+        object.signal_set(Signal::READABLE);
+        object.send_signal_to_port_async(Signal::READABLE, &port, 1);
+        object.send_signal_to_port_async(Signal::READABLE, &port, 1);
+        object.send_signal_to_port_async(Signal::READABLE, &port, 2);
+        assert_eq!(port.len(), 2);
+
+        let packets = port.wait_many(1).await;
+        let packet_repr = PortPacketRepr {
+            key: 1,
+            status: ZxError::OK,
+            data: PayloadRepr::Signal(PacketSignal {
+                trigger: Signal::READABLE,
+                observed: Signal::READABLE,
+                count: 2,
+                timestamp: 0,
+                _reserved1: 0,
+            }),
+        };
+        assert_eq!(packets.len(), 1);
+        assert_eq!(PortPacketRepr::from(&packets[0]), packet_repr);
+
+        // not coalesced with the packet taken out
+        object.send_signal_to_port_async(Signal::READABLE, &port, 1);
+        let packets = port.wait_many(8).await;
+        let keys: Vec<u64> = packets.iter().map(|p| p.key).collect();
+        assert_eq!(keys, [2, 1]);
+        assert!(!port.signal().contains(Signal::READABLE));
+    }
+
+    #[async_std::test]
+    async fn wait_objects_with_same_key() {
+        let port = Port::new(0).unwrap();
+        let object1 = DummyObject::new() as Arc<dyn KernelObject>;
+        let object2 = DummyObject::new() as Arc<dyn KernelObject>;
+        object1.send_signal_to_port_async(Signal::READABLE, &port, 1);
+        object2.send_signal_to_port_async(Signal::READABLE, &port, 1);
+        object1.signal_set(Signal::READABLE);
+        object2.signal_set(Signal::READABLE | Signal::WRITABLE);
+        assert_eq!(port.len(), 2);
+
+        let packet = |observed| PortPacketRepr {
+            key: 1,
+            status: ZxError::OK,
+            data: PayloadRepr::Signal(PacketSignal {
+                trigger: Signal::READABLE,
+                observed,
+                count: 1,
+                timestamp: 0,
+                _reserved1: 0,
+            }),
+        };
+        // each object gets its own packet
+        let packets = port.wait_many(8).await;
+        assert_eq!(packets.len(), 2);
+        assert_eq!(PortPacketRepr::from(&packets[0]), packet(Signal::READABLE));
+        assert_eq!(
+            PortPacketRepr::from(&packets[1]),
+            packet(Signal::READABLE | Signal::WRITABLE)
+        );
+    }
 }
@@ -148,6 +148,17 @@ pub struct PacketInterrupt {
     pub _reserved2: u64,
 }
 
+impl PortPacket {
+    /// Get the payload of a signal packet.
+    #[allow(unsafe_code)]
+    pub(super) fn signal_mut(&mut self) -> Option<&mut PacketSignal> {
+        match self.type_ {
+            PacketType::SignalOne | PacketType::SignalRep => Some(unsafe { &mut self.data.signal }),
+            _ => None,
+        }
+    }
+}
+
 // Rust struct: for internal constructing and debugging
 
 /// A high-level representation of a packet sent through a port.
@@ -3,6 +3,7 @@ use crate::object::*;
 use alloc::boxed::Box;
 use alloc::sync::Arc;
 use core::time::Duration;
+use kernel_hal::TimerId;
 use spin::Mutex;
 
 /// An object that may be signaled at some point in the future
@@ -14,7 +15,6 @@ use spin::Mutex;
 pub struct Timer {
     base: KObjectBase,
     _counter: CountHelper,
-    #[allow(dead_code)]
     slack: Slack,
     inner: Mutex<TimerInner>,
 }
@@ -25,11 +25,14 @@ define_count_helper!(Timer);
 #[derive(Default)]
 struct TimerInner {
     deadline: Option<Duration>,
+    /// The pending HAL timer.
+    timer: Option<TimerId>,
 }
 
 /// Slack specifies how much a timer or event is allowed to deviate from its deadline.
 ///
-/// **Not supported: Now slack has no effect on the timer.**
+/// Deadlines are moved within the slack to coarse boundaries shared by nearby
+/// deadlines, so that their timers can fire together.
 #[repr(u32)]
 #[derive(Debug, Copy, Clone)]
 pub enum Slack {
@@ -41,6 +44,28 @@ pub enum Slack {
     Late = 2,
 }
 
+impl Slack {
+    /// Move `deadline` within the interval of `amount` slack to a multiple of
+    /// the largest power-of-two nanoseconds that is no more than `amount`.
+    pub fn coalesce(self, deadline: Duration, amount: Duration) -> Duration {
+        let amount = amount.as_nanos() as u64;
+        if amount <= 1 {
+            return deadline;
+        }
+        let align = 1u64 << (63 - amount.leading_zeros());
+        let nanos = deadline.as_nanos() as u64;
+        let down = nanos & !(align - 1);
+        let nanos = match self {
+            Slack::Early => down,
+            Slack::Late if down == nanos => nanos,
+            Slack::Late => down.saturating_add(align),
+            Slack::Center if nanos - down < align / 2 => down,
+            Slack::Center => down.saturating_add(align),
+        };
+        Duration::from_nanos(nanos)
+    }
+}
+
 impl Timer {
     /// Create a new `Timer`.
     pub fn new() -> Arc<Self> {
@@ -66,23 +91,34 @@ impl Timer {
 
     /// Starts a one-shot timer that will fire when `deadline` passes.
     ///
+    /// It may fire at any time within the interval of `slack` around `deadline`,
+    /// see [`Slack`].
+    ///
     /// If a previous call to `set` was pending, the previous timer is canceled
     /// and `Signal::SIGNALED` is de-asserted as needed.
-    pub fn set(self: &Arc<Self>, deadline: Duration, _slack: Duration) {
+    pub fn set(self: &Arc<Self>, deadline: Duration, slack: Duration) {
         let mut inner = self.inner.lock();
+        if let Some(timer) = inner.timer.take() {
+            kernel_hal::timer_cancel(timer);
+        }
+        let deadline = self.slack.coalesce(deadline, slack);
         inner.deadline = Some(deadline);
         self.base.signal_clear(Signal::SIGNALED);
         let me = Arc::downgrade(self);
-        kernel_hal::timer_set(
+        let timer = kernel_hal::timer_set(
             deadline,
             Box::new(move |now| me.upgrade().map(|timer| timer.touch(now)).unwrap_or(())),
         );
+        inner.timer = Some(timer);
     }
 
     /// Cancel the pending timer started by `set`.
     pub fn cancel(&self) {
         let mut inner = self.inner.lock();
         inner.deadline = None;
+        if let Some(timer) = inner.timer.take() {
+            kernel_hal::timer_cancel(timer);
+        }
     }
 
     /// Called by HAL timer.
@@ -92,6 +128,7 @@ impl Timer {
             if now >= deadline {
                 self.base.signal_set(Signal::SIGNALED);
                 inner.deadline = None;
+                inner.timer = None;
             }
         }
     }
@@ -139,4 +176,20 @@ mod tests {
         std::thread::sleep(Duration::from_millis(50));
         assert_eq!(timer.signal(), Signal::empty());
     }
+
+    #[test]
+    fn coalesce() {
+        let deadline = Duration::from_nanos(1000);
+        let slack = Duration::from_nanos(300);
+        // aligned to 256ns
+        assert_eq!(Slack::Early.coalesce(deadline, slack).as_nanos(), 768);
+        assert_eq!(Slack::Late.coalesce(deadline, slack).as_nanos(), 1024);
+        assert_eq!(Slack::Center.coalesce(deadline, slack).as_nanos(), 1024);
+        let deadline = Duration::from_nanos(1100);
+        assert_eq!(Slack::Center.coalesce(deadline, slack).as_nanos(), 1024);
+        assert_eq!(
+            Slack::Late.coalesce(deadline, Duration::default()),
+            deadline
+        );
+    }
 }
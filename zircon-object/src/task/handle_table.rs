@@ -0,0 +1,270 @@
+//! The handle table of a process.
+
+use {
+    crate::object::*,
+    alloc::{collections::BTreeMap, vec::Vec},
+    futures::channel::oneshot::{self, Receiver, Sender},
+    spin::{Mutex, RwLock},
+};
+
+/// Number of bits of the slot index in a handle value.
+const INDEX_BITS: u32 = 20;
+const INDEX_MASK: u32 = (1 << INDEX_BITS) - 1;
+/// Number of bits of the generation, the rest above the index.
+const GEN_MASK: u32 = (1 << (32 - 2 - INDEX_BITS)) - 1;
+
+/// The two lowest bits of a handle value are always set.
+const FIXED_BITS: u32 = 0x3;
+
+/// A table of handles, which are stored in a slab indexed by handle values.
+///
+/// A handle value encodes the index of its slot and the generation of the slot,
+/// which is incremented when the handle is removed. So a stale handle value
+/// never refers to a new handle which reuses the slot.
+///
+/// Looking up handles only takes the read lock of the slots, and the table is
+/// not protected by the lock of the process, so syscalls on handles of the same
+/// process don't serialize.
+#[derive(Default)]
+pub(super) struct HandleTable {
+    slots: RwLock<Slots>,
+    /// Senders notified when the handle is removed, which are rarely used.
+    cancel: Mutex<BTreeMap<HandleValue, Vec<Sender<()>>>>,
+}
+
+#[derive(Default)]
+struct Slots {
+    entries: Vec<Slot>,
+    /// Indexes of free slots.
+    free: Vec<u32>,
+}
+
+struct Slot {
+    gen: u32,
+    handle: Option<Handle>,
+}
+
+fn encode(index: u32, gen: u32) -> HandleValue {
+    (((gen & GEN_MASK) << INDEX_BITS | index) << 2) | FIXED_BITS
+}
+
+fn decode(handle_value: HandleValue) -> Option<(usize, u32)> {
+    if handle_value & FIXED_BITS != FIXED_BITS {
+        return None;
+    }
+    let value = handle_value >> 2;
+    Some(((value & INDEX_MASK) as usize, value >> INDEX_BITS))
+}
+
+impl Slots {
+    /// Number of handles which can still be added.
+    fn vacancy(&self) -> usize {
+        self.free.len() + (INDEX_MASK as usize + 1 - self.entries.len())
+    }
+
+    /// Add a handle, which must fit, see `vacancy`.
+    fn add(&mut self, handle: Handle) -> HandleValue {
+        let index = match self.free.pop() {
+            Some(index) => index,
+            None => {
+                self.entries.push(Slot {
+                    gen: 0,
+                    handle: None,
+                });
+                self.entries.len() as u32 - 1
+            }
+        };
+        let slot = &mut self.entries[index as usize];
+        slot.handle = Some(handle);
+        encode(index, slot.gen)
+    }
+
+    fn get(&self, handle_value: HandleValue) -> ZxResult<&Handle> {
+        let (index, gen) = decode(handle_value).ok_or(ZxError::BAD_HANDLE)?;
+        match self.entries.get(index) {
+            Some(Slot {
+                gen: slot_gen,
+                handle: Some(handle),
+            }) if *slot_gen == gen => Ok(handle),
+            _ => Err(ZxError::BAD_HANDLE),
+        }
+    }
+
+    fn remove(&mut self, handle_value: HandleValue) -> ZxResult<Handle> {
+        self.get(handle_value)?;
+        let index = decode(handle_value).unwrap().0;
+        let slot = &mut self.entries[index];
+        slot.gen = (slot.gen + 1) & GEN_MASK;
+        self.free.push(index as u32);
+        Ok(slot.handle.take().unwrap())
+    }
+}
+
+impl HandleTable {
+    /// Add a handle, return its value.
+    ///
+    /// Fails with `NO_RESOURCES` if the table is full.
+    pub fn add(&self, handle: Handle) -> ZxResult<HandleValue> {
+        let mut slots = self.slots.write();
+        if slots.vacancy() == 0 {
+            return Err(ZxError::NO_RESOURCES);
+        }
+        let handle_value = slots.add(handle);
+        info!("add handle: {:#x}", handle_value);
+        Ok(handle_value)
+    }
+
+    /// Add all handles in one critical section.
+    ///
+    /// Fails with `NO_RESOURCES` and adds none of them if they do not all fit.
+    pub fn add_many(&self, handles: Vec<Handle>) -> ZxResult<Vec<HandleValue>> {
+        let mut slots = self.slots.write();
+        if slots.vacancy() < handles.len() {
+            return Err(ZxError::NO_RESOURCES);
+        }
+        Ok(handles.into_iter().map(|h| slots.add(h)).collect())
+    }
+
+    /// Get a copy of the handle.
+    pub fn get(&self, handle_value: HandleValue) -> ZxResult<Handle> {
+        self.slots.read().get(handle_value).map(Handle::clone)
+    }
+
+    /// Remove a handle.
+    pub fn remove(&self, handle_value: HandleValue) -> ZxResult<Handle> {
+        let handle = self.slots.write().remove(handle_value)?;
+        self.notify_cancel(&[handle_value]);
+        Ok(handle)
+    }
+
+    /// Remove all handles in one critical section.
+    ///
+    /// If one or more error happens, return one of them.
+    /// All handles are discarded on success or failure.
+    pub fn remove_many(&self, handle_values: &[HandleValue]) -> ZxResult<Vec<Handle>> {
+        let mut error = None;
+        let mut handles = Vec::with_capacity(handle_values.len());
+        {
+            let mut slots = self.slots.write();
+            for &handle_value in handle_values {
+                match slots.remove(handle_value) {
+                    Ok(handle) => handles.push(handle),
+                    Err(err) => error = Some(err),
+                }
+            }
+        }
+        self.notify_cancel(handle_values);
+        match error {
+            Some(err) => Err(err),
+            None => Ok(handles),
+        }
+    }
+
+    /// Get an one-shot `Receiver` which is notified when the handle is removed.
+    pub fn cancel_token(&self, handle_value: HandleValue) -> ZxResult<Receiver<()>> {
+        // hold the lock of senders so that a concurrent removal notifies this one
+        let mut cancel = self.cancel.lock();
+        self.slots.read().get(handle_value)?;
+        let (sender, receiver) = oneshot::channel();
+        cancel.entry(handle_value).or_default().push(sender);
+        Ok(receiver)
+    }
+
+    /// Remove all handles.
+    ///
+    /// Pending cancel tokens are dropped without being notified.
+    pub fn clear(&self) {
+        let mut handles = Vec::new();
+        {
+            let mut slots = self.slots.write();
+            let Slots { entries, free } = &mut *slots;
+            for (index, slot) in entries.iter_mut().enumerate() {
+                if let Some(handle) = slot.handle.take() {
+                    slot.gen = (slot.gen + 1) & GEN_MASK;
+                    free.push(index as u32);
+                    handles.push(handle);
+                }
+            }
+        }
+        self.cancel.lock().clear();
+        // objects may run callbacks when their last handle is dropped
+        drop(handles);
+    }
+
+    fn notify_cancel(&self, handle_values: &[HandleValue]) {
+        let mut cancel = self.cancel.lock();
+        if cancel.is_empty() {
+            return;
+        }
+        for handle_value in handle_values {
+            for sender in cancel.remove(handle_value).unwrap_or_default() {
+                let _ = sender.send(());
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::task::*;
+
+    #[test]
+    fn generation() {
+        let job = Job::root();
+        let proc = Process::create(&job, "proc").expect("failed to create process");
+        let table = HandleTable::default();
+
+        let value = table
+            .add(Handle::new(proc.clone(), Rights::DEFAULT_PROCESS))
+            .unwrap();
+        assert_eq!(value & FIXED_BITS, FIXED_BITS);
+        assert!(table.get(value).is_ok());
+        assert_eq!(table.get(value & !1).err(), Some(ZxError::BAD_HANDLE));
+
+        let mut token = table.cancel_token(value).unwrap();
+        table.remove(value).unwrap();
+        assert_eq!(token.try_recv(), Ok(Some(())));
+
+        // the slot is reused with a new generation
+        let new_value = table
+            .add(Handle::new(proc.clone(), Rights::DEFAULT_PROCESS))
+            .unwrap();
+        assert_ne!(new_value, value);
+        assert_eq!(table.get(value).err(), Some(ZxError::BAD_HANDLE));
+        assert_eq!(table.remove(value).err(), Some(ZxError::BAD_HANDLE));
+        assert!(table.get(new_value).is_ok());
+
+        // all handles are removed even if some of them are invalid
+        let values = table
+            .add_many(vec![
+                Handle::new(proc.clone(), Rights::DEFAULT_PROCESS),
+                Handle::new(proc.clone(), Rights::DEFAULT_PROCESS),
+            ])
+            .unwrap();
+        assert_eq!(
+            table.remove_many(&[values[0], value, values[1]]).err(),
+            Some(ZxError::BAD_HANDLE)
+        );
+        assert_eq!(table.get(values[0]).err(), Some(ZxError::BAD_HANDLE));
+        assert_eq!(table.get(values[1]).err(), Some(ZxError::BAD_HANDLE));
+
+        table.clear();
+        assert_eq!(table.get(new_value).err(), Some(ZxError::BAD_HANDLE));
+
+        // a full table refuses new handles instead of panicking
+        table.slots.write().free.clear();
+        table
+            .slots
+            .write()
+            .entries
+            .resize_with(INDEX_MASK as usize + 1, || Slot {
+                gen: 0,
+                handle: None,
+            });
+        let handle = Handle::new(proc.clone(), Rights::DEFAULT_PROCESS);
+        assert_eq!(table.add(handle).err(), Some(ZxError::NO_RESOURCES));
+        let handles = vec![Handle::new(proc, Rights::DEFAULT_PROCESS)];
+        assert_eq!(table.add_many(handles).err(), Some(ZxError::NO_RESOURCES));
+    }
+}
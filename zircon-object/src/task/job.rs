@@ -6,6 +6,7 @@ use {
     crate::task::Task,
     alloc::sync::{Arc, Weak},
     alloc::vec::Vec,
+    core::time::Duration,
     spin::Mutex,
 };
 
@@ -164,6 +165,11 @@ impl Job {
         Ok(())
     }
 
+    /// Get the minimum slack of timers in the job, from the timer slack policy.
+    pub fn min_timer_slack(&self) -> Duration {
+        self.inner.lock().timer_policy.min_slack()
+    }
+
     /// Add a process to the job.
     pub(super) fn add_process(&self, process: Arc<Process>) -> ZxResult {
         let mut inner = self.inner.lock();
@@ -1,5 +1,6 @@
 use crate::error::*;
 use crate::signal::Slack;
+use core::time::Duration;
 
 /// Security and resource policies of a job.
 #[derive(Default, Copy, Clone)]
@@ -141,6 +142,11 @@ impl TimerSlack {
             mode: policy.default_mode,
         }
     }
+
+    /// The minimum slack of timers.
+    pub(super) fn min_slack(&self) -> Duration {
+        Duration::from_nanos(self.amount as u64)
+    }
 }
 
 impl Default for TimerSlack {
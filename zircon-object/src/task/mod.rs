@@ -4,14 +4,16 @@ use super::*;
 use alloc::sync::Arc;
 
 mod exception;
+mod handle_table;
 mod job;
 mod job_policy;
 mod process;
+mod profile;
 mod suspend_token;
 mod thread;
 
 pub use {
-    self::exception::*, self::job::*, self::job_policy::*, self::process::*,
+    self::exception::*, self::job::*, self::job_policy::*, self::process::*, self::profile::*,
     self::suspend_token::*, self::thread::*,
 };
 
@@ -1,10 +1,13 @@
 use {
-    super::{exception::*, job::Job, job_policy::*, thread::Thread, *},
-    crate::{object::*, signal::Futex, vm::*},
+    super::{exception::*, handle_table::HandleTable, job::Job, job_policy::*, thread::Thread, *},
+    crate::{
+        object::*,
+        signal::{Futex, FutexKey},
+        vm::*,
+    },
     alloc::{boxed::Box, sync::Arc, vec::Vec},
     core::{any::Any, sync::atomic::AtomicI32},
-    futures::channel::oneshot::{self, Receiver, Sender},
-    hashbrown::HashMap,
+    futures::channel::oneshot::Receiver,
     spin::Mutex,
 };
 
@@ -57,6 +60,7 @@ pub struct Process {
     ext: Box<dyn Any + Send + Sync>,
     exceptionate: Arc<Exceptionate>,
     debug_exceptionate: Arc<Exceptionate>,
+    handles: HandleTable,
     inner: Mutex<ProcessInner>,
 }
 
@@ -75,9 +79,6 @@ define_count_helper!(Process);
 #[derive(Default)]
 struct ProcessInner {
     status: Status,
-    max_handle_id: u32,
-    handles: HashMap<HandleValue, (Handle, Vec<Sender<()>>)>,
-    futexes: HashMap<usize, Arc<Futex>>,
     threads: Vec<Arc<Thread>>,
 
     // special info
@@ -124,6 +125,7 @@ impl Process {
             ext: Box::new(ext),
             exceptionate: Exceptionate::new(ExceptionChannelType::Process),
             debug_exceptionate: Exceptionate::new(ExceptionChannelType::Debugger),
+            handles: HandleTable::default(),
             inner: Mutex::new(ProcessInner::default()),
         });
         job.add_process(proc.clone())?;
@@ -182,16 +184,18 @@ impl Process {
             if inner.status != Status::Init {
                 return Err(ZxError::BAD_STATE);
             }
+            handle_value = match arg1 {
+                Some(handle) => self.handles.add(handle)?,
+                None => INVALID_HANDLE,
+            };
             inner.status = Status::Running;
-            handle_value = arg1.map_or(INVALID_HANDLE, |handle| inner.add_handle(handle));
         }
         thread.set_first_thread();
         match thread.start(entry, stack, handle_value as usize, arg2, thread_fn) {
             Ok(_) => Ok(()),
             Err(err) => {
-                let mut inner = self.inner.lock();
                 if handle_value != INVALID_HANDLE {
-                    inner.remove_handle(handle_value).ok();
+                    self.handles.remove(handle_value).ok();
                 }
                 Err(err)
             }
@@ -208,15 +212,16 @@ impl Process {
         }
         inner.status = Status::Exited(retcode);
         if inner.threads.is_empty() {
-            inner.handles.clear();
             drop(inner);
+            self.handles.clear();
             self.terminate();
             return;
         }
         for thread in inner.threads.iter() {
             thread.kill();
         }
-        inner.handles.clear();
+        drop(inner);
+        self.handles.clear();
     }
 
     /// The process finally terminates.
@@ -310,19 +315,20 @@ impl Process {
     }
 
     /// Add a handle to the process
-    pub fn add_handle(&self, handle: Handle) -> HandleValue {
-        self.inner.lock().add_handle(handle)
+    ///
+    /// Fails with `ZxError::NO_RESOURCES` if the handle table is full.
+    pub fn add_handle(&self, handle: Handle) -> ZxResult<HandleValue> {
+        self.handles.add(handle)
     }
 
-    /// Add all handles to the process
-    pub fn add_handles(&self, handles: Vec<Handle>) -> Vec<HandleValue> {
-        let mut inner = self.inner.lock();
-        handles.into_iter().map(|h| inner.add_handle(h)).collect()
+    /// Add all handles to the process, or none of them if they do not all fit
+    pub fn add_handles(&self, handles: Vec<Handle>) -> ZxResult<Vec<HandleValue>> {
+        self.handles.add_many(handles)
     }
 
     /// Remove a handle from the process
     pub fn remove_handle(&self, handle_value: HandleValue) -> ZxResult<Handle> {
-        self.inner.lock().remove_handle(handle_value)
+        self.handles.remove(handle_value)
     }
 
     /// Remove all handles from the process.
@@ -330,11 +336,7 @@ impl Process {
     /// If one or more error happens, return one of them.
     /// All handles are discarded on success or failure.
     pub fn remove_handles(&self, handle_values: &[HandleValue]) -> ZxResult<Vec<Handle>> {
-        let mut inner = self.inner.lock();
-        handle_values
-            .iter()
-            .map(|h| inner.remove_handle(*h))
-            .collect()
+        self.handles.remove_many(handle_values)
     }
 
     /// Remove a handle referring to a kernel object of the given type from the process.
@@ -349,17 +351,16 @@ impl Process {
 
     /// Get a handle from the process
     fn get_handle(&self, handle_value: HandleValue) -> ZxResult<Handle> {
-        self.inner.lock().get_handle(handle_value)
+        self.handles.get(handle_value)
     }
 
-    /// Get a futex from the process
+    /// Get a futex from the process.
+    ///
+    /// Futexes are private to the process, and looked up in the global futex
+    /// table without locking the process.
     pub fn get_futex(&self, addr: &'static AtomicI32) -> Arc<Futex> {
-        let mut inner = self.inner.lock();
-        inner
-            .futexes
-            .entry(addr as *const AtomicI32 as usize)
-            .or_insert_with(|| Futex::new(addr))
-            .clone()
+        let key = FutexKey::Private(self.id(), addr as *const AtomicI32 as usize);
+        Futex::get(key, addr)
     }
 
     /// Duplicate a handle with new `rights`, return the new handle value.
@@ -373,13 +374,9 @@ impl Process {
         handle_value: HandleValue,
         operation: impl FnOnce(Rights) -> ZxResult<Rights>,
     ) -> ZxResult<HandleValue> {
-        let mut inner = self.inner.lock();
-        let mut handle = match inner.handles.get(&handle_value) {
-            Some((h, _)) => h.clone(),
-            None => return Err(ZxError::BAD_HANDLE),
-        };
+        let mut handle = self.handles.get(handle_value)?;
         handle.rights = operation(handle.rights)?;
-        let new_handle_value = inner.add_handle(handle);
+        let new_handle_value = self.handles.add(handle)?;
         Ok(new_handle_value)
     }
 
@@ -517,7 +514,7 @@ impl Process {
 
     /// Get an one-shot `Receiver` for receiving cancel message of the given handle.
     pub fn get_cancel_token(&self, handle_value: HandleValue) -> ZxResult<Receiver<()>> {
-        self.inner.lock().get_cancel_token(handle_value)
+        self.handles.cancel_token(handle_value)
     }
 
     /// Get KoIDs of Threads.
@@ -566,46 +563,10 @@ impl Task for Process {
 }
 
 impl ProcessInner {
-    /// Add a handle to the process
-    fn add_handle(&mut self, handle: Handle) -> HandleValue {
-        // FIXME: handle value from ptr
-        let key = (self.max_handle_id << 2) | 0x3u32;
-        info!("add handle: {:#x}, {:?}", key, handle.object);
-        self.max_handle_id += 1;
-        self.handles.insert(key, (handle, Vec::new()));
-        key
-    }
-
     /// Whether `thread` is in this process.
     fn contains_thread(&self, thread: &Arc<Thread>) -> bool {
         self.threads.iter().any(|t| Arc::ptr_eq(t, thread))
     }
-
-    fn remove_handle(&mut self, handle_value: HandleValue) -> ZxResult<Handle> {
-        let (handle, queue) = self
-            .handles
-            .remove(&handle_value)
-            .ok_or(ZxError::BAD_HANDLE)?;
-        for sender in queue {
-            let _ = sender.send(());
-        }
-        Ok(handle)
-    }
-
-    fn get_cancel_token(&mut self, handle_value: HandleValue) -> ZxResult<Receiver<()>> {
-        let (_, queue) = self
-            .handles
-            .get_mut(&handle_value)
-            .ok_or(ZxError::BAD_HANDLE)?;
-        let (sender, receiver) = oneshot::channel();
-        queue.push(sender);
-        Ok(receiver)
-    }
-
-    fn get_handle(&mut self, handle_value: HandleValue) -> ZxResult<Handle> {
-        let (handle, _) = self.handles.get(&handle_value).ok_or(ZxError::BAD_HANDLE)?;
-        Ok(handle.clone())
-    }
 }
 
 /// Information of a process.
@@ -639,7 +600,7 @@ mod tests {
         let proc = Process::create(&root_job, "proc").expect("failed to create process");
         let handle = Handle::new(proc.clone(), Rights::DEFAULT_PROCESS);
 
-        let handle_value = proc.add_handle(handle);
+        let handle_value = proc.add_handle(handle).unwrap();
         let _info = proc.get_handle_info(handle_value).unwrap();
 
         // getting object should success
@@ -680,7 +641,7 @@ mod tests {
         let handle1 = Handle::new(proc.clone(), Rights::DEFAULT_PROCESS);
         let handle2 = Handle::new(proc.clone(), Rights::DEFAULT_PROCESS);
 
-        let handle_values = proc.add_handles(vec![handle1, handle2]);
+        let handle_values = proc.add_handles(vec![handle1, handle2]).unwrap();
         let object1: Arc<Process> = proc
             .get_object_with_rights(handle_values[0], Rights::DEFAULT_PROCESS)
             .expect("failed to get object");
@@ -707,7 +668,7 @@ mod tests {
 
         // duplicate handle with the same rights.
         let rights = Rights::DUPLICATE;
-        let handle_value = proc.add_handle(Handle::new(proc.clone(), rights));
+        let handle_value = proc.add_handle(Handle::new(proc.clone(), rights)).unwrap();
         let new_handle_value = proc
             .dup_handle_operating_rights(handle_value, |old_rights| Ok(old_rights))
             .unwrap();
@@ -723,7 +684,9 @@ mod tests {
         );
 
         // duplicate handle which does not have `Rights::DUPLICATE` should fail.
-        let handle_value = proc.add_handle(Handle::new(proc.clone(), Rights::empty()));
+        let handle_value = proc
+            .add_handle(Handle::new(proc.clone(), Rights::empty()))
+            .unwrap();
         assert_eq!(
             proc.dup_handle_operating_rights(handle_value, |handle_rights| {
                 if !handle_rights.contains(Rights::DUPLICATE) {
@@ -0,0 +1,98 @@
+use {super::*, crate::object::*, alloc::sync::Arc, bitflags::bitflags};
+
+/// Scheduling profile which can be applied to threads.
+///
+/// ## SYNOPSIS
+///
+/// A profile is created by `zx_profile_create()` from the root job, and applied to
+/// threads by `zx_object_set_profile()`. Only the priority is supported,
+/// a profile with a CPU affinity mask is rejected with `NOT_SUPPORTED`.
+pub struct Profile {
+    base: KObjectBase,
+    priority: u8,
+}
+
+impl_kobject!(Profile);
+
+impl Profile {
+    /// Create a new profile.
+    pub fn create(info: &ProfileInfo) -> ZxResult<Arc<Self>> {
+        let flags = ProfileInfoFlags::from_bits(info.flags).ok_or(ZxError::INVALID_ARGS)?;
+        if flags != ProfileInfoFlags::PRIORITY {
+            return Err(ZxError::NOT_SUPPORTED);
+        }
+        if info.priority < 0 || info.priority > MAX_PRIORITY as i32 {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        Ok(Arc::new(Profile {
+            base: KObjectBase::new(),
+            priority: info.priority as u8,
+        }))
+    }
+
+    /// Get the scheduling priority.
+    pub fn priority(&self) -> u8 {
+        self.priority
+    }
+}
+
+/// Information to create a profile, `zx_profile_info_t`.
+#[repr(C)]
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ProfileInfo {
+    /// `ProfileInfoFlags`
+    pub flags: u32,
+    padding1: [u8; 4],
+    /// Scheduling priority
+    pub priority: i32,
+    padding2: [u8; 20],
+    /// CPU affinity mask
+    pub cpu_affinity_mask: [u64; 8],
+}
+
+bitflags! {
+    /// Fields which are valid in `ProfileInfo`.
+    pub struct ProfileInfoFlags: u32 {
+        /// `priority` is valid.
+        #[allow(clippy::identity_op)]
+        const PRIORITY = 1 << 0;
+        /// `cpu_affinity_mask` is valid.
+        const CPU_MASK = 1 << 1;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn create() {
+        let info = ProfileInfo {
+            flags: ProfileInfoFlags::PRIORITY.bits(),
+            priority: 24,
+            ..Default::default()
+        };
+        let profile = Profile::create(&info).unwrap();
+        assert_eq!(profile.priority(), 24);
+
+        let info = ProfileInfo {
+            flags: ProfileInfoFlags::PRIORITY.bits(),
+            priority: 32,
+            ..Default::default()
+        };
+        assert_eq!(Profile::create(&info).err(), Some(ZxError::INVALID_ARGS));
+
+        let info = ProfileInfo {
+            flags: ProfileInfoFlags::CPU_MASK.bits(),
+            ..Default::default()
+        };
+        assert_eq!(Profile::create(&info).err(), Some(ZxError::NOT_SUPPORTED));
+
+        let info = ProfileInfo {
+            flags: (ProfileInfoFlags::PRIORITY | ProfileInfoFlags::CPU_MASK).bits(),
+            priority: 24,
+            ..Default::default()
+        };
+        assert_eq!(Profile::create(&info).err(), Some(ZxError::NOT_SUPPORTED));
+    }
+}
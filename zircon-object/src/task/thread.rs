@@ -3,6 +3,7 @@ use {
     super::process::Process,
     super::*,
     crate::object::*,
+    crate::util::ktrace::{ktrace, TraceEvent},
     alloc::{boxed::Box, sync::Arc},
     bitflags::bitflags,
     core::{
@@ -102,6 +103,11 @@ impl_kobject!(Thread
 );
 define_count_helper!(Thread);
 
+/// The default scheduling priority of a thread.
+pub const DEFAULT_PRIORITY: u8 = 16;
+/// The highest scheduling priority of a thread.
+pub const MAX_PRIORITY: u8 = 31;
+
 #[derive(Default)]
 struct ThreadInner {
     /// Thread context
@@ -129,6 +135,10 @@ struct ThreadInner {
     /// The time this thread has run on cpu
     time: u128,
     flags: ThreadFlag,
+    /// Scheduling priority, higher is scheduled first
+    priority: u8,
+    /// Priority inherited from the waiters of a futex owned by this thread
+    inherited_priority: u8,
 }
 
 impl ThreadInner {
@@ -215,6 +225,7 @@ impl Thread {
             exceptionate: Exceptionate::new(ExceptionChannelType::Thread),
             inner: Mutex::new(ThreadInner {
                 context: Some(Box::new(UserContext::default())),
+                priority: DEFAULT_PRIORITY,
                 ..Default::default()
             }),
         });
@@ -262,7 +273,8 @@ impl Thread {
             inner.change_state(ThreadState::Running, &self.base);
         }
         let vmtoken = self.proc().vmar().table_phys();
-        kernel_hal::Thread::spawn(thread_fn(CurrentThread(self.clone())), vmtoken);
+        let priority = self.priority();
+        kernel_hal::Thread::spawn(thread_fn(CurrentThread(self.clone())), vmtoken, priority);
         Ok(())
     }
 
@@ -279,7 +291,8 @@ impl Thread {
             inner.change_state(ThreadState::Running, &self.base);
         }
         let vmtoken = self.proc().vmar().table_phys();
-        kernel_hal::Thread::spawn(thread_fn(CurrentThread(self.clone())), vmtoken);
+        let priority = self.priority();
+        kernel_hal::Thread::spawn(thread_fn(CurrentThread(self.clone())), vmtoken, priority);
         Ok(())
     }
 
@@ -371,6 +384,30 @@ impl Thread {
         self.inner.lock().state()
     }
 
+    /// Get the scheduling priority, including the inherited one.
+    pub fn priority(&self) -> u8 {
+        let inner = self.inner.lock();
+        inner.priority.max(inner.inherited_priority)
+    }
+
+    /// Inherit `priority` from the waiters of a futex owned by this thread,
+    /// or stop inheriting if it is 0.
+    ///
+    /// It takes effect the same as [`set_priority`].
+    ///
+    /// [`set_priority`]: Thread::set_priority
+    pub(crate) fn inherit_priority(&self, priority: u8) {
+        self.inner.lock().inherited_priority = priority.min(MAX_PRIORITY);
+    }
+
+    /// Set the scheduling priority.
+    ///
+    /// It takes effect when the thread is started, or the next time a running
+    /// thread enters user mode.
+    pub fn set_priority(&self, priority: u8) {
+        self.inner.lock().priority = priority.min(MAX_PRIORITY);
+    }
+
     /// Add the parameter to the time this thread has run on cpu.
     pub fn time_add(&self, time: u128) {
         self.inner.lock().time += time;
@@ -508,6 +545,7 @@ impl CurrentThread {
                     // resume:  return the context token from thread object
                     // There is no need to call change_state here
                     // since take away the context of a non-suspended thread won't change it's state
+                    ktrace(TraceEvent::ContextSwitch, self.thread.id(), 1);
                     Poll::Ready(inner.context.take().unwrap())
                 } else {
                     // suspend: put waker into the thread object
@@ -523,6 +561,7 @@ impl CurrentThread {
 
     /// The thread ends running and takes back the context.
     pub fn end_running(&self, context: Box<UserContext>) {
+        ktrace(TraceEvent::ContextSwitch, self.id(), 0);
         let mut inner = self.inner.lock();
         inner.context = Some(context);
         let state = inner.state;
@@ -809,7 +848,7 @@ mod tests {
         let thread = CurrentThread(thread);
 
         let handle = Handle::new(proc.clone(), Rights::DEFAULT_PROCESS);
-        let handle_value = proc.add_handle(handle);
+        let handle_value = proc.add_handle(handle).unwrap();
         let object = proc
             .get_dyn_object_with_rights(handle_value, Rights::WAIT)
             .unwrap();
@@ -957,4 +996,17 @@ mod tests {
         thread.time_add(10);
         assert_eq!(thread.get_time(), 10);
     }
+
+    #[test]
+    fn priority() {
+        let root_job = Job::root();
+        let proc = Process::create(&root_job, "proc").expect("failed to create process");
+        let thread = Thread::create(&proc, "thread").expect("failed to create thread");
+
+        assert_eq!(thread.priority(), DEFAULT_PRIORITY);
+        thread.set_priority(24);
+        assert_eq!(thread.priority(), 24);
+        thread.set_priority(u8::MAX);
+        assert_eq!(thread.priority(), MAX_PRIORITY);
+    }
 }
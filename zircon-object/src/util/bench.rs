@@ -0,0 +1,107 @@
+//! Round-trip benchmarks of IPC objects.
+//!
+//! They are ignored by default, run them with
+//! `cargo test --release -p zircon-object -- --ignored bench_`.
+//! Each prints one JSON line in the format of `linux-syscall/bench/bench.h`.
+
+use {
+    crate::{ipc::*, object::*, signal::*},
+    alloc::{sync::Arc, vec::Vec},
+    core::sync::atomic::{AtomicI32, Ordering},
+    std::time::Instant,
+};
+
+const ROUND_TRIPS: u32 = 100_000;
+
+fn report(bench: &str, start: Instant) {
+    let ns = start.elapsed().as_nanos() as f64 / ROUND_TRIPS as f64;
+    println!(
+        "{{\"bench\": \"{}\", \"value\": {:.3}, \"unit\": \"ns\", \"iters\": {}}}",
+        bench, ns, ROUND_TRIPS
+    );
+}
+
+#[async_std::test]
+#[ignore]
+async fn bench_channel_round_trip() {
+    let (client, server) = Channel::create();
+    async_std::task::spawn(async move {
+        let object = server.clone() as Arc<dyn KernelObject>;
+        loop {
+            object.wait_signal(Signal::READABLE).await;
+            let msg = match server.read() {
+                Ok(msg) => msg,
+                Err(_) => return,
+            };
+            if server.write(msg).is_err() {
+                return;
+            }
+        }
+    });
+    let object = client.clone() as Arc<dyn KernelObject>;
+    let start = Instant::now();
+    for _ in 0..ROUND_TRIPS {
+        client
+            .write(MessagePacket::with_data(&[0; 32], Vec::new()))
+            .unwrap();
+        object.wait_signal(Signal::READABLE).await;
+        client.read().unwrap();
+    }
+    report("zircon_channel_round_trip", start);
+}
+
+#[async_std::test]
+#[ignore]
+async fn bench_port_round_trip() {
+    let request = Port::new(0).unwrap();
+    let reply = Port::new(0).unwrap();
+    let packet = || PortPacketRepr {
+        key: 1,
+        status: ZxError::OK,
+        data: PayloadRepr::User([0; 32]),
+    };
+    async_std::task::spawn({
+        let (request, reply) = (request.clone(), reply.clone());
+        async move {
+            for _ in 0..ROUND_TRIPS {
+                request.wait().await;
+                reply.push(packet());
+            }
+        }
+    });
+    let start = Instant::now();
+    for _ in 0..ROUND_TRIPS {
+        request.push(packet());
+        reply.wait().await;
+    }
+    report("zircon_port_round_trip", start);
+}
+
+#[async_std::test]
+#[ignore]
+async fn bench_futex_round_trip() {
+    // the turn of the round trip, odd for the other task
+    static TURN: AtomicI32 = AtomicI32::new(0);
+    let futex = Futex::new(&TURN);
+    async_std::task::spawn({
+        let futex = futex.clone();
+        async move {
+            for i in 0..ROUND_TRIPS as i32 {
+                while TURN.load(Ordering::Acquire) == 2 * i {
+                    let _ = futex.wait(2 * i).await;
+                }
+                TURN.store(2 * i + 2, Ordering::Release);
+                futex.wake(1);
+            }
+        }
+    });
+    let start = Instant::now();
+    for i in 0..ROUND_TRIPS as i32 {
+        TURN.store(2 * i + 1, Ordering::Release);
+        futex.wake(1);
+        while TURN.load(Ordering::Acquire) == 2 * i + 1 {
+            let _ = futex.wait(2 * i + 1).await;
+        }
+    }
+    report("zircon_futex_round_trip", start);
+}
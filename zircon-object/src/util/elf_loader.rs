@@ -1,6 +1,7 @@
 //! ELF loading of Zircon and Linux.
 use crate::{error::*, vm::*};
-use alloc::sync::Arc;
+use alloc::{sync::Arc, vec, vec::Vec};
+use core::convert::TryInto;
 use xmas_elf::{
     program::{Flags, ProgramHeader, SegmentData, Type},
     sections::SectionData,
@@ -13,6 +14,13 @@ pub trait VmarExt {
     /// Create `VMObject` from all LOAD segments of `elf` and map them to this VMAR.
     /// Return the first `VMObject`.
     fn load_from_elf(&self, elf: &ElfFile) -> ZxResult<Arc<VmObject>>;
+    /// Same as `load_from_elf`, but the segments are copy-on-write children of `file`,
+    /// the VMO holding the content of the ELF file, instead of copies of the data.
+    ///
+    /// The dynamic relocations are applied for the base of this VMAR before
+    /// the segments are mapped, and the pages are mapped on demand if
+    /// `MAP_ON_DEMAND`. Only the headers of `elf` are needed.
+    fn load_from_elf_vmo(&self, elf: &ElfFile, file: &Arc<VmObject>) -> ZxResult<Arc<VmObject>>;
     /// Same as `load_from_elf`, but the `vmo` is an existing one instead of a lot of new ones.
     fn map_from_elf(&self, elf: &ElfFile, vmo: Arc<VmObject>) -> ZxResult;
 }
@@ -32,6 +40,32 @@ impl VmarExt for VmAddressRegion {
         }
         Ok(first_vmo.unwrap())
     }
+    fn load_from_elf_vmo(&self, elf: &ElfFile, file: &Arc<VmObject>) -> ZxResult<Arc<VmObject>> {
+        let mut segments = Segments(Vec::new());
+        for ph in elf.program_iter() {
+            if ph.get_type().unwrap() != Type::Load {
+                continue;
+            }
+            let vmo = make_cow_vmo(file, ph)?;
+            let offset = ph.virtual_addr() as usize / PAGE_SIZE * PAGE_SIZE;
+            segments.0.push((offset, vmo, ph.flags().to_mmu_flags()));
+        }
+        segments.relocate(elf, self.addr())?;
+        for (offset, vmo, flags) in segments.0.iter() {
+            self.map_ext(
+                Some(*offset),
+                vmo.clone(),
+                0,
+                vmo.len(),
+                MMUFlags::RXW,
+                *flags,
+                false,
+                !MAP_ON_DEMAND,
+            )?;
+        }
+        let (_, first_vmo, _) = segments.0.first().ok_or(ZxError::INVALID_ARGS)?;
+        Ok(first_vmo.clone())
+    }
     fn map_from_elf(&self, elf: &ElfFile, vmo: Arc<VmObject>) -> ZxResult {
         for ph in elf.program_iter() {
             if ph.get_type().unwrap() != Type::Load {
@@ -80,6 +114,124 @@ fn make_vmo(elf: &ElfFile, ph: ProgramHeader) -> ZxResult<Arc<VmObject>> {
     Ok(vmo)
 }
 
+/// The VMOs of the LOAD segments of an ELF, with their offsets and flags.
+struct Segments(Vec<(usize, Arc<VmObject>, MMUFlags)>);
+
+impl Segments {
+    /// Find the VMO holding `len` bytes at `vaddr` of the ELF, and the offset in it.
+    fn find(&self, vaddr: usize, len: usize) -> ZxResult<(&Arc<VmObject>, usize)> {
+        self.0
+            .iter()
+            .find(|(offset, vmo, _)| {
+                vaddr >= *offset && vaddr.saturating_add(len) <= offset + vmo.len()
+            })
+            .map(|(offset, vmo, _)| (vmo, vaddr - offset))
+            .ok_or(ZxError::OUT_OF_RANGE)
+    }
+
+    fn read_words(&self, vaddr: usize, count: usize) -> ZxResult<Vec<u64>> {
+        let mut buf = vec![0u8; count * 8];
+        let (vmo, offset) = self.find(vaddr, buf.len())?;
+        vmo.read(offset, &mut buf)?;
+        Ok(buf
+            .chunks_exact(8)
+            .map(|word| u64::from_ne_bytes(word.try_into().unwrap()))
+            .collect())
+    }
+
+    /// Apply the dynamic relocations found through the DYNAMIC segment for `base`.
+    fn relocate(&self, elf: &ElfFile, base: usize) -> ZxResult {
+        const DT_NULL: u64 = 0;
+        const DT_SYMTAB: u64 = 6;
+        const DT_RELA: u64 = 7;
+        const DT_RELASZ: u64 = 8;
+        const DT_RELAENT: u64 = 9;
+        const DT_SYMENT: u64 = 11;
+        const REL_GOT: u64 = 6;
+        const REL_PLT: u64 = 7;
+        const REL_RELATIVE: u64 = 8;
+        let dynamic = match elf
+            .program_iter()
+            .find(|ph| ph.get_type() == Ok(Type::Dynamic))
+        {
+            Some(ph) => ph,
+            None => return Ok(()),
+        };
+        let words = dynamic.mem_size() as usize / 8;
+        let entries = self.read_words(dynamic.virtual_addr() as usize, words)?;
+        let (mut rela, mut rela_size, mut rela_ent) = (0, 0, 24);
+        let (mut symtab, mut sym_ent) = (0, 24);
+        for entry in entries.chunks_exact(2) {
+            match entry[0] {
+                DT_NULL => break,
+                DT_SYMTAB => symtab = entry[1],
+                DT_RELA => rela = entry[1],
+                DT_RELASZ => rela_size = entry[1],
+                DT_RELAENT => rela_ent = entry[1],
+                DT_SYMENT => sym_ent = entry[1],
+                _ => {}
+            }
+        }
+        if rela == 0 || rela_size == 0 {
+            return Ok(());
+        }
+        if rela_ent < 24 || rela_ent % 8 != 0 {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        let relocs = self.read_words(rela as usize, rela_size as usize / 8)?;
+        for reloc in relocs.chunks_exact(rela_ent as usize / 8) {
+            let (offset, info, addend) = (reloc[0] as usize, reloc[1], reloc[2] as usize);
+            let value = match info & 0xffff_ffff {
+                REL_GOT | REL_PLT => {
+                    let sym_addr = symtab.wrapping_add((info >> 32).wrapping_mul(sym_ent));
+                    let sym_addr = sym_addr as usize;
+                    // st_name: u32, st_info: u8, st_other: u8, st_shndx: u16, st_value: u64
+                    let sym = self.read_words(sym_addr, 2)?;
+                    if sym[0] >> 48 == 0 {
+                        warn!("need to find symbol at {:#x}", sym_addr);
+                        return Err(ZxError::NOT_SUPPORTED);
+                    }
+                    base.wrapping_add(sym[1] as usize).wrapping_add(addend)
+                }
+                REL_RELATIVE => base.wrapping_add(addend),
+                t => {
+                    warn!("unknown relocation type: {}", t);
+                    return Err(ZxError::NOT_SUPPORTED);
+                }
+            };
+            let (vmo, offset) = self.find(offset, 8)?;
+            vmo.write(offset, &value.to_ne_bytes())?;
+        }
+        Ok(())
+    }
+}
+
+/// Make a copy-on-write child of `file` for a LOAD segment.
+///
+/// Pages are shared with `file` until written. Only the pages holding the
+/// segment data are taken from `file`, the rest (.bss) are anonymous zero pages.
+fn make_cow_vmo(file: &Arc<VmObject>, ph: ProgramHeader) -> ZxResult<Arc<VmObject>> {
+    assert_eq!(ph.get_type().unwrap(), Type::Load);
+    static ZEROS: [u8; PAGE_SIZE] = [0; PAGE_SIZE];
+    let page_offset = ph.virtual_addr() as usize % PAGE_SIZE;
+    if ph.offset() as usize % PAGE_SIZE != page_offset {
+        return Err(ZxError::INVALID_ARGS);
+    }
+    let file_offset = ph.offset() as usize - page_offset;
+    let len = pages(ph.mem_size() as usize + page_offset) * PAGE_SIZE;
+    let data_end = page_offset + ph.file_size() as usize;
+    let data_len = (pages(data_end) * PAGE_SIZE).min(len);
+    // the pages the child grows by are beyond its range in `file`
+    let vmo = file.create_child(true, file_offset, data_len)?;
+    // the rest of the file after the segment data is visible in its last page
+    let visible_end = file.len().saturating_sub(file_offset).min(data_len);
+    if data_end < visible_end {
+        vmo.write(data_end, &ZEROS[..visible_end - data_end])?;
+    }
+    vmo.set_len(len)?;
+    Ok(vmo)
+}
+
 /// Extensional ELF loading methods for `ElfFile`.
 pub trait ElfExt {
     /// Get total size of all LOAD segments.
@@ -90,8 +242,6 @@ pub trait ElfExt {
     fn get_interpreter(&self) -> Result<&str, &str>;
     /// Get the symbol table for dynamic linking (.dynsym section).
     fn dynsym(&self) -> Result<&[DynEntry64], &'static str>;
-    /// Relocate according to the dynamic relocation section (.rel.dyn section).
-    fn relocate(&self, base: usize) -> Result<(), &'static str>;
 }
 
 impl ElfExt for ElfFile<'_> {
@@ -142,48 +292,4 @@ impl ElfExt for ElfFile<'_> {
             _ => Err("bad .dynsym"),
         }
     }
-
-    #[allow(unsafe_code)]
-    fn relocate(&self, base: usize) -> Result<(), &'static str> {
-        let data = self
-            .find_section_by_name(".rela.dyn")
-            .ok_or(".rela.dyn not found")?
-            .get_data(self)
-            .map_err(|_| "corrupted .rela.dyn")?;
-        let entries = match data {
-            SectionData::Rela64(entries) => entries,
-            _ => return Err("bad .rela.dyn"),
-        };
-        let dynsym = self.dynsym()?;
-        for entry in entries {
-            const REL_GOT: u32 = 6;
-            const REL_PLT: u32 = 7;
-            const REL_RELATIVE: u32 = 8;
-            match entry.get_type() {
-                REL_GOT | REL_PLT => {
-                    let dynsym = &dynsym[entry.get_symbol_table_index() as usize];
-                    let symval = if dynsym.shndx() == 0 {
-                        let name = dynsym.get_name(self)?;
-                        panic!("need to find symbol: {:?}", name);
-                    } else {
-                        base + dynsym.value() as usize
-                    };
-                    let value = symval + entry.get_addend() as usize;
-                    unsafe {
-                        let ptr = (base + entry.get_offset() as usize) as *mut usize;
-                        ptr.write(value);
-                    }
-                }
-                REL_RELATIVE => {
-                    let value = base + entry.get_addend() as usize;
-                    unsafe {
-                        let ptr = (base + entry.get_offset() as usize) as *mut usize;
-                        ptr.write(value);
-                    }
-                }
-                t => unimplemented!("unknown type: {}", t),
-            }
-        }
-        Ok(())
-    }
 }
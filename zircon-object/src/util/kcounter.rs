@@ -2,25 +2,101 @@
 use core::fmt::{Debug, Error, Formatter};
 use core::sync::atomic::{AtomicUsize, Ordering};
 
+/// Number of shards of each counter, CPUs share them if there are more CPUs.
+pub const KCOUNTER_SHARDS: usize = 16;
+
+/// Maximum number of kernel counters.
+pub const KCOUNTER_MAX: usize = 128;
+
+/// Values of all counters, a row for each shard.
+///
+/// Each CPU only writes its own row, so that hot counters don't bounce cache
+/// lines between CPUs. The layout is the same as the arena of Zircon.
+#[repr(C, align(4096))]
+pub struct KCounterArena([[AtomicUsize; KCOUNTER_MAX]; KCOUNTER_SHARDS]);
+
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO: AtomicUsize = AtomicUsize::new(0);
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_ROW: [AtomicUsize; KCOUNTER_MAX] = [ZERO; KCOUNTER_MAX];
+
+#[used]
+#[cfg_attr(target_os = "none", link_section = ".kcounter.items")]
+static ARENA: KCounterArena = KCounterArena([ZERO_ROW; KCOUNTER_SHARDS]);
+
+/// Number of indexes in the arena assigned to counters.
+static ARENA_USED: AtomicUsize = AtomicUsize::new(0);
+
+impl KCounterArena {
+    /// Get the arena of all counters.
+    pub fn get() -> &'static Self {
+        &ARENA
+    }
+}
+
 /// Kernel counter.
-#[repr(transparent)]
+///
+/// It is an index of the arena, which is assigned when it is first used.
 #[derive(Debug)]
-pub struct KCounter(AtomicUsize);
+pub struct KCounter {
+    /// The index plus one, or 0 if unassigned.
+    index: AtomicUsize,
+}
 
 impl KCounter {
     /// Create a new KCounter.
     pub const fn new() -> Self {
-        KCounter(AtomicUsize::new(0))
+        KCounter {
+            index: AtomicUsize::new(0),
+        }
     }
 
     /// Add a value to the counter.
     pub fn add(&self, x: usize) {
-        self.0.fetch_add(x, Ordering::Relaxed);
+        self.shard().fetch_add(x, Ordering::Relaxed);
     }
 
-    /// Get the value of counter.
+    /// Subtract a value from the counter, for counters of live objects.
+    pub fn sub(&self, x: usize) {
+        self.shard().fetch_sub(x, Ordering::Relaxed);
+    }
+
+    /// Get the value of counter, which is the sum of all shards.
     pub fn get(&self) -> usize {
-        self.0.load(Ordering::Relaxed)
+        let index = self.index();
+        ARENA.0.iter().fold(0, |sum, row| {
+            sum.wrapping_add(row[index].load(Ordering::Relaxed))
+        })
+    }
+
+    /// Get the index of the counter in the arena.
+    pub fn index(&self) -> usize {
+        match self.index.load(Ordering::Acquire) {
+            0 => self.assign_index(),
+            index => index - 1,
+        }
+    }
+
+    #[cold]
+    fn assign_index(&self) -> usize {
+        let new = ARENA_USED.fetch_add(1, Ordering::Relaxed);
+        assert!(new < KCOUNTER_MAX, "too many kcounters");
+        // a concurrent caller may have assigned one, then this one is wasted
+        match self
+            .index
+            .compare_exchange(0, new + 1, Ordering::AcqRel, Ordering::Acquire)
+        {
+            Ok(_) => new,
+            Err(index) => index - 1,
+        }
+    }
+
+    /// Get the shard of current CPU.
+    ///
+    /// `cpu_id` returns an index cached per CPU by the HAL, which costs far
+    /// less than the contended atomic that sharding avoids.
+    fn shard(&self) -> &AtomicUsize {
+        &ARENA.0[kernel_hal::cpu_id() % KCOUNTER_SHARDS][self.index()]
     }
 }
 
@@ -37,8 +113,6 @@ pub struct KCounterDescriptor {
 #[macro_export]
 macro_rules! kcounter {
     ($var:ident, $name:expr) => {
-        #[used]
-        #[cfg_attr(target_os = "none", link_section = ".kcounter.items")]
         static $var: $crate::util::kcounter::KCounter = {
             #[used]
             #[cfg_attr(target_os = "none", link_section = ".kcounter.descriptor")]
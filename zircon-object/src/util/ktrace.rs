@@ -0,0 +1,284 @@
+//! A low-overhead binary trace of kernel events.
+//!
+//! Each CPU records fixed-size [`TraceRecord`]s into its own ring, so tracing
+//! never formats anything and CPUs rarely contend. An event is only recorded
+//! if its group is enabled by [`start`], otherwise it costs one atomic load.
+
+use {
+    alloc::vec::Vec,
+    bitflags::bitflags,
+    core::sync::atomic::{AtomicU32, Ordering},
+    spin::Mutex,
+};
+
+/// Maximum number of CPUs with their own ring, others share them.
+const MAX_CPU: usize = 16;
+
+/// Number of records in the ring of each CPU.
+const RING_RECORDS: usize = 4096;
+
+/// Size of a serialized record in bytes.
+pub const RECORD_SIZE: usize = 32;
+
+bitflags! {
+    /// Groups of trace events, which are enabled together.
+    pub struct TraceGroup: u32 {
+        /// Context switches.
+        const SCHEDULER = 1 << 2;
+        /// IPC messages.
+        const IPC       = 1 << 4;
+        /// Events written by user space.
+        const PROBE     = 1 << 6;
+        /// Syscall entries and exits.
+        const SYSCALL   = 1 << 8;
+        /// Page faults.
+        const VM        = 1 << 9;
+    }
+}
+
+/// A kind of trace event.
+#[repr(u32)]
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum TraceEvent {
+    /// A thread enters a syscall, `arg` is the syscall number.
+    SyscallEnter = 1,
+    /// A thread leaves a syscall, `arg` is the return value.
+    SyscallExit = 2,
+    /// A page fault in a VMAR, `arg` is the faulting address.
+    PageFault = 3,
+    /// A thread is switched in, `arg` is 1, or out, `arg` is 0.
+    ContextSwitch = 4,
+    /// A message is written to a channel, `arg` is its size in bytes.
+    ChannelWrite = 5,
+    /// A message is read from a channel, `arg` is its size in bytes.
+    ChannelRead = 6,
+    /// An event written by user space, `koid` is its ID.
+    Probe = 7,
+    /// Number of calls of syscall `koid` so far, in `arg`.
+    SyscallCalls = 8,
+    /// Total time spent in syscall `koid` so far, `arg` is in nanoseconds.
+    SyscallTime = 9,
+    /// A bucket of the latency histogram of syscall `koid`,
+    /// `arg` is the bucket index in the high 32 bits and its count in the low 32 bits.
+    SyscallLatency = 10,
+}
+
+impl TraceEvent {
+    /// Get the group of the event.
+    pub fn group(self) -> TraceGroup {
+        match self {
+            TraceEvent::SyscallEnter
+            | TraceEvent::SyscallExit
+            | TraceEvent::SyscallCalls
+            | TraceEvent::SyscallTime
+            | TraceEvent::SyscallLatency => TraceGroup::SYSCALL,
+            TraceEvent::PageFault => TraceGroup::VM,
+            TraceEvent::ContextSwitch => TraceGroup::SCHEDULER,
+            TraceEvent::ChannelWrite | TraceEvent::ChannelRead => TraceGroup::IPC,
+            TraceEvent::Probe => TraceGroup::PROBE,
+        }
+    }
+}
+
+/// A recorded event.
+///
+/// It is serialized as little-endian fields in order.
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct TraceRecord {
+    /// Time of the event in nanoseconds.
+    pub time: u64,
+    /// The `TraceEvent`.
+    pub event: u32,
+    /// The CPU which recorded it.
+    pub cpu: u32,
+    /// ID of the object the event is about.
+    pub koid: u64,
+    /// An argument depending on the event.
+    pub arg: u64,
+}
+
+impl TraceRecord {
+    fn to_bytes(self) -> [u8; RECORD_SIZE] {
+        let mut bytes = [0; RECORD_SIZE];
+        bytes[0..8].copy_from_slice(&self.time.to_le_bytes());
+        bytes[8..12].copy_from_slice(&self.event.to_le_bytes());
+        bytes[12..16].copy_from_slice(&self.cpu.to_le_bytes());
+        bytes[16..24].copy_from_slice(&self.koid.to_le_bytes());
+        bytes[24..32].copy_from_slice(&self.arg.to_le_bytes());
+        bytes
+    }
+}
+
+/// The records of one CPU, which overwrite the oldest ones when it is full.
+struct TraceRing {
+    records: Vec<TraceRecord>,
+    /// Index of the oldest record when it is full.
+    next: usize,
+}
+
+impl TraceRing {
+    fn push(&mut self, record: TraceRecord) {
+        if self.records.len() < self.records.capacity() {
+            self.records.push(record);
+        } else if !self.records.is_empty() {
+            self.records[self.next] = record;
+            self.next = (self.next + 1) % self.records.len();
+        }
+    }
+
+    /// Iterate over records from the oldest.
+    fn iter(&self) -> impl Iterator<Item = &TraceRecord> {
+        let (new, old) = self.records.split_at(self.next);
+        old.iter().chain(new.iter())
+    }
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const EMPTY_RING: Mutex<TraceRing> = Mutex::new(TraceRing {
+    records: Vec::new(),
+    next: 0,
+});
+static RINGS: [Mutex<TraceRing>; MAX_CPU] = [EMPTY_RING; MAX_CPU];
+
+/// Enabled `TraceGroup`s.
+static GROUP_MASK: AtomicU32 = AtomicU32::new(0);
+
+/// Record an event if its group is enabled.
+pub fn ktrace(event: TraceEvent, koid: u64, arg: u64) {
+    if GROUP_MASK.load(Ordering::Relaxed) & event.group().bits() == 0 {
+        return;
+    }
+    let cpu = kernel_hal::cpu_id();
+    let record = TraceRecord {
+        time: kernel_hal::timer_now().as_nanos() as u64,
+        event: event as u32,
+        cpu: cpu as u32,
+        koid,
+        arg,
+    };
+    RINGS[cpu % MAX_CPU].lock().push(record);
+}
+
+/// Whether events of `group` are recorded, which costs one atomic load.
+pub fn enabled(group: TraceGroup) -> bool {
+    GROUP_MASK.load(Ordering::Relaxed) & group.bits() != 0
+}
+
+/// Start recording events of `groups`.
+///
+/// The rings are allocated the first time.
+pub fn start(groups: TraceGroup) {
+    for ring in RINGS.iter() {
+        let mut ring = ring.lock();
+        if ring.records.capacity() == 0 {
+            ring.records = Vec::with_capacity(RING_RECORDS);
+        }
+    }
+    GROUP_MASK.store(groups.bits(), Ordering::Relaxed);
+}
+
+/// Stop recording events, which are kept until `rewind`.
+pub fn stop() {
+    GROUP_MASK.store(0, Ordering::Relaxed);
+}
+
+/// Discard all recorded events.
+pub fn rewind() {
+    for ring in RINGS.iter() {
+        let mut ring = ring.lock();
+        ring.records.clear();
+        ring.next = 0;
+    }
+}
+
+/// Get the size in bytes of all recorded events.
+pub fn size() -> usize {
+    let records: usize = RINGS.iter().map(|ring| ring.lock().records.len()).sum();
+    records * RECORD_SIZE
+}
+
+/// Read serialized records from `offset` bytes into `buf`, return the number
+/// of bytes read.
+///
+/// Records are grouped by CPU, each group from the oldest. They should be read
+/// after `stop`, or the offsets move as new events overwrite old ones.
+pub fn read(offset: usize, buf: &mut [u8]) -> usize {
+    let mut pos = 0;
+    let mut len = 0;
+    for ring in RINGS.iter() {
+        let ring = ring.lock();
+        if pos + ring.records.len() * RECORD_SIZE <= offset {
+            pos += ring.records.len() * RECORD_SIZE;
+            continue;
+        }
+        for record in ring.iter() {
+            if len == buf.len() {
+                return len;
+            }
+            if pos + RECORD_SIZE > offset {
+                let bytes = record.to_bytes();
+                let from = offset.saturating_sub(pos);
+                let n = (RECORD_SIZE - from).min(buf.len() - len);
+                buf[len..len + n].copy_from_slice(&bytes[from..from + n]);
+                len += n;
+            }
+            pos += RECORD_SIZE;
+        }
+    }
+    len
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::util::syscall_stats::SyscallStats;
+    use core::time::Duration;
+
+    #[test]
+    fn record_and_read() {
+        rewind();
+        ktrace(TraceEvent::Probe, 1, 0);
+        start(TraceGroup::PROBE);
+        ktrace(TraceEvent::Probe, 2, 3);
+        ktrace(TraceEvent::PageFault, 4, 0x1000);
+        stop();
+        ktrace(TraceEvent::Probe, 5, 0);
+
+        // only the probe in between is recorded
+        assert_eq!(size(), RECORD_SIZE);
+        let mut buf = [0u8; RECORD_SIZE + 1];
+        assert_eq!(read(0, &mut buf), RECORD_SIZE);
+        assert_eq!(buf[8..12], (TraceEvent::Probe as u32).to_le_bytes());
+        assert_eq!(buf[16..24], 2u64.to_le_bytes());
+        assert_eq!(buf[24..32], 3u64.to_le_bytes());
+
+        // read from the middle of a record
+        assert_eq!(read(16, &mut buf), RECORD_SIZE - 16);
+        assert_eq!(buf[0..8], 2u64.to_le_bytes());
+        assert_eq!(read(RECORD_SIZE, &mut buf), 0);
+
+        rewind();
+        assert_eq!(size(), 0);
+
+        // syscall stats are recorded in the same test, as the rings are global
+        let stats = SyscallStats::<4>::new();
+        stats.record(3, Duration::from_nanos(100));
+        stats.record(3, Duration::from_nanos(300));
+        start(TraceGroup::SYSCALL);
+        stats.trace();
+        stop();
+
+        // calls, time and the two latency buckets of syscall 3
+        let mut buf = [0u8; 4 * RECORD_SIZE];
+        assert_eq!(read(0, &mut buf), 4 * RECORD_SIZE);
+        let event = (TraceEvent::SyscallCalls as u32).to_le_bytes();
+        assert_eq!(buf[8..12], event);
+        assert_eq!(buf[16..24], 3u64.to_le_bytes());
+        assert_eq!(buf[24..32], 2u64.to_le_bytes());
+        let arg = |i: usize| &buf[i * RECORD_SIZE + 24..(i + 1) * RECORD_SIZE];
+        assert_eq!(arg(1), 400u64.to_le_bytes());
+        assert_eq!(arg(2), 1u64.to_le_bytes());
+        assert_eq!(arg(3), (1u64 << 32 | 1).to_le_bytes());
+        rewind();
+    }
+}
@@ -1,5 +1,10 @@
 //! Utilities.
+#[cfg(test)]
+mod bench;
 pub(crate) mod block_range;
 #[cfg(feature = "elf")]
 pub mod elf_loader;
 pub mod kcounter;
+pub mod ktrace;
+pub mod ring;
+pub mod syscall_stats;
@@ -0,0 +1,219 @@
+//! A fixed-capacity ring buffer of bytes.
+
+use alloc::{vec, vec::Vec};
+use core::cmp::min;
+
+/// A fixed-capacity ring buffer of bytes.
+///
+/// Data is copied in and out with at most two `memcpy`s.
+/// The storage is allocated on the first write, and grows geometrically
+/// up to the capacity as more data is buffered.
+pub struct RingBuffer {
+    /// the storage, of at most `capacity` bytes
+    buf: Vec<u8>,
+    capacity: usize,
+    /// index of the first byte
+    head: usize,
+    /// number of bytes in the buffer
+    len: usize,
+}
+
+/// The size of the storage allocated on the first write.
+const MIN_STORAGE: usize = 64;
+
+impl RingBuffer {
+    /// Create an empty ring buffer with `capacity` bytes.
+    pub fn new(capacity: usize) -> Self {
+        RingBuffer {
+            buf: Vec::new(),
+            capacity,
+            head: 0,
+            len: 0,
+        }
+    }
+
+    /// Get the capacity in bytes.
+    pub fn capacity(&self) -> usize {
+        self.capacity
+    }
+
+    /// Get the number of bytes in the buffer.
+    pub fn len(&self) -> usize {
+        self.len
+    }
+
+    /// Whether the buffer is empty.
+    pub fn is_empty(&self) -> bool {
+        self.len == 0
+    }
+
+    /// Get the number of bytes that can be pushed.
+    pub fn free(&self) -> usize {
+        self.capacity - self.len
+    }
+
+    /// Get the content as two slices, the same as `VecDeque::as_slices`.
+    pub fn as_slices(&self) -> (&[u8], &[u8]) {
+        if self.len == 0 {
+            return (&[], &[]);
+        }
+        let first = min(self.len, self.buf.len() - self.head);
+        (
+            &self.buf[self.head..self.head + first],
+            &self.buf[..self.len - first],
+        )
+    }
+
+    /// Copy the content to `buf` without consuming it.
+    ///
+    /// Returns the number of bytes copied.
+    pub fn peek(&self, buf: &mut [u8]) -> usize {
+        let (a, b) = self.as_slices();
+        let len_a = min(a.len(), buf.len());
+        let len_b = min(b.len(), buf.len() - len_a);
+        buf[..len_a].copy_from_slice(&a[..len_a]);
+        buf[len_a..len_a + len_b].copy_from_slice(&b[..len_b]);
+        len_a + len_b
+    }
+
+    /// Drop the first `len` bytes.
+    pub fn consume(&mut self, len: usize) {
+        assert!(len <= self.len);
+        self.len -= len;
+        self.head = if self.len == 0 {
+            0
+        } else {
+            (self.head + len) % self.buf.len()
+        };
+    }
+
+    /// Move the content to `buf`.
+    ///
+    /// Returns the number of bytes moved.
+    pub fn pop(&mut self, buf: &mut [u8]) -> usize {
+        let len = self.peek(buf);
+        self.consume(len);
+        len
+    }
+
+    /// Append as much of `data` as fits.
+    ///
+    /// Returns the number of bytes appended.
+    pub fn push(&mut self, data: &[u8]) -> usize {
+        let len = min(data.len(), self.free());
+        if len == 0 {
+            return 0;
+        }
+        if self.len + len > self.buf.len() {
+            let size = (self.len + len)
+                .max(self.buf.len() * 2)
+                .max(MIN_STORAGE)
+                .min(self.capacity);
+            self.realloc(size);
+        }
+        let size = self.buf.len();
+        let tail = (self.head + self.len) % size;
+        let first = min(len, size - tail);
+        self.buf[tail..tail + first].copy_from_slice(&data[..first]);
+        self.buf[..len - first].copy_from_slice(&data[first..len]);
+        self.len += len;
+        len
+    }
+
+    /// Append at most `len` bytes of the content to `other` without consuming them.
+    ///
+    /// Returns the number of bytes appended.
+    pub fn copy_to(&self, other: &mut RingBuffer, len: usize) -> usize {
+        let (a, b) = self.as_slices();
+        let n = other.push(&a[..min(a.len(), len)]);
+        if n < a.len() {
+            return n;
+        }
+        n + other.push(&b[..min(b.len(), len - n)])
+    }
+
+    /// Change the capacity, which must not be less than the current length.
+    pub fn resize(&mut self, capacity: usize) {
+        assert!(self.len <= capacity);
+        if self.buf.len() > capacity {
+            self.realloc(capacity);
+        }
+        self.capacity = capacity;
+    }
+
+    /// Move the content to the start of new storage of `size` bytes.
+    fn realloc(&mut self, size: usize) {
+        let mut buf = vec![0; size];
+        self.peek(&mut buf);
+        self.buf = buf;
+        self.head = 0;
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn push_pop() {
+        let mut ring = RingBuffer::new(8);
+        assert!(ring.is_empty());
+        assert_eq!(ring.push(b"hello"), 5);
+        assert_eq!(ring.free(), 3);
+        let mut buf = [0u8; 4];
+        assert_eq!(ring.pop(&mut buf), 4);
+        assert_eq!(&buf, b"hell");
+        // wrap around
+        assert_eq!(ring.push(b"world!!!"), 7);
+        assert_eq!(ring.len(), 8);
+        assert_eq!(ring.push(b"?"), 0);
+        let mut buf = [0u8; 8];
+        assert_eq!(ring.peek(&mut buf), 8);
+        assert_eq!(&buf, b"oworld!!");
+        ring.consume(3);
+        assert_eq!(ring.pop(&mut buf), 5);
+        assert_eq!(&buf[..5], b"rld!!");
+        assert!(ring.is_empty());
+    }
+
+    #[test]
+    fn copy_and_resize() {
+        let mut src = RingBuffer::new(4);
+        let mut dst = RingBuffer::new(3);
+        src.push(b"ab");
+        src.consume(2);
+        src.push(b"cdef");
+        assert_eq!(src.copy_to(&mut dst, 4), 3);
+        assert_eq!(src.len(), 4);
+        let mut buf = [0u8; 4];
+        assert_eq!(dst.peek(&mut buf), 3);
+        assert_eq!(&buf[..3], b"cde");
+
+        src.resize(8);
+        assert_eq!(src.push(b"gh"), 2);
+        let mut buf = [0u8; 8];
+        assert_eq!(src.pop(&mut buf), 6);
+        assert_eq!(&buf[..6], b"cdefgh");
+    }
+
+    #[test]
+    fn grow() {
+        let mut ring = RingBuffer::new(1000);
+        assert_eq!(ring.push(&[1; 10]), 10);
+        assert_eq!(ring.buf.len(), MIN_STORAGE);
+        // wrap around before growing
+        ring.consume(5);
+        assert_eq!(ring.push(&[2; 55]), 55);
+        assert_eq!(ring.buf.len(), MIN_STORAGE);
+        assert_eq!(ring.push(&[3; 10]), 10);
+        assert_eq!(ring.buf.len(), 2 * MIN_STORAGE);
+        assert_eq!(ring.push(&[4; 2000]), 930);
+        assert_eq!(ring.buf.len(), 1000);
+        let mut buf = [0u8; 1000];
+        assert_eq!(ring.pop(&mut buf), 1000);
+        assert!(buf[..5].iter().all(|&b| b == 1));
+        assert!(buf[5..60].iter().all(|&b| b == 2));
+        assert!(buf[60..70].iter().all(|&b| b == 3));
+        assert!(buf[70..].iter().all(|&b| b == 4));
+    }
+}
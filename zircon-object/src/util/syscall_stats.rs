@@ -0,0 +1,173 @@
+//! Call counts and latency histograms of syscalls.
+//!
+//! Syscalls are only timed and counted while the `SYSCALL` group of ktrace
+//! is enabled, so a syscall costs a single atomic load otherwise.
+
+use super::ktrace::{self, ktrace, TraceEvent, TraceGroup};
+use core::sync::atomic::{AtomicU32, AtomicU64, Ordering};
+use core::time::Duration;
+
+/// Number of buckets of a latency histogram.
+///
+/// Bucket 0 counts latencies below 256 ns, and each following bucket counts
+/// latencies up to twice as long, the last one counts all longer ones.
+pub const LATENCY_BUCKETS: usize = 16;
+
+/// Latencies below `1 << BUCKET_SHIFT` ns go to bucket 0.
+const BUCKET_SHIFT: u32 = 8;
+
+/// Number of shards of the stats, CPUs share a shard by their index modulo it.
+const STATS_SHARDS: usize = 8;
+
+/// Stats of syscalls numbered below `N`.
+///
+/// Each CPU updates its own shard, they are summed up when read.
+pub struct SyscallStats<const N: usize> {
+    shards: [StatsShard<N>; STATS_SHARDS],
+}
+
+struct StatsShard<const N: usize> {
+    calls: [AtomicU64; N],
+    total_ns: [AtomicU64; N],
+    latency: [[AtomicU32; LATENCY_BUCKETS]; N],
+}
+
+/// Stats of a syscall.
+#[derive(Debug, Default, Clone, Copy)]
+pub struct SyscallStat {
+    /// Number of calls.
+    pub calls: u64,
+    /// Total time spent in the syscall, including time blocked.
+    pub total: Duration,
+    /// Histogram of latencies, see `LATENCY_BUCKETS`.
+    pub latency: [u32; LATENCY_BUCKETS],
+}
+
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_U64: AtomicU64 = AtomicU64::new(0);
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_U32: AtomicU32 = AtomicU32::new(0);
+#[allow(clippy::declare_interior_mutable_const)]
+const ZERO_HISTOGRAM: [AtomicU32; LATENCY_BUCKETS] = [ZERO_U32; LATENCY_BUCKETS];
+
+fn bucket_of(ns: u64) -> usize {
+    let bits = 64 - (ns >> BUCKET_SHIFT).leading_zeros() as usize;
+    bits.min(LATENCY_BUCKETS - 1)
+}
+
+impl<const N: usize> StatsShard<N> {
+    #[allow(clippy::declare_interior_mutable_const)]
+    const EMPTY: Self = StatsShard {
+        calls: [ZERO_U64; N],
+        total_ns: [ZERO_U64; N],
+        latency: [ZERO_HISTOGRAM; N],
+    };
+}
+
+impl<const N: usize> SyscallStats<N> {
+    /// Create empty stats.
+    pub const fn new() -> Self {
+        SyscallStats {
+            shards: [StatsShard::EMPTY; STATS_SHARDS],
+        }
+    }
+
+    /// Start timing a syscall if the `SYSCALL` group of ktrace is enabled.
+    ///
+    /// The result is passed to `end` when the syscall returns.
+    pub fn begin(&self) -> Option<Duration> {
+        if ktrace::enabled(TraceGroup::SYSCALL) {
+            Some(kernel_hal::timer_now())
+        } else {
+            None
+        }
+    }
+
+    /// Record a call of syscall `num` if it was timed by `begin`.
+    pub fn end(&self, num: usize, begin: Option<Duration>) {
+        if let Some(begin) = begin {
+            let time = kernel_hal::timer_now()
+                .checked_sub(begin)
+                .unwrap_or_default();
+            self.record(num, time);
+        }
+    }
+
+    /// Record a call of syscall `num` which took `time`.
+    pub fn record(&self, num: usize, time: Duration) {
+        if num >= N {
+            return;
+        }
+        let shard = &self.shards[kernel_hal::cpu_id() % STATS_SHARDS];
+        let ns = time.as_nanos() as u64;
+        shard.calls[num].fetch_add(1, Ordering::Relaxed);
+        shard.total_ns[num].fetch_add(ns, Ordering::Relaxed);
+        shard.latency[num][bucket_of(ns)].fetch_add(1, Ordering::Relaxed);
+    }
+
+    /// Get the stats of syscall `num`.
+    pub fn get(&self, num: usize) -> SyscallStat {
+        let mut stat = SyscallStat::default();
+        if num >= N {
+            return stat;
+        }
+        for shard in self.shards.iter() {
+            stat.calls += shard.calls[num].load(Ordering::Relaxed);
+            stat.total += Duration::from_nanos(shard.total_ns[num].load(Ordering::Relaxed));
+            for (count, bucket) in stat.latency.iter_mut().zip(shard.latency[num].iter()) {
+                *count += bucket.load(Ordering::Relaxed);
+            }
+        }
+        stat
+    }
+
+    /// Record the stats of every syscall called so far as ktrace events.
+    ///
+    /// Nothing is recorded unless the `SYSCALL` group is enabled.
+    pub fn trace(&self) {
+        for num in 0..N {
+            let stat = self.get(num);
+            if stat.calls == 0 {
+                continue;
+            }
+            let num = num as u64;
+            ktrace(TraceEvent::SyscallCalls, num, stat.calls);
+            ktrace(TraceEvent::SyscallTime, num, stat.total.as_nanos() as u64);
+            for (bucket, &count) in stat.latency.iter().enumerate() {
+                if count != 0 {
+                    let arg = (bucket as u64) << 32 | count as u64;
+                    ktrace(TraceEvent::SyscallLatency, num, arg);
+                }
+            }
+        }
+    }
+}
+
+impl<const N: usize> Default for SyscallStats<N> {
+    fn default() -> Self {
+        Self::new()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn record() {
+        let stats = SyscallStats::<2>::new();
+        stats.record(1, Duration::from_nanos(100));
+        stats.record(1, Duration::from_nanos(300));
+        stats.record(1, Duration::from_secs(1));
+        stats.record(2, Duration::from_nanos(100));
+
+        let stat = stats.get(1);
+        assert_eq!(stat.calls, 3);
+        assert_eq!(stat.total, Duration::from_nanos(1_000_000_400));
+        assert_eq!(stat.latency[0], 1);
+        assert_eq!(stat.latency[1], 1);
+        assert_eq!(stat.latency[LATENCY_BUCKETS - 1], 1);
+        assert_eq!(stats.get(0).calls, 0);
+        assert_eq!(stats.get(2).calls, 0);
+    }
+}
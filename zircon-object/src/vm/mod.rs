@@ -25,6 +25,21 @@ pub const PAGE_SIZE: usize = 0x1000;
 /// log2(PAGE_SIZE)
 pub const PAGE_SIZE_LOG2: usize = 12;
 
+/// Size of a huge page
+pub const HUGE_PAGE_SIZE: usize = 0x20_0000;
+
+/// log2(HUGE_PAGE_SIZE)
+pub const HUGE_PAGE_SIZE_LOG2: usize = 21;
+
+/// Number of pages in a huge page
+pub const HUGE_PAGE_PAGES: usize = HUGE_PAGE_SIZE / PAGE_SIZE;
+
+/// Whether user mappings may be left unmapped until the first page fault.
+///
+/// Page faults of user memory can only be handled on bare metal,
+/// on LibOS the pages must be mapped when the VMO is mapped.
+pub const MAP_ON_DEMAND: bool = cfg!(target_os = "none");
+
 /// Check whether `x` is a multiple of `PAGE_SIZE`.
 pub fn page_aligned(x: usize) -> bool {
     check_aligned(x, PAGE_SIZE)
@@ -59,6 +74,26 @@ pub fn round_down_pages(size: usize) -> usize {
 lazy_static! {
     /// Kernel address space.
     pub static ref KERNEL_ASPACE: Arc<VmAddressRegion> = VmAddressRegion::new_kernel();
+    /// The page of `kernel_hal::vdso::VDSO_TIME`, which is mapped read-only next to the vDSO.
+    ///
+    /// It is `None` if the kernel memory can't be mapped to user space, as in the LibOS.
+    /// The vDSO VMO only holds the image, so the page must be mapped on its own.
+    pub static ref VDSO_TIME_VMO: Option<Arc<VmObject>> = vdso_time_vmo();
+}
+
+fn vdso_time_vmo() -> Option<Arc<VmObject>> {
+    #[cfg(target_os = "none")]
+    {
+        use crate::object::KernelObject;
+        use kernel_hal::PageTableTrait;
+        let vaddr = &kernel_hal::vdso::VDSO_TIME as *const _ as usize;
+        let paddr = kernel_hal::PageTable::current().query(vaddr).ok()?;
+        let vmo = VmObject::new_physical(paddr, 1);
+        vmo.set_name("vdso/time");
+        Some(vmo)
+    }
+    #[cfg(not(target_os = "none"))]
+    None
 }
 
 /// Allocate memory in kernel address space at given physical address.
@@ -1,8 +1,37 @@
 use {
-    super::*, crate::object::*, alloc::sync::Arc, alloc::vec, alloc::vec::Vec, bitflags::bitflags,
-    kernel_hal::PageTableTrait, spin::Mutex,
+    super::*,
+    crate::object::*,
+    crate::util::ktrace::{ktrace, TraceEvent},
+    alloc::{
+        boxed::Box,
+        collections::{BTreeMap, BTreeSet},
+        sync::{Arc, Weak},
+        vec,
+        vec::Vec,
+    },
+    bitflags::bitflags,
+    kernel_hal::PageTableTrait,
+    spin::Mutex,
 };
 
+kcounter!(HUGE_MAPPINGS, "vm.huge_mappings");
+
+lazy_static! {
+    /// Root VMARs of user address spaces by their page tables, to resolve
+    /// page faults of the kernel in copying user memory.
+    static ref ROOT_VMARS: Mutex<BTreeMap<PhysAddr, Weak<VmAddressRegion>>> = Mutex::default();
+}
+
+/// Resolve a page fault of the kernel in copying user memory, see
+/// `kernel_hal::UserFaultHandler`.
+fn handle_user_fault(table: PhysAddr, vaddr: VirtAddr, flags: MMUFlags) -> bool {
+    let vmar = ROOT_VMARS.lock().get(&table).and_then(Weak::upgrade);
+    match vmar {
+        Some(vmar) => vmar.handle_page_fault(vaddr, flags).is_ok(),
+        None => false,
+    }
+}
+
 bitflags! {
     /// Creation flags for VmAddressRegion.
     pub struct VmarFlags: u32 {
@@ -53,10 +82,21 @@ impl_kobject!(VmAddressRegion);
 define_count_helper!(VmAddressRegion);
 
 /// The mutable part of `VmAddressRegion`.
-#[derive(Default)]
+///
+/// Children and mappings are indexed by their base address. They never overlap
+/// each other, so the entry containing an address is always the last one whose
+/// base is not above it.
+///
+/// The free ranges between them are indexed both by base address, to merge
+/// them on release, and by size, to find a free area without walking the
+/// regions. Insert and remove regions with `occupy` and `release`.
 struct VmarInner {
-    children: Vec<Arc<VmAddressRegion>>,
-    mappings: Vec<Arc<VmMapping>>,
+    children: BTreeMap<VirtAddr, Arc<VmAddressRegion>>,
+    mappings: BTreeMap<VirtAddr, Arc<VmMapping>>,
+    /// Free ranges by base address, to their sizes.
+    free: BTreeMap<VirtAddr, usize>,
+    /// Free ranges by size, then base address.
+    free_by_size: BTreeSet<(usize, VirtAddr)>,
 }
 
 impl VmAddressRegion {
@@ -71,7 +111,7 @@ impl VmAddressRegion {
         };
         #[cfg(not(feature = "aspace-separate"))]
         let (addr, size) = (USER_ASPACE_BASE as usize, USER_ASPACE_SIZE as usize);
-        Arc::new(VmAddressRegion {
+        let vmar = Arc::new(VmAddressRegion {
             flags: VmarFlags::ROOT_FLAGS,
             base: KObjectBase::new(),
             _counter: CountHelper::new(),
@@ -79,8 +119,15 @@ impl VmAddressRegion {
             size,
             parent: None,
             page_table: Arc::new(Mutex::new(kernel_hal::PageTable::new())),
-            inner: Mutex::new(Some(VmarInner::default())),
-        })
+            inner: Mutex::new(Some(VmarInner::new(addr, size))),
+        });
+        static SET_FAULT_HANDLER: spin::Once<()> = spin::Once::new();
+        SET_FAULT_HANDLER
+            .call_once(|| kernel_hal::user_fault_set_handler(Box::new(handle_user_fault)));
+        ROOT_VMARS
+            .lock()
+            .insert(vmar.table_phys(), Arc::downgrade(&vmar));
+        vmar
     }
 
     /// Create a kernel root VMAR.
@@ -95,7 +142,7 @@ impl VmAddressRegion {
             size: kernel_vmar_size,
             parent: None,
             page_table: Arc::new(Mutex::new(kernel_hal::PageTable::new())),
-            inner: Mutex::new(Some(VmarInner::default())),
+            inner: Mutex::new(Some(VmarInner::new(kernel_vmar_base, kernel_vmar_size))),
         })
     }
 
@@ -112,7 +159,7 @@ impl VmAddressRegion {
             size: guest_vmar_size,
             parent: None,
             page_table: Arc::new(Mutex::new(crate::hypervisor::VmmPageTable::new())),
-            inner: Mutex::new(Some(VmarInner::default())),
+            inner: Mutex::new(Some(VmarInner::new(guest_vmar_base, guest_vmar_size))),
         })
     }
 
@@ -146,9 +193,10 @@ impl VmAddressRegion {
             size: len,
             parent: Some(self.clone()),
             page_table: self.page_table.clone(),
-            inner: Mutex::new(Some(VmarInner::default())),
+            inner: Mutex::new(Some(VmarInner::new(self.addr + offset, len))),
         });
-        inner.children.push(child.clone());
+        inner.occupy(child.addr, child.end_addr());
+        inner.children.insert(child.addr, child.clone());
         Ok(child)
     }
 
@@ -185,6 +233,34 @@ impl VmAddressRegion {
         )
     }
 
+    /// Map the whole `vmo` into this VMAR at an address aligned to `align`,
+    /// which is a power of two and a multiple of `PAGE_SIZE`.
+    ///
+    /// A mapping aligned to `HUGE_PAGE_SIZE` can be backed by huge pages.
+    pub fn map_aligned(
+        &self,
+        vmo: Arc<VmObject>,
+        len: usize,
+        flags: MMUFlags,
+        align: usize,
+    ) -> ZxResult<VirtAddr> {
+        if !align.is_power_of_two() || !page_aligned(align) {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        self.map_ext_aligned(
+            None,
+            vmo,
+            0,
+            len,
+            MMUFlags::RXW,
+            flags,
+            false,
+            true,
+            false,
+            align,
+        )
+    }
+
     /// Map the `vmo` into this VMAR.
     #[allow(clippy::too_many_arguments)]
     pub fn map_ext(
@@ -197,6 +273,67 @@ impl VmAddressRegion {
         flags: MMUFlags,
         overwrite: bool,
         map_range: bool,
+    ) -> ZxResult<VirtAddr> {
+        self.map_ext_aligned(
+            vmar_offset,
+            vmo,
+            vmo_offset,
+            len,
+            permissions,
+            flags,
+            overwrite,
+            map_range,
+            false,
+            PAGE_SIZE,
+        )
+    }
+
+    /// Map the `vmo` into this VMAR like `map_ext`, but the mapping may extend
+    /// past the end of the VMO. (For Linux `mmap` of files)
+    ///
+    /// The pages beyond the end of the VMO are never committed, and accessing
+    /// them fails just like a mapping of a VMO which is shrunk.
+    #[allow(clippy::too_many_arguments)]
+    pub fn map_ext_past_end(
+        &self,
+        vmar_offset: Option<usize>,
+        vmo: Arc<VmObject>,
+        vmo_offset: usize,
+        len: usize,
+        permissions: MMUFlags,
+        flags: MMUFlags,
+        overwrite: bool,
+        map_range: bool,
+    ) -> ZxResult<VirtAddr> {
+        self.map_ext_aligned(
+            vmar_offset,
+            vmo,
+            vmo_offset,
+            len,
+            permissions,
+            flags,
+            overwrite,
+            map_range,
+            true,
+            PAGE_SIZE,
+        )
+    }
+
+    /// Map the `vmo` into this VMAR, at an address aligned to `align` if
+    /// `vmar_offset` is not given.
+    #[allow(clippy::too_many_arguments)]
+    fn map_ext_aligned(
+        &self,
+        vmar_offset: Option<usize>,
+        vmo: Arc<VmObject>,
+        vmo_offset: usize,
+        len: usize,
+        permissions: MMUFlags,
+        flags: MMUFlags,
+        overwrite: bool,
+        map_range: bool,
+        past_end: bool,
+        align: usize,
     ) -> ZxResult<VirtAddr> {
         if !page_aligned(vmo_offset) || !page_aligned(len) || vmo_offset.overflowing_add(len).1 {
             return Err(ZxError::INVALID_ARGS);
@@ -204,13 +341,17 @@ impl VmAddressRegion {
         if !permissions.contains(flags & MMUFlags::RXW) {
             return Err(ZxError::ACCESS_DENIED);
         }
-        // TODO: allow the mapping extends past the end of vmo
-        if vmo_offset > vmo.len() || len > vmo.len() - vmo_offset {
+        if !past_end && (vmo_offset > vmo.len() || len > vmo.len() - vmo_offset) {
             return Err(ZxError::INVALID_ARGS);
         }
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().ok_or(ZxError::BAD_STATE)?;
-        let offset = self.determine_offset(inner, vmar_offset, len, PAGE_SIZE)?;
+        let offset = match vmar_offset {
+            None if align > PAGE_SIZE => self
+                .find_free_area(inner, len, align)
+                .ok_or(ZxError::NO_MEMORY)?,
+            _ => self.determine_offset(inner, vmar_offset, len, PAGE_SIZE)?,
+        };
         let addr = self.addr + offset;
         let mut flags = flags;
         // if vmo != 0
@@ -239,7 +380,8 @@ impl VmAddressRegion {
         if map_range {
             mapping.map()?;
         }
-        inner.mappings.push(mapping);
+        inner.occupy(addr, addr + len);
+        inner.mappings.insert(addr, mapping);
         Ok(addr)
     }
 
@@ -267,20 +409,29 @@ impl VmAddressRegion {
         let begin = addr;
         let end = addr + len;
         // check partial overlapped sub-regions
-        for vmar in inner.children.iter() {
-            if vmar.partial_overlap(begin, end) {
-                return Err(ZxError::INVALID_ARGS);
-            }
+        if overlapping(&inner.children, begin, end).any(|vmar| vmar.partial_overlap(begin, end)) {
+            return Err(ZxError::INVALID_ARGS);
         }
-        let mut new_maps = Vec::new();
-        inner.mappings.drain_filter(|map| {
+        // cutting may move the base address of a mapping, so take them out and re-insert.
+        let keys: Vec<VirtAddr> = overlapping(&inner.mappings, begin, end)
+            .map(|map| map.addr())
+            .collect();
+        for key in keys {
+            let map = inner.mappings.remove(&key).unwrap();
+            inner.release(map.addr().max(begin), map.end_addr().min(end));
             if let Some(new) = map.cut(begin, end) {
-                new_maps.push(new);
+                inner.mappings.insert(new.addr(), new);
             }
-            map.size() == 0
-        });
-        inner.mappings.extend(new_maps);
-        for vmar in inner.children.drain_filter(|vmar| vmar.within(begin, end)) {
+            if map.size() != 0 {
+                inner.mappings.insert(map.addr(), map);
+            }
+        }
+        let keys: Vec<VirtAddr> = overlapping(&inner.children, begin, end)
+            .map(|vmar| vmar.addr)
+            .collect();
+        for key in keys {
+            let vmar = inner.children.remove(&key).unwrap();
+            inner.release(vmar.addr, vmar.end_addr());
             vmar.destroy_internal()?;
         }
         Ok(())
@@ -297,45 +448,47 @@ impl VmAddressRegion {
         let inner = guard.as_mut().ok_or(ZxError::BAD_STATE)?;
         let end_addr = addr + len;
         // check if there are overlapping subregion
-        if inner
-            .children
-            .iter()
-            .any(|child| child.end_addr() >= addr && child.addr() <= end_addr)
+        if overlapping(&inner.children, addr, end_addr)
+            .next()
+            .is_some()
         {
             return Err(ZxError::INVALID_ARGS);
         }
-        let length: usize = inner
-            .mappings
-            .iter()
-            .filter_map(|map| {
-                if map.end_addr() >= addr && map.addr() <= end_addr {
-                    Some(end_addr.min(map.end_addr()) - addr.max(map.addr()))
-                } else {
-                    None
-                }
-            })
+        let length: usize = overlapping(&inner.mappings, addr, end_addr)
+            .map(|map| end_addr.min(map.end_addr()) - addr.max(map.addr()))
             .sum();
         if length != len {
             return Err(ZxError::NOT_FOUND);
         }
         // check if protect flags is valid
-        if inner
-            .mappings
-            .iter()
-            .filter(|map| map.end_addr() >= addr && map.addr() <= end_addr) // get mappings in range: [addr, end_addr]
+        if overlapping(&inner.mappings, addr, end_addr)
             .any(|map| !map.is_valid_mapping_flags(flags))
         {
             return Err(ZxError::ACCESS_DENIED);
         }
-        inner
-            .mappings
-            .iter()
-            .filter(|map| map.end_addr() >= addr && map.addr() <= end_addr)
-            .for_each(|map| {
-                let start_index = pages(addr.max(map.addr()) - map.addr());
-                let end_index = pages(end_addr.min(map.end_addr()) - map.addr());
-                map.protect(flags, start_index, end_index);
-            });
+        // a VMO shared with a fork must never be written through a mapping
+        let mut unshared = Vec::new();
+        if flags.contains(MMUFlags::WRITE) {
+            let keys: Vec<VirtAddr> = overlapping(&inner.mappings, addr, end_addr)
+                .filter(|map| map.inner.lock().fork_shared)
+                .map(|map| map.addr())
+                .collect();
+            for key in keys {
+                let mapping = inner.mappings[&key].unshare()?;
+                inner.mappings.insert(key, mapping.clone());
+                unshared.push(mapping);
+            }
+        }
+        overlapping(&inner.mappings, addr, end_addr).for_each(|map| {
+            let start_index = pages(addr.max(map.addr()) - map.addr());
+            let end_index = pages(end_addr.min(map.end_addr()) - map.addr());
+            map.protect(flags, start_index, end_index);
+        });
+        if !MAP_ON_DEMAND {
+            for mapping in unshared {
+                mapping.map()?;
+            }
+        }
         Ok(())
     }
 
@@ -346,7 +499,12 @@ impl VmAddressRegion {
         if let Some(parent) = &self.parent {
             let mut guard = parent.inner.lock();
             let inner = guard.as_mut().unwrap();
-            inner.children.retain(|vmar| !Arc::ptr_eq(self, vmar));
+            if let Some(vmar) = inner.children.get(&self.addr) {
+                if Arc::ptr_eq(self, vmar) {
+                    inner.children.remove(&self.addr);
+                    inner.release(self.addr, self.end_addr());
+                }
+            }
         }
         Ok(())
     }
@@ -355,12 +513,10 @@ impl VmAddressRegion {
     fn destroy_internal(&self) -> ZxResult {
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().ok_or(ZxError::BAD_STATE)?;
-        for vmar in inner.children.drain(..) {
+        for (_, vmar) in core::mem::take(&mut inner.children) {
             vmar.destroy_internal()?;
         }
-        for mapping in inner.mappings.drain(..) {
-            drop(mapping);
-        }
+        inner.mappings.clear();
         *guard = None;
         Ok(())
     }
@@ -369,10 +525,10 @@ impl VmAddressRegion {
     pub fn clear(&self) -> ZxResult {
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().ok_or(ZxError::BAD_STATE)?;
-        for vmar in inner.children.drain(..) {
+        for (_, vmar) in core::mem::take(&mut inner.children) {
             vmar.destroy_internal()?;
         }
-        inner.mappings.clear();
+        *inner = VmarInner::new(self.addr, self.size);
         Ok(())
     }
 
@@ -386,6 +542,38 @@ impl VmAddressRegion {
         self.addr
     }
 
+    /// Whether `[addr, addr + len)` is inside this VMAR.
+    pub fn contains_range(&self, addr: VirtAddr, len: usize) -> bool {
+        match addr.checked_add(len) {
+            Some(end) => addr >= self.addr && end <= self.addr + self.size,
+            None => false,
+        }
+    }
+
+    /// Whether all pages of `[addr, addr + len)` are mapped with `flags`,
+    /// e.g. a user buffer to write to once it is too late to fail.
+    pub fn is_mapped_with(&self, addr: VirtAddr, len: usize, flags: MMUFlags) -> bool {
+        let end = match addr.checked_add(len) {
+            Some(end) => end,
+            None => return false,
+        };
+        let mut vaddr = addr;
+        while vaddr < end {
+            let map = match self.find_mapping(vaddr) {
+                Some(map) => map,
+                None => return false,
+            };
+            let inner = map.inner.lock();
+            let map_end = inner.end_addr().min(end);
+            let range = (vaddr - inner.addr) / PAGE_SIZE..pages(map_end - inner.addr);
+            if inner.flags[range].iter().any(|f| !f.contains(flags)) {
+                return false;
+            }
+            vaddr = map_end;
+        }
+        true
+    }
+
     /// Whether this VMAR is dead.
     pub fn is_dead(&self) -> bool {
         self.inner.lock().is_none()
@@ -415,7 +603,7 @@ impl VmAddressRegion {
         } else if len > self.size {
             Err(ZxError::INVALID_ARGS)
         } else {
-            match self.find_free_area(&inner, 0, len, align) {
+            match self.find_free_area(&inner, len, align) {
                 Some(offset) => Ok(offset),
                 None => Err(ZxError::NO_MEMORY),
             }
@@ -431,33 +619,25 @@ impl VmAddressRegion {
         if end > self.addr + self.size {
             return false;
         }
-        // brute force
-        if inner.children.iter().any(|vmar| vmar.overlap(begin, end)) {
-            return false;
-        }
-        if inner.mappings.iter().any(|map| map.overlap(begin, end)) {
-            return false;
-        }
-        true
+        inner.last_overlap_end(begin, end).is_none()
     }
 
-    /// Find a free area with `len`.
-    fn find_free_area(
-        &self,
-        inner: &VmarInner,
-        offset_hint: usize,
-        len: usize,
-        align: usize,
-    ) -> Option<usize> {
+    /// Find a free area with `len` whose address is aligned to `align`.
+    fn find_free_area(&self, inner: &VmarInner, len: usize, align: usize) -> Option<usize> {
         // TODO: randomize
-        debug_assert!(check_aligned(offset_hint, align));
-        debug_assert!(check_aligned(len, align));
-        // brute force:
-        // try each area's end address as the start
-        core::iter::once(offset_hint)
-            .chain(inner.children.iter().map(|map| map.end_addr() - self.addr))
-            .chain(inner.mappings.iter().map(|map| map.end_addr() - self.addr))
-            .find(|&offset| self.test_map(inner, offset, len, align))
+        // best fit: the smallest free range with room for an aligned area,
+        // the lowest one among those of the same size.
+        inner
+            .free_by_size
+            .range((len, 0)..)
+            .find_map(|&(size, base)| {
+                let addr = ceil(base, align) * align;
+                if addr + len <= base + size {
+                    Some(addr - self.addr)
+                } else {
+                    None
+                }
+            })
     }
 
     fn end_addr(&self) -> VirtAddr {
@@ -497,10 +677,10 @@ impl VmAddressRegion {
     pub fn dump(&self) {
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().unwrap();
-        for map in inner.mappings.iter() {
+        for map in inner.mappings.values() {
             debug!("{:x?}", map);
         }
-        for child in inner.children.iter() {
+        for child in inner.children.values() {
             child.dump();
         }
     }
@@ -509,12 +689,12 @@ impl VmAddressRegion {
     pub fn vdso_base_addr(&self) -> Option<usize> {
         let guard = self.inner.lock();
         let inner = guard.as_ref().unwrap();
-        for map in inner.mappings.iter() {
+        for map in inner.mappings.values() {
             if map.vmo.name().starts_with("vdso") && map.inner.lock().vmo_offset == 0x7000 {
                 return Some(map.addr());
             }
         }
-        for vmar in inner.children.iter() {
+        for vmar in inner.children.values() {
             if let Some(addr) = vmar.vdso_base_addr() {
                 return Some(addr);
             }
@@ -522,40 +702,169 @@ impl VmAddressRegion {
         None
     }
 
+    /// Map the time page `VDSO_TIME_VMO` read-only into the root VMAR of this
+    /// address space, unless it is mapped already.
+    ///
+    /// Return the address of the page, or `None` if there is no time page.
+    pub fn map_vdso_time(&self) -> ZxResult<Option<VirtAddr>> {
+        let time_vmo = match VDSO_TIME_VMO.as_ref() {
+            Some(vmo) => vmo,
+            None => return Ok(None),
+        };
+        let mut root = self;
+        while let Some(parent) = &root.parent {
+            root = parent;
+        }
+        let mut addr = None;
+        root.for_each_mapping(&mut |map| {
+            if Arc::ptr_eq(&map.vmo, time_vmo) {
+                addr = Some(map.addr());
+            }
+        });
+        if addr.is_some() {
+            return Ok(addr);
+        }
+        let flags = MMUFlags::READ | MMUFlags::USER;
+        let addr = root.map_ext(
+            None,
+            time_vmo.clone(),
+            0,
+            PAGE_SIZE,
+            flags,
+            flags,
+            false,
+            true,
+        )?;
+        Ok(Some(addr))
+    }
+
     /// Handle page fault happened on this VMAR.
     ///
     /// The fault virtual address is `vaddr` and the reason is in `flags`.
     pub fn handle_page_fault(&self, vaddr: VirtAddr, flags: MMUFlags) -> ZxResult {
         let guard = self.inner.lock();
-        let inner = guard.as_ref().unwrap();
+        let inner = guard.as_ref().ok_or(ZxError::BAD_STATE)?;
         if !self.contains(vaddr) {
             return Err(ZxError::NOT_FOUND);
         }
-        if let Some(child) = inner.children.iter().find(|ch| ch.contains(vaddr)) {
+        if let Some(child) = containing(&inner.children, vaddr) {
+            // don't hold our lock while descending into the child.
+            let child = child.clone();
+            drop(guard);
             return child.handle_page_fault(vaddr, flags);
         }
-        if let Some(mapping) = inner.mappings.iter().find(|map| map.contains(vaddr)) {
+        if let Some(mapping) = containing(&inner.mappings, vaddr) {
+            ktrace(TraceEvent::PageFault, self.id(), vaddr as u64);
+            // nor while committing the pages, which may be read from a pager,
+            // or resolving a fault of the kernel in copying user memory
+            let mapping = mapping.clone();
+            drop(guard);
             return mapping.handle_page_fault(vaddr, flags);
         }
         Err(ZxError::NOT_FOUND)
     }
 
+    /// Set how page faults are handled for the mappings within `[addr, addr + len)`.
+    ///
+    /// On a fault, up to `pages` pages around the faulting one are mapped at once.
+    /// If `sequential` is set, the pages following the faulting one are expected to
+    /// be accessed soon, and are committed with the same access as the fault.
+    pub fn set_fault_around(
+        &self,
+        addr: VirtAddr,
+        len: usize,
+        pages: usize,
+        sequential: bool,
+    ) -> ZxResult {
+        if !page_aligned(addr) || !page_aligned(len) {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        self.for_each_mapping_in(addr, addr + len, &mut |map, _, _| {
+            map.set_fault_around(pages, sequential);
+            Ok(())
+        })
+    }
+
+    /// Map the pages within `[addr, addr + len)` ahead of access.
+    ///
+    /// Pages are only committed for read, so private and copy-on-write pages
+    /// are still shared until they are written. Pages which are not resident
+    /// are left to fault, see `VmMappingInner::map_resident_page`.
+    pub fn populate(&self, addr: VirtAddr, len: usize) -> ZxResult {
+        if !page_aligned(addr) || !page_aligned(len) {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        self.for_each_mapping_in(addr, addr + len, &mut |map, begin, end| {
+            map.populate(begin, end)
+        })
+    }
+
+    /// Get the VMOs mapped within `[addr, addr + len)`, each of them once.
+    pub fn mapped_vmos(&self, addr: VirtAddr, len: usize) -> ZxResult<Vec<Arc<VmObject>>> {
+        let mut vmos: Vec<Arc<VmObject>> = Vec::new();
+        self.for_each_mapping_in(addr, addr + len, &mut |map, _, _| {
+            if !vmos.iter().any(|vmo| Arc::ptr_eq(vmo, &map.vmo)) {
+                vmos.push(map.vmo.clone());
+            }
+            Ok(())
+        })?;
+        Ok(vmos)
+    }
+
+    /// Call `f` on each mapping overlapping `[begin, end)` recursively,
+    /// with the overlapped range of pages in that mapping.
+    fn for_each_mapping_in(
+        &self,
+        begin: VirtAddr,
+        end: VirtAddr,
+        f: &mut impl FnMut(&Arc<VmMapping>, usize, usize) -> ZxResult,
+    ) -> ZxResult {
+        let guard = self.inner.lock();
+        let inner = guard.as_ref().ok_or(ZxError::BAD_STATE)?;
+        for map in overlapping(&inner.mappings, begin, end) {
+            let (addr, end_addr) = (map.addr(), map.end_addr());
+            let start_index = (begin.max(addr) - addr) / PAGE_SIZE;
+            let end_index = pages(end.min(end_addr) - addr);
+            f(map, start_index, end_index)?;
+        }
+        for child in overlapping(&inner.children, begin, end) {
+            child.for_each_mapping_in(begin, end, f)?;
+        }
+        Ok(())
+    }
+
     fn for_each_mapping(&self, f: &mut impl FnMut(&Arc<VmMapping>)) {
         let guard = self.inner.lock();
         let inner = guard.as_ref().unwrap();
-        for map in inner.mappings.iter() {
+        for map in inner.mappings.values() {
             f(map);
         }
-        for child in inner.children.iter() {
+        for child in inner.children.values() {
             child.for_each_mapping(f);
         }
     }
 
     /// Clone the entire address space and VMOs from source VMAR. (For Linux fork)
     pub fn fork_from(&self, src: &Arc<Self>) -> ZxResult {
+        let mut writable = BTreeSet::new();
+        src.for_each_mapping(&mut |map| {
+            if map.is_writable() {
+                writable.insert(Arc::as_ptr(&map.vmo) as usize);
+            }
+        });
+        // the other VMOs are shared until a mapping of them is made writable
+        src.for_each_mapping(&mut |map| {
+            if !writable.contains(&(Arc::as_ptr(&map.vmo) as usize)) {
+                map.inner.lock().fork_shared = true;
+            }
+        });
+        let mut clones = ForkClones {
+            writable,
+            children: BTreeMap::new(),
+        };
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().unwrap();
-        inner.fork_from(src, &self.page_table)
+        inner.fork_from(src, &self.page_table, &mut clones)
     }
 
     /// Returns statistics about memory used by a task.
@@ -571,9 +880,13 @@ impl VmAddressRegion {
     pub fn read_memory(&self, vaddr: usize, buf: &mut [u8]) -> ZxResult<usize> {
         // TODO: support multiple VMOs
         let map = self.find_mapping(vaddr).ok_or(ZxError::NO_MEMORY)?;
-        let map_inner = map.inner.lock();
-        let vmo_offset = vaddr - map_inner.addr + map_inner.vmo_offset;
-        let size_limit = map_inner.addr + map_inner.size - vaddr;
+        let (vmo_offset, size_limit) = {
+            let map_inner = map.inner.lock();
+            (
+                vaddr - map_inner.addr + map_inner.vmo_offset,
+                map_inner.addr + map_inner.size - vaddr,
+            )
+        };
         let actual_size = buf.len().min(size_limit);
         map.vmo.read(vmo_offset, &mut buf[0..actual_size])?;
         Ok(actual_size)
@@ -585,9 +898,13 @@ impl VmAddressRegion {
     pub fn write_memory(&self, vaddr: usize, buf: &[u8]) -> ZxResult<usize> {
         // TODO: support multiple VMOs
         let map = self.find_mapping(vaddr).ok_or(ZxError::NO_MEMORY)?;
-        let map_inner = map.inner.lock();
-        let vmo_offset = vaddr - map_inner.addr + map_inner.vmo_offset;
-        let size_limit = map_inner.addr + map_inner.size - vaddr;
+        let (vmo_offset, size_limit) = {
+            let map_inner = map.inner.lock();
+            (
+                vaddr - map_inner.addr + map_inner.vmo_offset,
+                map_inner.addr + map_inner.size - vaddr,
+            )
+        };
         let actual_size = buf.len().min(size_limit);
         map.vmo.write(vmo_offset, &buf[0..actual_size])?;
         Ok(actual_size)
@@ -596,14 +913,13 @@ impl VmAddressRegion {
     /// Find mapping of vaddr
     pub fn find_mapping(&self, vaddr: usize) -> Option<Arc<VmMapping>> {
         let guard = self.inner.lock();
-        let inner = guard.as_ref().unwrap();
-        if let Some(mapping) = inner.mappings.iter().find(|map| map.contains(vaddr)) {
+        let inner = guard.as_ref()?;
+        if let Some(mapping) = containing(&inner.mappings, vaddr) {
             return Some(mapping.clone());
         }
-        if let Some(child) = inner.children.iter().find(|ch| ch.contains(vaddr)) {
-            return child.find_mapping(vaddr);
-        }
-        None
+        let child = containing(&inner.children, vaddr)?.clone();
+        drop(guard);
+        child.find_mapping(vaddr)
     }
 
     #[cfg(test)]
@@ -617,33 +933,195 @@ impl VmAddressRegion {
     fn used_size(&self) -> usize {
         let mut guard = self.inner.lock();
         let inner = guard.as_mut().unwrap();
-        let map_size: usize = inner.mappings.iter().map(|map| map.size()).sum();
-        let vmar_size: usize = inner.children.iter().map(|vmar| vmar.size).sum();
+        let map_size: usize = inner.mappings.values().map(|map| map.size()).sum();
+        let vmar_size: usize = inner.children.values().map(|vmar| vmar.size).sum();
         map_size + vmar_size
     }
+
+    /// Check that the free ranges are exactly the gaps between the regions.
+    #[cfg(test)]
+    fn check_free(&self) {
+        let guard = self.inner.lock();
+        let inner = guard.as_ref().unwrap();
+        let mut regions: Vec<(VirtAddr, VirtAddr)> = inner
+            .mappings
+            .values()
+            .map(|map| (map.addr(), map.end_addr()))
+            .chain(
+                inner
+                    .children
+                    .values()
+                    .map(|vmar| (vmar.addr, vmar.end_addr())),
+            )
+            .collect();
+        regions.sort_unstable();
+        regions.push((self.end_addr(), self.end_addr()));
+        let mut gaps = BTreeMap::new();
+        let mut begin = self.addr;
+        for (addr, end) in regions {
+            assert!(begin <= addr, "regions overlap at {:#x}", addr);
+            if begin < addr {
+                gaps.insert(begin, addr - begin);
+            }
+            begin = end;
+        }
+        let by_size: BTreeSet<_> = gaps.iter().map(|(&base, &size)| (size, base)).collect();
+        assert_eq!(inner.free, gaps);
+        assert_eq!(inner.free_by_size, by_size);
+    }
 }
 
 impl VmarInner {
+    /// Create the inner of a VMAR at `[addr, addr + size)`, which is all free.
+    fn new(addr: VirtAddr, size: usize) -> Self {
+        let mut inner = VmarInner {
+            children: BTreeMap::new(),
+            mappings: BTreeMap::new(),
+            free: BTreeMap::new(),
+            free_by_size: BTreeSet::new(),
+        };
+        inner.insert_free(addr, size);
+        inner
+    }
+
+    /// Take `[begin, end)` out of the free ranges for a new region.
+    fn occupy(&mut self, begin: VirtAddr, end: VirtAddr) {
+        let (&base, &size) = self
+            .free
+            .range(..=begin)
+            .next_back()
+            .expect("occupy a range which is not free");
+        debug_assert!(end <= base + size);
+        self.remove_free(base, size);
+        self.insert_free(base, begin - base);
+        self.insert_free(end, base + size - end);
+    }
+
+    /// Return `[begin, end)` of a removed region to the free ranges,
+    /// merging it with the adjacent ones.
+    fn release(&mut self, mut begin: VirtAddr, mut end: VirtAddr) {
+        if let Some((&base, &size)) = self.free.range(..begin).next_back() {
+            if base + size == begin {
+                self.remove_free(base, size);
+                begin = base;
+            }
+        }
+        if let Some(&size) = self.free.get(&end) {
+            self.remove_free(end, size);
+            end += size;
+        }
+        self.insert_free(begin, end - begin);
+    }
+
+    fn insert_free(&mut self, base: VirtAddr, size: usize) {
+        if size != 0 {
+            self.free.insert(base, size);
+            self.free_by_size.insert((size, base));
+        }
+    }
+
+    fn remove_free(&mut self, base: VirtAddr, size: usize) {
+        self.free.remove(&base);
+        self.free_by_size.remove(&(size, base));
+    }
+
+    /// Get the end address of the highest region overlapping `[begin, end)`.
+    fn last_overlap_end(&self, begin: VirtAddr, end: VirtAddr) -> Option<VirtAddr> {
+        let child_end = last_overlapping(&self.children, begin, end).map(|vmar| vmar.end_addr());
+        let map_end = last_overlapping(&self.mappings, begin, end).map(|map| map.end_addr());
+        child_end.max(map_end)
+    }
+
     /// Clone the entire address space and VMOs from source VMAR. (For Linux fork)
     fn fork_from(
         &mut self,
         src: &Arc<VmAddressRegion>,
         page_table: &Arc<Mutex<dyn PageTableTrait>>,
+        clones: &mut ForkClones,
     ) -> ZxResult {
         let src_guard = src.inner.lock();
         let src_inner = src_guard.as_ref().unwrap();
-        for child in src_inner.children.iter() {
-            self.fork_from(child, page_table)?;
+        for child in src_inner.children.values() {
+            self.fork_from(child, page_table, clones)?;
         }
-        for map in src_inner.mappings.iter() {
-            let mapping = map.clone_map(page_table.clone())?;
-            mapping.map()?;
-            self.mappings.push(mapping);
+        for map in src_inner.mappings.values() {
+            let mapping = map.clone_map(page_table.clone(), clones)?;
+            // populated by `handle_page_fault`, also for the kernel copying user memory
+            if !MAP_ON_DEMAND {
+                mapping.map()?;
+            }
+            self.occupy(mapping.addr(), mapping.end_addr());
+            self.mappings.insert(mapping.addr(), mapping);
         }
         Ok(())
     }
 }
 
+/// VMOs to map in a forked address space.
+struct ForkClones {
+    /// Address of VMOs which have a writable mapping in the source.
+    writable: BTreeSet<usize>,
+    /// The copy-on-write child of each VMO in `writable` created so far.
+    children: BTreeMap<usize, Arc<VmObject>>,
+}
+
+/// An address range occupied by a child VMAR or a mapping.
+trait Region {
+    fn end(&self) -> VirtAddr;
+}
+
+impl Region for VmAddressRegion {
+    fn end(&self) -> VirtAddr {
+        self.end_addr()
+    }
+}
+
+impl Region for VmMapping {
+    fn end(&self) -> VirtAddr {
+        self.end_addr()
+    }
+}
+
+/// Find the region containing `vaddr` in an address-ordered index.
+fn containing<T: Region>(index: &BTreeMap<VirtAddr, Arc<T>>, vaddr: VirtAddr) -> Option<&Arc<T>> {
+    let (_, region) = index.range(..=vaddr).next_back()?;
+    if region.end() > vaddr {
+        Some(region)
+    } else {
+        None
+    }
+}
+
+/// Find the highest region overlapping `[begin, end)` in an address-ordered index.
+fn last_overlapping<T: Region>(
+    index: &BTreeMap<VirtAddr, Arc<T>>,
+    begin: VirtAddr,
+    end: VirtAddr,
+) -> Option<&Arc<T>> {
+    let (_, region) = index.range(..end).next_back()?;
+    if region.end() > begin {
+        Some(region)
+    } else {
+        None
+    }
+}
+
+/// Iterate over the regions overlapping `[begin, end)` in an address-ordered index.
+fn overlapping<T: Region>(
+    index: &BTreeMap<VirtAddr, Arc<T>>,
+    begin: VirtAddr,
+    end: VirtAddr,
+) -> impl Iterator<Item = &Arc<T>> {
+    let end = end.max(begin);
+    let head = index
+        .range(..begin)
+        .next_back()
+        .map(|(_, region)| region)
+        .filter(move |region| region.end() > begin);
+    head.into_iter()
+        .chain(index.range(begin..end).map(|(_, region)| region))
+}
+
 /// Information of a VmAddressRegion.
 #[repr(C)]
 #[derive(Debug)]
@@ -665,6 +1143,23 @@ pub struct VmMapping {
 struct VmMappingInner {
     /// The actual flags used in the mapping of each page
     flags: Vec<MMUFlags>,
+    /// Whether each page has been mapped into the page table.
+    ///
+    /// Fault-around and `protect` skip the pages which are not mapped,
+    /// the faulting page itself is always mapped again.
+    mapped: Vec<bool>,
+    /// How many pages around a faulting page are mapped at once.
+    fault_around: usize,
+    /// Commit the pages following a faulting page with the same access.
+    sequential: bool,
+    /// Physical address of each huge page mapped, by virtual address.
+    ///
+    /// All of its pages have the same flags, which are mapped as they are.
+    huge: BTreeMap<VirtAddr, PhysAddr>,
+    /// Whether the VMO is shared with the address space of a fork, as no page
+    /// was writable then. The mapping is replaced with one of a copy-on-write
+    /// child before a page is made writable, so neither sees the writes of the other.
+    fork_shared: bool,
     addr: VirtAddr,
     size: usize,
     vmo_offset: usize,
@@ -707,6 +1202,11 @@ impl VmMapping {
         let mapping = Arc::new(VmMapping {
             inner: Mutex::new(VmMappingInner {
                 flags: vec![flags; pages(size)],
+                mapped: vec![false; pages(size)],
+                fault_around: DEFAULT_FAULT_AROUND_PAGES,
+                sequential: false,
+                huge: BTreeMap::new(),
+                fork_shared: false,
                 addr,
                 size,
                 vmo_offset,
@@ -723,30 +1223,86 @@ impl VmMapping {
     /// Commit pages to vmo, and map those to frames in page_table.
     /// Temporarily used for development. A standard procedure for
     /// vmo is: create_vmo, op_range(commit), map
+    ///
+    /// Aligned ranges committed to contiguous frames are mapped as huge pages.
     fn map(self: &Arc<Self>) -> ZxResult {
-        self.vmo.commit_pages_with(&mut |commit| {
+        let (addr, end) = {
             let inner = self.inner.lock();
+            (inner.addr, inner.end_addr())
+        };
+        self.commit_huge_in(addr, end);
+        let vmo_len = self.vmo.len();
+        self.vmo.commit_pages_with(&mut |commit| {
+            let mut inner = self.inner.lock();
             let mut page_table = self.page_table.lock();
-            let page_num = inner.size / PAGE_SIZE;
+            let page_num = inner.backed_pages(vmo_len);
             let vmo_offset = inner.vmo_offset / PAGE_SIZE;
-            for i in 0..page_num {
-                let paddr = commit(vmo_offset + i, inner.flags[i])?;
+            let mut i = 0;
+            while i < page_num {
+                if i + HUGE_PAGE_PAGES <= page_num
+                    && inner.try_map_huge(&mut *page_table, commit, i)
+                {
+                    i += HUGE_PAGE_PAGES;
+                    continue;
+                }
+                // map a run of contiguous frames at once, up to the next huge page
+                let flags = inner.flags[i];
+                let paddr = commit(vmo_offset + i, flags)?;
+                let mut n = 1;
+                while i + n < page_num
+                    && inner.flags[i + n] == flags
+                    && (inner.addr + (i + n) * PAGE_SIZE) % HUGE_PAGE_SIZE != 0
+                {
+                    if commit(vmo_offset + i + n, flags)? != paddr + n * PAGE_SIZE {
+                        break;
+                    }
+                    n += 1;
+                }
                 page_table
-                    .map(inner.addr + i * PAGE_SIZE, paddr, inner.flags[i])
+                    .map_cont(inner.addr + i * PAGE_SIZE, paddr, n, flags)
                     .expect("failed to map");
+                for mapped in inner.mapped[i..i + n].iter_mut() {
+                    *mapped = true;
+                }
+                i += n;
             }
             Ok(())
         })
     }
 
+    /// Commit contiguous frames for the untouched, writable huge pages in `[begin, end)`.
+    ///
+    /// Returns whether any huge page in the range may be mapped.
+    fn commit_huge_in(&self, begin: VirtAddr, end: VirtAddr) -> bool {
+        let vmo_pages: Vec<usize> = {
+            let inner = self.inner.lock();
+            let mut vaddr = ceil(begin, HUGE_PAGE_SIZE) * HUGE_PAGE_SIZE;
+            let mut vmo_pages = Vec::new();
+            while vaddr + HUGE_PAGE_SIZE <= end {
+                if let Some(page_idx) = inner.huge_candidate(vaddr) {
+                    if inner.flags[page_idx].contains(MMUFlags::WRITE) {
+                        vmo_pages.push(inner.vmo_offset / PAGE_SIZE + page_idx);
+                    }
+                }
+                vaddr += HUGE_PAGE_SIZE;
+            }
+            vmo_pages
+        };
+        if self.vmo.is_contiguous() {
+            return true;
+        }
+        let mut committed = false;
+        for page_idx in vmo_pages {
+            committed |= self.vmo.commit_huge(page_idx);
+        }
+        committed
+    }
+
     fn unmap(&self) {
-        let inner = self.inner.lock();
-        let pages = inner.size / PAGE_SIZE;
+        let mut inner = self.inner.lock();
+        let (addr, end) = (inner.addr, inner.end_addr());
         // TODO inner.vmo_offset unused?
-        self.page_table
-            .lock()
-            .unmap_cont(inner.addr, pages)
-            .expect("failed to unmap")
+        inner.unmap_range(&mut *self.page_table.lock(), addr, end);
     }
 
     fn fill_in_task_status(&self, task_stats: &mut TaskStatsInfo) {
@@ -777,55 +1333,58 @@ impl VmMapping {
         let mut page_table = self.page_table.lock();
         if inner.addr >= begin && inner.end_addr() <= end {
             // subset: [xxxxxxxxxx]
-            page_table
-                .unmap_cont(inner.addr, pages(inner.size))
-                .expect("failed to unmap");
+            let (addr, end) = (inner.addr, inner.end_addr());
+            inner.unmap_range(&mut *page_table, addr, end);
             inner.size = 0;
             inner.flags.clear();
+            inner.mapped.clear();
             None
         } else if inner.addr >= begin && inner.addr < end {
             // prefix: [xxxx------]
             let cut_len = end - inner.addr;
-            page_table
-                .unmap_cont(inner.addr, pages(cut_len))
-                .expect("failed to unmap");
+            let addr = inner.addr;
+            inner.unmap_range(&mut *page_table, addr, end);
             inner.addr = end;
             inner.size -= cut_len;
             inner.vmo_offset += cut_len;
             inner.flags.drain(0..pages(cut_len));
+            inner.mapped.drain(0..pages(cut_len));
             None
         } else if inner.end_addr() <= end && inner.end_addr() > begin {
             // postfix: [------xxxx]
-            let cut_len = inner.end_addr() - begin;
             let new_len = begin - inner.addr;
-            page_table
-                .unmap_cont(begin, pages(cut_len))
-                .expect("failed to unmap");
+            let end = inner.end_addr();
+            inner.unmap_range(&mut *page_table, begin, end);
             inner.size = new_len;
-            inner.flags.truncate(new_len);
+            inner.flags.truncate(pages(new_len));
+            inner.mapped.truncate(pages(new_len));
             None
         } else {
             // superset: [---xxxx---]
-            let cut_len = end - begin;
             let new_len1 = begin - inner.addr;
             let new_len2 = inner.end_addr() - end;
-            page_table
-                .unmap_cont(begin, pages(cut_len))
-                .expect("failed to unmap");
+            inner.unmap_range(&mut *page_table, begin, end);
             let new_flags_range = (pages(inner.size) - pages(new_len2))..pages(inner.size);
             let new_mapping = Arc::new(VmMapping {
                 permissions: self.permissions,
                 vmo: self.vmo.clone(),
                 page_table: self.page_table.clone(),
                 inner: Mutex::new(VmMappingInner {
-                    flags: inner.flags.drain(new_flags_range).collect(),
+                    flags: inner.flags.drain(new_flags_range.clone()).collect(),
+                    mapped: inner.mapped.drain(new_flags_range).collect(),
+                    fault_around: inner.fault_around,
+                    sequential: inner.sequential,
+                    huge: inner.huge.split_off(&end),
+                    fork_shared: inner.fork_shared,
                     addr: end,
                     size: new_len2,
                     vmo_offset: inner.vmo_offset + (end - inner.addr),
                 }),
             });
             inner.size = new_len1;
-            inner.flags.truncate(new_len1);
+            inner.flags.truncate(pages(new_len1));
+            inner.mapped.truncate(pages(new_len1));
+            self.vmo.append_mapping(Arc::downgrade(&new_mapping));
             Some(new_mapping)
         }
     }
@@ -847,14 +1406,54 @@ impl VmMapping {
     fn protect(&self, flags: MMUFlags, start_index: usize, end_index: usize) {
         let mut inner = self.inner.lock();
         let mut pg_table = self.page_table.lock();
-        for i in start_index..end_index {
+        let begin = inner.addr + start_index * PAGE_SIZE;
+        let end = inner.addr + end_index * PAGE_SIZE;
+        // huge pages inside the range still have the same flags for all pages
+        let mut huge = inner
+            .split_huge_around(&mut *pg_table, begin, end)
+            .into_iter()
+            .peekable();
+        let mut i = start_index;
+        while i < end_index {
+            let vaddr = inner.addr + i * PAGE_SIZE;
             let mut new_flags = inner.flags[i];
             new_flags.remove(MMUFlags::RXW);
             new_flags.insert(flags & MMUFlags::RXW);
-            inner.flags[i] = new_flags;
-            pg_table
-                .protect(inner.addr + i * PAGE_SIZE, new_flags)
-                .unwrap();
+            // a page mapped for read may map the zero frame or a frame shared
+            // for copy-on-write, so only a write fault may make it writable
+            let mut pt_flags = new_flags;
+            if MAP_ON_DEMAND {
+                pt_flags.remove(MMUFlags::WRITE);
+            }
+            if huge.peek() == Some(&vaddr) {
+                huge.next();
+                // huge pages are committed with the flags they are mapped with
+                if inner.flags[i].contains(MMUFlags::WRITE) {
+                    pt_flags = new_flags;
+                }
+                for flags in inner.flags[i..i + HUGE_PAGE_PAGES].iter_mut() {
+                    *flags = new_flags;
+                }
+                pg_table.protect_huge(vaddr, pt_flags).unwrap();
+                i += HUGE_PAGE_PAGES;
+                continue;
+            }
+            // change a run of pages with the same flags at once,
+            // skipping the pages which are not mapped
+            let run_end = huge
+                .peek()
+                .map_or(end_index, |&huge| (huge - inner.addr) / PAGE_SIZE);
+            let (old_flags, mapped) = (inner.flags[i], inner.mapped[i]);
+            let count = (i..run_end)
+                .take_while(|&j| inner.flags[j] == old_flags && inner.mapped[j] == mapped)
+                .count();
+            for flags in inner.flags[i..i + count].iter_mut() {
+                *flags = new_flags;
+            }
+            if mapped {
+                pg_table.protect_cont(vaddr, count, pt_flags).unwrap();
+            }
+            i += count;
         }
     }
 
@@ -880,57 +1479,182 @@ impl VmMapping {
         }
     }
 
+    /// Get the VMO mapped at `vaddr` and the offset of `vaddr` in it.
+    pub fn vmo_offset(&self, vaddr: usize) -> ZxResult<(&Arc<VmObject>, usize)> {
+        // the mapping may be cut meanwhile, so read its range under one lock
+        let inner = self.inner.lock();
+        if inner.addr <= vaddr && vaddr < inner.end_addr() {
+            Ok((&self.vmo, vaddr - inner.addr + inner.vmo_offset))
+        } else {
+            Err(ZxError::NO_MEMORY)
+        }
+    }
+
     /// Remove WRITE flag from the mappings for Copy-on-Write.
     pub(super) fn range_change(&self, offset: usize, len: usize, op: RangeChangeOp) {
         let inner = self.inner.try_lock();
         // If we are already locked, we are handling page fault/map range
         // In this case we can just ignore the operation since we will update the mapping later
-        if let Some(inner) = inner {
-            let start = offset.max(inner.vmo_offset);
-            let end = (inner.vmo_offset + inner.size / PAGE_SIZE).min(offset + len);
+        if let Some(mut inner) = inner {
+            let vmo_start = inner.vmo_offset / PAGE_SIZE;
+            let start = offset.max(vmo_start);
+            let end = (vmo_start + pages(inner.size)).min(offset + len);
             if !(start..end).is_empty() {
                 let mut pg_table = self.page_table.lock();
-                for i in (start - inner.vmo_offset)..(end - inner.vmo_offset) {
-                    match op {
-                        RangeChangeOp::RemoveWrite => {
-                            let mut new_flag = inner.flags[i];
-                            new_flag.remove(MMUFlags::WRITE);
+                let (start, end) = (start - vmo_start, end - vmo_start);
+                let begin = inner.addr + start * PAGE_SIZE;
+                let end_addr = inner.addr + end * PAGE_SIZE;
+                match op {
+                    RangeChangeOp::RemoveWrite => {
+                        // only base pages are changed
+                        for vaddr in inner.split_huge_around(&mut *pg_table, begin, end_addr) {
+                            inner.split_huge(&mut *pg_table, vaddr);
+                        }
+                        // change a run of pages with the same flags at once
+                        let mut i = start;
+                        while i < end {
+                            let flags = inner.flags[i];
+                            let count = inner.flags[i..end]
+                                .iter()
+                                .take_while(|&&f| f == flags)
+                                .count();
                             pg_table
-                                .protect(inner.addr + i * PAGE_SIZE, new_flag)
-                                .unwrap()
+                                .protect_cont(
+                                    inner.addr + i * PAGE_SIZE,
+                                    count,
+                                    flags - MMUFlags::WRITE,
+                                )
+                                .unwrap();
+                            i += count;
+                        }
+                    }
+                    RangeChangeOp::Unmap => {
+                        inner.unmap_range(&mut *pg_table, begin, end_addr);
+                        for mapped in inner.mapped[start..end].iter_mut() {
+                            *mapped = false;
                         }
-                        RangeChangeOp::Unmap => pg_table.unmap(inner.addr + i * PAGE_SIZE).unwrap(),
                     }
                 }
             }
         }
     }
 
+    /// Set how many pages around a faulting page are mapped at once.
+    fn set_fault_around(&self, pages: usize, sequential: bool) {
+        let mut inner = self.inner.lock();
+        inner.fault_around = pages.max(1);
+        inner.sequential = sequential;
+    }
+
+    /// Map the resident pages `[start_index, end_index)` which are not mapped yet for read.
+    fn populate(&self, start_index: usize, end_index: usize) -> ZxResult {
+        let vmo_len = self.vmo.len();
+        self.vmo.commit_pages_with(&mut |commit| {
+            let mut inner = self.inner.lock();
+            let mut pg_table = self.page_table.lock();
+            let end_index = end_index.min(inner.backed_pages(vmo_len));
+            for i in start_index..end_index {
+                if !inner.mapped[i] && inner.flags[i].contains(MMUFlags::READ) {
+                    inner.map_resident_page(&mut *pg_table, commit, i, MMUFlags::READ)?;
+                }
+            }
+            Ok(())
+        })
+    }
+
     /// Handle page fault happened on this VmMapping.
+    ///
+    /// Besides the faulting page, the neighbouring pages in the fault-around window
+    /// that are not mapped yet are committed and mapped under the same lock.
+    /// They are faulted for read only unless the mapping is sequential, so copy-on-write
+    /// pages keep shared and zero pages are not allocated until written.
     pub(crate) fn handle_page_fault(&self, vaddr: VirtAddr, access_flags: MMUFlags) -> ZxResult {
         let vaddr = round_down_pages(vaddr);
-        let page_idx = (vaddr - self.addr()) / PAGE_SIZE;
-        let mut flags = self.inner.lock().flags[page_idx];
-        if !flags.contains(access_flags) {
-            return Err(ZxError::ACCESS_DENIED);
-        }
-        if !access_flags.contains(MMUFlags::WRITE) {
-            flags.remove(MMUFlags::WRITE)
-        }
-        let paddr = self.vmo.commit_page(page_idx, access_flags)?;
-        let mut pg_table = self.page_table.lock();
-        pg_table.unmap(vaddr).unwrap();
-        pg_table
-            .map(vaddr, paddr, flags)
-            .map_err(|_| ZxError::ACCESS_DENIED)?;
-        Ok(())
+        // a write fault in an untouched huge page commits and maps it at once
+        let huge_vaddr = vaddr / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+        let vmo_len = self.vmo.len();
+        let huge = access_flags.contains(MMUFlags::WRITE)
+            && self.commit_huge_in(huge_vaddr, huge_vaddr + HUGE_PAGE_SIZE);
+        self.vmo.commit_pages_with(&mut |commit| {
+            let mut inner = self.inner.lock();
+            // the mapping may be cut after it is found
+            if vaddr < inner.addr || vaddr >= inner.end_addr() {
+                return Err(ZxError::NOT_FOUND);
+            }
+            let page_idx = (vaddr - inner.addr) / PAGE_SIZE;
+            if !inner.flags[page_idx].contains(access_flags) {
+                return Err(ZxError::ACCESS_DENIED);
+            }
+            // the page is beyond the end of the VMO
+            let backed = inner.backed_pages(vmo_len);
+            if page_idx >= backed {
+                return Err(ZxError::OUT_OF_RANGE);
+            }
+            let mut pg_table = self.page_table.lock();
+            if huge && huge_vaddr >= inner.addr {
+                let huge_idx = (huge_vaddr - inner.addr) / PAGE_SIZE;
+                if huge_idx + HUGE_PAGE_PAGES <= backed
+                    && inner.try_map_huge(&mut *pg_table, commit, huge_idx)
+                {
+                    return Ok(());
+                }
+            }
+            inner.map_page(&mut *pg_table, commit, page_idx, access_flags)?;
+
+            let (begin, end) = inner.fault_around_range(page_idx);
+            let end = end.min(backed);
+            let around_flags = if inner.sequential {
+                access_flags
+            } else {
+                MMUFlags::READ
+            };
+            for i in begin..end {
+                if i == page_idx || inner.mapped[i] || !inner.flags[i].contains(around_flags) {
+                    continue;
+                }
+                // best effort: the neighbours will fault again if they fail
+                if inner
+                    .map_resident_page(&mut *pg_table, commit, i, around_flags)
+                    .is_err()
+                {
+                    break;
+                }
+            }
+            Ok(())
+        })
     }
 
     /// Clone VMO and map it to a new page table. (For Linux)
-    fn clone_map(&self, page_table: Arc<Mutex<dyn PageTableTrait>>) -> ZxResult<Arc<Self>> {
-        let new_vmo = self.vmo.create_child(false, 0, self.vmo.len())?;
+    /// Clone the mapping for a forked address space.
+    ///
+    /// A VMO which is never mapped writable is shared until a mapping of it is
+    /// made writable, see `unshare`. Otherwise all mappings of the VMO map the
+    /// same copy-on-write child of it.
+    ///
+    /// The new mapping maps nothing in `page_table` yet.
+    fn clone_map(
+        &self,
+        page_table: Arc<Mutex<dyn PageTableTrait>>,
+        clones: &mut ForkClones,
+    ) -> ZxResult<Arc<Self>> {
+        let key = Arc::as_ptr(&self.vmo) as usize;
+        let new_vmo = if !clones.writable.contains(&key) {
+            self.vmo.clone()
+        } else if let Some(child) = clones.children.get(&key) {
+            child.clone()
+        } else {
+            let child = self.vmo.create_child(false, 0, self.vmo.len())?;
+            clones.children.insert(key, child.clone());
+            child
+        };
+        let mut inner = self.inner.lock().clone();
+        // nothing is mapped in the new page table yet
+        inner.huge.clear();
+        for mapped in inner.mapped.iter_mut() {
+            *mapped = false;
+        }
         let mapping = Arc::new(VmMapping {
-            inner: Mutex::new(self.inner.lock().clone()),
+            inner: Mutex::new(inner),
             permissions: self.permissions,
             page_table,
             vmo: new_vmo.clone(),
@@ -938,12 +1662,269 @@ impl VmMapping {
         new_vmo.append_mapping(Arc::downgrade(&mapping));
         Ok(mapping)
     }
+
+    /// Make a mapping of a copy-on-write child of the VMO shared with a fork,
+    /// to replace this one before a page of it is made writable.
+    ///
+    /// This mapping is unmapped and left empty. The pages beyond the end of
+    /// the VMO are left out of the child, so they still can not be accessed.
+    fn unshare(&self) -> ZxResult<Arc<Self>> {
+        let mut inner = self.inner.lock().clone();
+        let len = inner
+            .size
+            .min(self.vmo.len().saturating_sub(inner.vmo_offset));
+        let vmo = self.vmo.create_child(false, inner.vmo_offset, len)?;
+        inner.vmo_offset = 0;
+        inner.fork_shared = false;
+        inner.huge.clear();
+        for mapped in inner.mapped.iter_mut() {
+            *mapped = false;
+        }
+        let (addr, end) = (inner.addr, inner.end_addr());
+        let mapping = Arc::new(VmMapping {
+            inner: Mutex::new(inner),
+            permissions: self.permissions,
+            page_table: self.page_table.clone(),
+            vmo: vmo.clone(),
+        });
+        vmo.append_mapping(Arc::downgrade(&mapping));
+        self.cut(addr, end);
+        Ok(mapping)
+    }
+
+    /// Whether any page of the mapping is writable.
+    fn is_writable(&self) -> bool {
+        let inner = self.inner.lock();
+        inner
+            .flags
+            .iter()
+            .any(|flags| flags.contains(MMUFlags::WRITE))
+    }
 }
 
 impl VmMappingInner {
     fn end_addr(&self) -> VirtAddr {
         self.addr + self.size
     }
+
+    /// Get the number of pages from the start of the mapping which are inside
+    /// a VMO of `vmo_len` bytes, the rest can not be committed.
+    fn backed_pages(&self, vmo_len: usize) -> usize {
+        let vmo_pages = vmo_len.saturating_sub(self.vmo_offset) / PAGE_SIZE;
+        pages(self.size).min(vmo_pages)
+    }
+
+    /// Get the range of page indexes to map when the page `page_idx` faults.
+    fn fault_around_range(&self, page_idx: usize) -> (usize, usize) {
+        let window = self.fault_around.max(1);
+        let begin = if self.sequential {
+            page_idx
+        } else {
+            page_idx / window * window
+        };
+        (begin, (begin + window).min(pages(self.size)))
+    }
+
+    /// Commit the page `page_idx` for `access_flags` and map it.
+    ///
+    /// The page is mapped without WRITE permission unless it is committed for write.
+    fn map_page(
+        &mut self,
+        pg_table: &mut dyn PageTableTrait,
+        commit: &mut dyn FnMut(usize, MMUFlags) -> ZxResult<PhysAddr>,
+        page_idx: usize,
+        access_flags: MMUFlags,
+    ) -> ZxResult {
+        let paddr = commit(self.vmo_offset / PAGE_SIZE + page_idx, access_flags)?;
+        self.map_frame(pg_table, page_idx, paddr, access_flags)
+    }
+
+    /// Same as `map_page`, but the page is left unmapped if it is not resident,
+    /// that is, it would be mapped to the shared zero frame.
+    ///
+    /// Nothing refreshes such a mapping when the page is committed later by
+    /// a write to the VMO or through another mapping, so only the page which
+    /// faults may be mapped to the zero frame. Returns whether it is mapped.
+    fn map_resident_page(
+        &mut self,
+        pg_table: &mut dyn PageTableTrait,
+        commit: &mut dyn FnMut(usize, MMUFlags) -> ZxResult<PhysAddr>,
+        page_idx: usize,
+        access_flags: MMUFlags,
+    ) -> ZxResult<bool> {
+        let paddr = commit(self.vmo_offset / PAGE_SIZE + page_idx, access_flags)?;
+        if paddr == kernel_hal::PhysFrame::zero_frame_addr() {
+            return Ok(false);
+        }
+        self.map_frame(pg_table, page_idx, paddr, access_flags)?;
+        Ok(true)
+    }
+
+    /// Map the page `page_idx` to the frame at `paddr` committed for `access_flags`.
+    fn map_frame(
+        &mut self,
+        pg_table: &mut dyn PageTableTrait,
+        page_idx: usize,
+        paddr: PhysAddr,
+        access_flags: MMUFlags,
+    ) -> ZxResult {
+        let mut flags = self.flags[page_idx];
+        if !access_flags.contains(MMUFlags::WRITE) {
+            flags.remove(MMUFlags::WRITE)
+        }
+        let vaddr = self.addr + page_idx * PAGE_SIZE;
+        // a page in a huge page is remapped on its own
+        self.split_huge_around(pg_table, vaddr, vaddr + PAGE_SIZE);
+        pg_table.unmap(vaddr).unwrap();
+        pg_table
+            .map(vaddr, paddr, flags)
+            .map_err(|_| ZxError::ACCESS_DENIED)?;
+        self.mapped[page_idx] = true;
+        Ok(())
+    }
+
+    /// Get the index of the first page if the huge page at `vaddr` may be mapped,
+    /// that is, it is inside the mapping, none of its pages is mapped,
+    /// and all of them have the same flags.
+    fn huge_candidate(&self, vaddr: VirtAddr) -> Option<usize> {
+        if vaddr % HUGE_PAGE_SIZE != 0
+            || vaddr < self.addr
+            || vaddr + HUGE_PAGE_SIZE > self.end_addr()
+        {
+            return None;
+        }
+        let page_idx = (vaddr - self.addr) / PAGE_SIZE;
+        let range = page_idx..page_idx + HUGE_PAGE_PAGES;
+        let flags = self.flags[page_idx];
+        if self.flags[range.clone()].iter().any(|&f| f != flags)
+            || self.mapped[range].iter().any(|&mapped| mapped)
+        {
+            return None;
+        }
+        Some(page_idx)
+    }
+
+    /// Map the pages from `page_idx` as a huge page if they are committed to
+    /// contiguous frames aligned to `HUGE_PAGE_SIZE`.
+    ///
+    /// Returns false if nothing is mapped.
+    fn try_map_huge(
+        &mut self,
+        pg_table: &mut dyn PageTableTrait,
+        commit: &mut dyn FnMut(usize, MMUFlags) -> ZxResult<PhysAddr>,
+        page_idx: usize,
+    ) -> bool {
+        let vaddr = self.addr + page_idx * PAGE_SIZE;
+        if self.huge_candidate(vaddr) != Some(page_idx) {
+            return false;
+        }
+        let flags = self.flags[page_idx];
+        let vmo_idx = self.vmo_offset / PAGE_SIZE + page_idx;
+        let paddr = match commit(vmo_idx, flags) {
+            Ok(paddr) if paddr % HUGE_PAGE_SIZE == 0 => paddr,
+            _ => return false,
+        };
+        for i in 1..HUGE_PAGE_PAGES {
+            match commit(vmo_idx + i, flags) {
+                Ok(p) if p == paddr + i * PAGE_SIZE => {}
+                _ => return false,
+            }
+        }
+        if pg_table.map_huge(vaddr, paddr, flags).is_err() {
+            return false;
+        }
+        self.huge.insert(vaddr, paddr);
+        for mapped in self.mapped[page_idx..page_idx + HUGE_PAGE_PAGES].iter_mut() {
+            *mapped = true;
+        }
+        HUGE_MAPPINGS.add(1);
+        true
+    }
+
+    /// Remap the huge page at `vaddr` with base pages.
+    fn split_huge(&mut self, pg_table: &mut dyn PageTableTrait, vaddr: VirtAddr) {
+        let paddr = match self.huge.remove(&vaddr) {
+            Some(paddr) => paddr,
+            None => return,
+        };
+        HUGE_MAPPINGS.sub(1);
+        pg_table.unmap_huge(vaddr).unwrap();
+        let page_idx = (vaddr - self.addr) / PAGE_SIZE;
+        for i in 0..HUGE_PAGE_PAGES {
+            pg_table
+                .map(
+                    vaddr + i * PAGE_SIZE,
+                    paddr + i * PAGE_SIZE,
+                    self.flags[page_idx + i],
+                )
+                .expect("failed to map");
+        }
+    }
+
+    /// Split the huge pages partly overlapping `[begin, end)`.
+    ///
+    /// Returns the huge pages inside the range.
+    fn split_huge_around(
+        &mut self,
+        pg_table: &mut dyn PageTableTrait,
+        begin: VirtAddr,
+        end: VirtAddr,
+    ) -> Vec<VirtAddr> {
+        if self.huge.is_empty() {
+            return Vec::new();
+        }
+        let overlap: Vec<VirtAddr> = self
+            .huge
+            .range(begin / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE..end)
+            .map(|(&vaddr, _)| vaddr)
+            .collect();
+        let mut inside = Vec::new();
+        for vaddr in overlap {
+            if vaddr >= begin && vaddr + HUGE_PAGE_SIZE <= end {
+                inside.push(vaddr);
+            } else {
+                self.split_huge(pg_table, vaddr);
+            }
+        }
+        inside
+    }
+
+    /// Unmap all pages in `[begin, end)`.
+    fn unmap_range(&mut self, pg_table: &mut dyn PageTableTrait, begin: VirtAddr, end: VirtAddr) {
+        let mut vaddr = begin;
+        for huge in self.split_huge_around(pg_table, begin, end) {
+            if huge > vaddr {
+                pg_table
+                    .unmap_cont(vaddr, pages(huge - vaddr))
+                    .expect("failed to unmap");
+            }
+            self.huge.remove(&huge);
+            HUGE_MAPPINGS.sub(1);
+            pg_table.unmap_huge(huge).unwrap();
+            vaddr = huge + HUGE_PAGE_SIZE;
+        }
+        if end > vaddr {
+            pg_table
+                .unmap_cont(vaddr, pages(end - vaddr))
+                .expect("failed to unmap");
+        }
+    }
+}
+
+impl Drop for VmAddressRegion {
+    fn drop(&mut self) {
+        if self.parent.is_none() {
+            let table = self.page_table.lock().table_phys();
+            let mut vmars = ROOT_VMARS.lock();
+            // the page table may be reused by a new root already
+            if vmars
+                .get(&table)
+                .map_or(false, |vmar| vmar.strong_count() == 0)
+            {
+                vmars.remove(&table);
+            }
+        }
+    }
 }
 
 impl Drop for VmMapping {
@@ -952,6 +1933,9 @@ impl Drop for VmMapping {
     }
 }
 
+/// The default number of pages mapped at once when handling a page fault.
+pub const DEFAULT_FAULT_AROUND_PAGES: usize = 16;
+
 /// The base of kernel address space
 /// In x86 fuchsia this is 0xffff_ff80_0000_0000 instead
 pub const KERNEL_ASPACE_BASE: u64 = 0xffff_ff02_0000_0000;
@@ -1000,6 +1984,150 @@ mod tests {
         );
     }
 
+    #[test]
+    fn fork() {
+        let vmar = VmAddressRegion::new_root();
+        let ro = VmObject::new_paged(1);
+        let rw = VmObject::new_paged(2);
+        ro.write(0, &[1]).unwrap();
+        rw.write(0, &[2]).unwrap();
+        let rw_flags = MMUFlags::READ | MMUFlags::WRITE;
+        let ro_addr = vmar
+            .map(None, ro.clone(), 0, PAGE_SIZE, MMUFlags::READ)
+            .unwrap();
+        let rw_addr = vmar.map(None, rw.clone(), 0, PAGE_SIZE, rw_flags).unwrap();
+        let rw_addr2 = vmar.map(None, rw, PAGE_SIZE, PAGE_SIZE, rw_flags).unwrap();
+        let file = VmObject::new_paged(1);
+        let file_addr = vmar
+            .map_ext_past_end(
+                None,
+                file,
+                0,
+                2 * PAGE_SIZE,
+                MMUFlags::RXW,
+                MMUFlags::READ,
+                false,
+                false,
+            )
+            .unwrap();
+
+        let forked = VmAddressRegion::new_root();
+        forked.fork_from(&vmar).unwrap();
+        forked.check_free();
+        // read-only VMO is shared
+        let ro_map = forked.find_mapping(ro_addr).unwrap();
+        assert!(Arc::ptr_eq(&ro_map.vmo, &ro));
+        // mappings of a writable VMO share one copy-on-write child
+        let child = forked.find_mapping(rw_addr).unwrap().vmo.clone();
+        assert!(Arc::ptr_eq(
+            &forked.find_mapping(rw_addr2).unwrap().vmo,
+            &child
+        ));
+        vmar.write_memory(rw_addr, &[3]).unwrap();
+        let mut buf = [0u8];
+        forked.read_memory(rw_addr, &mut buf).unwrap();
+        assert_eq!(buf[0], 2);
+
+        // the shared VMO is replaced by a copy-on-write child when made writable,
+        // in both address spaces
+        vmar.protect(ro_addr, PAGE_SIZE, rw_flags).unwrap();
+        forked.protect(ro_addr, PAGE_SIZE, rw_flags).unwrap();
+        assert!(!Arc::ptr_eq(
+            &forked.find_mapping(ro_addr).unwrap().vmo,
+            &ro
+        ));
+        vmar.write_memory(ro_addr, &[4]).unwrap();
+        forked.write_memory(ro_addr, &[5]).unwrap();
+        vmar.read_memory(ro_addr, &mut buf).unwrap();
+        assert_eq!(buf[0], 4);
+        forked.read_memory(ro_addr, &mut buf).unwrap();
+        assert_eq!(buf[0], 5);
+        ro.read(0, &mut buf).unwrap();
+        assert_eq!(buf[0], 1);
+
+        // the pages past the end of a shared VMO stay out of reach
+        forked.protect(file_addr, 2 * PAGE_SIZE, rw_flags).unwrap();
+        forked
+            .handle_page_fault(file_addr, MMUFlags::WRITE)
+            .unwrap();
+        assert_eq!(
+            forked.handle_page_fault(file_addr + PAGE_SIZE, MMUFlags::WRITE),
+            Err(ZxError::OUT_OF_RANGE)
+        );
+    }
+
+    #[test]
+    fn vmo_offset() {
+        let vmar = VmAddressRegion::new_root();
+        let vmo = VmObject::new_paged(4);
+        let addr = vmar
+            .map(None, vmo.clone(), PAGE_SIZE, 3 * PAGE_SIZE, MMUFlags::READ)
+            .unwrap();
+        let vaddr = addr + PAGE_SIZE + 8;
+        let mapping = vmar.find_mapping(vaddr).unwrap();
+        let (map_vmo, offset) = mapping.vmo_offset(vaddr).unwrap();
+        assert!(Arc::ptr_eq(map_vmo, &vmo));
+        assert_eq!(offset, 2 * PAGE_SIZE + 8);
+
+        // cutting the front of the mapping keeps the offsets of the rest
+        vmar.unmap(addr, PAGE_SIZE).unwrap();
+        assert_eq!(mapping.vmo_offset(vaddr).unwrap().1, 2 * PAGE_SIZE + 8);
+        assert_eq!(mapping.vmo_offset(addr).err(), Some(ZxError::NO_MEMORY));
+    }
+
+    #[test]
+    fn is_mapped_with() {
+        let vmar = VmAddressRegion::new_root();
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        let addr = vmar
+            .map(None, VmObject::new_paged(2), 0, 2 * PAGE_SIZE, flags)
+            .unwrap();
+        vmar.map_at(
+            addr + 2 * PAGE_SIZE - vmar.addr(),
+            VmObject::new_paged(1),
+            0,
+            PAGE_SIZE,
+            MMUFlags::READ,
+        )
+        .unwrap();
+        assert!(vmar.is_mapped_with(addr + 8, 2 * PAGE_SIZE - 8, MMUFlags::WRITE));
+        assert!(vmar.is_mapped_with(addr + 8, 3 * PAGE_SIZE - 8, MMUFlags::READ));
+        assert!(!vmar.is_mapped_with(addr + 8, 2 * PAGE_SIZE, MMUFlags::WRITE));
+        assert!(!vmar.is_mapped_with(addr, 4 * PAGE_SIZE, MMUFlags::READ));
+        assert!(!vmar.is_mapped_with(addr, usize::MAX, MMUFlags::READ));
+    }
+
+    #[test]
+    fn split_mapping() {
+        let vmar = VmAddressRegion::new_root();
+        let vmo = VmObject::new_paged(3);
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        let addr = vmar
+            .map_ext(
+                None,
+                vmo.clone(),
+                0,
+                3 * PAGE_SIZE,
+                flags,
+                flags,
+                false,
+                true,
+            )
+            .unwrap();
+        let head = vmar.find_mapping(addr).unwrap();
+        vmar.unmap(addr + PAGE_SIZE, PAGE_SIZE).unwrap();
+        let tail = vmar.find_mapping(addr + 2 * PAGE_SIZE).unwrap();
+        assert!(tail.inner.lock().mapped[0]);
+        assert_eq!(
+            head.handle_page_fault(addr + PAGE_SIZE, MMUFlags::READ),
+            Err(ZxError::NOT_FOUND)
+        );
+
+        // the piece split off is still unmapped when its pages are decommitted
+        vmo.decommit(2 * PAGE_SIZE, PAGE_SIZE).unwrap();
+        assert!(!tail.inner.lock().mapped[0]);
+    }
+
     /// A valid virtual address base to mmap.
     const MAGIC: usize = 0xdead_beaf;
 
@@ -1117,6 +2245,49 @@ mod tests {
             .is_ok());
     }
 
+    #[test]
+    fn free_ranges() {
+        let s = Sample::new();
+        let base = s.root.addr();
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        s.root.check_free();
+        s.child1.check_free();
+
+        // unmapping the middle of a mapping splits it
+        let addr = s
+            .root
+            .map_at(0x4000, VmObject::new_paged(4), 0, 0x4000, flags)
+            .unwrap();
+        s.root.unmap(addr + 0x1000, 0x2000).unwrap();
+        s.root.check_free();
+
+        // overwrite the hole and the last piece
+        s.root
+            .map_ext(
+                Some(0x5000),
+                VmObject::new_paged(3),
+                0,
+                0x3000,
+                MMUFlags::RXW,
+                flags,
+                true,
+                false,
+            )
+            .unwrap();
+        s.root.check_free();
+
+        // removed children are merged with the free ranges around them
+        s.child2.destroy().unwrap();
+        s.root.check_free();
+        s.root.unmap(base, 0x2000).unwrap();
+        assert!(s.child1.is_dead());
+        s.root.check_free();
+
+        s.root.clear().unwrap();
+        s.root.check_free();
+        assert_eq!(s.root.count(), 0);
+    }
+
     #[test]
     fn unmap_mapping() {
         //   +--------+--------+--------+--------+--------+
@@ -1158,6 +2329,229 @@ mod tests {
         assert_eq!(vmar.used_size(), 0x1000);
     }
 
+    #[test]
+    fn lookup_and_free_area() {
+        let vmar = VmAddressRegion::new_root();
+        let base = vmar.addr();
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        // map every other page
+        for i in 0..64 {
+            let vmo = VmObject::new_paged(1);
+            vmar.map_at(i * 2 * PAGE_SIZE, vmo, 0, PAGE_SIZE, flags)
+                .unwrap();
+        }
+        assert_eq!(vmar.count(), 64);
+        let map = vmar.find_mapping(base + 10 * PAGE_SIZE + 8).unwrap();
+        assert_eq!(map.addr(), base + 10 * PAGE_SIZE);
+        assert!(vmar.find_mapping(base + 11 * PAGE_SIZE).is_none());
+
+        // a single page fits into the first hole
+        let addr = vmar.map(None, VmObject::new_paged(1), 0, PAGE_SIZE, flags);
+        assert_eq!(addr, Ok(base + PAGE_SIZE));
+        // two pages do not fit anywhere in the holes
+        let addr = vmar.map(None, VmObject::new_paged(2), 0, 2 * PAGE_SIZE, flags);
+        assert_eq!(addr, Ok(base + 127 * PAGE_SIZE));
+
+        // unmapping across several mappings splits and re-indexes them
+        vmar.unmap(base + 9 * PAGE_SIZE, 4 * PAGE_SIZE).unwrap();
+        assert!(vmar.find_mapping(base + 10 * PAGE_SIZE).is_none());
+        assert!(vmar.find_mapping(base + 8 * PAGE_SIZE).is_some());
+        assert!(vmar.find_mapping(base + 14 * PAGE_SIZE).is_some());
+        let addr = vmar.map(None, VmObject::new_paged(3), 0, 3 * PAGE_SIZE, flags);
+        assert_eq!(addr, Ok(base + 9 * PAGE_SIZE));
+    }
+
+    #[test]
+    #[allow(unsafe_code)]
+    fn huge_page() {
+        let vmar = VmAddressRegion::new_root();
+        let vmo = VmObject::new_paged(2 * HUGE_PAGE_PAGES);
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        let len = 2 * HUGE_PAGE_SIZE;
+        let addr = vmar.map_at(0, vmo.clone(), 0, len, flags).unwrap();
+        let mapping = vmar.find_mapping(addr).unwrap();
+        let huge_count = || mapping.inner.lock().huge.len();
+        assert_eq!(huge_count(), 2);
+        unsafe {
+            ((addr + HUGE_PAGE_SIZE + PAGE_SIZE) as *mut usize).write(MAGIC);
+        }
+
+        // changing part of a huge page splits it
+        vmar.protect(addr + HUGE_PAGE_SIZE, PAGE_SIZE, MMUFlags::READ)
+            .unwrap();
+        assert_eq!(huge_count(), 1);
+        unsafe {
+            assert_eq!(
+                ((addr + HUGE_PAGE_SIZE + PAGE_SIZE) as *const usize).read(),
+                MAGIC
+            );
+        }
+
+        // changing a whole huge page keeps it
+        vmar.protect(addr, HUGE_PAGE_SIZE, MMUFlags::READ).unwrap();
+        assert_eq!(huge_count(), 1);
+        assert_eq!(mapping.get_flags(addr).unwrap(), MMUFlags::READ);
+
+        // decommitting part of a huge page splits it and unmaps the part
+        vmo.decommit(PAGE_SIZE, PAGE_SIZE).unwrap();
+        assert_eq!(huge_count(), 0);
+        let mapped = |i: usize| mapping.inner.lock().mapped[i];
+        assert!(mapped(0) && !mapped(1) && mapped(2));
+        assert_eq!(
+            vmo.committed_pages_in_range(0, HUGE_PAGE_PAGES),
+            HUGE_PAGE_PAGES - 1
+        );
+
+        vmar.unmap(addr, len).unwrap();
+        assert_eq!(huge_count(), 0);
+    }
+
+    #[test]
+    fn map_aligned() {
+        let vmar = VmAddressRegion::new_root();
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        vmar.map_at(0, VmObject::new_paged(1), 0, PAGE_SIZE, flags)
+            .unwrap();
+        let vmo = VmObject::new_paged(2 * HUGE_PAGE_PAGES);
+        let len = 2 * HUGE_PAGE_SIZE;
+        let addr = vmar.map_aligned(vmo, len, flags, HUGE_PAGE_SIZE).unwrap();
+        assert_eq!(addr % HUGE_PAGE_SIZE, 0);
+        let mapping = vmar.find_mapping(addr).unwrap();
+        assert_eq!(mapping.inner.lock().huge.len(), 2);
+
+        assert_eq!(
+            vmar.map_aligned(VmObject::new_paged(1), PAGE_SIZE, flags, 3)
+                .err(),
+            Some(ZxError::INVALID_ARGS)
+        );
+        assert_eq!(
+            vmar.map_aligned(VmObject::new_paged(1), PAGE_SIZE, flags, 3 * PAGE_SIZE)
+                .err(),
+            Some(ZxError::INVALID_ARGS)
+        );
+
+        // a free range just as long as the mapping is used if it is aligned
+        let child = vmar
+            .allocate(
+                None,
+                3 * HUGE_PAGE_SIZE,
+                VmarFlags::CAN_MAP_RXW,
+                HUGE_PAGE_SIZE,
+            )
+            .unwrap();
+        let vmo = VmObject::new_paged(HUGE_PAGE_PAGES);
+        child.map_at(0, vmo, 0, HUGE_PAGE_SIZE, flags).unwrap();
+        child
+            .map_at(
+                2 * HUGE_PAGE_SIZE,
+                VmObject::new_paged(1),
+                0,
+                PAGE_SIZE,
+                flags,
+            )
+            .unwrap();
+        let vmo = VmObject::new_paged(HUGE_PAGE_PAGES);
+        let addr = child
+            .map_aligned(vmo, HUGE_PAGE_SIZE, flags, HUGE_PAGE_SIZE)
+            .unwrap();
+        assert_eq!(addr, child.addr() + HUGE_PAGE_SIZE);
+        child.check_free();
+    }
+
+    #[test]
+    fn fault_around() {
+        let vmar = VmAddressRegion::new_root();
+        let vmo = VmObject::new_paged(32);
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        let len = 32 * PAGE_SIZE;
+        let addr = vmar
+            .map_ext(
+                None,
+                vmo.clone(),
+                0,
+                len,
+                MMUFlags::RXW,
+                flags,
+                false,
+                false,
+            )
+            .unwrap();
+        let mapping = vmar.find_mapping(addr).unwrap();
+        let mapped_count = || mapping.inner.lock().mapped.iter().filter(|&&m| m).count();
+
+        // a read fault maps the resident pages of the window, without committing any page
+        vmo.write(5 * PAGE_SIZE, &[1]).unwrap();
+        vmar.handle_page_fault(addr + 3 * PAGE_SIZE, MMUFlags::READ)
+            .unwrap();
+        assert_eq!(mapped_count(), 2);
+        assert_eq!(vmo.committed_pages_in_range(0, 32), 1);
+
+        // a write fault only commits the faulting page
+        vmar.handle_page_fault(addr + 3 * PAGE_SIZE, MMUFlags::WRITE)
+            .unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 32), 2);
+
+        // zero pages are left unmapped, so a later write to the VMO shows up
+        assert!(!mapping.inner.lock().mapped[4]);
+        vmo.write(4 * PAGE_SIZE, &[2]).unwrap();
+        vmar.handle_page_fault(addr + 4 * PAGE_SIZE, MMUFlags::READ)
+            .unwrap();
+        assert!(mapping.inner.lock().mapped[4]);
+
+        // sequential mappings commit the following pages as well
+        vmar.set_fault_around(addr, len, 8, true).unwrap();
+        vmar.handle_page_fault(addr + 20 * PAGE_SIZE, MMUFlags::WRITE)
+            .unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 32), 11);
+        assert_eq!(mapped_count(), 11);
+
+        // populating maps the resident pages only, and commits nothing
+        vmo.write(30 * PAGE_SIZE, &[3]).unwrap();
+        vmar.populate(addr, len).unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 32), 12);
+        assert_eq!(mapped_count(), 12);
+        assert!(mapping.inner.lock().mapped[30]);
+    }
+
+    #[test]
+    fn map_past_end() {
+        let vmar = VmAddressRegion::new_root();
+        let vmo = VmObject::new_paged_with_resizable(true, 2);
+        let flags = MMUFlags::READ | MMUFlags::WRITE;
+        let len = 4 * PAGE_SIZE;
+        assert_eq!(
+            vmar.map_ext(None, vmo.clone(), 0, len, flags, flags, false, false),
+            Err(ZxError::INVALID_ARGS)
+        );
+        let addr = vmar
+            .map_ext_past_end(None, vmo.clone(), 0, len, flags, flags, false, true)
+            .unwrap();
+        vmar.check_free();
+
+        // only the pages inside the VMO are committed and can be accessed
+        assert_eq!(vmo.committed_pages_in_range(0, 2), 2);
+        vmar.handle_page_fault(addr + PAGE_SIZE, MMUFlags::WRITE)
+            .unwrap();
+        assert_eq!(
+            vmar.handle_page_fault(addr + 2 * PAGE_SIZE, MMUFlags::READ),
+            Err(ZxError::OUT_OF_RANGE)
+        );
+
+        // growing the VMO makes the rest of the mapping accessible
+        vmo.set_len(len).unwrap();
+        vmar.handle_page_fault(addr + 3 * PAGE_SIZE, MMUFlags::WRITE)
+            .unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 4), 3);
+
+        // protecting skips the page which is still not mapped
+        assert!(!vmar.find_mapping(addr).unwrap().inner.lock().mapped[2]);
+        vmar.protect(addr, len, MMUFlags::READ).unwrap();
+        assert_eq!(
+            vmar.handle_page_fault(addr + 2 * PAGE_SIZE, MMUFlags::WRITE),
+            Err(ZxError::ACCESS_DENIED)
+        );
+    }
+
     #[test]
     #[allow(unsafe_code)]
     fn copy_on_write_update_mapping() {
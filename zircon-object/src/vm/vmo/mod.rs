@@ -24,6 +24,14 @@ pub fn vmo_page_bytes() -> usize {
     (VMO_PAGE_ALLOC.get() - VMO_PAGE_DEALLOC.get()) * PAGE_SIZE
 }
 
+/// Provider of the initial content of pages in a paged VMO.
+///
+/// Pages of a VMO without pager are filled with zero on first access.
+pub trait VmPager: Sync + Send {
+    /// Fill the frame at `paddr` with the content of page `page_idx`.
+    fn read_page(&self, page_idx: usize, paddr: PhysAddr) -> ZxResult;
+}
+
 /// Virtual Memory Object Trait
 #[allow(clippy::len_without_is_empty)]
 pub trait VMObjectTrait: Sync + Send {
@@ -56,6 +64,14 @@ pub trait VMObjectTrait: Sync + Send {
     /// Commit allocating physical memory.
     fn commit(&self, offset: usize, len: usize) -> ZxResult;
 
+    /// Commit the `HUGE_PAGE_PAGES` pages from `page_idx` to physically contiguous
+    /// frames aligned to `HUGE_PAGE_SIZE`, so that they can be mapped as a huge page.
+    ///
+    /// Returns false if it is not supported or none of the pages is committed.
+    fn commit_huge(&self, _page_idx: usize) -> bool {
+        false
+    }
+
     /// Decommit allocated physical memory.
     fn decommit(&self, offset: usize, len: usize) -> ZxResult;
 
@@ -144,6 +160,18 @@ impl VmObject {
         })
     }
 
+    /// Create a new resizable VMO whose pages are filled by `pager` on first access.
+    pub fn new_paged_with_pager(pages: usize, pager: Arc<dyn VmPager>) -> Arc<Self> {
+        let base = KObjectBase::with_signal(Signal::VMO_ZERO_CHILDREN);
+        Arc::new(VmObject {
+            resizable: true,
+            _counter: CountHelper::new(),
+            trait_: VMObjectPaged::new_with_pager(pages, pager),
+            inner: Mutex::new(VmObjectInner::default()),
+            base,
+        })
+    }
+
     /// Create a new VMO representing a piece of contiguous physical memory.
     pub fn new_physical(paddr: PhysAddr, pages: usize) -> Arc<Self> {
         Arc::new(VmObject {
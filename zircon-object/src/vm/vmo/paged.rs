@@ -1,13 +1,12 @@
 use {
     super::*,
     crate::util::block_range::BlockIter,
-    alloc::collections::VecDeque,
+    alloc::collections::{BTreeMap, VecDeque},
     alloc::sync::{Arc, Weak},
     alloc::vec::Vec,
     core::cell::{Ref, RefCell, RefMut},
     core::ops::Range,
     core::sync::atomic::*,
-    hashbrown::HashMap,
     kernel_hal::{frame_flush, PhysFrame, PAGE_SIZE},
     spin::{Mutex, MutexGuard},
 };
@@ -81,8 +80,8 @@ struct VMObjectPagedInner {
     parent_limit: usize,
     /// The size in bytes.
     size: usize,
-    /// Physical frames of this VMO.
-    frames: HashMap<usize, PageState>,
+    /// Physical frames of this VMO, ordered by page index.
+    frames: BTreeMap<usize, PageState>,
     /// All mappings to this VMO.
     mappings: Vec<Weak<VmMapping>>,
     /// Cache Policy
@@ -93,6 +92,17 @@ struct VMObjectPagedInner {
     self_ref: WeakRef,
     /// Sum of pin_count
     pin_count: usize,
+    /// Source of uncommitted pages, only on the root node.
+    pager: Option<PagerSlice>,
+}
+
+/// The pages of a pager visible from a root node.
+struct PagerSlice {
+    pager: Arc<dyn VmPager>,
+    /// Page index in the pager of the first page of the node.
+    offset: usize,
+    /// Number of pages from the pager, the rest are zero.
+    pages: usize,
 }
 
 /// Page state in VMO.
@@ -166,17 +176,29 @@ impl VMObjectPaged {
                 parent_offset: 0usize,
                 parent_limit: 0usize,
                 size: pages * PAGE_SIZE,
-                frames: HashMap::new(),
+                frames: BTreeMap::new(),
                 mappings: Vec::new(),
                 cache_policy: CachePolicy::Cached,
                 contiguous: false,
                 self_ref: Default::default(),
                 pin_count: 0,
+                pager: None,
             },
             None,
         )
     }
 
+    /// Create a new VMO whose pages are filled by `pager` on first access.
+    pub fn new_with_pager(pages: usize, pager: Arc<dyn VmPager>) -> Arc<Self> {
+        let vmo = Self::new(pages);
+        vmo.inner.borrow_mut().pager = Some(PagerSlice {
+            pager,
+            offset: 0,
+            pages: usize::MAX,
+        });
+        vmo
+    }
+
     /// Create a new VMO backing on contiguous pages.
     pub fn new_contiguous(pages: usize, align_log2: usize) -> ZxResult<Arc<Self>> {
         let vmo = Self::new(pages);
@@ -299,12 +321,20 @@ impl VMObjectTrait for VMObjectPaged {
         let (_guard, mut inner) = self.get_inner_mut();
         let start_page = offset / PAGE_SIZE;
         let pages = len / PAGE_SIZE;
+        if inner.parent.is_none() && inner.pager.is_none() && !inner.type_.is_hidden() {
+            // fast path: allocate all missing frames in one batch
+            return inner.commit_new(start_page..start_page + pages);
+        }
         for i in 0..pages {
             inner.commit_page(start_page + i, MMUFlags::WRITE)?;
         }
         Ok(())
     }
 
+    fn commit_huge(&self, page_idx: usize) -> bool {
+        self.get_inner_mut().1.commit_huge(page_idx)
+    }
+
     fn decommit(&self, offset: usize, len: usize) -> ZxResult {
         let (_guard, mut inner) = self.get_inner_mut();
         if inner.parent.is_some() {
@@ -312,9 +342,7 @@ impl VMObjectTrait for VMObjectPaged {
         }
         let start_page = offset / PAGE_SIZE;
         let pages = len / PAGE_SIZE;
-        for i in 0..pages {
-            inner.decommit(start_page + i);
-        }
+        inner.decommit(start_page..start_page + pages);
         Ok(())
     }
 
@@ -393,16 +421,19 @@ impl VMObjectTrait for VMObjectPaged {
         }
         let start_page = offset / PAGE_SIZE;
         let end_page = pages(offset + len);
-        for i in start_page..end_page {
-            let frame = inner.frames.get(&i).unwrap();
+        let frames = inner.frames.range(start_page..end_page);
+        if frames.clone().count() != end_page - start_page {
+            return Err(ZxError::BAD_STATE);
+        }
+        for (_, frame) in frames {
             if frame.pin_count == VM_PAGE_OBJECT_MAX_PIN_COUNT {
                 return Err(ZxError::UNAVAILABLE);
             }
         }
-        for i in start_page..end_page {
-            inner.frames.get_mut(&i).unwrap().pin_count += 1;
-            inner.pin_count += 1;
+        for (_, frame) in inner.frames.range_mut(start_page..end_page) {
+            frame.pin_count += 1;
         }
+        inner.pin_count += end_page - start_page;
         Ok(())
     }
 
@@ -416,17 +447,20 @@ impl VMObjectTrait for VMObjectPaged {
         }
         let start_page = offset / PAGE_SIZE;
         let end_page = pages(offset + len);
-        for i in start_page..end_page {
-            let frame = inner.frames.get(&i).unwrap();
+        let frames = inner.frames.range(start_page..end_page);
+        if frames.clone().count() != end_page - start_page {
+            return Err(ZxError::BAD_STATE);
+        }
+        for (_, frame) in frames {
             if frame.pin_count == 0 {
                 return Err(ZxError::UNAVAILABLE);
             }
         }
-        assert_ne!(inner.pin_count, 0);
-        for i in start_page..end_page {
-            inner.frames.get_mut(&i).unwrap().pin_count -= 1;
-            inner.pin_count -= 1;
+        assert!(inner.pin_count >= end_page - start_page);
+        for (_, frame) in inner.frames.range_mut(start_page..end_page) {
+            frame.pin_count -= 1;
         }
+        inner.pin_count -= end_page - start_page;
         Ok(())
     }
 
@@ -502,6 +536,66 @@ impl VMObjectPagedInner {
         ret
     }
 
+    /// Commit zeroed frames for all uncommitted pages in `range`.
+    ///
+    /// Only for VMOs without parent and pager, whose missing pages are always zero.
+    /// Aligned runs of huge pages are committed to contiguous frames if possible.
+    fn commit_new(&mut self, range: Range<usize>) -> ZxResult {
+        let mut huge = ceil(range.start, HUGE_PAGE_PAGES) * HUGE_PAGE_PAGES;
+        while huge + HUGE_PAGE_PAGES <= range.end {
+            let untouched = self
+                .frames
+                .range(huge..huge + HUGE_PAGE_PAGES)
+                .next()
+                .is_none();
+            // stop trying once there is no contiguous memory
+            if untouched && !self.commit_huge(huge) {
+                break;
+            }
+            huge += HUGE_PAGE_PAGES;
+        }
+        let holes = holes_in(&self.frames, range, 0);
+        let count: usize = holes.iter().map(|hole| hole.len()).sum();
+        if count == 0 {
+            return Ok(());
+        }
+        let mut frames = PhysFrame::alloc_many(count);
+        if frames.len() < count {
+            return Err(ZxError::NO_MEMORY);
+        }
+        for idx in holes.into_iter().flatten() {
+            let frame = frames.pop().unwrap();
+            kernel_hal::pmem_zero(frame.addr(), PAGE_SIZE);
+            self.frames.insert(idx, PageState::new(frame));
+        }
+        Ok(())
+    }
+
+    /// Commit zeroed, contiguous frames for the huge page from `page_idx`.
+    ///
+    /// Only if the VMO has no parent and pager, and none of the pages is committed.
+    fn commit_huge(&mut self, page_idx: usize) -> bool {
+        let range = page_idx..page_idx + HUGE_PAGE_PAGES;
+        if self.parent.is_some()
+            || self.pager.is_some()
+            || self.type_.is_hidden()
+            || range.end * PAGE_SIZE > self.size
+            || self.frames.range(range.clone()).next().is_some()
+        {
+            return false;
+        }
+        let frames =
+            PhysFrame::alloc_contiguous(HUGE_PAGE_PAGES, HUGE_PAGE_SIZE_LOG2 - PAGE_SIZE_LOG2);
+        if frames.is_empty() {
+            return false;
+        }
+        kernel_hal::pmem_zero(frames[0].addr(), HUGE_PAGE_SIZE);
+        for (idx, frame) in range.zip(frames) {
+            self.frames.insert(idx, PageState::new(frame));
+        }
+        true
+    }
+
     /// Commit a page recursively.
     fn commit_page_internal(
         &mut self,
@@ -519,8 +613,17 @@ impl VMObjectPagedInner {
         };
         let mut need_unmap = false;
         if no_frame {
-            // if out_of_range
-            if out_of_range || no_parent {
+            let pager = self
+                .pager
+                .as_ref()
+                .filter(|slice| no_parent && !out_of_range && page_idx < slice.pages);
+            if let Some(slice) = pager {
+                // fill the page from pager, then handle it as a committed page
+                let target_frame = PhysFrame::alloc().ok_or(ZxError::NO_MEMORY)?;
+                let pager_idx = slice.offset + page_idx;
+                slice.pager.read_page(pager_idx, target_frame.addr())?;
+                self.frames.insert(page_idx, PageState::new(target_frame));
+            } else if out_of_range || no_parent {
                 if !flags.contains(MMUFlags::WRITE) {
                     // read-only, just return zero frame
                     return Ok(CommitResult::Ref(PhysFrame::zero_frame_addr()));
@@ -614,8 +717,20 @@ impl VMObjectPagedInner {
         Ok(CommitResult::Ref(frame.frame.addr()))
     }
 
-    fn decommit(&mut self, page_idx: usize) {
-        self.frames.remove(&page_idx);
+    /// Decommit all pages in `range` owned by this VMO.
+    ///
+    /// The range is unmapped first, splitting the huge pages around it, so no
+    /// mapping is left to the freed frames.
+    fn decommit(&mut self, range: Range<usize>) {
+        for map in self.mappings.iter() {
+            if let Some(map) = map.upgrade() {
+                map.range_change(range.start, range.len(), RangeChangeOp::Unmap);
+            }
+        }
+        let keys: Vec<usize> = self.frames.range(range).map(|(&idx, _)| idx).collect();
+        for idx in keys {
+            self.frames.remove(&idx);
+        }
     }
 
     fn range_change(&self, parent_offset: usize, parent_limit: usize, op: RangeChangeOp) {
@@ -653,34 +768,47 @@ impl VMObjectPagedInner {
             end_idx,
             self.size
         );
-        let mut count = 0;
-        for i in start_idx..end_idx {
-            if self.frames.contains_key(&i) {
-                count += 1;
-                continue;
+        let mut count = self.frames.range(start_idx..end_idx).count();
+        // The pages not in this node may be found in ancestors.
+        // Track them as ranges of page index in the view of the current ancestor.
+        let parent_end = end_idx.min(self.parent_limit / PAGE_SIZE);
+        let mut holes = holes_in(
+            &self.frames,
+            start_idx..parent_end,
+            self.parent_offset / PAGE_SIZE,
+        );
+        let mut current = self.parent.clone();
+        while let Some(vmop) = current {
+            if holes.is_empty() {
+                break;
             }
-            if self.parent_limit <= i * PAGE_SIZE {
-                continue;
+            let inner = vmop.inner.borrow();
+            for hole in holes.iter() {
+                count += inner
+                    .frames
+                    .range(hole.clone())
+                    .filter(|(_, frame)| frame.tag.is_split() || inner.owner == self.owner)
+                    .count();
             }
-            let mut current = self.parent.clone();
-            let mut current_idx = i + self.parent_offset / PAGE_SIZE;
-            while let Some(vmop) = current {
-                let inner = vmop.inner.borrow();
-                if let Some(frame) = inner.frames.get(&current_idx) {
-                    if frame.tag.is_split() || inner.owner == self.owner {
-                        count += 1;
-                        break;
-                    }
-                }
-                if inner.owner != self.owner {
-                    break;
-                }
-                current_idx += inner.parent_offset / PAGE_SIZE;
-                if current_idx >= inner.parent_limit / PAGE_SIZE {
-                    break;
-                }
-                current = inner.parent.clone();
+            if inner.owner != self.owner {
+                break;
             }
+            // the pages found here are resolved, look for the rest in the parent
+            let offset = inner.parent_offset / PAGE_SIZE;
+            let limit = inner.parent_limit / PAGE_SIZE;
+            holes = holes
+                .into_iter()
+                .flat_map(|hole| holes_in(&inner.frames, hole, offset))
+                .filter_map(|hole| {
+                    let hole = hole.start..hole.end.min(limit);
+                    if hole.is_empty() {
+                        None
+                    } else {
+                        Some(hole)
+                    }
+                })
+                .collect();
+            current = inner.parent.clone();
         }
         count
     }
@@ -718,6 +846,15 @@ impl VMObjectPagedInner {
                 child.frames.insert(idx, value);
             }
         }
+        // the child becomes the root, take over the pager
+        if let Some(slice) = self.pager.take() {
+            let visible = (end - start).min(slice.pages.saturating_sub(start));
+            child.pager = Some(PagerSlice {
+                pager: slice.pager,
+                offset: slice.offset + start,
+                pages: visible,
+            });
+        }
         // connect child to my parent
         child.parent_offset += self.parent_offset;
         child.parent_limit += self.parent_offset;
@@ -756,12 +893,13 @@ impl VMObjectPagedInner {
                 parent_offset: offset,
                 parent_limit: (offset + len).min(self.size),
                 size: len,
-                frames: HashMap::new(),
+                frames: BTreeMap::new(),
                 mappings: Vec::new(),
                 cache_policy: CachePolicy::Cached,
                 contiguous: false,
                 self_ref: Default::default(),
                 pin_count: 0,
+                pager: None,
             },
             Some(lock_ref.clone()),
         );
@@ -783,6 +921,7 @@ impl VMObjectPagedInner {
                 contiguous: self.contiguous,
                 self_ref: Default::default(),
                 pin_count: self.pin_count,
+                pager: self.pager.take(),
             },
             Some(lock_ref.clone()),
         );
@@ -830,35 +969,36 @@ impl VMObjectPagedInner {
             let other_end = other_child.parent_limit / PAGE_SIZE;
             let start = new_start / PAGE_SIZE;
             let end = new_end / PAGE_SIZE;
-            for i in 0..self.size / PAGE_SIZE {
-                let not_in_range =
-                    !((start <= i && end > i) || (other_start <= i && other_end > i));
-                if not_in_range {
-                    // if not in this node's range
-                    if self.frames.contains_key(&i) {
-                        // if the frame is in our, remove it
-                        assert!(self.frames.remove(&i).is_some());
-                    } else {
-                        // or it is in our ancestor, tell them we do not need it.
-                        unwanted.push_back(i + self.parent_offset / PAGE_SIZE);
+            let in_range =
+                |i: usize| (start <= i && end > i) || (other_start <= i && other_end > i);
+            // if a page not in this node's range is in our ancestor, tell them we do not need it.
+            // (only ancestors care about it)
+            if self.parent.is_some() {
+                let parent_offset = self.parent_offset / PAGE_SIZE;
+                let mut keys = self.frames.keys().peekable();
+                for i in 0..self.size / PAGE_SIZE {
+                    if keys.peek() == Some(&&i) {
+                        keys.next();
+                    } else if !in_range(i) {
+                        unwanted.push_back(i + parent_offset);
                     }
-                } else {
+                }
+            }
+            let keys: Vec<usize> = self.frames.keys().copied().collect();
+            for i in keys {
+                if !in_range(i) {
+                    // if not in this node's range, remove it
+                    self.frames.remove(&i);
+                } else if self.frames[&i].tag.is_split() {
                     // if in this node's range, check if it can be moved
-                    if let Some(frame) = self.frames.get(&i) {
-                        if frame.tag.is_split() {
-                            let mut new_frame = self.frames.remove(&i).unwrap();
-                            if self.contiguous
-                                && !other_child.contiguous
-                                && new_frame.pin_count >= 1
-                            {
-                                new_frame.pin_count -= 1;
-                            }
-                            if new_frame.tag == tag && other_start <= i && other_end > i {
-                                new_frame.tag = PageStateTag::Owned;
-                                let new_key = i - other_child.parent_offset / PAGE_SIZE;
-                                other_child.frames.insert(new_key, new_frame);
-                            }
-                        }
+                    let mut new_frame = self.frames.remove(&i).unwrap();
+                    if self.contiguous && !other_child.contiguous && new_frame.pin_count >= 1 {
+                        new_frame.pin_count -= 1;
+                    }
+                    if new_frame.tag == tag && other_start <= i && other_end > i {
+                        new_frame.tag = PageStateTag::Owned;
+                        let new_key = i - other_child.parent_offset / PAGE_SIZE;
+                        other_child.frames.insert(new_key, new_frame);
                     }
                 }
             }
@@ -971,15 +1111,16 @@ impl VMObjectPagedInner {
             self.parent_offset = 0;
             self.parent_limit = 0;
         } else if new_size < self.size {
-            let mut unwanted = VecDeque::<usize>::new();
-            let parent_end = (self.parent_limit - self.parent_offset) / PAGE_SIZE;
-            for i in new_size / PAGE_SIZE..self.size / PAGE_SIZE {
-                self.decommit(i);
-                if parent_end > i {
-                    unwanted.push_back(i + self.parent_offset / PAGE_SIZE);
-                }
+            let (start, end) = (new_size / PAGE_SIZE, self.size / PAGE_SIZE);
+            self.decommit(start..end);
+            if self.parent.is_some() {
+                let parent_end = (self.parent_limit - self.parent_offset) / PAGE_SIZE;
+                let parent_offset = self.parent_offset / PAGE_SIZE;
+                let unwanted = (start..end.min(parent_end))
+                    .map(|i| i + parent_offset)
+                    .collect();
+                self.release_unwanted_pages_in_parent(unwanted);
             }
-            self.release_unwanted_pages_in_parent(unwanted);
             if new_size < self.parent_limit - self.parent_offset {
                 self.parent_limit = self.parent_offset + new_size;
             }
@@ -1036,6 +1177,30 @@ impl Drop for VMObjectPaged {
     }
 }
 
+/// Get the ranges of page index in `range` which have no frame,
+/// shifted by `offset` to the view of the parent.
+fn holes_in(
+    frames: &BTreeMap<usize, PageState>,
+    range: Range<usize>,
+    offset: usize,
+) -> Vec<Range<usize>> {
+    let mut holes = Vec::new();
+    if range.is_empty() {
+        return holes;
+    }
+    let mut begin = range.start;
+    for (&idx, _) in frames.range(range.clone()) {
+        if begin < idx {
+            holes.push(begin + offset..idx + offset);
+        }
+        begin = idx + 1;
+    }
+    if begin < range.end {
+        holes.push(begin + offset..range.end + offset);
+    }
+    holes
+}
+
 /// Generate a owner ID.
 fn new_owner_id() -> u64 {
     static OWNER_ID: AtomicU64 = AtomicU64::new(1);
@@ -1111,6 +1276,81 @@ mod tests {
         assert_eq!(vmo2.get_info().committed_bytes as usize, PAGE_SIZE);
     }
 
+    #[test]
+    fn sparse_committed_pages() {
+        let pages = 0x10000;
+        let vmo = VmObject::new_paged(pages);
+        for &i in &[1, 0x100, 0xfff0] {
+            vmo.test_write(i, 1);
+        }
+        assert_eq!(vmo.committed_pages_in_range(0, pages), 3);
+        assert_eq!(vmo.committed_pages_in_range(2, 0x100), 0);
+
+        // pages shared with the parent are not counted for the child
+        let child = vmo.create_child(false, 0, pages * PAGE_SIZE).unwrap();
+        child.test_write(0x100, 2);
+        assert_eq!(vmo.committed_pages_in_range(0, pages), 3);
+        assert_eq!(child.committed_pages_in_range(0, pages), 1);
+
+        let vmo = VmObject::new_paged(16);
+        vmo.commit(0, 16 * PAGE_SIZE).unwrap();
+        vmo.decommit(4 * PAGE_SIZE, 8 * PAGE_SIZE).unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 16), 8);
+        assert_eq!(vmo.committed_pages_in_range(4, 12), 0);
+    }
+
+    /// Fill each page with its index.
+    struct IndexPager;
+
+    impl VmPager for IndexPager {
+        fn read_page(&self, page_idx: usize, paddr: PhysAddr) -> ZxResult {
+            kernel_hal::pmem_write(paddr, &[page_idx as u8; PAGE_SIZE]);
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn pager() {
+        let vmo = VmObject::new_paged_with_pager(4, Arc::new(IndexPager));
+        assert_eq!(vmo.committed_pages_in_range(0, 4), 0);
+        assert_eq!(vmo.test_read(2), 2);
+        assert_eq!(vmo.committed_pages_in_range(0, 4), 1);
+
+        // COW children see the content from pager
+        let child = vmo.create_child(false, 0, 4 * PAGE_SIZE).unwrap();
+        assert_eq!(child.test_read(3), 3);
+        child.test_write(1, 10);
+        assert_eq!(child.test_read(1), 10);
+        assert_eq!(vmo.test_read(1), 1);
+        vmo.test_write(3, 20);
+        assert_eq!(child.test_read(3), 3);
+
+        // the pager moves to the last child when it becomes the root
+        let last = vmo
+            .create_child(false, 2 * PAGE_SIZE, 2 * PAGE_SIZE)
+            .unwrap();
+        drop(vmo);
+        drop(child);
+        assert_eq!(last.test_read(0), 2);
+        assert_eq!(last.test_read(1), 20);
+        last.decommit(0, 2 * PAGE_SIZE).unwrap();
+        assert_eq!(last.test_read(0), 2);
+        assert_eq!(last.test_read(1), 3);
+    }
+
+    #[test]
+    fn commit_range() {
+        let vmo = VmObject::new_paged(16);
+        vmo.test_write(2, 1);
+        vmo.commit(0, 8 * PAGE_SIZE).unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 16), 8);
+        // committed pages are zeroed, existing ones are kept
+        assert_eq!(vmo.test_read(0), 0);
+        assert_eq!(vmo.test_read(2), 1);
+        vmo.commit(4 * PAGE_SIZE, 8 * PAGE_SIZE).unwrap();
+        assert_eq!(vmo.committed_pages_in_range(0, 16), 12);
+    }
+
     impl VmObject {
         pub fn test_write(&self, page: usize, value: u8) {
             self.write(page * PAGE_SIZE, &[value]).unwrap();
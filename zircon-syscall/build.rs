@@ -13,6 +13,7 @@ fn main() {
     writeln!(fout, "#[allow(clippy::upper_case_acronyms)]").unwrap();
     writeln!(fout, "pub enum SyscallType {{").unwrap();
 
+    let mut num = 0;
     let data = std::fs::read_to_string("src/zx-syscall-numbers.h").unwrap();
     for line in data.lines() {
         if !line.starts_with("#define") {
@@ -25,7 +26,14 @@ fn main() {
 
         let name = &name[7..].to_uppercase();
         writeln!(fout, "    {} = {},", name, id).unwrap();
+        num = num.max(id.parse::<usize>().unwrap() + 1);
     }
     writeln!(fout, "}}").unwrap();
     writeln!(fout, "}}").unwrap();
+    writeln!(
+        fout,
+        "\n/// Number of syscalls, which is the maximum number plus one."
+    )
+    .unwrap();
+    writeln!(fout, "pub const SYSCALL_NUM: usize = {};", num).unwrap();
 }
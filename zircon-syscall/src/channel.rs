@@ -63,13 +63,13 @@ impl Syscall<'_> {
                 .iter()
                 .map(|handle| handle.get_handle_info())
                 .collect();
-            let values = proc.add_handles(msg.handles);
+            let values = proc.add_handles(core::mem::take(&mut msg.handles))?;
             for (i, value) in values.iter().enumerate() {
                 handle_infos[i].handle = *value;
             }
             UserOutPtr::<HandleInfo>::from(handles).write_array(&handle_infos)?;
         } else {
-            let values = proc.add_handles(msg.handles);
+            let values = proc.add_handles(core::mem::take(&mut msg.handles))?;
             UserOutPtr::<HandleValue>::from(handles).write_array(&values)?;
         }
         Ok(())
@@ -95,7 +95,8 @@ impl Syscall<'_> {
             return Err(ZxError::OUT_OF_RANGE);
         }
         let proc = self.thread.proc();
-        let data = user_bytes.read_array(num_bytes as usize)?;
+        let mut msg = MessagePacket::with_len(num_bytes as usize);
+        user_bytes.read_array_into(&mut msg.data)?;
         let handles = user_handles.read_array(num_handles as usize)?;
         let transfer_self = handles.iter().any(|&handle| handle == handle_value);
         let handles = proc.remove_handles(&handles)?;
@@ -111,7 +112,8 @@ impl Syscall<'_> {
             }
         }
         let channel = proc.get_object_with_rights::<Channel>(handle_value, Rights::WRITE)?;
-        channel.write(MessagePacket { data, handles })?;
+        msg.handles = handles;
+        channel.write(msg)?;
         Ok(())
     }
     /// Create a new channel.   
@@ -127,8 +129,8 @@ impl Syscall<'_> {
         }
         let proc = self.thread.proc();
         let (end0, end1) = Channel::create();
-        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_CHANNEL));
-        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_CHANNEL));
+        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_CHANNEL))?;
+        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_CHANNEL))?;
         out0.write(handle0)?;
         out1.write(handle1)?;
         Ok(())
@@ -155,26 +157,28 @@ impl Syscall<'_> {
         if args.rd_num_bytes < 4 || args.wr_num_bytes < 4 {
             return Err(ZxError::INVALID_ARGS);
         }
+        if args.wr_num_bytes > 65536 {
+            return Err(ZxError::OUT_OF_RANGE);
+        }
         let proc = self.thread.proc();
         let channel =
             proc.get_object_with_rights::<Channel>(handle_value, Rights::READ | Rights::WRITE)?;
-        let wr_msg = MessagePacket {
-            data: args.wr_bytes.read_array(args.wr_num_bytes as usize)?,
-            handles: {
-                let handles = args.wr_handles.read_array(args.wr_num_handles as usize)?;
-                let handles = proc.remove_handles(&handles)?;
-                for handle in handles.iter() {
-                    if !handle.rights.contains(Rights::TRANSFER) {
-                        return Err(ZxError::ACCESS_DENIED);
-                    }
+        let mut wr_msg = MessagePacket::with_len(args.wr_num_bytes as usize);
+        args.wr_bytes.read_array_into(&mut wr_msg.data)?;
+        wr_msg.handles = {
+            let handles = args.wr_handles.read_array(args.wr_num_handles as usize)?;
+            let handles = proc.remove_handles(&handles)?;
+            for handle in handles.iter() {
+                if !handle.rights.contains(Rights::TRANSFER) {
+                    return Err(ZxError::ACCESS_DENIED);
                 }
-                handles
-            },
+            }
+            handles
         };
 
         let future = channel.call(wr_msg);
         pin_mut!(future);
-        let rd_msg: MessagePacket = self
+        let mut rd_msg: MessagePacket = self
             .thread
             .blocking_run(future, ThreadState::BlockedChannel, deadline.into(), None)
             .await?;
@@ -188,7 +192,7 @@ impl Syscall<'_> {
         }
         args.rd_bytes.write_array(rd_msg.data.as_slice())?;
         args.rd_handles
-            .write_array(&proc.add_handles(rd_msg.handles))?;
+            .write_array(&proc.add_handles(core::mem::take(&mut rd_msg.handles))?)?;
         Ok(())
     }
 
@@ -226,7 +230,6 @@ impl Syscall<'_> {
             handle, options, user_bytes, num_bytes, user_handles, num_handles
         );
         let proc = self.thread.proc();
-        let data = user_bytes.read_array(num_bytes as usize)?;
         let mut dispositions = user_handles.read_array(num_handles as usize)?;
         let mut handles: Vec<Handle> = Vec::new();
         let mut ret: ZxResult = Ok(());
@@ -264,8 +267,11 @@ impl Syscall<'_> {
             return Err(ZxError::OUT_OF_RANGE);
         }
         ret?;
+        let mut msg = MessagePacket::with_len(num_bytes as usize);
+        user_bytes.read_array_into(&mut msg.data)?;
         let channel = proc.get_object_with_rights::<Channel>(handle, Rights::WRITE)?;
-        channel.write(MessagePacket { data, handles })?;
+        msg.handles = handles;
+        channel.write(msg)?;
         Ok(())
     }
 }
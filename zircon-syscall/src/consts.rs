@@ -177,5 +177,9 @@ pub enum SyscallType {
     COUNT = 167,
     FUTEX_WAKE_HANDLE_CLOSE_THREAD_EXIT = 200,
     VMAR_UNMAP_HANDLE_CLOSE_THREAD_EXIT = 201,
+    PORT_WAIT_MANY = 202,
 }
 }
+
+/// Number of syscalls, which is the maximum number plus one.
+pub const SYSCALL_NUM: usize = 203;
@@ -33,7 +33,7 @@ impl Syscall<'_> {
         }
         let _copied_desc = desc.read_array(desc_size)?;
         let iommu = Iommu::create();
-        let handle = proc.add_handle(Handle::new(iommu, Rights::DEFAULT_CHANNEL));
+        let handle = proc.add_handle(Handle::new(iommu, Rights::DEFAULT_CHANNEL))?;
         info!("iommu handle value {:#x}", handle);
         out.write(handle)?;
         Ok(())
@@ -63,7 +63,7 @@ impl Syscall<'_> {
             return Err(ZxError::INVALID_ARGS);
         }
         let bti = BusTransactionInitiator::create(iommu, bti_id);
-        let handle = proc.add_handle(Handle::new(bti, Rights::DEFAULT_BTI));
+        let handle = proc.add_handle(Handle::new(bti, Rights::DEFAULT_BTI))?;
         out.write(handle)?;
         Ok(())
     }
@@ -108,7 +108,7 @@ impl Syscall<'_> {
             return Err(ZxError::INVALID_ARGS);
         }
         addrs.write_array(&encoded_addrs)?;
-        let handle = proc.add_handle(Handle::new(pmt, Rights::INSPECT));
+        let handle = proc.add_handle(Handle::new(pmt, Rights::INSPECT))?;
         out.write(handle)?;
         Ok(())
     }
@@ -172,7 +172,7 @@ impl Syscall<'_> {
             resource.validate_ranged_resource(ResourceKind::IRQ, src_num, 1)?;
             Interrupt::new_physical(src_num, options)?
         };
-        let handle = proc.add_handle(Handle::new(interrupt, Rights::DEFAULT_INTERRUPT));
+        let handle = proc.add_handle(Handle::new(interrupt, Rights::DEFAULT_INTERRUPT))?;
         out.write(handle)?;
         Ok(())
     }
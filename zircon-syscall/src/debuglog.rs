@@ -27,7 +27,7 @@ impl Syscall<'_> {
         } else {
             Rights::DEFAULT_DEBUGLOG | Rights::READ
         };
-        let dlog_handle = proc.add_handle(Handle::new(dlog, dlog_right));
+        let dlog_handle = proc.add_handle(Handle::new(dlog, dlog_right))?;
         target.write(dlog_handle)?;
         Ok(())
     }
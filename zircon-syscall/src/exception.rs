@@ -47,7 +47,7 @@ impl Syscall<'_> {
         let user_end = proc.add_handle(Handle::new(
             exceptionate.create_channel(rights)?,
             Rights::TRANSFER | Rights::WAIT | Rights::READ,
-        ));
+        ))?;
         out.write(user_end)?;
         Ok(())
     }
@@ -64,7 +64,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let exception =
             proc.get_object_with_rights::<ExceptionObject>(exception, Rights::default())?;
-        let handle = proc.add_handle(exception.get_thread_handle());
+        let handle = proc.add_handle(exception.get_thread_handle())?;
         out.write(handle)?;
         Ok(())
     }
@@ -83,7 +83,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let exception =
             proc.get_object_with_rights::<ExceptionObject>(exception, Rights::default())?;
-        let handle = proc.add_handle(exception.get_process_handle()?);
+        let handle = proc.add_handle(exception.get_process_handle()?)?;
         out.write(handle)?;
         Ok(())
     }
@@ -22,8 +22,8 @@ impl Syscall<'_> {
         }
         let (end0, end1) = Fifo::create(elem_count, elem_size);
         let proc = self.thread.proc();
-        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_FIFO));
-        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_FIFO));
+        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_FIFO))?;
+        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_FIFO))?;
         out0.write(handle0)?;
         out1.write(handle1)?;
         Ok(())
@@ -33,7 +33,7 @@ impl Syscall<'_> {
 
         let guest = Guest::new()?;
         let vmar = guest.vmar();
-        let guest_handle_value = proc.add_handle(Handle::new(guest, Rights::DEFAULT_GUEST));
+        let guest_handle_value = proc.add_handle(Handle::new(guest, Rights::DEFAULT_GUEST))?;
         guest_handle.write(guest_handle_value)?;
 
         let vmar_flags = vmar.get_flags();
@@ -47,7 +47,7 @@ impl Syscall<'_> {
         if vmar_flags.contains(VmarFlags::CAN_MAP_EXECUTE) {
             vmar_rights.insert(Rights::EXECUTE);
         }
-        let vmar_handle_value = proc.add_handle(Handle::new(vmar, vmar_rights));
+        let vmar_handle_value = proc.add_handle(Handle::new(vmar, vmar_rights))?;
         vmar_handle.write(vmar_handle_value)?;
         Ok(())
     }
@@ -99,7 +99,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let guest = proc.get_object_with_rights::<Guest>(guest_handle, Rights::MANAGE_PROCESS)?;
         let vcpu = Vcpu::new(guest, entry, (*self.thread).clone())?;
-        let handle_value = proc.add_handle(Handle::new(vcpu, Rights::DEFAULT_VCPU));
+        let handle_value = proc.add_handle(Handle::new(vcpu, Rights::DEFAULT_VCPU))?;
         out.write(handle_value)?;
         Ok(())
     }
@@ -0,0 +1,84 @@
+use {
+    super::*,
+    zircon_object::{dev::*, util::ktrace},
+};
+
+const KTRACE_ACTION_START: u32 = 1;
+const KTRACE_ACTION_STOP: u32 = 2;
+const KTRACE_ACTION_REWIND: u32 = 3;
+
+impl Syscall<'_> {
+    /// Read the trace buffer from `offset` bytes.
+    ///
+    /// If `buf` is null, `actual` is set to the size of the whole buffer.
+    pub fn sys_ktrace_read(
+        &self,
+        handle: HandleValue,
+        mut buf: UserOutPtr<u8>,
+        offset: u32,
+        len: usize,
+        mut actual: UserOutPtr<usize>,
+    ) -> ZxResult {
+        info!(
+            "ktrace.read: handle={:#x?}, buf=({:#x?}; {:#x?}), offset={:#x?}",
+            handle, buf, len, offset,
+        );
+        let proc = self.thread.proc();
+        proc.get_object::<Resource>(handle)?
+            .validate(ResourceKind::ROOT)?;
+        let size = ktrace::size();
+        if buf.is_null() {
+            actual.write(size)?;
+            return Ok(());
+        }
+        let offset = offset as usize;
+        if offset > size {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        let mut buffer = vec![0u8; len.min(size - offset)];
+        let actual_len = ktrace::read(offset, &mut buffer);
+        buf.write_array(&buffer[..actual_len])?;
+        actual.write(actual_len)?;
+        Ok(())
+    }
+
+    /// Start, stop or rewind tracing.
+    ///
+    /// Tracing is started for the groups in `options`. Stopping it first records
+    /// the stats of all syscalls if the `SYSCALL` group is enabled.
+    pub fn sys_ktrace_control(
+        &self,
+        handle: HandleValue,
+        action: u32,
+        options: u32,
+        _ptr: usize,
+    ) -> ZxResult {
+        info!(
+            "ktrace.control: handle={:#x?}, action={:#x?}, options={:#x?}",
+            handle, action, options,
+        );
+        let proc = self.thread.proc();
+        proc.get_object::<Resource>(handle)?
+            .validate(ResourceKind::ROOT)?;
+        match action {
+            KTRACE_ACTION_START => ktrace::start(ktrace::TraceGroup::from_bits_truncate(options)),
+            KTRACE_ACTION_STOP => {
+                SYSCALL_STATS.trace();
+                ktrace::stop();
+            }
+            KTRACE_ACTION_REWIND => ktrace::rewind(),
+            _ => return Err(ZxError::INVALID_ARGS),
+        }
+        Ok(())
+    }
+
+    /// Record a probe event `id` with two arguments.
+    pub fn sys_ktrace_write(&self, handle: HandleValue, id: u32, arg0: u32, arg1: u32) -> ZxResult {
+        let proc = self.thread.proc();
+        proc.get_object::<Resource>(handle)?
+            .validate(ResourceKind::ROOT)?;
+        let arg = (arg1 as u64) << 32 | arg0 as u64;
+        ktrace::ktrace(ktrace::TraceEvent::Probe, id as u64, arg);
+        Ok(())
+    }
+}
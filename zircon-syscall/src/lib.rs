@@ -20,6 +20,8 @@ use {
     kernel_hal::user::*,
     zircon_object::object::*,
     zircon_object::task::{CurrentThread, ThreadFn},
+    zircon_object::util::ktrace::{ktrace, TraceEvent},
+    zircon_object::util::syscall_stats::SyscallStats,
 };
 
 mod channel;
@@ -34,6 +36,7 @@ mod futex;
 mod handle;
 #[cfg(feature = "hypervisor")]
 mod hypervisor;
+mod ktrace;
 mod object;
 mod pci;
 mod port;
@@ -49,6 +52,11 @@ mod vmo;
 
 use consts::SyscallType as Sys;
 
+/// Call counts and latencies of syscalls, indexed by syscall number.
+///
+/// They are only recorded while the `SYSCALL` group of ktrace is enabled.
+pub static SYSCALL_STATS: SyscallStats<{ consts::SYSCALL_NUM }> = SyscallStats::new();
+
 pub struct Syscall<'a> {
     pub thread: &'a CurrentThread,
     pub thread_fn: ThreadFn,
@@ -56,8 +64,6 @@ pub struct Syscall<'a> {
 
 impl Syscall<'_> {
     pub async fn syscall(&mut self, num: u32, args: [usize; 8]) -> isize {
-        let thread_name = self.thread.name();
-        let proc_name = self.thread.proc().name();
         let sys_type = match Sys::try_from(num) {
             Ok(t) => t,
             Err(_) => {
@@ -65,10 +71,16 @@ impl Syscall<'_> {
                 return ZxError::INVALID_ARGS as _;
             }
         };
+        // names are only taken if the log is enabled
         debug!(
             "{}|{} {:?} => args={:x?}",
-            proc_name, thread_name, sys_type, args
+            self.thread.proc().name(),
+            self.thread.name(),
+            sys_type,
+            args
         );
+        ktrace(TraceEvent::SyscallEnter, self.thread.id(), num as u64);
+        let begin = SYSCALL_STATS.begin();
         let [a0, a1, a2, a3, a4, a5, a6, a7] = args;
         let ret = match sys_type {
             Sys::HANDLE_CLOSE => self.sys_handle_close(a0 as _),
@@ -125,6 +137,8 @@ impl Syscall<'_> {
             Sys::JOB_CREATE => self.sys_job_create(a0 as _, a1 as _, a2.into()),
             Sys::JOB_SET_POLICY => self.sys_job_set_policy(a0 as _, a1 as _, a2 as _, a3, a4 as _),
             Sys::JOB_SET_CRITICAL => self.sys_job_set_critical(a0 as _, a1 as _, a2 as _),
+            Sys::PROFILE_CREATE => self.sys_profile_create(a0 as _, a1 as _, a2.into(), a3.into()),
+            Sys::OBJECT_SET_PROFILE => self.sys_object_set_profile(a0 as _, a1 as _, a2 as _),
             Sys::TASK_SUSPEND | Sys::TASK_SUSPEND_TOKEN => {
                 self.sys_task_suspend_token(a0 as _, a1.into())
             }
@@ -202,6 +216,10 @@ impl Syscall<'_> {
             Sys::EVENTPAIR_CREATE => self.sys_eventpair_create(a0 as _, a1.into(), a2.into()),
             Sys::PORT_CREATE => self.sys_port_create(a0 as _, a1.into()),
             Sys::PORT_WAIT => self.sys_port_wait(a0 as _, a1.into(), a2.into()).await,
+            Sys::PORT_WAIT_MANY => {
+                self.sys_port_wait_many(a0 as _, a1.into(), a2.into(), a3 as _, a4.into())
+                    .await
+            }
             Sys::PORT_QUEUE => self.sys_port_queue(a0 as _, a1.into()),
             Sys::PORT_CANCEL => {
                 error!("Skip PORT_CANCEL");
@@ -264,6 +282,11 @@ impl Syscall<'_> {
             Sys::DEBUGLOG_CREATE => self.sys_debuglog_create(a0 as _, a1 as _, a2.into()),
             Sys::DEBUGLOG_WRITE => self.sys_debuglog_write(a0 as _, a1 as _, a2.into(), a3 as _),
             Sys::DEBUGLOG_READ => self.sys_debuglog_read(a0 as _, a1 as _, a2.into(), a3 as _),
+            Sys::KTRACE_READ => {
+                self.sys_ktrace_read(a0 as _, a1.into(), a2 as _, a3 as _, a4.into())
+            }
+            Sys::KTRACE_CONTROL => self.sys_ktrace_control(a0 as _, a1 as _, a2 as _, a3 as _),
+            Sys::KTRACE_WRITE => self.sys_ktrace_write(a0 as _, a1 as _, a2 as _, a3 as _),
             Sys::RESOURCE_CREATE => self.sys_resource_create(
                 a0 as _,
                 a1 as _,
@@ -379,10 +402,19 @@ impl Syscall<'_> {
                 Err(ZxError::NOT_SUPPORTED)
             }
         };
-        info!("{}|{} {:?} <= {:?}", proc_name, thread_name, sys_type, ret);
-        match ret {
+        info!(
+            "{}|{} {:?} <= {:?}",
+            self.thread.proc().name(),
+            self.thread.name(),
+            sys_type,
+            ret
+        );
+        let ret = match ret {
             Ok(_) => 0,
             Err(err) => err as isize,
-        }
+        };
+        SYSCALL_STATS.end(num as usize, begin);
+        ktrace(TraceEvent::SyscallExit, self.thread.id(), ret as u64);
+        ret
     }
 }
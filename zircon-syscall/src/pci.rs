@@ -150,7 +150,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let dev = proc.get_object_with_rights::<PcieDeviceKObject>(dev, Rights::READ)?;
         let interrupt = dev.map_interrupt(irq)?;
-        let handle = proc.add_handle(Handle::new(interrupt, Rights::DEFAULT_PCI_INTERRUPT));
+        let handle = proc.add_handle(Handle::new(interrupt, Rights::DEFAULT_PCI_INTERRUPT))?;
         out_handle.write(handle)?;
         Ok(())
     }
@@ -170,7 +170,7 @@ impl Syscall<'_> {
         proc.get_object::<Resource>(handle)?
             .validate(ResourceKind::ROOT)?;
         let (info, device) = PCIeBusDriver::get_nth_device(index as usize)?;
-        let handle = proc.add_handle(Handle::new(device, Rights::DEFAULT_DEVICE));
+        let handle = proc.add_handle(Handle::new(device, Rights::DEFAULT_DEVICE))?;
         out_info.write(info)?;
         out_handle.write(handle)?;
         Ok(())
@@ -196,7 +196,7 @@ impl Syscall<'_> {
         };
         if info.is_mmio {
             let vmo = VmObject::new_physical(info.bus_addr as usize, pages(info.size as usize));
-            let handle = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO));
+            let handle = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO))?;
             out_handle.write(handle)?;
             device.enable_mmio()?;
         } else {
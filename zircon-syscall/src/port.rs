@@ -1,6 +1,6 @@
 use {
     super::*,
-    zircon_object::{signal::*, task::*},
+    zircon_object::{signal::*, task::*, vm::MMUFlags},
 };
 
 impl Syscall<'_> {
@@ -8,7 +8,7 @@ impl Syscall<'_> {
     pub fn sys_port_create(&self, options: u32, mut out: UserOutPtr<HandleValue>) -> ZxResult {
         info!("port.create: options={:#x}", options);
         let port_handle = Handle::new(Port::new(options)?, Rights::DEFAULT_PORT);
-        let handle_value = self.thread.proc().add_handle(port_handle);
+        let handle_value = self.thread.proc().add_handle(port_handle)?;
         out.write(handle_value)?;
         Ok(())
     }
@@ -37,6 +37,49 @@ impl Syscall<'_> {
         Ok(())
     }
 
+    /// Wait for packets in a port, and take out at most `count` of them.
+    ///
+    /// Interrupt packets come first, then the others in FIFO order.
+    /// The number of packets written to `packets` is returned in `actual`.
+    pub async fn sys_port_wait_many(
+        &self,
+        handle_value: HandleValue,
+        deadline: Deadline,
+        mut packets: UserOutPtr<PortPacket>,
+        count: usize,
+        mut actual: UserOutPtr<usize>,
+    ) -> ZxResult {
+        info!(
+            "port.wait_many: handle={}, deadline={:?}, count={}",
+            handle_value, deadline, count
+        );
+        if count == 0 {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        packets.check()?;
+        let len = count
+            .checked_mul(core::mem::size_of::<PortPacket>())
+            .ok_or(ZxError::INVALID_ARGS)?;
+        let proc = self.thread.proc();
+        // the packets are taken out of the port, so they must not fail to be written
+        if !proc
+            .vmar()
+            .is_mapped_with(packets.as_ptr() as usize, len, MMUFlags::WRITE)
+        {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        let port = proc.get_object_with_rights::<Port>(handle_value, Rights::READ)?;
+        let future = port.wait_many(count);
+        pin_mut!(future);
+        let res = self
+            .thread
+            .blocking_run(future, ThreadState::BlockedPort, deadline.into(), None)
+            .await?;
+        packets.write_array(&res)?;
+        actual.write_if_not_null(res.len())?;
+        Ok(())
+    }
+
     /// Queue a packet to a port.  
     pub fn sys_port_queue(
         &self,
@@ -30,7 +30,7 @@ impl Syscall<'_> {
             _ => return Err(ZxError::INVALID_ARGS),
         };
         let handle = Handle::new(Timer::with_slack(slack), Rights::DEFAULT_TIMER);
-        out.write(proc.add_handle(handle))?;
+        out.write(proc.add_handle(handle)?)?;
         Ok(())
     }
 
@@ -43,7 +43,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         proc.check_policy(PolicyCondition::NewEvent)?;
         let handle = Handle::new(Event::new(), Rights::DEFAULT_EVENT);
-        out.write(proc.add_handle(handle))?;
+        out.write(proc.add_handle(handle)?)?;
         Ok(())
     }
 
@@ -63,8 +63,8 @@ impl Syscall<'_> {
         let (event0, event1) = EventPair::create();
         let handle0 = Handle::new(event0, Rights::DEFAULT_EVENTPAIR);
         let handle1 = Handle::new(event1, Rights::DEFAULT_EVENTPAIR);
-        out0.write(proc.add_handle(handle0))?;
-        out1.write(proc.add_handle(handle1))?;
+        out0.write(proc.add_handle(handle0)?)?;
+        out1.write(proc.add_handle(handle1)?)?;
         Ok(())
     }
 
@@ -82,7 +82,8 @@ impl Syscall<'_> {
         }
         let proc = self.thread.proc();
         let timer = proc.get_object_with_rights::<Timer>(handle, Rights::WRITE)?;
-        timer.set(Duration::from(deadline), Duration::from_nanos(slack as u64));
+        let slack = Duration::from_nanos(slack as u64).max(proc.job().min_timer_slack());
+        timer.set(Duration::from(deadline), slack);
         Ok(())
     }
 
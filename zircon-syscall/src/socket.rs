@@ -13,8 +13,8 @@ impl Syscall<'_> {
         info!("socket.create: options={:#x?}", options);
         let (end0, end1) = Socket::create(options)?;
         let proc = self.thread.proc();
-        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_SOCKET));
-        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_SOCKET));
+        let handle0 = proc.add_handle(Handle::new(end0, Rights::DEFAULT_SOCKET))?;
+        let handle1 = proc.add_handle(Handle::new(end1, Rights::DEFAULT_SOCKET))?;
         out0.write(handle0)?;
         out1.write(handle1)?;
         Ok(())
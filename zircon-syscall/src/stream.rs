@@ -36,7 +36,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let vmo = proc.get_object_with_rights::<VmObject>(vmo_handle, vmo_rights)?;
         let stream = Stream::create(vmo, seek, options.bits());
-        let handle = proc.add_handle(Handle::new(stream, rights));
+        let handle = proc.add_handle(Handle::new(stream, rights))?;
         out.write(handle)?;
         Ok(())
     }
@@ -63,11 +63,8 @@ impl Syscall<'_> {
         let options = WriteOptions::from_bits(options).ok_or(ZxError::INVALID_ARGS)?;
         let proc = self.thread.proc();
         let stream = proc.get_object_with_rights::<Stream>(handle_value, Rights::WRITE)?;
-        let mut actual_count = 0;
-        for io_vec in data.iter() {
-            actual_count +=
-                stream.write(io_vec.as_slice()?, options.contains(WriteOptions::APPEND))?;
-        }
+        let append = options.contains(WriteOptions::APPEND);
+        let actual_count = write_chunks(&data, |buf, _| stream.write(buf, append))?;
         actual_count_ptr.write_if_not_null(actual_count)?;
         Ok(())
     }
@@ -77,7 +74,7 @@ impl Syscall<'_> {
         &self,
         handle_value: HandleValue,
         options: u32,
-        mut offset: usize,
+        offset: usize,
         vector: UserInPtr<IoVecIn>,
         vector_size: usize,
         mut actual_count_ptr: UserOutPtr<usize>,
@@ -92,11 +89,7 @@ impl Syscall<'_> {
         let data = vector.read_iovecs(vector_size)?;
         let proc = self.thread.proc();
         let stream = proc.get_object_with_rights::<Stream>(handle_value, Rights::WRITE)?;
-        let mut actual_count = 0;
-        for io_vec in data.iter() {
-            actual_count += stream.write_at(io_vec.as_slice()?, offset)?;
-            offset += actual_count;
-        }
+        let actual_count = write_chunks(&data, |buf, pos| stream.write_at(buf, offset + pos))?;
         actual_count_ptr.write_if_not_null(actual_count)?;
         Ok(())
     }
@@ -120,10 +113,7 @@ impl Syscall<'_> {
         let mut data = vector.read_iovecs(vector_size)?;
         let proc = self.thread.proc();
         let stream = proc.get_object_with_rights::<Stream>(handle_value, Rights::READ)?;
-        let mut actual_count = 0usize;
-        for io_vec in data.iter_mut() {
-            actual_count += stream.read(io_vec.as_mut_slice()?)?;
-        }
+        let actual_count = read_chunks(&mut data, |buf, _| stream.read(buf))?;
         actual_count_ptr.write_if_not_null(actual_count)?;
         Ok(())
     }
@@ -133,7 +123,7 @@ impl Syscall<'_> {
         &self,
         handle_value: HandleValue,
         options: u32,
-        mut offset: usize,
+        offset: usize,
         vector: UserInPtr<IoVecOut>,
         vector_size: usize,
         mut actual_count_ptr: UserOutPtr<usize>,
@@ -148,11 +138,7 @@ impl Syscall<'_> {
         let mut data = vector.read_iovecs(vector_size)?;
         let proc = self.thread.proc();
         let stream = proc.get_object_with_rights::<Stream>(handle_value, Rights::READ)?;
-        let mut actual_count = 0usize;
-        for io_vec in data.iter_mut() {
-            actual_count += stream.read_at(io_vec.as_mut_slice()?, offset)?;
-            offset += actual_count;
-        }
+        let actual_count = read_chunks(&mut data, |buf, pos| stream.read_at(buf, offset + pos))?;
         actual_count_ptr.write_if_not_null(actual_count)?;
         Ok(())
     }
@@ -182,3 +168,47 @@ impl Syscall<'_> {
         Ok(())
     }
 }
+
+/// Size of the kernel buffer which stream data is copied through.
+const STREAM_BUF_SIZE: usize = 0x10000;
+
+/// Gather `data` into a bounded kernel buffer and pass each chunk with its
+/// position to `write`, until a short write. Return the bytes written.
+fn write_chunks(
+    data: &IoVecs<In>,
+    mut write: impl FnMut(&[u8], usize) -> ZxResult<usize>,
+) -> ZxResult<usize> {
+    let total = data.total_len();
+    let mut buf = vec![0u8; total.min(STREAM_BUF_SIZE)];
+    let mut actual_count = 0;
+    while actual_count < total {
+        let len = data.read_to_buf(actual_count, &mut buf)?;
+        let count = write(&buf[..len], actual_count)?;
+        actual_count += count;
+        if count < len {
+            break;
+        }
+    }
+    Ok(actual_count)
+}
+
+/// Fill each chunk of a bounded kernel buffer by `read` with its position,
+/// and scatter it into `data`, until a short read. Return the bytes read.
+fn read_chunks(
+    data: &mut IoVecs<Out>,
+    mut read: impl FnMut(&mut [u8], usize) -> ZxResult<usize>,
+) -> ZxResult<usize> {
+    let total = data.total_len();
+    let mut buf = vec![0u8; total.min(STREAM_BUF_SIZE)];
+    let mut actual_count = 0;
+    while actual_count < total {
+        let len = buf.len().min(total - actual_count);
+        let count = read(&mut buf[..len], actual_count)?;
+        data.write_from_buf_at(actual_count, &buf[..count])?;
+        actual_count += count;
+        if count < len {
+            break;
+        }
+    }
+    Ok(actual_count)
+}
@@ -32,7 +32,7 @@ impl Syscall<'_> {
                     .check_root_job()?;
                 // TODO: out-of-memory event
                 let event = Event::new();
-                let event_handle = proc.add_handle(Handle::new(event, Rights::DEFAULT_EVENT));
+                let event_handle = proc.add_handle(Handle::new(event, Rights::DEFAULT_EVENT))?;
                 out.write(event_handle)?;
                 Ok(())
             }
@@ -28,11 +28,11 @@ impl Syscall<'_> {
             .or_else(|_| proc.get_object_with_rights::<Job>(job, Rights::WRITE))?;
         let new_proc = Process::create(&job, &name)?;
         let new_vmar = new_proc.vmar();
-        let proc_handle_value = proc.add_handle(Handle::new(new_proc, Rights::DEFAULT_PROCESS));
+        let proc_handle_value = proc.add_handle(Handle::new(new_proc, Rights::DEFAULT_PROCESS))?;
         let vmar_handle_value = proc.add_handle(Handle::new(
             new_vmar,
             Rights::DEFAULT_VMAR | Rights::READ | Rights::WRITE | Rights::EXECUTE,
-        ));
+        ))?;
         proc_handle.write(proc_handle_value)?;
         vmar_handle.write(vmar_handle_value)?;
         Ok(())
@@ -68,7 +68,7 @@ impl Syscall<'_> {
         let proc = self.thread.proc();
         let process = proc.get_object_with_rights::<Process>(proc_handle, Rights::MANAGE_THREAD)?;
         let thread = Thread::create(&process, &name)?;
-        let handle = proc.add_handle(Handle::new(thread, Rights::DEFAULT_THREAD));
+        let handle = proc.add_handle(Handle::new(thread, Rights::DEFAULT_THREAD))?;
         thread_handle.write(handle)?;
         Ok(())
     }
@@ -231,7 +231,7 @@ impl Syscall<'_> {
             let thread: Arc<dyn Task> = thread;
             let token_handle =
                 Handle::new(SuspendToken::create(&thread), Rights::DEFAULT_SUSPEND_TOKEN);
-            token.write(proc.add_handle(token_handle))?;
+            token.write(proc.add_handle(token_handle)?)?;
             return Ok(());
         }
         if let Ok(_process) = proc.get_object_with_rights::<Process>(handle, Rights::WRITE) {
@@ -277,7 +277,7 @@ impl Syscall<'_> {
                 .get_object_with_rights::<Job>(parent, Rights::MANAGE_JOB)
                 .or_else(|_| proc.get_object_with_rights::<Job>(parent, Rights::WRITE))?;
             let child = parent_job.create_child()?;
-            out.write(proc.add_handle(Handle::new(child, Rights::DEFAULT_JOB)))?;
+            out.write(proc.add_handle(Handle::new(child, Rights::DEFAULT_JOB))?)?;
             Ok(())
         }
     }
@@ -367,6 +367,50 @@ impl Syscall<'_> {
         actual.write(len)?;
         Ok(())
     }
+
+    /// Create a scheduler profile.
+    pub fn sys_profile_create(
+        &self,
+        root_job: HandleValue,
+        options: u32,
+        info: UserInPtr<ProfileInfo>,
+        mut out: UserOutPtr<HandleValue>,
+    ) -> ZxResult {
+        info!(
+            "profile.create: root_job={:#x?}, options={:#x}, info={:?}",
+            root_job, options, info
+        );
+        if options != 0 {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        let proc = self.thread.proc();
+        proc.get_object_with_rights::<Job>(root_job, Rights::MANAGE_PROCESS)?;
+        let profile = Profile::create(&info.read()?)?;
+        let handle = proc.add_handle(Handle::new(profile, Rights::DEFAULT_PROFILE))?;
+        out.write(handle)?;
+        Ok(())
+    }
+
+    /// Apply a scheduling profile to a thread.
+    pub fn sys_object_set_profile(
+        &self,
+        handle: HandleValue,
+        profile: HandleValue,
+        options: u32,
+    ) -> ZxResult {
+        info!(
+            "object.set_profile: handle={:#x?}, profile={:#x?}, options={:#x}",
+            handle, profile, options
+        );
+        if options != 0 {
+            return Err(ZxError::INVALID_ARGS);
+        }
+        let proc = self.thread.proc();
+        let thread = proc.get_object_with_rights::<Thread>(handle, Rights::MANAGE_THREAD)?;
+        let profile = proc.get_object_with_rights::<Profile>(profile, Rights::APPLY_PROFILE)?;
+        thread.set_priority(profile.priority());
+        Ok(())
+    }
 }
 
 const JOB_POL_BASE_V1: u32 = 0;
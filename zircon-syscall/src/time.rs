@@ -2,15 +2,12 @@ use {
     super::*,
     core::{
         fmt::{Debug, Formatter, Result},
-        sync::atomic::{AtomicU64, Ordering},
         time::Duration,
     },
-    kernel_hal::{sleep_until, timer_now, yield_now},
+    kernel_hal::{sleep_until, timer_now, vdso::VDSO_TIME, yield_now},
     zircon_object::{dev::*, task::*},
 };
 
-static UTC_OFFSET: AtomicU64 = AtomicU64::new(0);
-
 const ZX_CLOCK_MONOTONIC: u32 = 0;
 const ZX_CLOCK_UTC: u32 = 1;
 const ZX_CLOCK_THREAD: u32 = 2;
@@ -39,7 +36,8 @@ impl Syscall<'_> {
                 Ok(())
             }
             ZX_CLOCK_UTC => {
-                time.write(timer_now().as_nanos() as u64 + UTC_OFFSET.load(Ordering::Relaxed))?;
+                let utc_offset = VDSO_TIME.utc_offset() as u64;
+                time.write((timer_now().as_nanos() as u64).wrapping_add(utc_offset))?;
                 Ok(())
             }
             ZX_CLOCK_THREAD => {
@@ -70,7 +68,8 @@ impl Syscall<'_> {
         match clock_id {
             ZX_CLOCK_MONOTONIC => Err(ZxError::ACCESS_DENIED),
             ZX_CLOCK_UTC => {
-                UTC_OFFSET.store(offset, Ordering::Relaxed);
+                // also published to user space through the time page
+                VDSO_TIME.set_utc_offset(offset as i64);
                 Ok(())
             }
             _ => Err(ZxError::INVALID_ARGS),
@@ -71,7 +71,8 @@ impl Syscall<'_> {
         }
         let child = parent.allocate(offset, size, vmar_flags, align)?;
         let child_addr = child.addr();
-        let child_handle = proc.add_handle(Handle::new(child, Rights::DEFAULT_VMAR | perm_rights));
+        let child_handle =
+            proc.add_handle(Handle::new(child, Rights::DEFAULT_VMAR | perm_rights))?;
         info!("vmar.allocate: at {:#x?}", child_addr);
         out_child_vmar.write(child_handle)?;
         out_child_addr.write(child_addr)?;
@@ -146,6 +147,9 @@ impl Syscall<'_> {
             return Err(ZxError::INVALID_ARGS);
         }
         let vmar_offset = if is_specific { Some(vmar_offset) } else { None };
+        // the code of the vDSO reads clocks from the time page
+        let is_vdso_code =
+            vmo.name().starts_with("vdso/") && mapping_flags.contains(MMUFlags::EXECUTE);
         let vaddr = vmar.map_ext(
             vmar_offset,
             vmo,
@@ -157,6 +161,9 @@ impl Syscall<'_> {
             map_range,
         )?;
         info!("vmar.map: at {:#x?}", vaddr);
+        if is_vdso_code {
+            vmar.map_vdso_time()?;
+        }
         mapped_addr.write(vaddr)?;
         Ok(())
     }
@@ -24,7 +24,7 @@ impl Syscall<'_> {
         let resizable = options != 0;
         let proc = self.thread.proc();
         let vmo = VmObject::new_paged_with_resizable(resizable, pages(size as usize));
-        let handle_value = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO));
+        let handle_value = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO))?;
         out.write(handle_value)?;
         Ok(())
     }
@@ -171,7 +171,7 @@ impl Syscall<'_> {
             "parent_rights: {:?} child_rights: {:?}",
             parent_rights, child_rights
         );
-        out.write(proc.add_handle(Handle::new(child_vmo, child_rights)))?;
+        out.write(proc.add_handle(Handle::new(child_vmo, child_rights))?)?;
         Ok(())
     }
 
@@ -199,7 +199,8 @@ impl Syscall<'_> {
             return Err(ZxError::INVALID_ARGS);
         }
         let vmo = VmObject::new_physical(paddr, size / PAGE_SIZE);
-        let handle_value = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO | Rights::EXECUTE));
+        let handle_value =
+            proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO | Rights::EXECUTE))?;
         out.write(handle_value)?;
         Ok(())
     }
@@ -231,7 +232,7 @@ impl Syscall<'_> {
         proc.check_policy(PolicyCondition::NewVMO)?;
         let _bti = proc.get_object_with_rights::<BusTransactionInitiator>(bti, Rights::MAP)?;
         let vmo = VmObject::new_contiguous(pages(size), align_log2)?;
-        let handle_value = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO));
+        let handle_value = proc.add_handle(Handle::new(vmo, Rights::DEFAULT_VMO))?;
         out.write(handle_value)?;
         Ok(())
     }